@@ -22,6 +22,7 @@
 #include <QtNetwork/QLocalSocket>
 #include <KIOCore/kfileitem.h>
 #include <QDir>
+#include <QSet>
 #include <QTimer>
 #include "ownclouddolphinpluginhelper.h"
 
@@ -32,6 +33,10 @@ class OwncloudDolphinPlugin : public KOverlayIconPlugin
 
     using StatusMap = QHash<QByteArray, QByteArray>;
     StatusMap m_status;
+    // Directories for which the status of all entries was already requested
+    QSet<QByteArray> m_requestedDirectories;
+    // Directories for which the status of all entries arrived
+    QSet<QByteArray> m_answeredDirectories;
 
 public:
 
@@ -50,7 +55,19 @@ public:
         QDir localPath(url.toLocalFile());
         const QByteArray localFile = localPath.canonicalPath().toUtf8();
 
-        helper->sendCommand(QByteArray("RETRIEVE_FILE_STATUS:" + localFile + "\n"));
+        const QByteArray directory = localFile.left(localFile.lastIndexOf('/'));
+        if (supportsDirectoryStatus() && isInSyncFolder(directory)) {
+            // One request gives the status of the whole directory; changes are pushed afterwards
+            if (!m_requestedDirectories.contains(directory)) {
+                m_requestedDirectories.insert(directory);
+                helper->sendCommand(QByteArray("RETRIEVE_DIRECTORY_STATUS:" + directory + "\n"));
+            } else if (m_answeredDirectories.contains(directory) && !m_status.contains(localFile)) {
+                // Not part of the directory reply, for example because it was created afterwards
+                helper->sendCommand(QByteArray("RETRIEVE_FILE_STATUS:" + localFile + "\n"));
+            }
+        } else {
+            helper->sendCommand(QByteArray("RETRIEVE_FILE_STATUS:" + localFile + "\n"));
+        }
 
         StatusMap::iterator it = m_status.find(localFile);
         if (it != m_status.constEnd()) {
@@ -60,6 +77,22 @@ public:
     }
 
 private:
+    bool supportsDirectoryStatus() {
+        // RETRIEVE_DIRECTORY_STATUS was added in version 1.2
+        const QList<QByteArray> version = OwncloudDolphinPluginHelper::instance()->version().split('.');
+        return version.size() >= 2 && version[0] == "1" && version[1].toInt() >= 2;
+    }
+
+    bool isInSyncFolder(const QByteArray &directory) {
+        const QString path = QString::fromUtf8(directory);
+        const auto paths = OwncloudDolphinPluginHelper::instance()->paths();
+        for (const auto &syncFolder : paths) {
+            if (path == syncFolder || path.startsWith(syncFolder + QLatin1Char('/')))
+                return true;
+        }
+        return false;
+    }
+
     QStringList overlaysForString(const QByteArray &status) {
         QStringList r;
         if (status.startsWith("NOP"))
@@ -80,8 +113,39 @@ private:
         return r;
     }
 
+    void setStatus(const QByteArray &name, const QByteArray &newStatus) {
+        QByteArray &status = m_status[name]; // reference to the item in the hash
+        if (status == newStatus)
+            return;
+        status = newStatus;
+
+        emit overlaysChanged(QUrl::fromLocalFile(QString::fromUtf8(name)), overlaysForString(status));
+    }
+
     void slotCommandRecieved(const QByteArray &line) {
 
+        if (line.startsWith("VERSION:") || line.startsWith("UPDATE_VIEW:")) {
+            // The client restarted or finished a sync: ask again for whole directories
+            m_requestedDirectories.clear();
+            m_answeredDirectories.clear();
+            return;
+        }
+
+        if (line.startsWith("DIRECTORY_STATUS:")) {
+            // DIRECTORY_STATUS:directory followed by status:name entries, separated by '\x1e'
+            const QList<QByteArray> entries = line.mid(int(qstrlen("DIRECTORY_STATUS:"))).split('\x1e');
+            const QByteArray &directory = entries.first();
+            m_answeredDirectories.insert(directory);
+            for (int i = 1; i < entries.size(); ++i) {
+                const QByteArray &entry = entries[i];
+                int colon = entry.indexOf(':');
+                if (colon <= 0 || colon == entry.size() - 1)
+                    continue;
+                setStatus(directory + '/' + entry.mid(colon + 1), entry.left(colon));
+            }
+            return;
+        }
+
         QList<QByteArray> tokens = line.split(':');
         if (tokens.count() < 3)
             return;
@@ -93,12 +157,7 @@ private:
         // We can't use tokens[2] because the filename might contain ':'
         int secondColon = line.indexOf(":", line.indexOf(":") + 1);
         const QByteArray name = line.mid(secondColon + 1);
-        QByteArray &status = m_status[name]; // reference to the item in the hash
-        if (status == tokens[1])
-            return;
-        status = tokens[1];
-
-        emit overlaysChanged(QUrl::fromLocalFile(QString::fromUtf8(name)), overlaysForString(status));
+        setStatus(name, tokens[1]);
     }
 };
 
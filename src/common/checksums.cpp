@@ -24,6 +24,8 @@
 #include <qtconcurrentrun.h>
 #include <QCryptographicHash>
 
+#include <vector>
+
 #ifdef ZLIB_FOUND
 #include <zlib.h>
 #endif
@@ -111,6 +113,12 @@ QByteArray calcSha1(QIODevice *device)
     return calcCryptoHash(device, QCryptographicHash::Sha1);
 }
 
+static bool checksumComputationEnabled()
+{
+    static bool enabled = qEnvironmentVariableIsEmpty("OWNCLOUD_DISABLE_CHECKSUM_COMPUTATIONS");
+    return enabled;
+}
+
 #ifdef ZLIB_FOUND
 QByteArray calcAdler32(QIODevice *device)
 {
@@ -132,6 +140,68 @@ QByteArray calcAdler32(QIODevice *device)
 }
 #endif
 
+ChecksumCalculator::ChecksumCalculator(const QByteArray &checksumType)
+    : _checksumType(checksumType)
+{
+    if (!checksumComputationEnabled()) {
+        return;
+    }
+
+    if (checksumType == checkSumMD5C) {
+        _cryptographicHash = std::make_unique<QCryptographicHash>(QCryptographicHash::Md5);
+    } else if (checksumType == checkSumSHA1C) {
+        _cryptographicHash = std::make_unique<QCryptographicHash>(QCryptographicHash::Sha1);
+    } else if (checksumType == checkSumSHA2C) {
+        _cryptographicHash = std::make_unique<QCryptographicHash>(QCryptographicHash::Sha256);
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(5, 9, 0)
+    else if (checksumType == checkSumSHA3C) {
+        _cryptographicHash = std::make_unique<QCryptographicHash>(QCryptographicHash::Sha3_256);
+    }
+#endif
+#ifdef ZLIB_FOUND
+    else if (checksumType == checkSumAdlerC) {
+        _adlerHash = adler32(0L, Z_NULL, 0);
+        _isValid = true;
+        return;
+    }
+#endif
+    _isValid = _cryptographicHash != nullptr;
+}
+
+ChecksumCalculator::~ChecksumCalculator() = default;
+
+void ChecksumCalculator::addData(const char *data, qint64 length)
+{
+    if (!_isValid || length <= 0) {
+        return;
+    }
+    _dataSize += length;
+    if (_cryptographicHash) {
+        _cryptographicHash->addData(data, int(length));
+        return;
+    }
+#ifdef ZLIB_FOUND
+    _adlerHash = adler32(_adlerHash, reinterpret_cast<const Bytef *>(data), uInt(length));
+#endif
+}
+
+QByteArray ChecksumCalculator::result()
+{
+    if (!_isValid) {
+        return QByteArray();
+    }
+    _isValid = false;
+    if (_cryptographicHash) {
+        return _cryptographicHash->result().toHex();
+    }
+    // Same as calcAdler32(): an empty file has no Adler32 checksum
+    if (_dataSize == 0) {
+        return QByteArray();
+    }
+    return QByteArray::number(_adlerHash, 16);
+}
+
 QByteArray makeChecksumHeader(const QByteArray &checksumType, const QByteArray &checksum)
 {
     if (checksumType.isEmpty() || checksum.isEmpty())
@@ -193,12 +263,6 @@ bool uploadChecksumEnabled()
     return enabled;
 }
 
-static bool checksumComputationEnabled()
-{
-    static bool enabled = qEnvironmentVariableIsEmpty("OWNCLOUD_DISABLE_CHECKSUM_COMPUTATIONS");
-    return enabled;
-}
-
 ComputeChecksum::ComputeChecksum(QObject *parent)
     : QObject(parent)
 {
@@ -216,6 +280,16 @@ QByteArray ComputeChecksum::checksumType() const
     return _checksumType;
 }
 
+void ComputeChecksum::setAdditionalChecksumTypes(const QByteArrayList &types)
+{
+    _additionalChecksumTypes = types;
+}
+
+QMap<QByteArray, QByteArray> ComputeChecksum::additionalChecksums() const
+{
+    return _additionalChecksums ? *_additionalChecksums : QMap<QByteArray, QByteArray>();
+}
+
 void ComputeChecksum::start(const QString &filePath)
 {
     qCInfo(lcChecksums) << "Computing" << checksumType() << "checksum of" << filePath << "in a thread";
@@ -243,7 +317,10 @@ void ComputeChecksum::startImpl(std::unique_ptr<QIODevice> device)
 
     // Bug: The thread will keep running even if ComputeChecksum is deleted.
     auto type = checksumType();
-    _watcher.setFuture(QtConcurrent::run([sharedDevice, type]() {
+    auto additionalTypes = _additionalChecksumTypes;
+    auto additionalChecksums = QSharedPointer<QMap<QByteArray, QByteArray>>::create();
+    _additionalChecksums = additionalChecksums;
+    _watcher.setFuture(QtConcurrent::run([sharedDevice, type, additionalTypes, additionalChecksums]() {
         if (!sharedDevice->open(QIODevice::ReadOnly)) {
             if (auto file = qobject_cast<QFile *>(sharedDevice.data())) {
                 qCWarning(lcChecksums) << "Could not open file" << file->fileName()
@@ -254,7 +331,13 @@ void ComputeChecksum::startImpl(std::unique_ptr<QIODevice> device)
             }
             return QByteArray();
         }
-        auto result = ComputeChecksum::computeNow(sharedDevice.data(), type);
+        QByteArray result;
+        if (additionalTypes.isEmpty()) {
+            result = ComputeChecksum::computeNow(sharedDevice.data(), type);
+        } else {
+            *additionalChecksums = ComputeChecksum::computeNow(sharedDevice.data(), QByteArrayList() << type << additionalTypes);
+            result = additionalChecksums->take(type);
+        }
         sharedDevice->close();
         return result;
     }));
@@ -302,6 +385,51 @@ QByteArray ComputeChecksum::computeNow(QIODevice *device, const QByteArray &chec
     return QByteArray();
 }
 
+QMap<QByteArray, QByteArray> ComputeChecksum::computeNow(QIODevice *device, const QByteArrayList &checksumTypes)
+{
+    QMap<QByteArray, QByteArray> result;
+    if (!checksumComputationEnabled()) {
+        qCWarning(lcChecksums) << "Checksum computation disabled by environment variable";
+        return result;
+    }
+
+    std::vector<std::unique_ptr<ChecksumCalculator>> calculators;
+    for (const auto &type : checksumTypes) {
+        if (type.isEmpty() || result.contains(type)) {
+            continue;
+        }
+        auto calculator = std::make_unique<ChecksumCalculator>(type);
+        if (!calculator->isValid()) {
+            qCWarning(lcChecksums) << "Unknown checksum type:" << type;
+            continue;
+        }
+        result.insert(type, QByteArray());
+        calculators.push_back(std::move(calculator));
+    }
+
+    QByteArray buf(BUFSIZE, Qt::Uninitialized);
+    while (!device->atEnd()) {
+        const qint64 size = device->read(buf.data(), BUFSIZE);
+        if (size < 0) {
+            qCWarning(lcChecksums) << "Error reading from device" << device << device->errorString();
+            return {};
+        }
+        for (const auto &calculator : calculators) {
+            calculator->addData(buf.constData(), size);
+        }
+    }
+
+    for (const auto &calculator : calculators) {
+        const auto checksum = calculator->result();
+        if (checksum.isNull()) {
+            result.remove(calculator->checksumType());
+        } else {
+            result[calculator->checksumType()] = checksum;
+        }
+    }
+    return result;
+}
+
 void ComputeChecksum::slotCalculationDone()
 {
     QByteArray checksum = _watcher.future().result();
@@ -352,6 +480,25 @@ void ValidateChecksumHeader::start(std::unique_ptr<QIODevice> device, const QByt
         calculator->start(std::move(device));
 }
 
+void ValidateChecksumHeader::start(const QString &filePath, const QByteArray &checksumHeader,
+    const QByteArray &precomputedChecksumType, const QByteArray &precomputedChecksum)
+{
+    QByteArray headerType;
+    QByteArray headerChecksum;
+    if (precomputedChecksum.isEmpty()
+        || !parseChecksumHeader(checksumHeader, &headerType, &headerChecksum)
+        || headerType != precomputedChecksumType) {
+        start(filePath, checksumHeader);
+        return;
+    }
+
+    _filePath = filePath;
+    _expectedChecksumType = headerType;
+    _expectedChecksum = headerChecksum;
+    qCInfo(lcChecksums) << "Validating" << headerType << "checksum of" << filePath << "computed while writing it";
+    slotChecksumCalculated(precomputedChecksumType, precomputedChecksum);
+}
+
 void ValidateChecksumHeader::slotChecksumCalculated(const QByteArray &checksumType,
     const QByteArray &checksum)
 {
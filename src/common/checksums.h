@@ -24,10 +24,13 @@
 #include <QObject>
 #include <QByteArray>
 #include <QFutureWatcher>
+#include <QMap>
+#include <QSharedPointer>
 
 #include <memory>
 
 class QFile;
+class QCryptographicHash;
 
 namespace OCC {
 
@@ -72,6 +75,45 @@ QByteArray OCSYNC_EXPORT calcSha1(QIODevice *device);
 QByteArray OCSYNC_EXPORT calcAdler32(QIODevice *device);
 #endif
 
+/**
+ * Computes a checksum incrementally from consecutive blocks of data.
+ *
+ * Used where the data passes through the client anyway, for example
+ * while a download is written to disk, so the file does not need to be
+ * read a second time to checksum it.
+ * \ingroup libsync
+ */
+class OCSYNC_EXPORT ChecksumCalculator
+{
+public:
+    explicit ChecksumCalculator(const QByteArray &checksumType);
+    ~ChecksumCalculator();
+
+    QByteArray checksumType() const { return _checksumType; }
+
+    /// Whether the checksum type is supported and computations are enabled
+    bool isValid() const { return _isValid; }
+
+    void addData(const char *data, qint64 length);
+
+    /**
+     * Finishes the computation and returns the checksum.
+     *
+     * Returns a null QByteArray if the calculator is not valid. Afterwards
+     * no more data may be added.
+     */
+    QByteArray result();
+
+private:
+    Q_DISABLE_COPY(ChecksumCalculator)
+
+    QByteArray _checksumType;
+    std::unique_ptr<QCryptographicHash> _cryptographicHash;
+    unsigned int _adlerHash = 0;
+    qint64 _dataSize = 0;
+    bool _isValid = false;
+};
+
 /**
  * Computes the checksum of a file.
  * \ingroup libsync
@@ -90,6 +132,22 @@ public:
 
     QByteArray checksumType() const;
 
+    /**
+     * Sets further checksum types that are computed in the same pass over
+     * the data as the main checksum type. The default is none.
+     *
+     * Their results can be retrieved with additionalChecksums() once done()
+     * was emitted.
+     */
+    void setAdditionalChecksumTypes(const QByteArrayList &types);
+
+    /**
+     * The checksums of the additional types, by type.
+     *
+     * Types that could not be computed are missing.
+     */
+    QMap<QByteArray, QByteArray> additionalChecksums() const;
+
     /**
      * Computes the checksum for the given file path.
      *
@@ -117,6 +175,13 @@ public:
      */
     static QByteArray computeNowOnFile(const QString &filePath, const QByteArray &checksumType);
 
+    /**
+     * Computes the checksums of several types synchronously, reading the device only once.
+     *
+     * Returns the checksums by type. Unsupported types are missing.
+     */
+    static QMap<QByteArray, QByteArray> computeNow(QIODevice *device, const QByteArrayList &checksumTypes);
+
 signals:
     void done(const QByteArray &checksumType, const QByteArray &checksum);
 
@@ -127,6 +192,10 @@ private:
     void startImpl(std::unique_ptr<QIODevice> device);
 
     QByteArray _checksumType;
+    QByteArrayList _additionalChecksumTypes;
+
+    // written by the checksum calculation thread, read once it is finished
+    QSharedPointer<QMap<QByteArray, QByteArray>> _additionalChecksums;
 
     // watcher for the checksum calculation thread
     QFutureWatcher<QByteArray> _watcher;
@@ -161,6 +230,16 @@ public:
      */
     void start(std::unique_ptr<QIODevice> device, const QByteArray &checksumHeader);
 
+    /**
+     * Check a file's checksum that was already computed while its data was written
+     *
+     * If the type of \a checksumHeader matches \a precomputedChecksumType, the
+     * result is emitted without reading the file. Otherwise this falls back to
+     * computing the checksum of \a filePath like start(filePath, checksumHeader).
+     */
+    void start(const QString &filePath, const QByteArray &checksumHeader,
+        const QByteArray &precomputedChecksumType, const QByteArray &precomputedChecksum);
+
 signals:
     void validated(const QByteArray &checksumType, const QByteArray &checksum);
     void validationFailed(const QString &errMsg, const QByteArray &checksumType, const QByteArray &checksum, const QString &filePath);
@@ -43,6 +43,11 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcSql, "nextcloud.sync.database.sql", QtInfoMsg)
 
+void sqlParameterCountMismatch(const char *sql)
+{
+    qFatal("The parameter types do not match the statement: %s", sql);
+}
+
 SqlDatabase::SqlDatabase() = default;
 
 SqlDatabase::~SqlDatabase()
@@ -425,6 +430,35 @@ void SqlQuery::bindValueInternal(int pos, const QVariant &value)
     ASSERT(res == SQLITE_OK);
 }
 
+void SqlQuery::bindTyped(int pos, qint64 value)
+{
+    ASSERT(_stmt);
+    const int res = sqlite3_bind_int64(_stmt, pos, value);
+    if (res != SQLITE_OK)
+        qCWarning(lcSql) << "ERROR binding SQL value:" << value << "error:" << res;
+    ASSERT(res == SQLITE_OK);
+}
+
+void SqlQuery::bindTyped(int pos, const QByteArray &value)
+{
+    ASSERT(_stmt);
+    const int res = sqlite3_bind_text(_stmt, pos, value.constData(), value.size(), SQLITE_TRANSIENT);
+    if (res != SQLITE_OK)
+        qCWarning(lcSql) << "ERROR binding SQL value:" << value << "error:" << res;
+    ASSERT(res == SQLITE_OK);
+}
+
+void SqlQuery::bindTyped(int pos, const QString &value)
+{
+    ASSERT(_stmt);
+    const int res = value.isNull()
+        ? sqlite3_bind_null(_stmt, pos)
+        : sqlite3_bind_text16(_stmt, pos, value.utf16(), value.size() * static_cast<int>(sizeof(QChar)), SQLITE_TRANSIENT);
+    if (res != SQLITE_OK)
+        qCWarning(lcSql) << "ERROR binding SQL value:" << value << "error:" << res;
+    ASSERT(res == SQLITE_OK);
+}
+
 bool SqlQuery::nullValue(int index)
 {
     return sqlite3_column_type(_stmt, index) == SQLITE_NULL;
@@ -451,6 +485,12 @@ QByteArray SqlQuery::baValue(int index)
         sqlite3_column_bytes(_stmt, index));
 }
 
+QByteArray SqlQuery::baView(int index)
+{
+    return QByteArray::fromRawData(static_cast<const char *>(sqlite3_column_blob(_stmt, index)),
+        sqlite3_column_bytes(_stmt, index));
+}
+
 QString SqlQuery::error() const
 {
     return _error;
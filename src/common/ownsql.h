@@ -22,6 +22,7 @@
 #include <QLoggingCategory>
 #include <QObject>
 #include <QVariant>
+#include <initializer_list>
 
 #include "ocsynclib.h"
 
@@ -33,6 +34,73 @@ OCSYNC_EXPORT Q_DECLARE_LOGGING_CATEGORY(lcSql)
 
 class SqlQuery;
 
+/// Returns the number of parameters of \a sql: the highest ?NNN index, counting a plain ? as the next one
+constexpr int sqlParameterCount(const char *sql)
+{
+    int count = 0;
+    bool quoted = false;
+    for (; *sql; ++sql) {
+        if (*sql == '\'') {
+            quoted = !quoted;
+            continue;
+        }
+        if (quoted || *sql != '?')
+            continue;
+        if (sql[1] >= '0' && sql[1] <= '9') {
+            int index = 0;
+            while (sql[1] >= '0' && sql[1] <= '9') {
+                ++sql;
+                index = index * 10 + (*sql - '0');
+            }
+            count = index > count ? index : count;
+        } else {
+            ++count;
+        }
+    }
+    return count;
+}
+
+/// Called when an SqlStatement does not match its SQL, fails the compilation of constexpr statements
+OCSYNC_EXPORT void sqlParameterCountMismatch(const char *sql);
+
+/**
+ * @brief An SQL statement along with the types of its parameters
+ * @ingroup libsync
+ *
+ * Used with SqlQuery::initOrReset() and SqlQuery::bindAll(), which then only
+ * accepts values for the parameters ?1 to ?N in the order of Params. Values are
+ * bound as their declared type, without going through QVariant:
+ *
+ *  - qint64: integer, use it for all integer and boolean parameters
+ *  - QByteArray: UTF-8 text
+ *  - QString: text, NULL for a null string
+ *
+ * Declare statements as constexpr so a mismatch between Params and the
+ * parameters of the SQL fails to compile:
+ *
+ *     static constexpr SqlStatement<qint64, QByteArray> setEtag{"UPDATE metadata SET md5=?2 WHERE phash=?1;"};
+ */
+template <typename... Params>
+class SqlStatement
+{
+public:
+    template <std::size_t N>
+    constexpr SqlStatement(const char (&sql)[N])
+        : _sql(sql)
+        , _size(int(N - 1))
+    {
+        if (sqlParameterCount(sql) != int(sizeof...(Params)))
+            sqlParameterCountMismatch(sql);
+    }
+
+    /// Refers to the string literal, which outlives the statement
+    QByteArray sql() const { return QByteArray::fromRawData(_sql, _size); }
+
+private:
+    const char *_sql;
+    int _size;
+};
+
 /**
  * @brief The SqlDatabase class
  * @ingroup libsync
@@ -109,6 +177,11 @@ public:
      * return false if there is an error
      */
     bool initOrReset(const QByteArray &sql, SqlDatabase &db);
+    template <typename... Params>
+    bool initOrReset(const SqlStatement<Params...> &statement, SqlDatabase &db)
+    {
+        return initOrReset(statement.sql(), db);
+    }
     /**
      * Prepare the SqlQuery.
      * If the query was already prepared, this will first call finish(), and re-prepare it.
@@ -127,6 +200,14 @@ public:
     int intValue(int index);
     quint64 int64Value(int index);
     QByteArray baValue(int index);
+
+    /** The content of a text or blob column, without copying it.
+     *
+     * Refers to the memory of the statement, so it is only valid until the
+     * next call to next(), reset_and_clear_bindings() or finish(). Use
+     * baValue() for data that is kept.
+     */
+    QByteArray baView(int index);
     bool isSelect();
     bool isPragma();
     bool exec();
@@ -158,6 +239,23 @@ public:
         bindValueInternal(pos, value);
     }
 
+    /// Binds \a values to the parameters of \a statement, which must be the statement of this query
+    template <typename... Params, typename... Values>
+    void bindAll(const SqlStatement<Params...> &, const Values &... values)
+    {
+        static_assert(sizeof...(Values) == sizeof...(Params), "one value is needed for each statement parameter");
+        int pos = 0;
+        (void)std::initializer_list<int>{ (bindTyped(++pos, static_cast<Params>(values)), 0)... };
+    }
+
+    /** Typed binding, unlike bindValue() it neither builds a QVariant nor logs the value.
+     *
+     * Text is copied by sqlite, so the arguments may be temporaries.
+     */
+    void bindTyped(int pos, qint64 value);
+    void bindTyped(int pos, const QByteArray &value);
+    void bindTyped(int pos, const QString &value);
+
     const QByteArray &lastQuery() const;
     int numRowsAffected();
     void reset_and_clear_bindings();
@@ -23,6 +23,7 @@
 #include <QElapsedTimer>
 #include <QUrl>
 #include <QDir>
+#include <QThread>
 #include <sqlite3.h>
 #include <cstring>
 
@@ -41,15 +42,81 @@
 #define IS_PREFIX_PATH_OR_EQUAL(prefix, path) \
     "(" path " == " prefix " OR " IS_PREFIX_PATH_OF(prefix, path) ")"
 
+// The files table stores the name of each file and the id of its parent
+// directory. The directories table holds the path of each such directory,
+// with a trailing '/' unless it is the root, so the full path of a record
+// is the concatenation of the two.
+#define METADATA_PATH "(directories.path || files.name)"
+// SQL condition to check whether a record of the files table is below the directory prefix
+#define IS_METADATA_BELOW(prefix) \
+    "(files.parent IN (SELECT id FROM directories WHERE directories.path >= (" prefix "||'/') AND directories.path < (" prefix "||'0')))"
+
+#define METADATA_TABLE_COLUMNS \
+    "phash INTEGER PRIMARY KEY," \
+    "parent INTEGER," /* the id of the parent in the directories table */ \
+    "name TEXT," \
+    "inode INTEGER," \
+    "modtime INTEGER(8)," \
+    "type INTEGER," \
+    "md5 VARCHAR(32)," /* This is the etag.  Called md5 for compatibility */ \
+    "fileid VARCHAR(128)," \
+    "remotePerm VARCHAR(128)," \
+    "filesize BIGINT," \
+    "ignoredChildrenRemote INT," \
+    "contentChecksum TEXT," \
+    "contentChecksumTypeId INTEGER," \
+    "e2eMangledName TEXT," \
+    "isE2eEncrypted INTEGER"
+
 namespace OCC {
 
 Q_LOGGING_CATEGORY(lcDb, "nextcloud.sync.database", QtInfoMsg)
 
+// The layout of the tables, stored as the user_version of the database.
+// Databases of a newer layout are not opened.
+//  0: full paths in the metadata table
+//  1: the files and directories tables
+static const int journalSchemaVersion = 1;
+
 #define GET_FILE_RECORD_QUERY \
-        "SELECT path, inode, modtime, type, md5, fileid, remotePerm, filesize," \
+        "SELECT " METADATA_PATH ", inode, modtime, type, md5, fileid, remotePerm, filesize," \
         "  ignoredChildrenRemote, contentchecksumtype.name || ':' || contentChecksum, e2eMangledName, isE2eEncrypted " \
-        " FROM metadata" \
-        "  LEFT JOIN checksumtype as contentchecksumtype ON metadata.contentChecksumTypeId == contentchecksumtype.id"
+        " FROM files" \
+        "  JOIN directories ON files.parent == directories.id" \
+        "  LEFT JOIN checksumtype as contentchecksumtype ON files.contentChecksumTypeId == contentchecksumtype.id"
+
+// The statements of the queries that run for each file
+static constexpr SqlStatement<qint64> getFileRecordStatement{GET_FILE_RECORD_QUERY " WHERE phash=?1"};
+static constexpr SqlStatement<QString> getFileRecordByMangledNameStatement{GET_FILE_RECORD_QUERY " WHERE e2eMangledName=?1"};
+static constexpr SqlStatement<qint64> getFileRecordByInodeStatement{GET_FILE_RECORD_QUERY " WHERE inode=?1"};
+static constexpr SqlStatement<QByteArray> getFileRecordsByFileIdStatement{GET_FILE_RECORD_QUERY " WHERE fileid=?1"};
+static constexpr SqlStatement<QByteArray> getFilesBelowPathStatement{
+    GET_FILE_RECORD_QUERY
+    " WHERE " IS_METADATA_BELOW("?1")
+    " OR " IS_PREFIX_PATH_OF("?1", "e2eMangledName")
+    // We want to ensure that the contents of a directory are sorted
+    // directly behind the directory itself. Without this ORDER BY
+    // an ordering like foo, foo-2, foo/file would be returned.
+    // With the trailing /, we get foo-2, foo, foo/file. This property
+    // is used in fill_tree_from_db().
+    " ORDER BY " METADATA_PATH "||'/' ASC"};
+static constexpr SqlStatement<qint64> listFilesInPathStatement{GET_FILE_RECORD_QUERY " WHERE files.parent = ?1 ORDER BY " METADATA_PATH "||'/' ASC"};
+static constexpr SqlStatement<qint64, qint64, QByteArray, qint64, qint64, qint64,
+    QByteArray, QByteArray, QByteArray, qint64, qint64, QByteArray, qint64, QByteArray, qint64>
+    setFileRecordStatement{
+        "INSERT OR REPLACE INTO files "
+        "(phash, parent, name, inode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId, e2eMangledName, isE2eEncrypted) "
+        "VALUES (?1 , ?2, ?3 , ?4 , ?5 , ?6 , ?7, ?8 , ?9 , ?10, ?11, ?12, ?13, ?14, ?15);"};
+static constexpr SqlStatement<qint64, QByteArray> setDirectoryStatement{
+    "INSERT OR IGNORE INTO directories (id, path) VALUES (?1, ?2);"};
+static constexpr SqlStatement<qint64, QByteArray, qint64> setFileRecordChecksumStatement{
+    "UPDATE files"
+    " SET contentChecksum = ?2, contentChecksumTypeId = ?3"
+    " WHERE phash == ?1;"};
+static constexpr SqlStatement<qint64, qint64, qint64, qint64> setFileRecordLocalMetadataStatement{
+    "UPDATE files"
+    " SET inode=?2, modtime=?3, filesize=?4"
+    " WHERE phash == ?1;"};
 
 static void fillFileRecordFromGetQuery(SyncJournalFileRecord &rec, SqlQuery &query)
 {
@@ -59,7 +126,7 @@ static void fillFileRecordFromGetQuery(SyncJournalFileRecord &rec, SqlQuery &que
     rec._type = static_cast<ItemType>(query.intValue(3));
     rec._etag = query.baValue(4);
     rec._fileId = query.baValue(5);
-    rec._remotePerm = RemotePermissions::fromDbValue(query.baValue(6));
+    rec._remotePerm = RemotePermissions::fromDbValue(query.baView(6));
     rec._fileSize = query.int64Value(7);
     rec._serverHasIgnoredFiles = (query.intValue(8) > 0);
     rec._checksumHeader = query.baValue(9);
@@ -270,7 +337,7 @@ bool SyncJournalDb::checkConnect()
         // has become unavailable - and then some operations may cause crashes. See #6049
         if (!QFile::exists(_dbFile)) {
             qCWarning(lcDb) << "Database open, but file" << _dbFile << "does not exist";
-            close();
+            closeLocked();
             return false;
         }
         return true;
@@ -358,29 +425,43 @@ bool SyncJournalDb::checkConnect()
                                                                         end - text, 0));
                                 }, nullptr, nullptr);
 
+    // Used to split the path of the old metadata layout, see updateMetadataTableStructure()
+    sqlite3_create_function(_db.sqliteDb(), "parent_directory", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+                                [] (sqlite3_context *ctx,int, sqlite3_value **argv) {
+                                    auto text = reinterpret_cast<const char*>(sqlite3_value_text(argv[0]));
+                                    const char *end = std::strrchr(text, '/');
+                                    sqlite3_result_text(ctx, text, end ? end + 1 - text : 0, SQLITE_TRANSIENT);
+                                }, nullptr, nullptr);
+    sqlite3_create_function(_db.sqliteDb(), "base_name", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+                                [] (sqlite3_context *ctx,int, sqlite3_value **argv) {
+                                    auto text = reinterpret_cast<const char*>(sqlite3_value_text(argv[0]));
+                                    const char *begin = std::strrchr(text, '/');
+                                    sqlite3_result_text(ctx, begin ? begin + 1 : text, -1, SQLITE_TRANSIENT);
+                                }, nullptr, nullptr);
+
+    pragma1.prepare("PRAGMA user_version;");
+    if (!pragma1.exec() || !pragma1.next().hasData) {
+        return sqlFail(QStringLiteral("Get PRAGMA user_version"), pragma1);
+    }
+    const int schemaVersion = pragma1.intValue(0);
+    if (schemaVersion > journalSchemaVersion) {
+        qCWarning(lcDb) << "The database has the schema version" << schemaVersion
+                        << "of a newer client, this one knows up to" << journalSchemaVersion;
+        pragma1.finish();
+        _db.close();
+        return false;
+    }
+
     /* Because insert is so slow, we do everything in a transaction, and only need one call to commit */
     startTransaction();
 
     SqlQuery createQuery(_db);
-    createQuery.prepare("CREATE TABLE IF NOT EXISTS metadata("
-                        "phash INTEGER(8),"
-                        "pathlen INTEGER,"
-                        "path VARCHAR(4096),"
-                        "inode INTEGER,"
-                        "uid INTEGER,"
-                        "gid INTEGER,"
-                        "mode INTEGER,"
-                        "modtime INTEGER(8),"
-                        "type INTEGER,"
-                        "md5 VARCHAR(32)," /* This is the etag.  Called md5 for compatibility */
-                        // updateDatabaseStructure() will add
-                        // fileid
-                        // remotePerm
-                        // filesize
-                        // ignoredChildrenRemote
-                        // contentChecksum
-                        // contentChecksumTypeId
-                        "PRIMARY KEY(phash)"
+    // Older versions stored the full path of each file in the metadata table,
+    // updateMetadataTableStructure() migrates their databases to this layout.
+    // The table has a new name, so these versions don't fail on it but start
+    // over with an empty metadata table.
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS files("
+                        METADATA_TABLE_COLUMNS
                         ");");
 
 #ifndef SQLITE_IOERR_SHMMAP
@@ -405,7 +486,16 @@ bool SyncJournalDb::checkConnect()
             return checkConnect();
         }
 
-        return sqlFail(QStringLiteral("Create table metadata"), createQuery);
+        return sqlFail(QStringLiteral("Create table files"), createQuery);
+    }
+
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS directories("
+                        "id INTEGER PRIMARY KEY," /* the phash of the path */
+                        "path TEXT UNIQUE"
+                        ");");
+
+    if (!createQuery.exec()) {
+        return sqlFail(QStringLiteral("Create table directories"), createQuery);
     }
 
     createQuery.prepare("CREATE TABLE IF NOT EXISTS key_value_store(key VARCHAR(4096), value VARCHAR(4096), PRIMARY KEY(key));");
@@ -627,13 +717,19 @@ bool SyncJournalDb::checkConnect()
 
 void SyncJournalDb::close()
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
+    closeLocked();
+}
+
+void SyncJournalDb::closeLocked()
+{
     qCInfo(lcDb) << "Closing DB" << _dbFile;
 
     commitTransaction();
 
     _db.close();
-    clearEtagStorageFilter();
+    _etagStorageFilter.clear();
     _metadataTableIsEmpty = false;
 }
 
@@ -649,72 +745,122 @@ bool SyncJournalDb::updateDatabaseStructure()
 
 bool SyncJournalDb::updateMetadataTableStructure()
 {
+    bool re = true;
 
+    // The metadata table of older versions, see migrateMetadataTable()
     auto columns = tableColumns("metadata");
-    bool re = true;
+    if (!columns.isEmpty()) {
+        // check if the file_id column is there and create it if not
+        if (columns.indexOf("fileid") == -1) {
+            SqlQuery query(_db);
+            query.prepare("ALTER TABLE metadata ADD COLUMN fileid VARCHAR(128);");
+            if (!query.exec()) {
+                sqlFail(QStringLiteral("updateMetadataTableStructure: Add column fileid"), query);
+                re = false;
+            }
 
-    // check if the file_id column is there and create it if not
-    if (columns.isEmpty()) {
-        return false;
-    }
+            query.prepare("CREATE INDEX metadata_file_id ON metadata(fileid);");
+            if (!query.exec()) {
+                sqlFail(QStringLiteral("updateMetadataTableStructure: create index fileid"), query);
+                re = false;
+            }
+            commitInternal(QStringLiteral("update database structure: add fileid col"));
+        }
+        if (columns.indexOf("remotePerm") == -1) {
+            SqlQuery query(_db);
+            query.prepare("ALTER TABLE metadata ADD COLUMN remotePerm VARCHAR(128);");
+            if (!query.exec()) {
+                sqlFail(QStringLiteral("updateMetadataTableStructure: add column remotePerm"), query);
+                re = false;
+            }
+            commitInternal(QStringLiteral("update database structure (remotePerm)"));
+        }
+        if (columns.indexOf("filesize") == -1) {
+            SqlQuery query(_db);
+            query.prepare("ALTER TABLE metadata ADD COLUMN filesize BIGINT;");
+            if (!query.exec()) {
+                sqlFail(QStringLiteral("updateDatabaseStructure: add column filesize"), query);
+                re = false;
+            }
+            commitInternal(QStringLiteral("update database structure: add filesize col"));
+        }
 
-    if (columns.indexOf("fileid") == -1) {
-        SqlQuery query(_db);
-        query.prepare("ALTER TABLE metadata ADD COLUMN fileid VARCHAR(128);");
-        if (!query.exec()) {
-            sqlFail(QStringLiteral("updateMetadataTableStructure: Add column fileid"), query);
-            re = false;
+        if (columns.indexOf("ignoredChildrenRemote") == -1) {
+            SqlQuery query(_db);
+            query.prepare("ALTER TABLE metadata ADD COLUMN ignoredChildrenRemote INT;");
+            if (!query.exec()) {
+                sqlFail(QStringLiteral("updateMetadataTableStructure: add ignoredChildrenRemote column"), query);
+                re = false;
+            }
+            commitInternal(QStringLiteral("update database structure: add ignoredChildrenRemote col"));
         }
 
-        query.prepare("CREATE INDEX metadata_file_id ON metadata(fileid);");
-        if (!query.exec()) {
-            sqlFail(QStringLiteral("updateMetadataTableStructure: create index fileid"), query);
-            re = false;
+        if (columns.indexOf("contentChecksum") == -1) {
+            SqlQuery query(_db);
+            query.prepare("ALTER TABLE metadata ADD COLUMN contentChecksum TEXT;");
+            if (!query.exec()) {
+                sqlFail(QStringLiteral("updateMetadataTableStructure: add contentChecksum column"), query);
+                re = false;
+            }
+            commitInternal(QStringLiteral("update database structure: add contentChecksum col"));
+        }
+        if (columns.indexOf("contentChecksumTypeId") == -1) {
+            SqlQuery query(_db);
+            query.prepare("ALTER TABLE metadata ADD COLUMN contentChecksumTypeId INTEGER;");
+            if (!query.exec()) {
+                sqlFail(QStringLiteral("updateMetadataTableStructure: add contentChecksumTypeId column"), query);
+                re = false;
+            }
+            commitInternal(QStringLiteral("update database structure: add contentChecksumTypeId col"));
         }
-        commitInternal(QStringLiteral("update database structure: add fileid col"));
-    }
-    if (columns.indexOf("remotePerm") == -1) {
-        SqlQuery query(_db);
-        query.prepare("ALTER TABLE metadata ADD COLUMN remotePerm VARCHAR(128);");
-        if (!query.exec()) {
-            sqlFail(QStringLiteral("updateMetadataTableStructure: add column remotePerm"), query);
-            re = false;
+
+        if (!columns.contains("e2eMangledName")) {
+            SqlQuery query(_db);
+            query.prepare("ALTER TABLE metadata ADD COLUMN e2eMangledName TEXT;");
+            if (!query.exec()) {
+                sqlFail(QStringLiteral("updateMetadataTableStructure: add e2eMangledName column"), query);
+                re = false;
+            }
+            commitInternal(QStringLiteral("update database structure: add e2eMangledName col"));
         }
-        commitInternal(QStringLiteral("update database structure (remotePerm)"));
-    }
-    if (columns.indexOf("filesize") == -1) {
-        SqlQuery query(_db);
-        query.prepare("ALTER TABLE metadata ADD COLUMN filesize BIGINT;");
-        if (!query.exec()) {
-            sqlFail(QStringLiteral("updateDatabaseStructure: add column filesize"), query);
-            re = false;
+
+        if (!columns.contains("isE2eEncrypted")) {
+            SqlQuery query(_db);
+            query.prepare("ALTER TABLE metadata ADD COLUMN isE2eEncrypted INTEGER;");
+            if (!query.exec()) {
+                sqlFail(QStringLiteral("updateMetadataTableStructure: add isE2eEncrypted column"), query);
+                re = false;
+            }
+            commitInternal(QStringLiteral("update database structure: add isE2eEncrypted col"));
         }
-        commitInternal(QStringLiteral("update database structure: add filesize col"));
+
+        if (!migrateMetadataTable())
+            return false;
     }
 
     if (true) {
         SqlQuery query(_db);
-        query.prepare("CREATE INDEX IF NOT EXISTS metadata_inode ON metadata(inode);");
+        query.prepare("CREATE INDEX IF NOT EXISTS files_file_id ON files(fileid);");
         if (!query.exec()) {
-            sqlFail(QStringLiteral("updateMetadataTableStructure: create index inode"), query);
+            sqlFail(QStringLiteral("updateMetadataTableStructure: create index fileid"), query);
             re = false;
         }
-        commitInternal(QStringLiteral("update database structure: add inode index"));
+        commitInternal(QStringLiteral("update database structure: add fileid index"));
     }
 
     if (true) {
         SqlQuery query(_db);
-        query.prepare("CREATE INDEX IF NOT EXISTS metadata_path ON metadata(path);");
+        query.prepare("CREATE INDEX IF NOT EXISTS files_inode ON files(inode);");
         if (!query.exec()) {
-            sqlFail(QStringLiteral("updateMetadataTableStructure: create index path"), query);
+            sqlFail(QStringLiteral("updateMetadataTableStructure: create index inode"), query);
             re = false;
         }
-        commitInternal(QStringLiteral("update database structure: add path index"));
+        commitInternal(QStringLiteral("update database structure: add inode index"));
     }
 
     if (true) {
         SqlQuery query(_db);
-        query.prepare("CREATE INDEX IF NOT EXISTS metadata_parent ON metadata(parent_hash(path));");
+        query.prepare("CREATE INDEX IF NOT EXISTS files_parent ON files(parent);");
         if (!query.exec()) {
             sqlFail(QStringLiteral("updateMetadataTableStructure: create index parent"), query);
             re = false;
@@ -722,55 +868,6 @@ bool SyncJournalDb::updateMetadataTableStructure()
         commitInternal(QStringLiteral("update database structure: add parent index"));
     }
 
-    if (columns.indexOf("ignoredChildrenRemote") == -1) {
-        SqlQuery query(_db);
-        query.prepare("ALTER TABLE metadata ADD COLUMN ignoredChildrenRemote INT;");
-        if (!query.exec()) {
-            sqlFail(QStringLiteral("updateMetadataTableStructure: add ignoredChildrenRemote column"), query);
-            re = false;
-        }
-        commitInternal(QStringLiteral("update database structure: add ignoredChildrenRemote col"));
-    }
-
-    if (columns.indexOf("contentChecksum") == -1) {
-        SqlQuery query(_db);
-        query.prepare("ALTER TABLE metadata ADD COLUMN contentChecksum TEXT;");
-        if (!query.exec()) {
-            sqlFail(QStringLiteral("updateMetadataTableStructure: add contentChecksum column"), query);
-            re = false;
-        }
-        commitInternal(QStringLiteral("update database structure: add contentChecksum col"));
-    }
-    if (columns.indexOf("contentChecksumTypeId") == -1) {
-        SqlQuery query(_db);
-        query.prepare("ALTER TABLE metadata ADD COLUMN contentChecksumTypeId INTEGER;");
-        if (!query.exec()) {
-            sqlFail(QStringLiteral("updateMetadataTableStructure: add contentChecksumTypeId column"), query);
-            re = false;
-        }
-        commitInternal(QStringLiteral("update database structure: add contentChecksumTypeId col"));
-    }
-
-    if (!columns.contains("e2eMangledName")) {
-        SqlQuery query(_db);
-        query.prepare("ALTER TABLE metadata ADD COLUMN e2eMangledName TEXT;");
-        if (!query.exec()) {
-            sqlFail(QStringLiteral("updateMetadataTableStructure: add e2eMangledName column"), query);
-            re = false;
-        }
-        commitInternal(QStringLiteral("update database structure: add e2eMangledName col"));
-    }
-
-    if (!columns.contains("isE2eEncrypted")) {
-        SqlQuery query(_db);
-        query.prepare("ALTER TABLE metadata ADD COLUMN isE2eEncrypted INTEGER;");
-        if (!query.exec()) {
-            sqlFail(QStringLiteral("updateMetadataTableStructure: add isE2eEncrypted column"), query);
-            re = false;
-        }
-        commitInternal(QStringLiteral("update database structure: add isE2eEncrypted col"));
-    }
-
     auto uploadInfoColumns = tableColumns("uploadinfo");
     if (uploadInfoColumns.isEmpty())
         return false;
@@ -798,7 +895,7 @@ bool SyncJournalDb::updateMetadataTableStructure()
 
     if (true) {
         SqlQuery query(_db);
-        query.prepare("CREATE INDEX IF NOT EXISTS metadata_e2e_id ON metadata(e2eMangledName);");
+        query.prepare("CREATE INDEX IF NOT EXISTS files_e2e_id ON files(e2eMangledName);");
         if (!query.exec()) {
             sqlFail(QStringLiteral("updateMetadataTableStructure: create index e2eMangledName"), query);
             re = false;
@@ -806,9 +903,56 @@ bool SyncJournalDb::updateMetadataTableStructure()
         commitInternal(QStringLiteral("update database structure: add e2eMangledName index"));
     }
 
+    if (re) {
+        SqlQuery query(_db);
+        query.prepare("PRAGMA user_version = " + QByteArray::number(journalSchemaVersion) + ";");
+        if (!query.exec()) {
+            sqlFail(QStringLiteral("updateMetadataTableStructure: set user_version"), query);
+            re = false;
+        }
+        commitInternal(QStringLiteral("update database structure: schema version"));
+    }
+
     return re;
 }
 
+bool SyncJournalDb::migrateMetadataTable()
+{
+    // Older versions store the full path of each record in the metadata table.
+    // Replace it by its name and the id of its parent directory in the files
+    // table. Versions that predate the files table recreate the metadata table
+    // when they open the database, so its content is the latest one even if
+    // the files table already exists.
+    qCInfo(lcDb) << "Migrating the metadata table to the files table";
+    SqlQuery query(_db);
+    query.prepare("DELETE FROM files;");
+    if (!query.exec()) {
+        return sqlFail(QStringLiteral("migrateMetadataTable: clear files"), query);
+    }
+    query.prepare("DELETE FROM directories;");
+    if (!query.exec()) {
+        return sqlFail(QStringLiteral("migrateMetadataTable: clear directories"), query);
+    }
+    query.prepare("INSERT OR IGNORE INTO directories (id, path) SELECT parent_hash(path), parent_directory(path) FROM metadata;");
+    if (!query.exec()) {
+        return sqlFail(QStringLiteral("migrateMetadataTable: fill directories"), query);
+    }
+    query.prepare("INSERT OR REPLACE INTO files "
+                  "(phash, parent, name, inode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId, e2eMangledName, isE2eEncrypted) "
+                  "SELECT phash, parent_hash(path), base_name(path), inode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId, e2eMangledName, isE2eEncrypted "
+                  "FROM metadata;");
+    if (!query.exec()) {
+        return sqlFail(QStringLiteral("migrateMetadataTable: fill files"), query);
+    }
+    // Dropping the table also drops its indexes on the path
+    query.prepare("DROP TABLE metadata;");
+    if (!query.exec()) {
+        return sqlFail(QStringLiteral("migrateMetadataTable: drop metadata table"), query);
+    }
+    commitInternal(QStringLiteral("update database structure: files table"));
+    return true;
+}
+
 bool SyncJournalDb::updateErrorBlacklistTableStructure()
 {
     auto columns = tableColumns("blacklist");
@@ -898,10 +1042,24 @@ qint64 SyncJournalDb::getPHash(const QByteArray &file)
     return h;
 }
 
-Result<void, QString> SyncJournalDb::setFileRecord(const SyncJournalFileRecord &_record)
+Result<void, QString> SyncJournalDb::setFileRecord(const SyncJournalFileRecord &record)
 {
-    SyncJournalFileRecord record = _record;
+    if (queueWrite([&record](QueuedWrites &writes) {
+            writes.fileRecords.insert(record._path, record);
+            // The record carries the newer local metadata
+            writes.localMetadata.remove(record._path);
+        })) {
+        return {};
+    }
+
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
+    return writeFileRecord(record);
+}
+
+SyncJournalFileRecord SyncJournalDb::applyEtagStorageFilter(const SyncJournalFileRecord &record) const
+{
+    SyncJournalFileRecord result = record;
 
     if (!_etagStorageFilter.isEmpty()) {
         // If we are a directory that should not be read from db next time, don't write the etag
@@ -909,11 +1067,17 @@ Result<void, QString> SyncJournalDb::setFileRecord(const SyncJournalFileRecord &
         foreach (const QByteArray &it, _etagStorageFilter) {
             if (it.startsWith(prefix)) {
                 qCInfo(lcDb) << "Filtered writing the etag of" << prefix << "because it is a prefix of" << it;
-                record._etag = "_invalid_";
+                result._etag = "_invalid_";
                 break;
             }
         }
     }
+    return result;
+}
+
+Result<void, QString> SyncJournalDb::writeFileRecord(const SyncJournalFileRecord &_record)
+{
+    const SyncJournalFileRecord record = applyEtagStorageFilter(_record);
 
     qCInfo(lcDb) << "Updating file record for path:" << record.path() << "inode:" << record._inode
                  << "modtime:" << record._modtime << "type:" << record._type
@@ -923,7 +1087,9 @@ Result<void, QString> SyncJournalDb::setFileRecord(const SyncJournalFileRecord &
 
     qlonglong phash = getPHash(record._path);
     if (checkConnect()) {
-        int plen = record._path.length();
+        const int slash = record._path.lastIndexOf('/');
+        const QByteArray parentPath = slash == -1 ? QByteArray() : record._path.left(slash);
+        const qint64 parent = getPHash(parentPath);
 
         QByteArray etag(record._etag);
         if (etag.isEmpty())
@@ -936,31 +1102,23 @@ Result<void, QString> SyncJournalDb::setFileRecord(const SyncJournalFileRecord &
         parseChecksumHeader(record._checksumHeader, &checksumType, &checksum);
         int contentChecksumTypeId = mapChecksumType(checksumType);
 
-        if (!_setFileRecordQuery.initOrReset(QByteArrayLiteral(
-            "INSERT OR REPLACE INTO metadata "
-            "(phash, pathlen, path, inode, uid, gid, mode, modtime, type, md5, fileid, remotePerm, filesize, ignoredChildrenRemote, contentChecksum, contentChecksumTypeId, e2eMangledName, isE2eEncrypted) "
-            "VALUES (?1 , ?2, ?3 , ?4 , ?5 , ?6 , ?7,  ?8 , ?9 , ?10, ?11, ?12, ?13, ?14, ?15, ?16, ?17, ?18);"), _db)) {
+        if (!_setFileRecordQuery.initOrReset(setFileRecordStatement, _db)) {
             return _setFileRecordQuery.error();
         }
 
-        _setFileRecordQuery.bindValue(1, phash);
-        _setFileRecordQuery.bindValue(2, plen);
-        _setFileRecordQuery.bindValue(3, record._path);
-        _setFileRecordQuery.bindValue(4, record._inode);
-        _setFileRecordQuery.bindValue(5, 0); // uid Not used
-        _setFileRecordQuery.bindValue(6, 0); // gid Not used
-        _setFileRecordQuery.bindValue(7, 0); // mode Not used
-        _setFileRecordQuery.bindValue(8, record._modtime);
-        _setFileRecordQuery.bindValue(9, record._type);
-        _setFileRecordQuery.bindValue(10, etag);
-        _setFileRecordQuery.bindValue(11, fileId);
-        _setFileRecordQuery.bindValue(12, remotePerm);
-        _setFileRecordQuery.bindValue(13, record._fileSize);
-        _setFileRecordQuery.bindValue(14, record._serverHasIgnoredFiles ? 1 : 0);
-        _setFileRecordQuery.bindValue(15, checksum);
-        _setFileRecordQuery.bindValue(16, contentChecksumTypeId);
-        _setFileRecordQuery.bindValue(17, record._e2eMangledName);
-        _setFileRecordQuery.bindValue(18, record._isE2eEncrypted);
+        if (!_setDirectoryQuery.initOrReset(setDirectoryStatement, _db)) {
+            return _setDirectoryQuery.error();
+        }
+        _setDirectoryQuery.bindAll(setDirectoryStatement, parent, slash == -1 ? QByteArray() : record._path.left(slash + 1));
+        if (!_setDirectoryQuery.exec()) {
+            return _setDirectoryQuery.error();
+        }
+
+        _setFileRecordQuery.bindAll(setFileRecordStatement,
+            phash, parent, record._path.mid(slash + 1), record._inode,
+            record._modtime, record._type, etag, fileId, remotePerm, record._fileSize,
+            record._serverHasIgnoredFiles ? 1 : 0, checksum, contentChecksumTypeId,
+            record._e2eMangledName, record._isE2eEncrypted);
 
         if (!_setFileRecordQuery.exec()) {
             return _setFileRecordQuery.error();
@@ -1047,16 +1205,39 @@ void SyncJournalDb::keyValueStoreDelete(const QString &key)
     }
 }
 
+// Drops the queued writes of the paths that match \a isRemoved
+template <typename T, typename Predicate>
+static void removeQueuedPaths(QHash<QByteArray, T> &writes, const Predicate &isRemoved)
+{
+    for (auto it = writes.begin(); it != writes.end();) {
+        if (isRemoved(it.key()))
+            it = writes.erase(it);
+        else
+            ++it;
+    }
+}
+
 // TODO: filename -> QBytearray?
 bool SyncJournalDb::deleteFileRecord(const QString &filename, bool recursively)
 {
     QMutexLocker locker(&_mutex);
 
+    {
+        // Queued writes must not bring the deleted records back
+        QMutexLocker lock(&_writeQueueMutex);
+        const QByteArray path = filename.toUtf8();
+        const auto isDeleted = [&](const QByteArray &queuedPath) {
+            return queuedPath == path || (recursively && queuedPath.startsWith(path + '/'));
+        };
+        removeQueuedPaths(_queuedWrites.fileRecords, isDeleted);
+        removeQueuedPaths(_queuedWrites.localMetadata, isDeleted);
+    }
+
     if (checkConnect()) {
         // if (!recursively) {
         // always delete the actual file.
 
-        if (!_deleteFileRecordPhash.initOrReset(QByteArrayLiteral("DELETE FROM metadata WHERE phash=?1"), _db))
+        if (!_deleteFileRecordPhash.initOrReset(QByteArrayLiteral("DELETE FROM files WHERE phash=?1"), _db))
             return false;
 
         qlonglong phash = getPHash(filename.toUtf8());
@@ -1066,12 +1247,33 @@ bool SyncJournalDb::deleteFileRecord(const QString &filename, bool recursively)
             return false;
 
         if (recursively) {
-            if (!_deleteFileRecordRecursively.initOrReset(QByteArrayLiteral("DELETE FROM metadata WHERE " IS_PREFIX_PATH_OF("?1", "path")), _db))
+            if (!_deleteFileRecordRecursively.initOrReset(QByteArrayLiteral("DELETE FROM files WHERE " IS_METADATA_BELOW("?1")), _db))
                 return false;
             _deleteFileRecordRecursively.bindValue(1, filename);
             if (!_deleteFileRecordRecursively.exec()) {
                 return false;
             }
+
+            // The directories below are empty now
+            if (!_deleteDirectoriesRecursively.initOrReset(QByteArrayLiteral("DELETE FROM directories WHERE path >= (?1||'/') AND path < (?1||'0')"), _db))
+                return false;
+            _deleteDirectoriesRecursively.bindValue(1, filename);
+            if (!_deleteDirectoriesRecursively.exec()) {
+                return false;
+            }
+        }
+
+        // Renames and deletes leave the directory of the record, and that of a
+        // renamed directory, without records. Don't keep their ids around.
+        if (!_deleteUnusedDirectories.initOrReset(QByteArrayLiteral(
+                "DELETE FROM directories WHERE id IN (?1, ?2)"
+                " AND NOT EXISTS (SELECT 1 FROM files WHERE files.parent == directories.id)"), _db))
+            return false;
+        const int slash = filename.lastIndexOf(QLatin1Char('/'));
+        _deleteUnusedDirectories.bindValue(1, phash);
+        _deleteUnusedDirectories.bindValue(2, getPHash(slash == -1 ? QByteArray() : filename.left(slash).toUtf8()));
+        if (!_deleteUnusedDirectories.exec()) {
+            return false;
         }
         return true;
     } else {
@@ -1090,6 +1292,20 @@ bool SyncJournalDb::getFileRecord(const QByteArray &filename, SyncJournalFileRec
     rec->_path.clear();
     Q_ASSERT(!rec->isValid());
 
+    // Queued writes are not in the database yet
+    Optional<LocalMetadata> queuedMetadata;
+    {
+        QMutexLocker lock(&_writeQueueMutex);
+        const auto record = _queuedWrites.fileRecords.constFind(filename);
+        if (record != _queuedWrites.fileRecords.cend()) {
+            *rec = applyEtagStorageFilter(*record);
+            return true;
+        }
+        const auto metadata = _queuedWrites.localMetadata.constFind(filename);
+        if (metadata != _queuedWrites.localMetadata.cend())
+            queuedMetadata = *metadata;
+    }
+
     if (_metadataTableIsEmpty)
         return true; // no error, yet nothing found (rec->isValid() == false)
 
@@ -1097,13 +1313,13 @@ bool SyncJournalDb::getFileRecord(const QByteArray &filename, SyncJournalFileRec
         return false;
 
     if (!filename.isEmpty()) {
-        if (!_getFileRecordQuery.initOrReset(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE phash=?1"), _db))
+        if (!_getFileRecordQuery.initOrReset(getFileRecordStatement, _db))
             return false;
 
-        _getFileRecordQuery.bindValue(1, getPHash(filename));
+        _getFileRecordQuery.bindAll(getFileRecordStatement, getPHash(filename));
 
         if (!_getFileRecordQuery.exec()) {
-            close();
+            closeLocked();
             return false;
         }
 
@@ -1111,11 +1327,16 @@ bool SyncJournalDb::getFileRecord(const QByteArray &filename, SyncJournalFileRec
         if (!next.ok) {
             QString err = _getFileRecordQuery.error();
             qCWarning(lcDb) << "No journal entry found for" << filename << "Error:" << err;
-            close();
+            closeLocked();
             return false;
         }
         if (next.hasData) {
             fillFileRecordFromGetQuery(*rec, _getFileRecordQuery);
+            if (queuedMetadata) {
+                rec->_modtime = queuedMetadata->modtime;
+                rec->_fileSize = queuedMetadata->size;
+                rec->_inode = queuedMetadata->inode;
+            }
         }
     }
     return true;
@@ -1123,6 +1344,7 @@ bool SyncJournalDb::getFileRecord(const QByteArray &filename, SyncJournalFileRec
 
 bool SyncJournalDb::getFileRecordByE2eMangledName(const QString &mangledName, SyncJournalFileRecord *rec)
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
 
     // Reset the output var in case the caller is reusing it.
@@ -1139,14 +1361,14 @@ bool SyncJournalDb::getFileRecordByE2eMangledName(const QString &mangledName, Sy
     }
 
     if (!mangledName.isEmpty()) {
-        if (!_getFileRecordQueryByMangledName.initOrReset(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE e2eMangledName=?1"), _db)) {
+        if (!_getFileRecordQueryByMangledName.initOrReset(getFileRecordByMangledNameStatement, _db)) {
             return false;
         }
 
-        _getFileRecordQueryByMangledName.bindValue(1, mangledName);
+        _getFileRecordQueryByMangledName.bindAll(getFileRecordByMangledNameStatement, mangledName);
 
         if (!_getFileRecordQueryByMangledName.exec()) {
-            close();
+            closeLocked();
             return false;
         }
 
@@ -1154,7 +1376,7 @@ bool SyncJournalDb::getFileRecordByE2eMangledName(const QString &mangledName, Sy
         if (!next.ok) {
             QString err = _getFileRecordQueryByMangledName.error();
             qCWarning(lcDb) << "No journal entry found for mangled name" << mangledName << "Error: " << err;
-            close();
+            closeLocked();
             return false;
         }
         if (next.hasData) {
@@ -1166,6 +1388,7 @@ bool SyncJournalDb::getFileRecordByE2eMangledName(const QString &mangledName, Sy
 
 bool SyncJournalDb::getFileRecordByInode(quint64 inode, SyncJournalFileRecord *rec)
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
 
     // Reset the output var in case the caller is reusing it.
@@ -1179,10 +1402,10 @@ bool SyncJournalDb::getFileRecordByInode(quint64 inode, SyncJournalFileRecord *r
     if (!checkConnect())
         return false;
 
-    if (!_getFileRecordQueryByInode.initOrReset(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE inode=?1"), _db))
+    if (!_getFileRecordQueryByInode.initOrReset(getFileRecordByInodeStatement, _db))
         return false;
 
-    _getFileRecordQueryByInode.bindValue(1, inode);
+    _getFileRecordQueryByInode.bindAll(getFileRecordByInodeStatement, inode);
 
     if (!_getFileRecordQueryByInode.exec())
         return false;
@@ -1198,6 +1421,7 @@ bool SyncJournalDb::getFileRecordByInode(quint64 inode, SyncJournalFileRecord *r
 
 bool SyncJournalDb::getFileRecordsByFileId(const QByteArray &fileId, const std::function<void(const SyncJournalFileRecord &)> &rowCallback)
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
 
     if (fileId.isEmpty() || _metadataTableIsEmpty)
@@ -1206,10 +1430,10 @@ bool SyncJournalDb::getFileRecordsByFileId(const QByteArray &fileId, const std::
     if (!checkConnect())
         return false;
 
-    if (!_getFileRecordQueryByFileId.initOrReset(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE fileid=?1"), _db))
+    if (!_getFileRecordQueryByFileId.initOrReset(getFileRecordsByFileIdStatement, _db))
         return false;
 
-    _getFileRecordQueryByFileId.bindValue(1, fileId);
+    _getFileRecordQueryByFileId.bindAll(getFileRecordsByFileIdStatement, fileId);
 
     if (!_getFileRecordQueryByFileId.exec())
         return false;
@@ -1231,6 +1455,7 @@ bool SyncJournalDb::getFileRecordsByFileId(const QByteArray &fileId, const std::
 
 bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord&)> &rowCallback)
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
 
     if (_metadataTableIsEmpty)
@@ -1242,31 +1467,22 @@ bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::functio
     SqlQuery *query = nullptr;
 
     if(path.isEmpty()) {
-        // Since the path column doesn't store the starting /, the getFilesBelowPathQuery
+        // Since the directory paths don't store the starting /, the getFilesBelowPathQuery
         // can't be used for the root path "". It would scan for (path > '/' and path < '0')
         // and find nothing. So, unfortunately, we have to use a different query for
         // retrieving the whole tree.
 
-        if (!_getAllFilesQuery.initOrReset(QByteArrayLiteral( GET_FILE_RECORD_QUERY " ORDER BY path||'/' ASC"), _db))
+        if (!_getAllFilesQuery.initOrReset(QByteArrayLiteral( GET_FILE_RECORD_QUERY " ORDER BY " METADATA_PATH "||'/' ASC"), _db))
             return false;
         query = &_getAllFilesQuery;
     } else {
         // This query is used to skip discovery and fill the tree from the
         // database instead
-        if (!_getFilesBelowPathQuery.initOrReset(QByteArrayLiteral(
-                GET_FILE_RECORD_QUERY
-                " WHERE " IS_PREFIX_PATH_OF("?1", "path")
-                " OR " IS_PREFIX_PATH_OF("?1", "e2eMangledName")
-                // We want to ensure that the contents of a directory are sorted
-                // directly behind the directory itself. Without this ORDER BY
-                // an ordering like foo, foo-2, foo/file would be returned.
-                // With the trailing /, we get foo-2, foo, foo/file. This property
-                // is used in fill_tree_from_db().
-                " ORDER BY path||'/' ASC"), _db)) {
+        if (!_getFilesBelowPathQuery.initOrReset(getFilesBelowPathStatement, _db)) {
             return false;
         }
         query = &_getFilesBelowPathQuery;
-        query->bindValue(1, path);
+        query->bindAll(getFilesBelowPathStatement, path);
     }
 
     if (!query->exec()) {
@@ -1291,6 +1507,7 @@ bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::functio
 bool SyncJournalDb::listFilesInPath(const QByteArray& path,
                                     const std::function<void (const SyncJournalFileRecord &)>& rowCallback)
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
 
     if (_metadataTableIsEmpty)
@@ -1299,11 +1516,10 @@ bool SyncJournalDb::listFilesInPath(const QByteArray& path,
     if (!checkConnect())
         return false;
 
-    if (!_listFilesInPathQuery.initOrReset(QByteArrayLiteral(
-            GET_FILE_RECORD_QUERY " WHERE parent_hash(path) = ?1 ORDER BY path||'/' ASC"), _db))
+    if (!_listFilesInPathQuery.initOrReset(listFilesInPathStatement, _db))
         return false;
 
-    _listFilesInPathQuery.bindValue(1, getPHash(path));
+    _listFilesInPathQuery.bindAll(listFilesInPathStatement, getPHash(path));
 
     if (!_listFilesInPathQuery.exec())
         return false;
@@ -1332,7 +1548,7 @@ int SyncJournalDb::getFileRecordCount()
     QMutexLocker locker(&_mutex);
 
     SqlQuery query(_db);
-    query.prepare("SELECT COUNT(*) FROM metadata");
+    query.prepare("SELECT COUNT(*) FROM files");
 
     if (!query.exec()) {
         return -1;
@@ -1350,6 +1566,7 @@ bool SyncJournalDb::updateFileRecordChecksum(const QString &filename,
     const QByteArray &contentChecksum,
     const QByteArray &contentChecksumType)
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
 
     qCInfo(lcDb) << "Updating file checksum" << filename << contentChecksum << contentChecksumType;
@@ -1362,15 +1579,10 @@ bool SyncJournalDb::updateFileRecordChecksum(const QString &filename,
 
     int checksumTypeId = mapChecksumType(contentChecksumType);
 
-    if (!_setFileRecordChecksumQuery.initOrReset(QByteArrayLiteral(
-            "UPDATE metadata"
-            " SET contentChecksum = ?2, contentChecksumTypeId = ?3"
-            " WHERE phash == ?1;"), _db)) {
+    if (!_setFileRecordChecksumQuery.initOrReset(setFileRecordChecksumStatement, _db)) {
         return false;
     }
-    _setFileRecordChecksumQuery.bindValue(1, phash);
-    _setFileRecordChecksumQuery.bindValue(2, contentChecksum);
-    _setFileRecordChecksumQuery.bindValue(3, checksumTypeId);
+    _setFileRecordChecksumQuery.bindAll(setFileRecordChecksumStatement, phash, contentChecksum, checksumTypeId);
     return _setFileRecordChecksumQuery.exec();
 }
 
@@ -1378,8 +1590,28 @@ bool SyncJournalDb::updateLocalMetadata(const QString &filename,
     qint64 modtime, qint64 size, quint64 inode)
 
 {
+    if (queueWrite([&](QueuedWrites &writes) {
+            const QByteArray path = filename.toUtf8();
+            auto record = writes.fileRecords.find(path);
+            if (record != writes.fileRecords.end()) {
+                record->_modtime = modtime;
+                record->_fileSize = size;
+                record->_inode = inode;
+            } else {
+                writes.localMetadata.insert(path, { modtime, size, inode });
+            }
+        })) {
+        return true;
+    }
+
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
+    return writeLocalMetadata(filename, modtime, size, inode);
+}
 
+bool SyncJournalDb::writeLocalMetadata(const QString &filename,
+    qint64 modtime, qint64 size, quint64 inode)
+{
     qCInfo(lcDb) << "Updating local metadata for:" << filename << modtime << size << inode;
 
     qlonglong phash = getPHash(filename.toUtf8());
@@ -1389,34 +1621,30 @@ bool SyncJournalDb::updateLocalMetadata(const QString &filename,
     }
 
 
-    if (!_setFileRecordLocalMetadataQuery.initOrReset(QByteArrayLiteral(
-            "UPDATE metadata"
-            " SET inode=?2, modtime=?3, filesize=?4"
-            " WHERE phash == ?1;"), _db)) {
+    if (!_setFileRecordLocalMetadataQuery.initOrReset(setFileRecordLocalMetadataStatement, _db)) {
         return false;
     }
 
-    _setFileRecordLocalMetadataQuery.bindValue(1, phash);
-    _setFileRecordLocalMetadataQuery.bindValue(2, inode);
-    _setFileRecordLocalMetadataQuery.bindValue(3, modtime);
-    _setFileRecordLocalMetadataQuery.bindValue(4, size);
+    _setFileRecordLocalMetadataQuery.bindAll(setFileRecordLocalMetadataStatement, phash, inode, modtime, size);
     return _setFileRecordLocalMetadataQuery.exec();
 }
 
 Optional<SyncJournalDb::HasHydratedDehydrated> SyncJournalDb::hasHydratedOrDehydratedFiles(const QByteArray &filename)
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
     if (!checkConnect())
         return {};
 
     auto &query = _countDehydratedFilesQuery;
     if (!query.initOrReset(QByteArrayLiteral(
-            "SELECT DISTINCT type FROM metadata"
-            " WHERE (" IS_PREFIX_PATH_OR_EQUAL("?1", "path") " OR ?1 == '');"), _db)) {
+            "SELECT DISTINCT type FROM files"
+            " WHERE (phash == ?2 OR " IS_METADATA_BELOW("?1") " OR ?1 == '');"), _db)) {
         return {};
     }
 
     query.bindValue(1, filename);
+    query.bindValue(2, getPHash(filename));
     if (!query.exec())
         return {};
 
@@ -1470,6 +1698,13 @@ SyncJournalDb::DownloadInfo SyncJournalDb::getDownloadInfo(const QString &file)
 
     DownloadInfo res;
 
+    {
+        QMutexLocker lock(&_writeQueueMutex);
+        const auto queued = _queuedWrites.downloadInfos.constFind(file);
+        if (queued != _queuedWrites.downloadInfos.cend())
+            return queued->_valid ? *queued : res;
+    }
+
     if (checkConnect()) {
 
         if (!_getDownloadInfoQuery.initOrReset(QByteArrayLiteral(
@@ -1492,8 +1727,16 @@ SyncJournalDb::DownloadInfo SyncJournalDb::getDownloadInfo(const QString &file)
 
 void SyncJournalDb::setDownloadInfo(const QString &file, const SyncJournalDb::DownloadInfo &i)
 {
+    if (queueWrite([&](QueuedWrites &writes) { writes.downloadInfos.insert(file, i); }))
+        return;
+
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
+    writeDownloadInfo(file, i);
+}
 
+void SyncJournalDb::writeDownloadInfo(const QString &file, const SyncJournalDb::DownloadInfo &i)
+{
     if (!checkConnect()) {
         return;
     }
@@ -1521,6 +1764,7 @@ void SyncJournalDb::setDownloadInfo(const QString &file, const SyncJournalDb::Do
 QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInfos(const QSet<QString> &keep)
 {
     QVector<SyncJournalDb::DownloadInfo> empty_result;
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
 
     if (!checkConnect()) {
@@ -1558,6 +1802,7 @@ int SyncJournalDb::downloadInfoCount()
 {
     int re = 0;
 
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
     if (checkConnect()) {
         SqlQuery query("SELECT count(*) FROM downloadinfo", _db);
@@ -1578,6 +1823,13 @@ SyncJournalDb::UploadInfo SyncJournalDb::getUploadInfo(const QString &file)
 
     UploadInfo res;
 
+    {
+        QMutexLocker lock(&_writeQueueMutex);
+        const auto queued = _queuedWrites.uploadInfos.constFind(file);
+        if (queued != _queuedWrites.uploadInfos.cend())
+            return queued->_valid ? *queued : res;
+    }
+
     if (checkConnect()) {
         if (!_getUploadInfoQuery.initOrReset(QByteArrayLiteral(
                 "SELECT chunk, transferid, errorcount, size, modtime, contentChecksum FROM "
@@ -1606,8 +1858,16 @@ SyncJournalDb::UploadInfo SyncJournalDb::getUploadInfo(const QString &file)
 
 void SyncJournalDb::setUploadInfo(const QString &file, const SyncJournalDb::UploadInfo &i)
 {
+    if (queueWrite([&](QueuedWrites &writes) { writes.uploadInfos.insert(file, i); }))
+        return;
+
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
+    writeUploadInfo(file, i);
+}
 
+void SyncJournalDb::writeUploadInfo(const QString &file, const SyncJournalDb::UploadInfo &i)
+{
     if (!checkConnect()) {
         return;
     }
@@ -1643,6 +1903,7 @@ void SyncJournalDb::setUploadInfo(const QString &file, const SyncJournalDb::Uplo
 
 QVector<uint> SyncJournalDb::deleteStaleUploadInfos(const QSet<QString> &keep)
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
     QVector<uint> ids;
 
@@ -1733,11 +1994,13 @@ bool SyncJournalDb::deleteStaleErrorBlacklistEntries(const QSet<QString> &keep)
 
 void SyncJournalDb::deleteStaleFlagsEntries()
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
     if (!checkConnect())
         return;
 
-    SqlQuery delQuery("DELETE FROM flags WHERE path != '' AND path NOT IN (SELECT path from metadata);", _db);
+    SqlQuery delQuery("DELETE FROM flags WHERE path != '' AND path NOT IN"
+                      " (SELECT " METADATA_PATH " FROM files JOIN directories ON files.parent == directories.id);", _db);
     delQuery.exec();
 }
 
@@ -1963,6 +2226,7 @@ void SyncJournalDb::setSelectiveSyncList(SyncJournalDb::SelectiveSyncListType ty
 
 void SyncJournalDb::avoidRenamesOnNextSync(const QByteArray &path)
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
 
     if (!checkConnect()) {
@@ -1970,19 +2234,25 @@ void SyncJournalDb::avoidRenamesOnNextSync(const QByteArray &path)
     }
 
     SqlQuery query(_db);
-    query.prepare("UPDATE metadata SET fileid = '', inode = '0' WHERE " IS_PREFIX_PATH_OR_EQUAL("?1", "path"));
+    query.prepare("UPDATE files SET fileid = '', inode = '0' WHERE phash == ?2 OR " IS_METADATA_BELOW("?1"));
     query.bindValue(1, path);
+    query.bindValue(2, getPHash(path));
     query.exec();
 
     // We also need to remove the ETags so the update phase refreshes the directory paths
     // on the next sync
-    schedulePathForRemoteDiscovery(path);
+    schedulePathForRemoteDiscoveryLocked(path);
 }
 
 void SyncJournalDb::schedulePathForRemoteDiscovery(const QByteArray &fileName)
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
+    schedulePathForRemoteDiscoveryLocked(fileName);
+}
 
+void SyncJournalDb::schedulePathForRemoteDiscoveryLocked(const QByteArray &fileName)
+{
     if (!checkConnect()) {
         return;
     }
@@ -1992,12 +2262,7 @@ void SyncJournalDb::schedulePathForRemoteDiscovery(const QByteArray &fileName)
     if (argument.endsWith('/'))
         argument.chop(1);
 
-    SqlQuery query(_db);
-    // This query will match entries for which the path is a prefix of fileName
-    // Note: CSYNC_FTW_TYPE_DIR == 2
-    query.prepare("UPDATE metadata SET md5='_invalid_' WHERE " IS_PREFIX_PATH_OR_EQUAL("path", "?1") " AND type == 2;");
-    query.bindValue(1, argument);
-    query.exec();
+    invalidateDirectoryEtagsUpTo(argument);
 
     // Prevent future overwrite of the etags of this folder and all
     // parent folders for this sync
@@ -2007,11 +2272,15 @@ void SyncJournalDb::schedulePathForRemoteDiscovery(const QByteArray &fileName)
 
 void SyncJournalDb::clearEtagStorageFilter()
 {
+    // Queued writes still see the filter that was set when they were queued
+    waitForQueuedWrites();
+    QMutexLocker locker(&_mutex);
     _etagStorageFilter.clear();
 }
 
 void SyncJournalDb::forceRemoteDiscoveryNextSync()
 {
+    waitForQueuedWrites();
     QMutexLocker locker(&_mutex);
 
     if (!checkConnect()) {
@@ -2025,7 +2294,7 @@ void SyncJournalDb::forceRemoteDiscoveryNextSyncLocked()
 {
     qCInfo(lcDb) << "Forcing remote re-discovery by deleting folder Etags";
     SqlQuery deleteRemoteFolderEtagsQuery(_db);
-    deleteRemoteFolderEtagsQuery.prepare("UPDATE metadata SET md5='_invalid_' WHERE type=2;");
+    deleteRemoteFolderEtagsQuery.prepare("UPDATE files SET md5='_invalid_' WHERE type=2;");
     deleteRemoteFolderEtagsQuery.exec();
 }
 
@@ -2215,21 +2484,25 @@ QByteArray SyncJournalDb::conflictFileBaseName(const QByteArray &conflictName)
 
 void SyncJournalDb::clearFileTable()
 {
+    waitForQueuedWrites();
     QMutexLocker lock(&_mutex);
     SqlQuery query(_db);
-    query.prepare("DELETE FROM metadata;");
+    query.prepare("DELETE FROM files;");
+    query.exec();
+    query.prepare("DELETE FROM directories;");
     query.exec();
 }
 
 void SyncJournalDb::markVirtualFileForDownloadRecursively(const QByteArray &path)
 {
+    waitForQueuedWrites();
     QMutexLocker lock(&_mutex);
     if (!checkConnect())
         return;
 
     static_assert(ItemTypeVirtualFile == 4 && ItemTypeVirtualFileDownload == 5, "");
-    SqlQuery query("UPDATE metadata SET type=5 WHERE "
-                   "(" IS_PREFIX_PATH_OF("?1", "path") " OR ?1 == '') "
+    SqlQuery query("UPDATE files SET type=5 WHERE "
+                   "(" IS_METADATA_BELOW("?1") " OR ?1 == '') "
                    "AND type=4;", _db);
     query.bindValue(1, path);
     query.exec();
@@ -2237,10 +2510,28 @@ void SyncJournalDb::markVirtualFileForDownloadRecursively(const QByteArray &path
     // We also must make sure we do not read the files from the database (same logic as in schedulePathForRemoteDiscovery)
     // This includes all the parents up to the root, but also all the directory within the selected dir.
     static_assert(ItemTypeDirectory == 2, "");
-    query.prepare("UPDATE metadata SET md5='_invalid_' WHERE "
-                  "(" IS_PREFIX_PATH_OF("?1", "path") " OR ?1 == '' OR " IS_PREFIX_PATH_OR_EQUAL("path", "?1") ") AND type == 2;");
+    query.prepare("UPDATE files SET md5='_invalid_' WHERE "
+                  "(" IS_METADATA_BELOW("?1") " OR ?1 == '') AND type == 2;");
     query.bindValue(1, path);
     query.exec();
+    invalidateDirectoryEtagsUpTo(path);
+}
+
+void SyncJournalDb::invalidateDirectoryEtagsUpTo(const QByteArray &path)
+{
+    // Updates the directory itself and each of its parents, looked up by phash
+    // Note: CSYNC_FTW_TYPE_DIR == 2
+    if (path.isEmpty())
+        return;
+    SqlQuery query(_db);
+    query.prepare("UPDATE files SET md5='_invalid_' WHERE phash == ?1 AND type == 2;");
+    for (int end = path.indexOf('/');; end = path.indexOf('/', end + 1)) {
+        query.reset_and_clear_bindings();
+        query.bindValue(1, getPHash(end == -1 ? path : path.left(end)));
+        query.exec();
+        if (end == -1)
+            break;
+    }
 }
 
 Optional<PinState> SyncJournalDb::PinStateInterface::rawForPath(const QByteArray &path)
@@ -2394,15 +2685,29 @@ SyncJournalDb::PinStateInterface SyncJournalDb::internalPinStates()
     return {this};
 }
 
-void SyncJournalDb::commit(const QString &context, bool startTrans)
+Result<void, QString> SyncJournalDb::commit(const QString &context, bool startTrans)
 {
+    waitForQueuedWrites();
     QMutexLocker lock(&_mutex);
     commitInternal(context, startTrans);
+    if (!_queuedWriteError.isEmpty())
+        return _queuedWriteError;
+    return {};
 }
 
 void SyncJournalDb::commitIfNeededAndStartNewTransaction(const QString &context)
 {
+    // Consecutive requests are coalesced into one commit after the writes queued before them
+    if (queueWrite([&context](QueuedWrites &writes) { writes.commitContext = context; }))
+        return;
+
+    waitForQueuedWrites();
     QMutexLocker lock(&_mutex);
+    commitOrStartTransaction(context);
+}
+
+void SyncJournalDb::commitOrStartTransaction(const QString &context)
+{
     if (_transaction == 1) {
         commitInternal(context, true);
     } else {
@@ -2410,6 +2715,110 @@ void SyncJournalDb::commitIfNeededAndStartNewTransaction(const QString &context)
     }
 }
 
+void SyncJournalDb::setAsyncWrites(bool enabled)
+{
+    {
+        QMutexLocker lock(&_writeQueueMutex);
+        if (_asyncWrites == enabled)
+            return;
+        _asyncWrites = enabled;
+    }
+
+    if (enabled) {
+        {
+            QMutexLocker lock(&_mutex);
+            _queuedWriteError.clear();
+        }
+        qCInfo(lcDb) << "Starting the journal writer thread for" << _dbFile;
+        _writerThread.reset(QThread::create([this] { writerLoop(); }));
+        _writerThread->setObjectName(QStringLiteral("SyncJournalDb writer"));
+        _writerThread->start();
+        return;
+    }
+
+    // The writer leaves once the queue is empty, no more writes are queued
+    _writeQueueChanged.wakeAll();
+    _writerThread->wait();
+    _writerThread.reset();
+    qCInfo(lcDb) << "Stopped the journal writer thread for" << _dbFile;
+}
+
+bool SyncJournalDb::queueWrite(const std::function<void(QueuedWrites &)> &write)
+{
+    QMutexLocker lock(&_writeQueueMutex);
+    if (!_asyncWrites)
+        return false;
+    write(_queuedWrites);
+    _writeQueueChanged.wakeAll();
+    return true;
+}
+
+void SyncJournalDb::waitForQueuedWrites()
+{
+    QMutexLocker lock(&_writeQueueMutex);
+    while (!_queuedWrites.isEmpty() || _writerBusy)
+        _queuedWritesDone.wait(&_writeQueueMutex);
+}
+
+void SyncJournalDb::reportQueuedWriteFailure(const QString &path, const QString &error)
+{
+    qCWarning(lcDb) << "Queued write for" << path << "failed:" << error;
+
+    // The first failure is the interesting one, the later ones likely follow from it
+    if (_queuedWriteError.isEmpty())
+        _queuedWriteError = QStringLiteral("%1: %2").arg(path, error);
+    emit queuedWriteFailed(path, error);
+}
+
+void SyncJournalDb::writerLoop()
+{
+    forever {
+        {
+            QMutexLocker lock(&_writeQueueMutex);
+            while (_queuedWrites.isEmpty() && _asyncWrites)
+                _writeQueueChanged.wait(&_writeQueueMutex);
+            if (_queuedWrites.isEmpty())
+                return;
+        }
+
+        // Whatever got queued until the lock is acquired is written in the same batch
+        QMutexLocker locker(&_mutex);
+        QueuedWrites writes;
+        {
+            QMutexLocker lock(&_writeQueueMutex);
+            std::swap(writes, _queuedWrites);
+            _writerBusy = true;
+        }
+        executeWrites(writes);
+        locker.unlock();
+
+        QMutexLocker lock(&_writeQueueMutex);
+        _writerBusy = false;
+        _queuedWritesDone.wakeAll();
+    }
+}
+
+void SyncJournalDb::executeWrites(const QueuedWrites &writes)
+{
+    for (const auto &record : writes.fileRecords) {
+        const auto result = writeFileRecord(record);
+        if (!result)
+            reportQueuedWriteFailure(record.path(), result.error());
+    }
+    for (auto it = writes.localMetadata.cbegin(); it != writes.localMetadata.cend(); ++it) {
+        const QString path = QString::fromUtf8(it.key());
+        if (!writeLocalMetadata(path, it->modtime, it->size, it->inode))
+            reportQueuedWriteFailure(path, tr("Could not update the local metadata"));
+    }
+    for (auto it = writes.downloadInfos.cbegin(); it != writes.downloadInfos.cend(); ++it)
+        writeDownloadInfo(it.key(), it.value());
+    for (auto it = writes.uploadInfos.cbegin(); it != writes.uploadInfos.cend(); ++it)
+        writeUploadInfo(it.key(), it.value());
+
+    if (!writes.commitContext.isNull())
+        commitOrStartTransaction(writes.commitContext);
+}
+
 bool SyncJournalDb::open()
 {
     QMutexLocker lock(&_mutex);
@@ -2434,6 +2843,7 @@ void SyncJournalDb::commitInternal(const QString &context, bool startTrans)
 
 SyncJournalDb::~SyncJournalDb()
 {
+    setAsyncWrites(false);
     close();
 }
 
@@ -24,7 +24,9 @@
 #include <QHash>
 #include <QMutex>
 #include <QVariant>
+#include <QWaitCondition>
 #include <functional>
+#include <memory>
 
 #include "common/utility.h"
 #include "common/ownsql.h"
@@ -32,6 +34,8 @@
 #include "common/result.h"
 #include "common/pinstate.h"
 
+class QThread;
+
 namespace OCC {
 class SyncJournalFileRecord;
 
@@ -207,10 +211,42 @@ public:
 
     /* Because sqlite transactions are really slow, we encapsulate everything in big transactions
      * Commit will actually commit the transaction and create a new one.
+     *
+     * Fails with the error of the first queued write that failed since async
+     * writes were enabled, see setAsyncWrites().
      */
-    void commit(const QString &context, bool startTrans = true);
+    Result<void, QString> commit(const QString &context, bool startTrans = true);
     void commitIfNeededAndStartNewTransaction(const QString &context);
 
+    /** Whether writes are executed by a writer thread instead of the calling thread.
+     *
+     * If enabled, setFileRecord(), updateLocalMetadata(), setDownloadInfo(),
+     * setUploadInfo() and commitIfNeededAndStartNewTransaction() only queue
+     * the operation and return right away, reporting success. A later call
+     * for the same path replaces the queued one. The writer executes
+     * everything that got queued in the meantime in one go, with a single
+     * commit at the end.
+     *
+     * getFileRecord(), getDownloadInfo() and getUploadInfo() answer from the
+     * queued writes, other functions that read or change the same tables wait
+     * for the writer first, see waitForQueuedWrites(). commit() is a
+     * durability barrier: when it returns, everything queued before it is
+     * committed.
+     *
+     * If a queued setFileRecord() or updateLocalMetadata() fails,
+     * queuedWriteFailed() is emitted and every later commit() reports the
+     * failure until async writes are enabled again.
+     *
+     * Disabling waits for the writer thread to finish the queued writes.
+     */
+    void setAsyncWrites(bool enabled);
+
+    /** Waits until the writer thread executed the writes queued so far.
+     *
+     * Must not be called with the mutex held.
+     */
+    void waitForQueuedWrites();
+
     /** Open the db if it isn't already.
      *
      * This usually creates some temporary files next to the db file, like
@@ -370,13 +406,22 @@ public:
      */
     int autotestFailCounter = -1;
 
+signals:
+    /** A queued write for \a path failed, see setAsyncWrites().
+     *
+     * Emitted from the writer thread.
+     */
+    void queuedWriteFailed(const QString &path, const QString &error);
+
 private:
     int getFileRecordCount();
     bool updateDatabaseStructure();
     bool updateMetadataTableStructure();
+    bool migrateMetadataTable();
     bool updateErrorBlacklistTableStructure();
     bool sqlFail(const QString &log, const SqlQuery &query);
     void commitInternal(const QString &context, bool startTrans = true);
+    void commitOrStartTransaction(const QString &context);
     void startTransaction();
     void commitTransaction();
     QVector<QByteArray> tableColumns(const QByteArray &table);
@@ -385,6 +430,57 @@ private:
     // Same as forceRemoteDiscoveryNextSync but without acquiring the lock
     void forceRemoteDiscoveryNextSyncLocked();
 
+    // Same as schedulePathForRemoteDiscovery but without acquiring the lock
+    void schedulePathForRemoteDiscoveryLocked(const QByteArray &fileName);
+
+    // Same as close but without acquiring the lock, used for errors of functions holding it
+    void closeLocked();
+
+    // Returns the record with the etag that setFileRecord() would store
+    SyncJournalFileRecord applyEtagStorageFilter(const SyncJournalFileRecord &record) const;
+
+    // Invalidates the etags of the directory \a path and of all its parents
+    void invalidateDirectoryEtagsUpTo(const QByteArray &path);
+
+    // The implementations of the functions whose calls may be queued, see setAsyncWrites()
+    Result<void, QString> writeFileRecord(const SyncJournalFileRecord &record);
+    bool writeLocalMetadata(const QString &filename, qint64 modtime, qint64 size, quint64 inode);
+    void writeDownloadInfo(const QString &file, const DownloadInfo &i);
+    void writeUploadInfo(const QString &file, const UploadInfo &i);
+
+    struct LocalMetadata
+    {
+        qint64 modtime;
+        qint64 size;
+        quint64 inode;
+    };
+
+    // The writes that wait for the writer thread, the latest one per path
+    struct QueuedWrites
+    {
+        QHash<QByteArray, SyncJournalFileRecord> fileRecords;
+        QHash<QByteArray, LocalMetadata> localMetadata; // for paths without a queued record
+        QHash<QString, DownloadInfo> downloadInfos; // invalid ones delete the entry
+        QHash<QString, UploadInfo> uploadInfos; // invalid ones delete the entry
+        QString commitContext; // set by a queued commitIfNeededAndStartNewTransaction()
+
+        bool isEmpty() const
+        {
+            return fileRecords.isEmpty() && localMetadata.isEmpty() && downloadInfos.isEmpty()
+                && uploadInfos.isEmpty() && commitContext.isNull();
+        }
+    };
+
+    // Returns false if writes are not queued, the caller has to execute it then
+    bool queueWrite(const std::function<void(QueuedWrites &)> &write);
+    void writerLoop();
+
+    // Executes the taken writes on the writer thread, with the mutex held
+    void executeWrites(const QueuedWrites &writes);
+
+    // Remembers the failure of a queued write for commit(), must be called with the mutex held
+    void reportQueuedWriteFailure(const QString &path, const QString &error);
+
     // Returns the integer id of the checksum type
     //
     // Returns 0 on failure and for empty checksum types.
@@ -397,6 +493,16 @@ private:
     int _transaction;
     bool _metadataTableIsEmpty;
 
+    // The queued writes are protected by _writeQueueMutex, they are only taken with _mutex held
+    QMutex _writeQueueMutex;
+    QWaitCondition _writeQueueChanged;
+    QWaitCondition _queuedWritesDone;
+    QueuedWrites _queuedWrites;
+    bool _writerBusy = false; // the writer executes writes it took from the queue
+    bool _asyncWrites = false;
+    std::unique_ptr<QThread> _writerThread;
+    QString _queuedWriteError; // the first failure of a queued write, protected by _mutex
+
     SqlQuery _getFileRecordQuery;
     SqlQuery _getFileRecordQueryByMangledName;
     SqlQuery _getFileRecordQueryByInode;
@@ -405,6 +511,7 @@ private:
     SqlQuery _getAllFilesQuery;
     SqlQuery _listFilesInPathQuery;
     SqlQuery _setFileRecordQuery;
+    SqlQuery _setDirectoryQuery;
     SqlQuery _setFileRecordChecksumQuery;
     SqlQuery _setFileRecordLocalMetadataQuery;
     SqlQuery _getDownloadInfoQuery;
@@ -415,6 +522,8 @@ private:
     SqlQuery _deleteUploadInfoQuery;
     SqlQuery _deleteFileRecordPhash;
     SqlQuery _deleteFileRecordRecursively;
+    SqlQuery _deleteDirectoriesRecursively;
+    SqlQuery _deleteUnusedDirectories;
     SqlQuery _getErrorBlacklistQuery;
     SqlQuery _setErrorBlacklistQuery;
     SqlQuery _getSelectiveSyncListQuery;
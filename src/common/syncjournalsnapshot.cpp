@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "common/syncjournalsnapshot.h"
+#include "common/syncjournaldb.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace OCC {
+
+namespace {
+    /// Orders byte strings like QByteArray's operator< without building QByteArrays
+    int compareBytes(const char *a, int aLength, const char *b, int bLength)
+    {
+        const int result = std::memcmp(a, b, size_t(qMin(aLength, bLength)));
+        if (result != 0)
+            return result;
+        return aLength - bLength;
+    }
+}
+
+int SyncJournalSnapshot::parentLength(const QByteArray &path)
+{
+    return qMax(path.lastIndexOf('/'), 0);
+}
+
+bool SyncJournalSnapshot::lessThan(const Entry &entry, const char *parent, int parentLength, const QByteArray &path)
+{
+    const auto &entryPath = entry.record._path;
+    const int result = compareBytes(entryPath.constData(), entry.parentLength, parent, parentLength);
+    if (result != 0)
+        return result < 0;
+    return entryPath < path;
+}
+
+bool SyncJournalSnapshot::load(SyncJournalDb *db)
+{
+    _entries.clear();
+    const bool ok = db->getFilesBelowPath(QByteArray(), [this](const SyncJournalFileRecord &record) {
+        _entries.append({ record, parentLength(record._path) });
+    });
+    if (!ok) {
+        _entries.clear();
+        return false;
+    }
+
+    std::sort(_entries.begin(), _entries.end(), [](const Entry &a, const Entry &b) {
+        return lessThan(a, b.record._path.constData(), b.parentLength, b.record._path);
+    });
+    _entries.squeeze();
+    return true;
+}
+
+QVector<SyncJournalSnapshot::Entry>::const_iterator SyncJournalSnapshot::lowerBound(const QByteArray &path) const
+{
+    const int length = parentLength(path);
+    return std::lower_bound(_entries.cbegin(), _entries.cend(), path, [length](const Entry &entry, const QByteArray &path) {
+        return lessThan(entry, path.constData(), length, path);
+    });
+}
+
+const SyncJournalFileRecord *SyncJournalSnapshot::findFileRecord(const QByteArray &path) const
+{
+    const auto it = lowerBound(path);
+    if (it == _entries.cend() || it->record._path != path)
+        return nullptr;
+    return &it->record;
+}
+
+void SyncJournalSnapshot::listFilesInPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord &)> &rowCallback) const
+{
+    // The children of path are the entries whose parent is path, they start
+    // where a child with an empty name would be.
+    const int length = path.size();
+    const auto isChild = [&](const Entry &entry) {
+        return entry.parentLength == length && entry.record._path.startsWith(path)
+            && (length == 0 || entry.record._path.at(length) == '/');
+    };
+    const QByteArray first = path.isEmpty() ? QByteArray() : path + '/';
+    auto it = std::lower_bound(_entries.cbegin(), _entries.cend(), first, [&path, length](const Entry &entry, const QByteArray &first) {
+        return lessThan(entry, path.constData(), length, first);
+    });
+    for (; it != _entries.cend() && isChild(*it); ++it)
+        rowCallback(it->record);
+}
+
+void SyncJournalSnapshot::setFileRecord(const SyncJournalFileRecord &record)
+{
+    const auto it = lowerBound(record._path);
+    const int index = int(it - _entries.cbegin());
+    if (it != _entries.cend() && it->record._path == record._path) {
+        _entries[index].record = record;
+    } else {
+        _entries.insert(index, { record, parentLength(record._path) });
+    }
+}
+
+void SyncJournalSnapshot::deleteFileRecord(const QByteArray &path, bool recursively)
+{
+    if (!recursively) {
+        const auto it = lowerBound(path);
+        if (it != _entries.cend() && it->record._path == path)
+            _entries.remove(int(it - _entries.cbegin()));
+        return;
+    }
+
+    // The descendants are spread over the array since it is sorted by parent
+    const QByteArray prefix = path + '/';
+    const auto end = std::remove_if(_entries.begin(), _entries.end(), [&](const Entry &entry) {
+        return entry.record._path == path || entry.record._path.startsWith(prefix);
+    });
+    _entries.erase(end, _entries.end());
+}
+
+} // namespace OCC
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef SYNCJOURNALSNAPSHOT_H
+#define SYNCJOURNALSNAPSHOT_H
+
+#include <QVector>
+#include <functional>
+
+#include "ocsynclib.h"
+#include "common/syncjournalfilerecord.h"
+
+namespace OCC {
+
+class SyncJournalDb;
+
+/**
+ * @brief The file records of a SyncJournalDb, read once into memory
+ *
+ * The records are kept in one array, sorted by their parent directory and
+ * then by path, so the entries of a directory are adjacent and any record
+ * is found with a binary search. Lookups take no locks and run no queries.
+ *
+ * The snapshot is not updated when the journal changes. Whoever writes to
+ * the journal while relying on the snapshot must apply the same change to
+ * it with setFileRecord() or deleteFileRecord().
+ *
+ * Not thread safe.
+ * @ingroup libsync
+ */
+class OCSYNC_EXPORT SyncJournalSnapshot
+{
+public:
+    /// Replaces the content with all file records of \a db, returns false on a database error
+    bool load(SyncJournalDb *db);
+
+    int size() const { return _entries.size(); }
+    bool isEmpty() const { return _entries.isEmpty(); }
+
+    /// Returns the record of \a path, or nullptr if there is none
+    const SyncJournalFileRecord *findFileRecord(const QByteArray &path) const;
+
+    /// Calls \a rowCallback for each record directly inside the directory \a path, "" is the root
+    void listFilesInPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord &)> &rowCallback) const;
+
+    /// Adds the record or replaces the one with the same path
+    void setFileRecord(const SyncJournalFileRecord &record);
+
+    /// Removes the record of \a path and, if \a recursively is set, all records below it
+    void deleteFileRecord(const QByteArray &path, bool recursively = false);
+
+private:
+    struct Entry
+    {
+        SyncJournalFileRecord record;
+        int parentLength; /// length of the parent directory's path at the start of record._path
+    };
+
+    static int parentLength(const QByteArray &path);
+    static bool lessThan(const Entry &entry, const char *parent, int parentLength, const QByteArray &path);
+
+    /// The first entry that does not sort before (\a parent, \a path)
+    QVector<Entry>::const_iterator lowerBound(const QByteArray &path) const;
+
+    QVector<Entry> _entries;
+};
+
+} // namespace OCC
+
+#endif // SYNCJOURNALSNAPSHOT_H
@@ -36,6 +36,9 @@
 #include <QFileInfo>
 #include <QFile>
 #include <QDir>
+#include <QVarLengthArray>
+
+#include <algorithm>
 
 
 /** Expands C-like escape sequences (in place)
@@ -218,6 +221,143 @@ static QString leftIncludeLast(const QString &arr, const QChar &c)
     return arr.left(arr.lastIndexOf(c, arr.size() - 2) + 1);
 }
 
+void ExcludeBnameMatcher::clear(bool caseInsensitive)
+{
+    _caseInsensitive = caseInsensitive;
+    _rules.clear();
+    _literals.clear();
+    _prefixes.clear();
+    _suffixes.clear();
+    _prefixLengths.clear();
+    _suffixLengths.clear();
+    _matchAll.clear();
+}
+
+bool ExcludeBnameMatcher::addPattern(const QString &pattern, int baseIndex, Match match, bool dirOnly)
+{
+    int wildcard = -1;
+    for (int i = 0; i < pattern.size(); ++i) {
+        const ushort c = pattern.at(i).unicode();
+        switch (c) {
+        case '*':
+            if (wildcard != -1)
+                return false;
+            wildcard = i;
+            break;
+        case '?':
+        case '[':
+        case '\\':
+            return false;
+        default:
+            // Leave the case folding of non-ASCII characters to the regex engine
+            if (_caseInsensitive && c > 127)
+                return false;
+            break;
+        }
+    }
+
+    Rule rule;
+    rule.hasWildcard = wildcard != -1;
+    rule.prefix = rule.hasWildcard ? pattern.left(wildcard) : pattern;
+    if (rule.hasWildcard)
+        rule.suffix = pattern.mid(wildcard + 1);
+    rule.dirOnly = dirOnly;
+    rule.match = match;
+    rule.baseIndex = baseIndex;
+    const int index = _rules.size();
+    _rules.append(rule);
+
+    auto addLength = [](QVector<int> &lengths, int length) {
+        auto it = std::lower_bound(lengths.begin(), lengths.end(), length);
+        if (it == lengths.end() || *it != length)
+            lengths.insert(it, length);
+    };
+    if (!rule.hasWildcard) {
+        _literals.insert(hash(rule.prefix.constData(), rule.prefix.size()), index);
+    } else if (!rule.prefix.isEmpty()) {
+        _prefixes.insert(hash(rule.prefix.constData(), rule.prefix.size()), index);
+        addLength(_prefixLengths, rule.prefix.size());
+    } else if (!rule.suffix.isEmpty()) {
+        _suffixes.insert(hash(rule.suffix.constData(), rule.suffix.size()), index);
+        addLength(_suffixLengths, rule.suffix.size());
+    } else {
+        _matchAll.append(index);
+    }
+    return true;
+}
+
+void ExcludeBnameMatcher::match(const QStringRef &bname, bool isDirectory, Match *matches) const
+{
+    const QChar *data = bname.constData();
+    const int size = bname.size();
+
+    probe(_literals, hash(data, size), bname, isDirectory, matches);
+    for (int length : _prefixLengths) {
+        if (length > size)
+            break;
+        probe(_prefixes, hash(data, length), bname, isDirectory, matches);
+    }
+    for (int length : _suffixLengths) {
+        if (length > size)
+            break;
+        probe(_suffixes, hash(data + size - length, length), bname, isDirectory, matches);
+    }
+    for (int index : _matchAll)
+        apply(_rules.at(index), bname, isDirectory, matches);
+}
+
+uint ExcludeBnameMatcher::hash(const QChar *data, int size) const
+{
+    uint h = 0;
+    for (int i = 0; i < size; ++i) {
+        uint c = data[i].unicode();
+        if (_caseInsensitive)
+            c = QChar::toCaseFolded(c);
+        h = 31 * h + c;
+    }
+    return h;
+}
+
+void ExcludeBnameMatcher::probe(const QMultiHash<uint, int> &table, uint key, const QStringRef &bname, bool isDirectory, Match *matches) const
+{
+    for (auto it = table.constFind(key); it != table.cend() && it.key() == key; ++it)
+        apply(_rules.at(it.value()), bname, isDirectory, matches);
+}
+
+void ExcludeBnameMatcher::apply(const Rule &rule, const QStringRef &bname, bool isDirectory, Match *matches) const
+{
+    if (rule.dirOnly && !isDirectory)
+        return;
+    if (matches[rule.baseIndex] >= rule.match)
+        return;
+
+    const auto cs = _caseInsensitive ? Qt::CaseInsensitive : Qt::CaseSensitive;
+    if (rule.hasWildcard) {
+        if (bname.size() < rule.prefix.size() + rule.suffix.size()
+            || !bname.startsWith(rule.prefix, cs)
+            || !bname.endsWith(rule.suffix, cs)) {
+            return;
+        }
+    } else if (bname.compare(rule.prefix, cs) != 0) {
+        return;
+    }
+    matches[rule.baseIndex] = rule.match;
+}
+
+static ExcludeBnameMatcher::Match bnameRegexMatch(const QRegularExpression &regex, const QStringRef &bname)
+{
+    if (regex.pattern().isEmpty())
+        return ExcludeBnameMatcher::NoMatch;
+    const auto m = regex.match(bname);
+    if (!m.hasMatch())
+        return ExcludeBnameMatcher::NoMatch;
+    if (m.capturedStart(QStringLiteral("exclude")) != -1)
+        return ExcludeBnameMatcher::Exclude;
+    if (m.capturedStart(QStringLiteral("excluderemove")) != -1)
+        return ExcludeBnameMatcher::ExcludeAndRemove;
+    return ExcludeBnameMatcher::Trigger;
+}
+
 using namespace OCC;
 
 ExcludedFiles::ExcludedFiles(const QString &localPath)
@@ -320,6 +460,8 @@ bool ExcludedFiles::reloadExcludeFiles()
 {
     _allExcludes.clear();
     // clear all regex
+    _bnamePatterns.clear();
+    _traversalMatcherDirty = true;
     _bnameTraversalRegexFile.clear();
     _bnameTraversalRegexDir.clear();
     _fullTraversalRegexFile.clear();
@@ -430,6 +572,13 @@ CSYNC_EXCLUDE_TYPE ExcludedFiles::traversalPatternMatch(const QString &path, Ite
         }
     }
 
+    if (filetype != ItemTypeDirectory && filetype != ItemTypeFile)
+        return CSYNC_NOT_EXCLUDED;
+    const bool isDirectory = filetype == ItemTypeDirectory;
+
+    if (_traversalMatcherDirty)
+        compileTraversalMatcher();
+
     // Check the bname part of the path to see whether the full
     // regex should be run.
     QStringRef bnameStr(&path);
@@ -438,44 +587,40 @@ CSYNC_EXCLUDE_TYPE ExcludedFiles::traversalPatternMatch(const QString &path, Ite
         bnameStr = path.midRef(lastSlash + 1);
     }
 
-    QString basePath(_localPath + path);
-    while (basePath.size() > _localPath.size()) {
-        basePath = leftIncludeLast(basePath, QLatin1Char('/'));
-        QRegularExpressionMatch m;
-        if (filetype == ItemTypeDirectory
-            && _bnameTraversalRegexDir.contains(basePath)) {
-            m = _bnameTraversalRegexDir[basePath].match(bnameStr);
-        } else if (filetype == ItemTypeFile
-            && _bnameTraversalRegexFile.contains(basePath)) {
-            m = _bnameTraversalRegexFile[basePath].match(bnameStr);
-        } else {
+    // The bname patterns of all base paths are matched in one go
+    QVarLengthArray<ExcludeBnameMatcher::Match, 16> bnameMatches(_compiledBasePaths.size());
+    std::fill(bnameMatches.begin(), bnameMatches.end(), ExcludeBnameMatcher::NoMatch);
+    _bnameMatcher.match(bnameStr, isDirectory, bnameMatches.data());
+
+    // Only the base paths that are parents of path apply, the deepest first
+    auto isParentBasePath = [&path](const CompiledBasePath &base) {
+        return path.size() > base.relativePath.size() && path.startsWith(base.relativePath);
+    };
+
+    for (int i = 0; i < _compiledBasePaths.size(); ++i) {
+        const auto &base = _compiledBasePaths.at(i);
+        if (!isParentBasePath(base))
             continue;
-        }
 
-        if (!m.hasMatch())
+        auto bnameMatch = bnameMatches[i];
+        if (bnameMatch != ExcludeBnameMatcher::Exclude)
+            bnameMatch = qMax(bnameMatch, bnameRegexMatch(isDirectory ? base.bnameRegexDir : base.bnameRegexFile, bnameStr));
+
+        if (bnameMatch == ExcludeBnameMatcher::NoMatch)
             return CSYNC_NOT_EXCLUDED;
-        if (m.capturedStart(QStringLiteral("exclude")) != -1) {
+        if (bnameMatch == ExcludeBnameMatcher::Exclude) {
             return CSYNC_FILE_EXCLUDE_LIST;
-        } else if (m.capturedStart(QStringLiteral("excluderemove")) != -1) {
+        } else if (bnameMatch == ExcludeBnameMatcher::ExcludeAndRemove) {
             return CSYNC_FILE_EXCLUDE_AND_REMOVE;
         }
     }
 
     // third capture: full path matching is triggered
-    basePath = _localPath + path;
-    while (basePath.size() > _localPath.size()) {
-        basePath = leftIncludeLast(basePath, QLatin1Char('/'));
-        QRegularExpressionMatch m;
-        if (filetype == ItemTypeDirectory
-            && _fullTraversalRegexDir.contains(basePath)) {
-            m = _fullTraversalRegexDir[basePath].match(path);
-        } else if (filetype == ItemTypeFile
-            && _fullTraversalRegexFile.contains(basePath)) {
-            m = _fullTraversalRegexFile[basePath].match(path);
-        } else {
+    for (const auto &base : qAsConst(_compiledBasePaths)) {
+        if (!isParentBasePath(base))
             continue;
-        }
 
+        const auto m = (isDirectory ? base.fullTraversalRegexDir : base.fullTraversalRegexFile).match(path);
         if (m.hasMatch()) {
             if (m.capturedStart(QStringLiteral("exclude")) != -1) {
                 return CSYNC_FILE_EXCLUDE_LIST;
@@ -661,6 +806,8 @@ QString ExcludedFiles::extractBnameTrigger(const QString &exclude, bool wildcard
 void ExcludedFiles::prepare()
 {
     // clear all regex
+    _bnamePatterns.clear();
+    _traversalMatcherDirty = true;
     _bnameTraversalRegexFile.clear();
     _bnameTraversalRegexDir.clear();
     _fullTraversalRegexFile.clear();
@@ -711,6 +858,9 @@ void ExcludedFiles::prepare(const BasePathString & basePath)
     QString bnameTriggerFileDir;
     QString bnameTriggerDir;
 
+    // The patterns of the bname regexes, for compileTraversalMatcher()
+    QVector<BnamePattern> bnamePatterns;
+
     auto regexAppend = [](QString &fileDirPattern, QString &dirPattern, const QString &appendMe, bool dirOnly) {
         QString &pattern = dirOnly ? dirPattern : fileDirPattern;
         if (!pattern.isEmpty())
@@ -752,6 +902,8 @@ void ExcludedFiles::prepare(const BasePathString & basePath)
         auto regexExclude = convertToRegexpSyntax(exclude, _wildcardsMatchSlash);
         if (!fullPath) {
             regexAppend(bnameFileDir, bnameDir, regexExclude, matchDirOnly);
+            bnamePatterns.append({ exclude, regexExclude,
+                removeExcluded ? ExcludeBnameMatcher::ExcludeAndRemove : ExcludeBnameMatcher::Exclude, matchDirOnly });
         } else {
             regexAppend(fullFileDir, fullDir, regexExclude, matchDirOnly);
 
@@ -759,8 +911,11 @@ void ExcludedFiles::prepare(const BasePathString & basePath)
             QString bnameExclude = extractBnameTrigger(exclude, _wildcardsMatchSlash);
             auto regexBname = convertToRegexpSyntax(bnameExclude, true);
             regexAppend(bnameTriggerFileDir, bnameTriggerDir, regexBname, matchDirOnly);
+            bnamePatterns.append({ bnameExclude, regexBname, ExcludeBnameMatcher::Trigger, matchDirOnly });
         }
     }
+    _bnamePatterns[basePath] = bnamePatterns;
+    _traversalMatcherDirty = true;
 
     // The empty pattern would match everything - change it to match-nothing
     auto emptyMatchNothing = [](QString &pattern) {
@@ -855,3 +1010,73 @@ void ExcludedFiles::prepare(const BasePathString & basePath)
     _fullRegexDir[basePath].setPatternOptions(patternOptions);
     _fullRegexDir[basePath].optimize();
 }
+
+void ExcludedFiles::compileTraversalMatcher()
+{
+    _compiledBasePaths.clear();
+    _bnameMatcher.clear(OCC::Utility::fsCasePreserving());
+    _traversalMatcherDirty = false;
+
+    QRegularExpression::PatternOptions patternOptions = QRegularExpression::NoPatternOption;
+    if (OCC::Utility::fsCasePreserving())
+        patternOptions |= QRegularExpression::CaseInsensitiveOption;
+
+    // The patterns the matcher can't handle get a bname regex shaped like _bnameTraversalRegexFile/Dir
+    auto residualRegex = [&](QString groups[3]) {
+        if (groups[0].isEmpty() && groups[1].isEmpty() && groups[2].isEmpty())
+            return QRegularExpression();
+        for (int i = 0; i < 3; ++i) {
+            if (groups[i].isEmpty())
+                groups[i] = QStringLiteral("a^");
+        }
+        QRegularExpression regex(
+            QStringLiteral("^(?P<exclude>%1)$|"
+                           "^(?P<excluderemove>%2)$|"
+                           "^(?P<trigger>%3)$")
+                .arg(groups[0], groups[1], groups[2]),
+            patternOptions);
+        regex.optimize();
+        return regex;
+    };
+
+    // Deepest first, in the order traversalPatternMatch() walks the parent paths
+    auto basePaths = _bnamePatterns.keys();
+    std::sort(basePaths.begin(), basePaths.end(), [](const QString &a, const QString &b) {
+        return a.size() > b.size();
+    });
+    for (const auto &basePath : qAsConst(basePaths)) {
+        // Only base paths inside _localPath can ever be a parent path
+        if (!basePath.startsWith(_localPath))
+            continue;
+
+        const int baseIndex = _compiledBasePaths.size();
+        CompiledBasePath compiled;
+        compiled.relativePath = basePath.mid(_localPath.size());
+        compiled.fullTraversalRegexFile = _fullTraversalRegexFile.value(basePath);
+        compiled.fullTraversalRegexDir = _fullTraversalRegexDir.value(basePath);
+
+        // exclude, excluderemove and trigger groups
+        QString fileGroups[3];
+        QString dirGroups[3];
+        for (const auto &bnamePattern : _bnamePatterns.value(basePath)) {
+            if (_bnameMatcher.addPattern(bnamePattern.pattern, baseIndex, bnamePattern.match, bnamePattern.dirOnly))
+                continue;
+
+            const int group = bnamePattern.match == ExcludeBnameMatcher::Exclude ? 0
+                : bnamePattern.match == ExcludeBnameMatcher::ExcludeAndRemove    ? 1
+                                                                                 : 2;
+            auto append = [&](QString &pattern) {
+                if (!pattern.isEmpty())
+                    pattern.append(QLatin1Char('|'));
+                pattern.append(bnamePattern.regex);
+            };
+            append(dirGroups[group]);
+            if (!bnamePattern.dirOnly)
+                append(fileGroups[group]);
+        }
+        compiled.bnameRegexFile = residualRegex(fileGroups);
+        compiled.bnameRegexDir = residualRegex(dirGroups);
+
+        _compiledBasePaths.append(compiled);
+    }
+}
@@ -26,9 +26,11 @@
 #include "csync.h"
 
 #include <QObject>
+#include <QMultiHash>
 #include <QSet>
 #include <QString>
 #include <QRegularExpression>
+#include <QVector>
 
 #include <functional>
 
@@ -49,6 +51,66 @@ enum CSYNC_EXCLUDE_TYPE {
 
 class ExcludedFilesTest;
 
+/**
+ * Matches a basename against the bname patterns of all base paths at once.
+ *
+ * Literal patterns and patterns with a single '*' are stored in hash tables
+ * shared by all base paths, keyed by their literal text, prefix or suffix.
+ * Matching takes one probe per distinct prefix and suffix length and doesn't
+ * allocate. Patterns that addPattern() refuses need a regex.
+ */
+class ExcludeBnameMatcher
+{
+public:
+    // Ordered by priority, like the groups of the bname traversal regex
+    enum Match : quint8 {
+        NoMatch = 0,
+        Trigger,
+        ExcludeAndRemove,
+        Exclude
+    };
+
+    void clear(bool caseInsensitive);
+
+    /**
+     * Adds a glob pattern for the base path with the index \a baseIndex.
+     *
+     * Returns false if the pattern isn't simple enough for the tables.
+     */
+    bool addPattern(const QString &pattern, int baseIndex, Match match, bool dirOnly);
+
+    /**
+     * Raises matches[baseIndex] to the best match of each base path.
+     */
+    void match(const QStringRef &bname, bool isDirectory, Match *matches) const;
+
+private:
+    struct Rule
+    {
+        QString prefix;
+        QString suffix; // only used if hasWildcard
+        bool hasWildcard;
+        bool dirOnly;
+        Match match;
+        int baseIndex;
+    };
+
+    uint hash(const QChar *data, int size) const;
+    void probe(const QMultiHash<uint, int> &table, uint key, const QStringRef &bname, bool isDirectory, Match *matches) const;
+    void apply(const Rule &rule, const QStringRef &bname, bool isDirectory, Match *matches) const;
+
+    bool _caseInsensitive = false;
+    QVector<Rule> _rules;
+    // Hash of the literal, prefix or suffix to the index in _rules
+    QMultiHash<uint, int> _literals;
+    QMultiHash<uint, int> _prefixes;
+    QMultiHash<uint, int> _suffixes;
+    QVector<int> _prefixLengths;
+    QVector<int> _suffixLengths;
+    // Rules for "*"
+    QVector<int> _matchAll;
+};
+
 /**
  * Manages file/directory exclusion.
  *
@@ -228,6 +290,13 @@ private:
 
     void prepare();
 
+    /**
+     * Builds _bnameMatcher and _compiledBasePaths from _bnamePatterns.
+     *
+     * Called lazily by traversalPatternMatch() after prepare() changed anything.
+     */
+    void compileTraversalMatcher();
+
     static QString extractBnameTrigger(const QString &exclude, bool wildcardsMatchSlash);
     static QString convertToRegexpSyntax(QString exclude, bool wildcardsMatchSlash);
 
@@ -250,6 +319,31 @@ private:
     QMap<BasePathString, QRegularExpression> _fullRegexFile;
     QMap<BasePathString, QRegularExpression> _fullRegexDir;
 
+    struct BnamePattern
+    {
+        QString pattern;
+        QString regex;
+        ExcludeBnameMatcher::Match match;
+        bool dirOnly;
+    };
+    /// The patterns of _bnameTraversalRegexFile/Dir, see prepare()
+    QMap<BasePathString, QVector<BnamePattern>> _bnamePatterns;
+
+    struct CompiledBasePath
+    {
+        // Relative to _localPath, empty or ending with a /
+        QString relativePath;
+        // The patterns _bnameMatcher can't handle, empty if there are none
+        QRegularExpression bnameRegexFile;
+        QRegularExpression bnameRegexDir;
+        QRegularExpression fullTraversalRegexFile;
+        QRegularExpression fullTraversalRegexDir;
+    };
+    /// Deepest base path first, see compileTraversalMatcher()
+    QVector<CompiledBasePath> _compiledBasePaths;
+    ExcludeBnameMatcher _bnameMatcher;
+    bool _traversalMatcherDirty = true;
+
     bool _excludeConflictFiles = true;
 
     /**
@@ -21,6 +21,7 @@
 #include "logger.h"
 #include "configfile.h"
 #include "ocsnavigationappsjob.h"
+#include "bandwidthmanager.h"
 
 #include <QSettings>
 #include <QTimer>
@@ -36,6 +37,8 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcAccountState, "nextcloud.gui.account.state", QtInfoMsg)
 
+static const char bandwidthWeightC[] = "bandwidthWeight";
+
 AccountState::AccountState(AccountPtr account)
     : QObject()
     , _account(account)
@@ -66,14 +69,25 @@ AccountState::AccountState(AccountPtr account)
 
 AccountState::~AccountState() = default;
 
-AccountState *AccountState::loadFromSettings(AccountPtr account, QSettings & /*settings*/)
+AccountState *AccountState::loadFromSettings(AccountPtr account, QSettings &settings)
 {
     auto accountState = new AccountState(account);
+
+    // The share of the bandwidth limits compared to the other accounts
+    const int bandwidthWeight = settings.value(QLatin1String(bandwidthWeightC), 1).toInt();
+    BandwidthManager::instance()->setAccountWeight(account->id(), bandwidthWeight);
+
     return accountState;
 }
 
-void AccountState::writeToSettings(QSettings & /*settings*/)
+void AccountState::writeToSettings(QSettings &settings)
 {
+    const int bandwidthWeight = BandwidthManager::instance()->accountWeight(_account->id());
+    if (bandwidthWeight != 1) {
+        settings.setValue(QLatin1String(bandwidthWeightC), bandwidthWeight);
+    } else {
+        settings.remove(QLatin1String(bandwidthWeightC));
+    }
 }
 
 AccountPtr AccountState::account() const
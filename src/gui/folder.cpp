@@ -48,6 +48,10 @@
 
 static const char versionC[] = "version";
 
+// Above this many changes in one batch, they are not checked one by one for
+// spurious notifications: stat()ing each of them costs more than the sync
+static const int maxCheckedChangesPerBatch = 1000;
+
 namespace OCC {
 
 Q_LOGGING_CATEGORY(lcFolder, "nextcloud.gui.folder", QtInfoMsg)
@@ -558,14 +562,66 @@ void Folder::slotWatchedPathChanged(const QString &path, ChangeReason reason)
         return;
     }
 
-    auto relativePath = path.midRef(this->path().size());
-
     // Add to list of locally modified paths
     //
     // We do this before checking for our own sync-related changes to make
     // extra sure to not miss relevant changes.
-    auto relativePathBytes = relativePath.toUtf8();
-    _localDiscoveryTracker->addTouchedPath(relativePathBytes);
+    _localDiscoveryTracker->addTouchedPath(path.mid(this->path().size()));
+
+    if (checkWatchedPathChange(path, reason, false)) {
+        // Also schedule this folder for a sync, but only after some delay:
+        // The sync will not upload files that were changed too recently.
+        scheduleThisFolderSoon();
+    }
+}
+
+void Folder::slotWatchedPathsChanged(const QStringList &paths, const QStringList &trees)
+{
+    const auto rootPath = path();
+    bool needsSync = false;
+    QStringList relativePaths;
+    relativePaths.reserve(paths.size() + trees.size());
+
+    // Like slotWatchedPathChanged(), but the paths are added to the
+    // list of locally modified paths in one go before the filtering
+    QVector<QPair<QString, bool>> changes;
+    changes.reserve(paths.size() + trees.size());
+    for (const auto list : { &paths, &trees }) {
+        const bool tree = list == &trees;
+        for (const auto &path : *list) {
+            if (path.size() + 1 == rootPath.size() && rootPath.startsWith(path)) {
+                // The discovery of the root path doesn't cover everything below it
+                slotNextSyncFullLocalDiscovery();
+                needsSync = true;
+                continue;
+            }
+            if (!path.startsWith(rootPath)) {
+                qCDebug(lcFolder) << "Changed path is not contained in folder, ignoring:" << path;
+                continue;
+            }
+            relativePaths.append(path.mid(rootPath.size()));
+            changes.append({ path, tree });
+        }
+    }
+    _localDiscoveryTracker->addTouchedPaths(relativePaths);
+
+    // Large batches, like a checkout spread over many small directories,
+    // are treated like changed trees
+    const bool treatAsTrees = changes.size() > maxCheckedChangesPerBatch;
+    if (treatAsTrees)
+        qCInfo(lcFolder) << "Not checking" << changes.size() << "changes for spurious notifications";
+    for (const auto &change : qAsConst(changes)) {
+        if (checkWatchedPathChange(change.first, ChangeReason::Other, change.second || treatAsTrees))
+            needsSync = true;
+    }
+
+    if (needsSync)
+        scheduleThisFolderSoon();
+}
+
+bool Folder::checkWatchedPathChange(const QString &path, ChangeReason reason, bool tree)
+{
+    auto relativePath = path.midRef(this->path().size());
 
 // The folder watcher fires a lot of bogus notifications during
 // a sync operation, both for actual user files and the database
@@ -578,14 +634,14 @@ void Folder::slotWatchedPathChanged(const QString &path, ChangeReason reason)
     // Use the path to figure out whether it was our own change
     if (_engine->wasFileTouched(path)) {
         qCDebug(lcFolder) << "Changed path was touched by SyncEngine, ignoring:" << path;
-        return;
+        return false;
     }
 #endif
 
 
     SyncJournalFileRecord record;
-    _journal.getFileRecord(relativePathBytes, &record);
-    if (reason != ChangeReason::UnLock) {
+    _journal.getFileRecord(relativePath.toUtf8(), &record);
+    if (reason != ChangeReason::UnLock && !tree) {
         // Check that the mtime/size actually changed or there was
         // an attribute change (pin state) that caused the notification
         bool spurious = false;
@@ -602,16 +658,13 @@ void Folder::slotWatchedPathChanged(const QString &path, ChangeReason reason)
         }
         if (spurious) {
             qCInfo(lcFolder) << "Ignoring spurious notification for file" << relativePath;
-            return; // probably a spurious notification
+            return false; // probably a spurious notification
         }
     }
     warnOnNewExcludedItem(record, relativePath);
 
     emit watchedFileChangedExternally(path);
-
-    // Also schedule this folder for a sync, but only after some delay:
-    // The sync will not upload files that were changed too recently.
-    scheduleThisFolderSoon();
+    return true;
 }
 
 void Folder::implicitlyHydrateFile(const QString &relativepath)
@@ -907,6 +960,26 @@ void Folder::setSyncOptions()
         opt._targetChunkUploadDuration = cfgFile.targetChunkUploadDuration();
     }
 
+    int parallelChunkUploads = qgetenv("OWNCLOUD_PARALLEL_CHUNK_UPLOADS").toUInt();
+    opt._parallelChunkUploads = qMax(1, parallelChunkUploads ? parallelChunkUploads : cfgFile.parallelChunkUploads());
+
+    qint64 deltaSyncMinFileSize = qgetenv("OWNCLOUD_DELTA_SYNC_MIN_FILE_SIZE").toLongLong();
+    opt._deltaSyncMinFileSize = deltaSyncMinFileSize ? deltaSyncMinFileSize : cfgFile.deltaSyncMinFileSize();
+
+    int minParallelTransfers = qgetenv("OWNCLOUD_MIN_PARALLEL_TRANSFERS").toUInt();
+    opt._minParallelTransfers = qMax(1, minParallelTransfers ? minParallelTransfers : cfgFile.minParallelTransfers());
+    int maxParallelTransfers = qgetenv("OWNCLOUD_MAX_PARALLEL_TRANSFERS").toUInt();
+    opt._maxParallelTransfers = maxParallelTransfers ? maxParallelTransfers : cfgFile.maxParallelTransfers();
+    int parallelLocalScans = qgetenv("OWNCLOUD_MAX_PARALLEL_LOCAL_SCANS").toUInt();
+    opt._parallelLocalScans = parallelLocalScans ? parallelLocalScans : cfgFile.maxParallelLocalScans();
+    QByteArray journalSnapshotEnv = qgetenv("OWNCLOUD_JOURNAL_SNAPSHOT");
+    opt._useJournalSnapshot = journalSnapshotEnv.isEmpty() ? cfgFile.useJournalSnapshot() : journalSnapshotEnv != "0";
+    QByteArray asyncJournalWritesEnv = qgetenv("OWNCLOUD_ASYNC_JOURNAL_WRITES");
+    opt._asyncJournalWrites = asyncJournalWritesEnv.isEmpty() ? cfgFile.asyncJournalWrites() : asyncJournalWritesEnv != "0";
+
+    // Keep adapting the previous window instead of starting over with each sync
+    opt._transferConcurrency = _engine->syncOptions()._transferConcurrency;
+
     _engine->setSyncOptions(opt);
 }
 
@@ -1229,8 +1302,8 @@ void Folder::registerFolderWatcher()
         return;
 
     _folderWatcher.reset(new FolderWatcher(this));
-    connect(_folderWatcher.data(), &FolderWatcher::pathChanged,
-        this, [this](const QString &path) { slotWatchedPathChanged(path, Folder::ChangeReason::Other); });
+    connect(_folderWatcher.data(), &FolderWatcher::pathsChanged,
+        this, &Folder::slotWatchedPathsChanged);
     connect(_folderWatcher.data(), &FolderWatcher::lostChanges,
         this, &Folder::slotNextSyncFullLocalDiscovery);
     connect(_folderWatcher.data(), &FolderWatcher::becameUnreliable,
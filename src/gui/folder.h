@@ -334,6 +334,12 @@ public slots:
        */
     void slotWatchedPathChanged(const QString &path, ChangeReason reason);
 
+    /**
+     * Triggered by the folder watcher with a batch of changes, see
+     * FolderWatcher::pathsChanged(). Schedules at most one sync run.
+     */
+    void slotWatchedPathsChanged(const QStringList &paths, const QStringList &trees);
+
     /**
      * Mark a virtual file as being requested for download, and start a sync.
      *
@@ -416,6 +422,14 @@ private slots:
 private:
     void connectSyncRoot();
 
+    /**
+     * Filters out our own and spurious changes of an absolute \a path in this folder.
+     *
+     * Returns whether the change needs a sync run. A \a tree changed together
+     * with everything below it and is never considered spurious.
+     */
+    bool checkWatchedPathChange(const QString &path, ChangeReason reason, bool tree);
+
     bool reloadExcludes();
 
     void showSyncResultPopup();
@@ -497,7 +511,7 @@ private:
     /**
      * Watches this folder's local directory for changes.
      *
-     * Created by registerFolderWatcher(), triggers slotWatchedPathChanged()
+     * Created by registerFolderWatcher(), triggers slotWatchedPathsChanged()
      */
     QScopedPointer<FolderWatcher> _folderWatcher;
 
@@ -63,6 +63,9 @@ FolderMan::FolderMan(QObject *parent)
     QObject::connect(&_etagPollTimer, &QTimer::timeout, this, &FolderMan::slotEtagPollTimerTimeout);
     _etagPollTimer.start();
 
+    const int syncWorkerBudget = qEnvironmentVariableIntValue("OWNCLOUD_MAX_CONCURRENT_SYNCS");
+    _syncWorkerBudget = qMax(1, syncWorkerBudget > 0 ? syncWorkerBudget : cfg.maxConcurrentSyncs());
+
     _startScheduledSyncTimer.setSingleShot(true);
     connect(&_startScheduledSyncTimer, &QTimer::timeout,
         this, &FolderMan::slotStartScheduledFolderSync);
@@ -141,7 +144,7 @@ int FolderMan::unloadAndDeleteAllFolders()
     ASSERT(_folderMap.isEmpty());
 
     _lastSyncFolder = nullptr;
-    _currentSyncFolder = nullptr;
+    _currentSyncFolders.clear();
     _scheduledFolders.clear();
     emit folderListChanged(_folderMap);
     emit scheduleQueueChanged();
@@ -749,7 +752,7 @@ void FolderMan::startScheduledSyncSoon()
     if (_scheduledFolders.empty()) {
         return;
     }
-    if (isAnySyncRunning()) {
+    if (runningSyncFolders().size() >= syncWorkerBudget()) {
         return;
     }
 
@@ -787,10 +790,11 @@ void FolderMan::startScheduledSyncSoon()
   */
 void FolderMan::slotStartScheduledFolderSync()
 {
-    if (isAnySyncRunning()) {
-        for (auto f : _folderMap) {
-            if (f->isSyncRunning())
-                qCInfo(lcFolderMan) << "Currently folder " << f->remoteUrl().toString() << " is running, wait for finish!";
+    const int budget = syncWorkerBudget();
+    const auto running = runningSyncFolders();
+    if (running.size() >= budget) {
+        for (auto f : running) {
+            qCInfo(lcFolderMan) << "Currently folder " << f->remoteUrl().toString() << " is running, wait for finish!";
         }
         return;
     }
@@ -805,28 +809,62 @@ void FolderMan::slotStartScheduledFolderSync()
         return;
     }
 
-    // Find the first folder in the queue that can be synced.
-    Folder *folder = nullptr;
-    while (!_scheduledFolders.isEmpty()) {
-        Folder *g = _scheduledFolders.dequeue();
-        if (g->canSync()) {
-            folder = g;
-            break;
-        }
-    }
-
-    emit scheduleQueueChanged();
-
-    // Start syncing this folder!
-    if (folder) {
+    // Start syncing as many folders as the budget allows
+    for (auto folder : takeSchedulableFolders()) {
         // Safe to call several times, and necessary to try again if
         // the folder path didn't exist previously.
         folder->registerFolderWatcher();
         registerFolderWithSocketApi(folder);
 
-        _currentSyncFolder = folder;
+        _currentSyncFolders.append(folder);
         folder->startSync(QStringList());
     }
+
+    emit scheduleQueueChanged();
+}
+
+QList<Folder *> FolderMan::takeSchedulableFolders()
+{
+    QVector<AccountState *> scheduledAccounts;
+    QMutableListIterator<Folder *> it(_scheduledFolders);
+    while (it.hasNext()) {
+        Folder *f = it.next();
+        if (!f->canSync()) {
+            it.remove();
+            continue;
+        }
+        scheduledAccounts.append(f->accountState());
+    }
+    QVector<AccountState *> runningAccounts;
+    for (auto f : runningSyncFolders())
+        runningAccounts.append(f->accountState());
+
+    QList<Folder *> folders;
+    const auto picked = pickSyncsToStart(scheduledAccounts, runningAccounts, _syncWorkerBudget);
+    for (int index : picked)
+        folders.append(_scheduledFolders.at(index));
+    // Backwards, so the indexes stay valid
+    for (int i = picked.size() - 1; i >= 0; --i)
+        _scheduledFolders.removeAt(picked.at(i));
+    return folders;
+}
+
+QVector<int> FolderMan::pickSyncsToStart(const QVector<AccountState *> &scheduledAccounts,
+    const QVector<AccountState *> &runningAccounts, int budget)
+{
+    // Oldest first. Folders whose account is busy keep their place in the
+    // queue, so they are next once the account's sync is done.
+    QVector<int> picked;
+    auto busyAccounts = runningAccounts.toList().toSet();
+    int runningCount = runningAccounts.size();
+    for (int i = 0; i < scheduledAccounts.size() && runningCount < budget; ++i) {
+        if (busyAccounts.contains(scheduledAccounts.at(i)))
+            continue;
+        busyAccounts.insert(scheduledAccounts.at(i));
+        picked.append(i);
+        ++runningCount;
+    }
+    return picked;
 }
 
 bool FolderMan::pushNotificationsFilesReady(Account *account)
@@ -1008,14 +1046,17 @@ void FolderMan::slotScheduleFolderByTime()
 
 bool FolderMan::isAnySyncRunning() const
 {
-    if (_currentSyncFolder)
-        return true;
+    return !runningSyncFolders().isEmpty();
+}
 
+QList<Folder *> FolderMan::runningSyncFolders() const
+{
+    auto running = _currentSyncFolders;
     for (auto f : _folderMap) {
-        if (f->isSyncRunning())
-            return true;
+        if (f->isSyncRunning() && !running.contains(f))
+            running.append(f);
     }
-    return false;
+    return running;
 }
 
 void FolderMan::slotFolderSyncStarted()
@@ -1049,12 +1090,10 @@ void FolderMan::slotFolderSyncFinished(const SyncResult &)
         qPrintable(f->accountState()->account()->displayName()),
         qPrintable(f->remoteUrl().toString()));
 
-    if (f == _currentSyncFolder) {
-        _lastSyncFolder = _currentSyncFolder;
-        _currentSyncFolder = nullptr;
+    if (_currentSyncFolders.removeAll(f) > 0) {
+        _lastSyncFolder = f;
     }
-    if (!isAnySyncRunning())
-        startScheduledSyncSoon();
+    startScheduledSyncSoon();
 }
 
 Folder *FolderMan::addFolder(AccountState *accountState, const FolderDefinition &folderDefinition)
@@ -1310,10 +1349,10 @@ void FolderMan::slotWipeFolderForAccount(AccountState *accountState)
 
         qCInfo(lcFolderMan) << "Removing " << f->alias();
 
-        const bool currentlyRunning = (_currentSyncFolder == f);
+        const bool currentlyRunning = _currentSyncFolders.contains(f);
         if (currentlyRunning) {
             // abort the sync now
-            _currentSyncFolder->slotTerminateSync();
+            f->slotTerminateSync();
         }
 
         if (_scheduledFolders.removeAll(f) > 0) {
@@ -1674,9 +1713,9 @@ QQueue<Folder *> FolderMan::scheduleQueue() const
     return _scheduledFolders;
 }
 
-Folder *FolderMan::currentSyncFolder() const
+QList<Folder *> FolderMan::currentSyncFolders() const
 {
-    return _currentSyncFolder;
+    return _currentSyncFolders;
 }
 
 void FolderMan::restartApplication()
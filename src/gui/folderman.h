@@ -163,14 +163,33 @@ public:
     QQueue<Folder *> scheduleQueue() const;
 
     /**
-     * Access to the currently syncing folder.
+     * Access to the currently syncing folders.
      *
-     * Note: This is only the folder that's currently syncing *as-scheduled*. There
+     * Note: These are only the folders that are currently syncing *as-scheduled*. There
      * may be externally-managed syncs such as from placeholder hydrations.
      *
      * See also isAnySyncRunning()
      */
-    Folder *currentSyncFolder() const;
+    QList<Folder *> currentSyncFolders() const;
+
+    /**
+     * The number of folders that may sync at the same time.
+     *
+     * Folders of the same account never sync at the same time, so they
+     * share the account's connections and don't compete for server resources.
+     */
+    int syncWorkerBudget() const { return _syncWorkerBudget; }
+
+    /**
+     * Picks the scheduled syncs that may start now.
+     *
+     * \a scheduledAccounts are the accounts of the queued folders, oldest first,
+     * \a runningAccounts the ones of the running syncs. The oldest entries whose
+     * account has no running sync are picked until \a budget syncs run, at most
+     * one per account. Returns their indexes in \a scheduledAccounts.
+     */
+    static QVector<int> pickSyncsToStart(const QVector<AccountState *> &scheduledAccounts,
+        const QVector<AccountState *> &runningAccounts, int budget);
 
     /**
      * Returns true if any folder is currently syncing.
@@ -324,10 +343,17 @@ private:
 
     bool pushNotificationsFilesReady(Account *account);
 
+    /// All folders with a running sync, scheduled or externally managed
+    QList<Folder *> runningSyncFolders() const;
+
+    /// Takes the folders that may start syncing now from the queue, see pickSyncsToStart()
+    QList<Folder *> takeSchedulableFolders();
+
     QSet<Folder *> _disabledFolders;
     Folder::Map _folderMap;
     QString _folderConfigPath;
-    Folder *_currentSyncFolder = nullptr;
+    QList<Folder *> _currentSyncFolders;
+    int _syncWorkerBudget = 1;
     QPointer<Folder> _lastSyncFolder;
     bool _syncEnabled = true;
 
@@ -23,6 +23,7 @@
 #include <QMutexLocker>
 #include <QStringList>
 #include <QTimer>
+#include <QVarLengthArray>
 
 #if defined(Q_OS_WIN)
 #include "folderwatcher_win.h"
@@ -39,10 +40,106 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcFolderWatcher, "nextcloud.gui.folderwatcher", QtInfoMsg)
 
+// Changes are signalled once no new ones arrived for coalesceDelayMs,
+// but at most maxCoalesceDelayMs after the first one
+static const int coalesceDelayMs = 100;
+static const int maxCoalesceDelayMs = 1000;
+
+constexpr int PathChangeCoalescer::maxChangesPerDirectory;
+
+PathChangeCoalescer::PathChangeCoalescer(const QString &root)
+    : _root(root.endsWith(QLatin1Char('/')) ? root : root + QLatin1Char('/'))
+{
+}
+
+void PathChangeCoalescer::addPath(const QString &path, bool tree)
+{
+    QStringRef relativePath;
+    if (path.startsWith(_root)) {
+        relativePath = path.midRef(_root.size());
+    } else if (path.size() + 1 != _root.size() || !_root.startsWith(path)) {
+        if (!_outsidePaths.contains(path)) {
+            _outsidePaths.insert(path);
+            ++_size;
+        }
+        return;
+    }
+
+    QVarLengthArray<Node *, 32> ancestors;
+    Node *node = &_rootNode;
+    for (const auto &segment : relativePath.split(QLatin1Char('/'), QString::SkipEmptyParts)) {
+        if (node->tree)
+            return; // already covered
+        ancestors.append(node);
+        auto &child = node->children[segment.toString()];
+        if (!child)
+            child.reset(new Node);
+        node = child.get();
+    }
+    if (node->tree || (node->changed && !tree))
+        return;
+
+    if (tree) {
+        makeTree(node, ancestors.constData(), ancestors.size());
+    } else {
+        node->changed = true;
+        for (auto ancestor : ancestors)
+            ++ancestor->changesBelow;
+        ++_size;
+    }
+
+    // Only a single directory can exceed the limit now: collapse the deepest one
+    for (int i = ancestors.size() - 1; i >= 0; --i) {
+        if (ancestors[i]->changesBelow > maxChangesPerDirectory) {
+            makeTree(ancestors[i], ancestors.constData(), i);
+            break;
+        }
+    }
+}
+
+void PathChangeCoalescer::makeTree(Node *node, Node *const *ancestors, int ancestorCount)
+{
+    const int delta = (node->changed ? 0 : 1) - node->changesBelow;
+    node->children.clear();
+    node->changesBelow = 0;
+    node->changed = true;
+    node->tree = true;
+    for (int i = 0; i < ancestorCount; ++i)
+        ancestors[i]->changesBelow += delta;
+    _size += delta;
+}
+
+void PathChangeCoalescer::collect(const Node &node, const QString &path, QStringList *paths, QStringList *trees)
+{
+    if (node.tree) {
+        trees->append(path);
+        return;
+    }
+    if (node.changed)
+        paths->append(path);
+    for (const auto &child : node.children)
+        collect(*child.second, path + QLatin1Char('/') + child.first, paths, trees);
+}
+
+void PathChangeCoalescer::take(QStringList *paths, QStringList *trees)
+{
+    paths->clear();
+    trees->clear();
+    collect(_rootNode, _root.left(_root.size() - 1), paths, trees);
+    for (const auto &path : qAsConst(_outsidePaths))
+        paths->append(path);
+
+    _rootNode = Node();
+    _outsidePaths.clear();
+    _size = 0;
+}
+
 FolderWatcher::FolderWatcher(Folder *folder)
     : QObject(folder)
     , _folder(folder)
 {
+    _flushTimer.setSingleShot(true);
+    connect(&_flushTimer, &QTimer::timeout, this, &FolderWatcher::flushChangedPaths);
 }
 
 FolderWatcher::~FolderWatcher() = default;
@@ -50,7 +147,7 @@ FolderWatcher::~FolderWatcher() = default;
 void FolderWatcher::init(const QString &root)
 {
     _d.reset(new FolderWatcherPrivate(this, root));
-    _timer.start();
+    _changedPaths = PathChangeCoalescer(root);
 }
 
 bool FolderWatcher::pathIsIgnored(const QString &path)
@@ -74,19 +171,6 @@ bool FolderWatcher::isReliable() const
     return _isReliable;
 }
 
-void FolderWatcher::appendSubPaths(QDir dir, QStringList& subPaths) {
-    QStringList newSubPaths = dir.entryList(QDir::NoDotAndDotDot | QDir::Dirs | QDir::Files);
-    for (int i = 0; i < newSubPaths.size(); i++) {
-        QString path = dir.path() + "/" + newSubPaths[i];
-        QFileInfo fileInfo(path);
-        subPaths.append(path);
-        if (fileInfo.isDir()) {
-            QDir dir(path);
-            appendSubPaths(dir, subPaths);
-        }
-    }
-}
-
 void FolderWatcher::startNotificatonTest(const QString &path)
 {
 #ifdef Q_OS_MAC
@@ -140,54 +224,48 @@ int FolderWatcher::testLinuxWatchCount() const
 
 void FolderWatcher::changeDetected(const QString &path)
 {
-    QFileInfo fileInfo(path);
-    QStringList paths(path);
-    if (fileInfo.isDir()) {
-        QDir dir(path);
-        appendSubPaths(dir, paths);
-    }
-    changeDetected(paths);
+    // A directory may have been created or moved in together with its contents.
+    // The local discovery of a directory covers everything below it, so there
+    // is no need to list the contents here.
+    addChangedPath(path, QFileInfo(path).isDir());
 }
 
 void FolderWatcher::changeDetected(const QStringList &paths)
 {
-    // TODO: this shortcut doesn't look very reliable:
-    //   - why is the timeout only 1 second?
-    //   - what if there is more than one file being updated frequently?
-    //   - why do we skip the file altogether instead of e.g. reducing the upload frequency?
+    for (const auto &path : paths)
+        addChangedPath(path, false);
+}
 
-    // Check if the same path was reported within the last second.
-    QSet<QString> pathsSet = paths.toSet();
-    if (pathsSet == _lastPaths && _timer.elapsed() < 1000) {
-        // the same path was reported within the last second. Skip.
-        return;
+void FolderWatcher::addChangedPath(const QString &path, bool tree)
+{
+    if (!_testNotificationPath.isEmpty()
+        && Utility::fileNamesEqual(path, _testNotificationPath)) {
+        _testNotificationPath.clear();
     }
-    _lastPaths = pathsSet;
-    _timer.restart();
+    if (pathIsIgnored(path))
+        return;
 
-    QSet<QString> changedPaths;
+    if (_changedPaths.isEmpty())
+        _firstPendingChange.start();
+    _changedPaths.addPath(path, tree);
 
-    // ------- handle ignores:
-    for (int i = 0; i < paths.size(); ++i) {
-        QString path = paths[i];
-        if (!_testNotificationPath.isEmpty()
-            && Utility::fileNamesEqual(path, _testNotificationPath)) {
-            _testNotificationPath.clear();
-        }
-        if (pathIsIgnored(path)) {
-            continue;
-        }
+    // Wait for the changes to settle, but don't hold them back for too long
+    const auto remaining = maxCoalesceDelayMs - _firstPendingChange.elapsed();
+    _flushTimer.start(int(qBound<qint64>(0, remaining, coalesceDelayMs)));
+}
 
-        changedPaths.insert(path);
-    }
-    if (changedPaths.isEmpty()) {
+void FolderWatcher::flushChangedPaths()
+{
+    if (_changedPaths.isEmpty())
         return;
-    }
 
-    qCInfo(lcFolderWatcher) << "Detected changes in paths:" << changedPaths;
-    foreach (const QString &path, changedPaths) {
-        emit pathChanged(path);
-    }
+    QStringList paths;
+    QStringList trees;
+    _changedPaths.take(&paths, &trees);
+
+    qCInfo(lcFolderWatcher) << "Detected changes in" << paths.size() << "paths and" << trees.size() << "trees";
+    qCDebug(lcFolderWatcher) << "Changed paths:" << paths << "changed trees:" << trees;
+    emit pathsChanged(paths, trees);
 }
 
 } // namespace OCC
@@ -27,8 +27,10 @@
 #include <QScopedPointer>
 #include <QSet>
 #include <QDir>
+#include <QTimer>
 
-class QTimer;
+#include <map>
+#include <memory>
 
 namespace OCC {
 
@@ -37,12 +39,69 @@ Q_DECLARE_LOGGING_CATEGORY(lcFolderWatcher)
 class FolderWatcherPrivate;
 class Folder;
 
+/**
+ * @brief Collects changed paths and collapses them under common ancestors
+ *
+ * The paths are kept in a trie of path segments. A change below a changed
+ * tree is dropped, a changed tree drops the changes below it, and a directory
+ * that gets more than maxChangesPerDirectory changes below it becomes a
+ * changed tree itself.
+ *
+ * Paths are absolute. Changes are only collapsed up to the root, paths
+ * outside of it are kept as they are.
+ *
+ * @ingroup gui
+ */
+class PathChangeCoalescer
+{
+public:
+    explicit PathChangeCoalescer(const QString &root = QString());
+
+    /// A directory with more changes below it is reported as a changed tree
+    static constexpr int maxChangesPerDirectory = 1000;
+
+    /**
+     * Records a change of \a path.
+     *
+     * With \a tree everything below the path may have changed as well, like
+     * for a directory that was moved in with its contents.
+     */
+    void addPath(const QString &path, bool tree);
+
+    /// The number of paths and trees take() would return
+    int size() const { return _size; }
+    bool isEmpty() const { return _size == 0; }
+
+    /// Replaces \a paths and \a trees by the collected changes and clears them
+    void take(QStringList *paths, QStringList *trees);
+
+private:
+    struct Node
+    {
+        std::map<QString, std::unique_ptr<Node>> children;
+        // Number of changed paths and trees below this node
+        int changesBelow = 0;
+        bool changed = false;
+        bool tree = false;
+    };
+
+    /// Turns \a node into a changed tree, \a ancestors are its parents from the root down
+    void makeTree(Node *node, Node *const *ancestors, int ancestorCount);
+    static void collect(const Node &node, const QString &path, QStringList *paths, QStringList *trees);
+
+    QString _root; // ends with a /
+    Node _rootNode;
+    QSet<QString> _outsidePaths;
+    int _size = 0;
+};
+
 /**
  * @brief Monitors a directory recursively for changes
  *
  * Folder Watcher monitors a directory and its sub directories
- * for changes in the local file system. Changes are signalled
- * through the pathChanged() signal.
+ * for changes in the local file system. Changes are collected
+ * for a moment and signalled in batches through the pathsChanged()
+ * signal.
  *
  * @ingroup gui
  */
@@ -84,9 +143,14 @@ public:
     int testLinuxWatchCount() const;
 
 signals:
-    /** Emitted when one of the watched directories or one
-     *  of the contained files is changed. */
-    void pathChanged(const QString &path);
+    /**
+     * Emitted when some of the watched directories or contained files changed.
+     *
+     * \a paths changed themselves. The \a trees are directories that changed
+     * together with everything below them, like directories that were moved in
+     * or got a lot of changes. Paths below them are not reported separately.
+     */
+    void pathsChanged(const QStringList &paths, const QStringList &trees);
 
     /**
      * Emitted if some notifications were lost.
@@ -111,18 +175,22 @@ protected slots:
 
 private slots:
     void startNotificationTestWhenReady();
+    void flushChangedPaths();
 
 protected:
     QHash<QString, int> _pendingPathes;
 
 private:
     QScopedPointer<FolderWatcherPrivate> _d;
-    QElapsedTimer _timer;
-    QSet<QString> _lastPaths;
     Folder *_folder;
     bool _isReliable = true;
 
-    void appendSubPaths(QDir dir, QStringList& subPaths);
+    void addChangedPath(const QString &path, bool tree);
+
+    /** Changes that were not signalled yet, see flushChangedPaths() */
+    PathChangeCoalescer _changedPaths;
+    QTimer _flushTimer;
+    QElapsedTimer _firstPendingChange;
 
     /** Path of the expected test notification */
     QString _testNotificationPath;
@@ -15,22 +15,42 @@
 #include "config.h"
 
 #include <sys/inotify.h>
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "folder.h"
 #include "folderwatcher_linux.h"
 
 #include <cerrno>
+#include <climits>
 #include <QStringList>
 #include <QObject>
 #include <QVarLengthArray>
 
 namespace OCC {
 
+// The directory paths are resolved through the file system, cache some
+static const int maxCachedDirectoryHandles = 10000;
+
+static bool isJournalFile(const char *fileName)
+{
+    // Filter out journal changes - redundant with filtering in
+    // FolderWatcher::pathIsIgnored.
+    return qstrncmp(fileName, "._sync_", 7) == 0
+        || qstrncmp(fileName, ".csync_journal.db", 17) == 0
+        || qstrncmp(fileName, ".sync_", 6) == 0;
+}
+
 FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString &path)
     : QObject()
     , _parent(p)
     , _folder(path)
 {
+    if (qEnvironmentVariableIsSet("OWNCLOUD_FANOTIFY_WATCHER") && initFanotify(path))
+        return;
+
     _fd = inotify_init();
     if (_fd != -1) {
         _socket.reset(new QSocketNotifier(_fd, QSocketNotifier::Read));
@@ -42,7 +62,165 @@ FolderWatcherPrivate::FolderWatcherPrivate(FolderWatcher *p, const QString &path
     QMetaObject::invokeMethod(this, "slotAddFolderRecursive", Q_ARG(QString, path));
 }
 
-FolderWatcherPrivate::~FolderWatcherPrivate() = default;
+FolderWatcherPrivate::~FolderWatcherPrivate()
+{
+    _socket.reset();
+    if (_fanotifyFd != -1)
+        close(_fanotifyFd);
+    if (_mountFd != -1)
+        close(_mountFd);
+}
+
+bool FolderWatcherPrivate::initFanotify(const QString &path)
+{
+#ifdef FAN_REPORT_DFID_NAME
+    // Reporting names needs Linux 5.9, marking the whole file system needs
+    // CAP_SYS_ADMIN and resolving the reported handles CAP_DAC_READ_SEARCH.
+    const auto pathBytes = QDir(path).absolutePath().toUtf8();
+    int fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME, O_RDONLY | O_LARGEFILE);
+    if (fd == -1) {
+        qCInfo(lcFolderWatcher) << "fanotify_init() failed, using inotify:" << strerror(errno);
+        return false;
+    }
+    if (fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+            FAN_CLOSE_WRITE | FAN_ATTRIB | FAN_MOVE | FAN_CREATE | FAN_DELETE | FAN_ONDIR,
+            AT_FDCWD, pathBytes.constData())
+        == -1) {
+        qCInfo(lcFolderWatcher) << "fanotify_mark() failed, using inotify:" << strerror(errno);
+        close(fd);
+        return false;
+    }
+    _fanotifyFd = fd;
+    _mountFd = open(pathBytes.constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    _folder = QDir(path).absolutePath();
+    _canonicalFolder = QDir(path).canonicalPath();
+
+    // Check that the handles reported for the folder can be resolved
+    QByteArray handle(sizeof(file_handle) + MAX_HANDLE_SZ, Qt::Uninitialized);
+    auto fileHandle = reinterpret_cast<file_handle *>(handle.data());
+    fileHandle->handle_bytes = MAX_HANDLE_SZ;
+    int mountId = 0;
+    if (_mountFd == -1
+        || name_to_handle_at(AT_FDCWD, pathBytes.constData(), fileHandle, &mountId, 0) == -1
+        || fanotifyDirectory(handle.left(int(sizeof(file_handle) + fileHandle->handle_bytes))).path != _canonicalFolder) {
+        qCInfo(lcFolderWatcher) << "Can't resolve fanotify file handles, using inotify:" << strerror(errno);
+        close(_fanotifyFd);
+        _fanotifyFd = -1;
+        if (_mountFd != -1)
+            close(_mountFd);
+        _mountFd = -1;
+        _directoryHandles.clear();
+        return false;
+    }
+
+    _socket.reset(new QSocketNotifier(_fanotifyFd, QSocketNotifier::Read));
+    connect(_socket.data(), &QSocketNotifier::activated, this, &FolderWatcherPrivate::slotReceivedFanotifyNotification);
+    qCInfo(lcFolderWatcher) << "Watching" << path << "with fanotify";
+    return true;
+#else
+    Q_UNUSED(path)
+    qCInfo(lcFolderWatcher) << "fanotify is not supported by this build, using inotify";
+    return false;
+#endif
+}
+
+FolderWatcherPrivate::FanotifyDirectory FolderWatcherPrivate::fanotifyDirectory(const QByteArray &handle)
+{
+    auto it = _directoryHandles.constFind(handle);
+    if (it != _directoryHandles.constEnd())
+        return *it;
+
+    FanotifyDirectory directory;
+    auto fileHandle = QByteArray(handle);
+    int fd = open_by_handle_at(_mountFd, reinterpret_cast<file_handle *>(fileHandle.data()), O_PATH | O_CLOEXEC);
+    if (fd == -1)
+        return directory; // ESTALE: the directory was deleted
+
+    char target[PATH_MAX];
+    struct stat st;
+    const auto link = QByteArray("/proc/self/fd/") + QByteArray::number(fd);
+    const auto len = readlink(link.constData(), target, sizeof(target));
+    if (len > 0 && fstat(fd, &st) == 0 && st.st_nlink > 0)
+        directory.path = QString::fromUtf8(target, int(len));
+    close(fd);
+
+    if (!directory.path.isEmpty()) {
+        // Most events of the file system are outside the folder, remember those as well
+        directory.inFolder = directory.path == _canonicalFolder || directory.path.startsWith(_canonicalFolder + '/');
+        if (_directoryHandles.size() >= maxCachedDirectoryHandles)
+            _directoryHandles.clear();
+        _directoryHandles.insert(handle, directory);
+    }
+    return directory;
+}
+
+void FolderWatcherPrivate::forgetFanotifyDirectories(const QString &path)
+{
+    const auto prefix = path + '/';
+    for (auto it = _directoryHandles.begin(); it != _directoryHandles.end();) {
+        if (it->path == path || it->path.startsWith(prefix)) {
+            it = _directoryHandles.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void FolderWatcherPrivate::slotReceivedFanotifyNotification(int fd)
+{
+#ifdef FAN_REPORT_DFID_NAME
+    alignas(fanotify_event_metadata) char buffer[8192];
+    ssize_t len = 0;
+    while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+        auto metadata = reinterpret_cast<fanotify_event_metadata *>(buffer);
+        for (; FAN_EVENT_OK(metadata, len); metadata = FAN_EVENT_NEXT(metadata, len)) {
+            if (metadata->vers != FANOTIFY_METADATA_VERSION)
+                continue;
+            if (metadata->fd >= 0)
+                close(metadata->fd);
+            if (metadata->mask & FAN_Q_OVERFLOW) {
+                qCWarning(lcFolderWatcher) << "fanotify queue overflow";
+                emit _parent->lostChanges();
+                continue;
+            }
+
+            // The whole file system is watched: the directory handle tells
+            // whether the event is about something in the folder
+            auto info = reinterpret_cast<const fanotify_event_info_fid *>(metadata + 1);
+            if (metadata->event_len < sizeof(*metadata) + sizeof(*info)
+                || info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+                continue;
+            auto fileHandle = reinterpret_cast<const file_handle *>(info->handle);
+            const QByteArray handle(reinterpret_cast<const char *>(fileHandle),
+                int(sizeof(file_handle) + fileHandle->handle_bytes));
+            const char *fileName = reinterpret_cast<const char *>(fileHandle->f_handle + fileHandle->handle_bytes);
+
+            const auto directory = fanotifyDirectory(handle);
+            if (directory.path.isEmpty())
+                continue;
+
+            // A renamed or deleted directory changes the paths below it, the
+            // handle is the one of its parent directory
+            if ((metadata->mask & FAN_ONDIR) && (metadata->mask & (FAN_MOVE | FAN_DELETE)) && qstrcmp(fileName, ".") != 0)
+                forgetFanotifyDirectories(directory.path + '/' + QString::fromUtf8(fileName));
+
+            if (!directory.inFolder || isJournalFile(fileName))
+                continue;
+
+            // Report paths below the folder path that was passed in, which may not be canonical
+            QString p = _folder + directory.path.midRef(_canonicalFolder.size());
+            if (qstrcmp(fileName, ".") != 0) {
+                p += '/' + QString::fromUtf8(fileName);
+            } else if (directory.path == _canonicalFolder) {
+                continue; // an event on the folder itself
+            }
+            _parent->changeDetected(p);
+        }
+    }
+#else
+    Q_UNUSED(fd)
+#endif
+}
 
 // attention: result list passed by reference!
 bool FolderWatcherPrivate::findFoldersBelow(const QDir &dir, QStringList &fullList)
@@ -169,13 +347,8 @@ void FolderWatcherPrivate::slotReceivedNotification(int fd)
         if (event->len == 0 || event->wd <= -1)
             continue;
         QByteArray fileName(event->name);
-        // Filter out journal changes - redundant with filtering in
-        // FolderWatcher::pathIsIgnored.
-        if (fileName.startsWith("._sync_")
-            || fileName.startsWith(".csync_journal.db")
-            || fileName.startsWith(".sync_")) {
+        if (isJournalFile(event->name))
             continue;
-        }
         const QString p = _watchToPath[event->wd] + '/' + fileName;
         _parent->changeDetected(p);
 
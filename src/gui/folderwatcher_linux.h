@@ -28,7 +28,14 @@ class QTimer;
 namespace OCC {
 
 /**
- * @brief Linux (inotify) API implementation of FolderWatcher
+ * @brief Linux (inotify and fanotify) API implementation of FolderWatcher
+ *
+ * By default every directory gets its own inotify watch. With the
+ * OWNCLOUD_FANOTIFY_WATCHER environment variable set, the whole filesystem
+ * is marked with fanotify instead, if the kernel and the privileges of the
+ * process allow it. That needs no scan of the tree and isn't limited by
+ * the number of inotify watches.
+ *
  * @ingroup gui
  */
 class FolderWatcherPrivate : public QObject
@@ -47,12 +54,25 @@ public:
 protected slots:
     void slotReceivedNotification(int fd);
     void slotAddFolderRecursive(const QString &path);
+    void slotReceivedFanotifyNotification(int fd);
 
 protected:
     bool findFoldersBelow(const QDir &dir, QStringList &fullList);
     void inotifyRegisterPath(const QString &path);
     void removeFoldersBelow(const QString &path);
 
+    /// Returns false if fanotify can't be used and inotify must be used instead
+    bool initFanotify(const QString &path);
+    /// A directory reported by fanotify
+    struct FanotifyDirectory
+    {
+        QString path; // the current path, empty if the directory is gone
+        bool inFolder = false; // whether it is the watched folder or below it
+    };
+    FanotifyDirectory fanotifyDirectory(const QByteArray &handle);
+    /// Drops the cached handles of the directory at \a path and the directories below it
+    void forgetFanotifyDirectories(const QString &path);
+
 private:
     FolderWatcher *_parent;
 
@@ -60,7 +80,13 @@ private:
     QHash<int, QString> _watchToPath;
     QMap<QString, int> _pathToWatch;
     QScopedPointer<QSocketNotifier> _socket;
-    int _fd;
+    int _fd = -1;
+
+    // fanotify reports file handles of directories, _mountFd is used to open them
+    int _fanotifyFd = -1;
+    int _mountFd = -1;
+    QString _canonicalFolder;
+    QHash<QByteArray, FanotifyDirectory> _directoryHandles;
 };
 }
 
@@ -75,7 +75,7 @@
 // This is the version that is returned when the client asks for the VERSION.
 // The first number should be changed if there is an incompatible change that breaks old clients.
 // The second number should be changed when there are new features.
-#define MIRALL_SOCKET_API_VERSION "1.1"
+#define MIRALL_SOCKET_API_VERSION "1.2"
 
 namespace {
 #if GUI_TESTING
@@ -281,6 +281,11 @@ SocketApi::SocketApi(QObject *parent)
 
     // folder watcher
     connect(FolderMan::instance(), &FolderMan::folderSyncStateChange, this, &SocketApi::slotUpdateFolderView);
+
+    // Status changes are collected for a moment, so each directory gets one push
+    _statusPushTimer.setSingleShot(true);
+    _statusPushTimer.setInterval(100);
+    connect(&_statusPushTimer, &QTimer::timeout, this, &SocketApi::sendPendingStatusPushes);
 }
 
 SocketApi::~SocketApi()
@@ -454,6 +459,7 @@ void SocketApi::slotUpdateFolderView(Folder *f)
             || f->syncResult().status() == SyncResult::SetupError) {
             QString rootPath = removeTrailingSlash(f->path());
             broadcastStatusPushMessage(rootPath, f->syncEngine().syncFileStatusTracker().fileStatus(""));
+            sendPendingStatusPushes();
 
             broadcastMessage(buildMessage(QLatin1String("UPDATE_VIEW"), rootPath));
         } else {
@@ -512,12 +518,61 @@ void SocketApi::processShareRequest(const QString &localFile, SocketListener *li
 
 void SocketApi::broadcastStatusPushMessage(const QString &systemPath, SyncFileStatus fileStatus)
 {
-    QString msg = buildMessage(QLatin1String("STATUS"), systemPath, fileStatus.toSocketAPIString());
     Q_ASSERT(!systemPath.endsWith('/'));
-    uint directoryHash = qHash(systemPath.left(systemPath.lastIndexOf('/')));
-    foreach (auto &listener, _listeners) {
-        listener.sendMessageIfDirectoryMonitored(msg, directoryHash);
+    if (_listeners.isEmpty())
+        return;
+
+    // Only the latest status of each path is sent
+    auto it = _pendingStatusPushes.find(systemPath);
+    if (it == _pendingStatusPushes.end()) {
+        _pendingStatusPushes.insert(systemPath, fileStatus);
+        _pendingStatusPushOrder.append(systemPath);
+    } else {
+        *it = fileStatus;
     }
+    if (!_statusPushTimer.isActive())
+        _statusPushTimer.start();
+}
+
+void SocketApi::sendPendingStatusPushes()
+{
+    _statusPushTimer.stop();
+
+    // Group the paths by directory, keeping the order in which they changed first
+    QStringList directories;
+    QHash<QString, QStringList> pathsByDirectory;
+    for (const auto &path : qAsConst(_pendingStatusPushOrder)) {
+        const QString directory = path.left(path.lastIndexOf('/'));
+        auto &paths = pathsByDirectory[directory];
+        if (paths.isEmpty())
+            directories.append(directory);
+        paths.append(path);
+    }
+
+    for (const auto &directory : qAsConst(directories)) {
+        const uint directoryHash = qHash(directory);
+        const auto &paths = pathsByDirectory[directory];
+
+        QString batchMessage = QLatin1String("DIRECTORY_STATUS:") + QDir::toNativeSeparators(directory);
+        for (const auto &path : paths) {
+            batchMessage += QLatin1Char('\x1e') % _pendingStatusPushes[path].toSocketAPIString()
+                % QLatin1Char(':') % path.mid(directory.size() + 1);
+        }
+
+        for (const auto &listener : qAsConst(_listeners)) {
+            if (!listener.isDirectoryMonitored(directoryHash))
+                continue;
+            if (listener.receivesDirectoryStatus) {
+                listener.sendMessage(batchMessage);
+            } else {
+                for (const auto &path : paths)
+                    listener.sendMessage(buildMessage(QLatin1String("STATUS"), path, _pendingStatusPushes[path].toSocketAPIString()));
+            }
+        }
+    }
+
+    _pendingStatusPushes.clear();
+    _pendingStatusPushOrder.clear();
 }
 
 void SocketApi::command_RETRIEVE_FOLDER_STATUS(const QString &argument, SocketListener *listener)
@@ -548,6 +603,24 @@ void SocketApi::command_RETRIEVE_FILE_STATUS(const QString &argument, SocketList
     listener->sendMessage(message);
 }
 
+void SocketApi::command_RETRIEVE_DIRECTORY_STATUS(const QString &argument, SocketListener *listener)
+{
+    QString message = QLatin1String("DIRECTORY_STATUS:") + QDir::toNativeSeparators(argument);
+
+    auto fileData = FileData::get(argument);
+    if (fileData.folder) {
+        // Status changes of the entries are pushed from now on
+        listener->registerMonitoredDirectory(qHash(fileData.localPath));
+        listener->receivesDirectoryStatus = true;
+
+        const auto statuses = fileData.folder->syncEngine().syncFileStatusTracker().directoryStatuses(fileData.folderRelativePath);
+        for (auto it = statuses.cbegin(); it != statuses.cend(); ++it)
+            message += QLatin1Char('\x1e') % it.value().toSocketAPIString() % QLatin1Char(':') % it.key();
+    }
+
+    listener->sendMessage(message);
+}
+
 void SocketApi::command_SHARE(const QString &localFile, SocketListener *listener)
 {
     processShareRequest(localFile, listener, ShareDialogStartPage::UsersAndGroups);
@@ -22,6 +22,8 @@
 
 #include "config.h"
 
+#include <QTimer>
+
 #if defined(Q_OS_MAC)
 #include "socketapisocket_mac.h"
 #else
@@ -69,6 +71,7 @@ private slots:
     void onLostConnection();
     void slotSocketDestroyed(QObject *obj);
     void slotReadSocket();
+    void sendPendingStatusPushes();
 
     static void copyUrlToClipboard(const QString &link);
     static void emailPrivateLink(const QString &link);
@@ -105,6 +108,13 @@ private:
     Q_INVOKABLE void command_RETRIEVE_FOLDER_STATUS(const QString &argument, SocketListener *listener);
     Q_INVOKABLE void command_RETRIEVE_FILE_STATUS(const QString &argument, SocketListener *listener);
 
+    /** Sends the status of each entry of a directory in one message. (added in version 1.2)
+     * Reply with DIRECTORY_STATUS:[Directory] followed by [Status]:[Name] for each entry,
+     * all separated by '\x1e'. Later status changes in the directory are pushed in the same
+     * format instead of STATUS messages.
+     */
+    Q_INVOKABLE void command_RETRIEVE_DIRECTORY_STATUS(const QString &argument, SocketListener *listener);
+
     Q_INVOKABLE void command_VERSION(const QString &argument, SocketListener *listener);
 
     Q_INVOKABLE void command_SHARE_MENU_TITLE(const QString &argument, SocketListener *listener);
@@ -166,6 +176,11 @@ private:
     QSet<QString> _registeredAliases;
     QList<SocketListener> _listeners;
     SocketApiServer _localServer;
+
+    // The status pushes that were not sent yet, with the latest status of each path
+    QHash<QString, SyncFileStatus> _pendingStatusPushes;
+    QStringList _pendingStatusPushOrder;
+    QTimer _statusPushTimer;
 };
 }
 
@@ -61,6 +61,8 @@ class SocketListener
 {
 public:
     QPointer<QIODevice> socket;
+    /// Whether the client sent RETRIEVE_DIRECTORY_STATUS, so it understands DIRECTORY_STATUS pushes
+    bool receivesDirectoryStatus = false;
 
     explicit SocketListener(QIODevice *socket)
         : socket(socket)
@@ -71,10 +73,15 @@ public:
 
     void sendMessageIfDirectoryMonitored(const QString &message, uint systemDirectoryHash) const
     {
-        if (_monitoredDirectoriesBloomFilter.isHashMaybeStored(systemDirectoryHash))
+        if (isDirectoryMonitored(systemDirectoryHash))
             sendMessage(message, false);
     }
 
+    bool isDirectoryMonitored(uint systemDirectoryHash) const
+    {
+        return _monitoredDirectoriesBloomFilter.isHashMaybeStored(systemDirectoryHash);
+    }
+
     void registerMonitoredDirectory(uint systemDirectoryHash)
     {
         _monitoredDirectoriesBloomFilter.storeHash(systemDirectoryHash);
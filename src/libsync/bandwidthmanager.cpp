@@ -12,7 +12,8 @@
  * for more details.
  */
 
-#include "owncloudpropagator.h"
+#include "bandwidthmanager.h"
+#include "account.h"
 #include "propagatedownload.h"
 #include "propagateupload.h"
 #include "propagatorjobs.h"
@@ -44,33 +45,26 @@ static qint64 relativeLimitMeasuringTimerIntervalMsec = 1000 * 2;
 //  * For relative limiting, do less measuring and more delaying+giving quota
 //  * For relative limiting, smoothen measurements
 
-BandwidthManager::BandwidthManager(OwncloudPropagator *p)
-    : QObject()
-    , _propagator(p)
+// How often the token buckets for absolute limits are refilled. No transfer
+// holds more quota than the whole limit allows for one interval.
+static const qint64 absoluteLimitTimerIntervalMsec = 250;
+
+BandwidthManager::BandwidthManager(QObject *parent)
+    : QObject(parent)
     , _relativeLimitCurrentMeasuredDevice(nullptr)
     , _relativeUploadLimitProgressAtMeasuringRestart(0)
     , _currentUploadLimit(0)
     , _relativeLimitCurrentMeasuredJob(nullptr)
     , _currentDownloadLimit(0)
 {
-    _currentUploadLimit = _propagator->_uploadLimit;
-    _currentDownloadLimit = _propagator->_downloadLimit;
-
-    QObject::connect(&_switchingTimer, &QTimer::timeout, this, &BandwidthManager::switchingTimerExpired);
-    _switchingTimer.setInterval(10 * 1000);
-    _switchingTimer.start();
-    QMetaObject::invokeMethod(this, "switchingTimerExpired", Qt::QueuedConnection);
-
     // absolute uploads/downloads
     QObject::connect(&_absoluteLimitTimer, &QTimer::timeout, this, &BandwidthManager::absoluteLimitTimerExpired);
-    _absoluteLimitTimer.setInterval(1000);
-    _absoluteLimitTimer.start();
+    _absoluteLimitTimer.setInterval(absoluteLimitTimerIntervalMsec);
 
     // Relative uploads
     QObject::connect(&_relativeUploadMeasuringTimer, &QTimer::timeout,
         this, &BandwidthManager::relativeUploadMeasuringTimerExpired);
     _relativeUploadMeasuringTimer.setInterval(relativeLimitMeasuringTimerIntervalMsec);
-    _relativeUploadMeasuringTimer.start();
     _relativeUploadMeasuringTimer.setSingleShot(true); // will be restarted from the delay timer
     QObject::connect(&_relativeUploadDelayTimer, &QTimer::timeout,
         this, &BandwidthManager::relativeUploadDelayTimerExpired);
@@ -80,19 +74,70 @@ BandwidthManager::BandwidthManager(OwncloudPropagator *p)
     QObject::connect(&_relativeDownloadMeasuringTimer, &QTimer::timeout,
         this, &BandwidthManager::relativeDownloadMeasuringTimerExpired);
     _relativeDownloadMeasuringTimer.setInterval(relativeLimitMeasuringTimerIntervalMsec);
-    _relativeDownloadMeasuringTimer.start();
     _relativeDownloadMeasuringTimer.setSingleShot(true); // will be restarted from the delay timer
     QObject::connect(&_relativeDownloadDelayTimer, &QTimer::timeout,
         this, &BandwidthManager::relativeDownloadDelayTimerExpired);
     _relativeDownloadDelayTimer.setSingleShot(true); // will be restarted from the measuring timer
+
+    // The timers are started by updateTimers() once a limit applies to a transfer
 }
 
 BandwidthManager::~BandwidthManager() = default;
 
-void BandwidthManager::registerUploadDevice(UploadDevice *p)
+BandwidthManager *BandwidthManager::instance()
+{
+    static BandwidthManager *instance = new BandwidthManager;
+    return instance;
+}
+
+bool BandwidthManager::isTimerActive() const
+{
+    return _absoluteLimitTimer.isActive()
+        || _relativeUploadMeasuringTimer.isActive() || _relativeUploadDelayTimer.isActive()
+        || _relativeDownloadMeasuringTimer.isActive() || _relativeDownloadDelayTimer.isActive();
+}
+
+void BandwidthManager::updateTimers()
+{
+    const bool absoluteNeeded = (usingAbsoluteUploadLimit() && !_absoluteUploadDeviceList.empty())
+        || (usingAbsoluteDownloadLimit() && !_downloadJobList.empty());
+    if (absoluteNeeded && !_absoluteLimitTimer.isActive()) {
+        _absoluteLimitTimer.start();
+        _absoluteLimitClock.start();
+    } else if (!absoluteNeeded) {
+        _absoluteLimitTimer.stop();
+    }
+
+    // The measuring and the delay timer restart each other, start the cycle with measuring
+    if (usingRelativeUploadLimit() && !_relativeUploadDeviceList.empty()) {
+        if (!_relativeUploadMeasuringTimer.isActive() && !_relativeUploadDelayTimer.isActive())
+            _relativeUploadMeasuringTimer.start();
+    } else {
+        _relativeUploadMeasuringTimer.stop();
+        _relativeUploadDelayTimer.stop();
+        _relativeLimitCurrentMeasuredDevice = nullptr;
+    }
+
+    if (usingRelativeDownloadLimit() && !_downloadJobList.empty()) {
+        if (!_relativeDownloadMeasuringTimer.isActive() && !_relativeDownloadDelayTimer.isActive())
+            _relativeDownloadMeasuringTimer.start();
+    } else {
+        _relativeDownloadMeasuringTimer.stop();
+        _relativeDownloadDelayTimer.stop();
+        _relativeLimitCurrentMeasuredJob = nullptr;
+    }
+}
+
+void BandwidthManager::setAccountWeight(const QString &accountId, int weight)
+{
+    _accountWeights[accountId] = qMax(1, weight);
+}
+
+void BandwidthManager::registerUploadDevice(UploadDevice *p, const QString &accountId)
 {
     _absoluteUploadDeviceList.push_back(p);
     _relativeUploadDeviceList.push_back(p);
+    _transferAccounts[p] = accountId;
     QObject::connect(p, &QObject::destroyed, this, &BandwidthManager::unregisterUploadDevice);
 
     if (usingAbsoluteUploadLimit()) {
@@ -105,6 +150,7 @@ void BandwidthManager::registerUploadDevice(UploadDevice *p)
         p->setBandwidthLimited(false);
         p->setChoked(false);
     }
+    updateTimers();
 }
 
 void BandwidthManager::unregisterUploadDevice(QObject *o)
@@ -112,15 +158,18 @@ void BandwidthManager::unregisterUploadDevice(QObject *o)
     auto p = reinterpret_cast<UploadDevice *>(o); // note, we might already be in the ~QObject
     _absoluteUploadDeviceList.remove(p);
     _relativeUploadDeviceList.remove(p);
+    _transferAccounts.remove(o);
     if (p == _relativeLimitCurrentMeasuredDevice) {
         _relativeLimitCurrentMeasuredDevice = nullptr;
         _relativeUploadLimitProgressAtMeasuringRestart = 0;
     }
+    updateTimers();
 }
 
 void BandwidthManager::registerDownloadJob(GETFileJob *j)
 {
     _downloadJobList.push_back(j);
+    _transferAccounts[j] = j->account()->id();
     QObject::connect(j, &QObject::destroyed, this, &BandwidthManager::unregisterDownloadJob);
 
     if (usingAbsoluteDownloadLimit()) {
@@ -133,16 +182,19 @@ void BandwidthManager::registerDownloadJob(GETFileJob *j)
         j->setBandwidthLimited(false);
         j->setChoked(false);
     }
+    updateTimers();
 }
 
 void BandwidthManager::unregisterDownloadJob(QObject *o)
 {
     auto *j = reinterpret_cast<GETFileJob *>(o); // note, we might already be in the ~QObject
     _downloadJobList.remove(j);
+    _transferAccounts.remove(o);
     if (_relativeLimitCurrentMeasuredJob == j) {
         _relativeLimitCurrentMeasuredJob = nullptr;
         _relativeDownloadLimitProgressAtMeasuringRestart = 0;
     }
+    updateTimers();
 }
 
 void BandwidthManager::relativeUploadMeasuringTimerExpired()
@@ -335,12 +387,12 @@ void BandwidthManager::relativeDownloadDelayTimerExpired()
 
 // end downloads
 
-void BandwidthManager::switchingTimerExpired()
+void BandwidthManager::setUploadLimit(qint64 newUploadLimit)
 {
-    qint64 newUploadLimit = _propagator->_uploadLimit;
     if (newUploadLimit != _currentUploadLimit) {
         qCInfo(lcBandwidthManager) << "Upload Bandwidth limit changed" << _currentUploadLimit << newUploadLimit;
         _currentUploadLimit = newUploadLimit;
+        _uploadTokens = 0;
         Q_FOREACH (UploadDevice *ud, _relativeUploadDeviceList) {
             if (newUploadLimit == 0) {
                 ud->setBandwidthLimited(false);
@@ -353,11 +405,16 @@ void BandwidthManager::switchingTimerExpired()
                 ud->setChoked(true);
             }
         }
+        updateTimers();
     }
-    qint64 newDownloadLimit = _propagator->_downloadLimit;
+}
+
+void BandwidthManager::setDownloadLimit(qint64 newDownloadLimit)
+{
     if (newDownloadLimit != _currentDownloadLimit) {
         qCInfo(lcBandwidthManager) << "Download Bandwidth limit changed" << _currentDownloadLimit << newDownloadLimit;
         _currentDownloadLimit = newDownloadLimit;
+        _downloadTokens = 0;
         Q_FOREACH (GETFileJob *j, _downloadJobList) {
             if (usingAbsoluteDownloadLimit()) {
                 j->setBandwidthLimited(true);
@@ -370,25 +427,87 @@ void BandwidthManager::switchingTimerExpired()
                 j->setChoked(false);
             }
         }
+        updateTimers();
     }
 }
 
+QVector<qint64> BandwidthManager::fairShares(qint64 tokens, const QVector<QuotaRequest> &requests,
+    const QHash<QString, int> &accountWeights)
+{
+    QVector<qint64> grants(requests.size(), 0);
+
+    QHash<QString, int> requestsPerAccount;
+    for (const auto &request : requests)
+        requestsPerAccount[request.accountId]++;
+
+    // Water filling: hand out the tokens by weight to the requests that still
+    // have room, until either the tokens or the room are used up.
+    while (tokens > 0) {
+        double totalWeight = 0;
+        for (int i = 0; i < requests.size(); ++i) {
+            if (grants[i] < requests[i].room)
+                totalWeight += double(accountWeights.value(requests[i].accountId, 1)) / requestsPerAccount[requests[i].accountId];
+        }
+        if (totalWeight == 0)
+            break;
+
+        const qint64 available = tokens;
+        for (int i = 0; i < requests.size() && tokens > 0; ++i) {
+            if (grants[i] >= requests[i].room)
+                continue;
+            const double weight = double(accountWeights.value(requests[i].accountId, 1)) / requestsPerAccount[requests[i].accountId];
+            // At least one byte, so that rounding can't stall the distribution
+            qint64 grant = qMax<qint64>(1, available * weight / totalWeight);
+            grant = qMin(grant, qMin(tokens, requests[i].room - grants[i]));
+            grants[i] += grant;
+            tokens -= grant;
+        }
+    }
+    return grants;
+}
+
 void BandwidthManager::absoluteLimitTimerExpired()
 {
+    const qint64 elapsedMsec = qMax<qint64>(1, _absoluteLimitClock.restart());
+
+    // Refill the buckets at the rate of the limits. Tokens don't pile up for
+    // more than two intervals, so idle times don't lead to bursts.
+    auto refill = [elapsedMsec](qint64 &tokens, qint64 limit) {
+        const qint64 perInterval = limit * absoluteLimitTimerIntervalMsec / 1000;
+        tokens = qMin(tokens + limit * elapsedMsec / 1000, 2 * perInterval);
+        return perInterval;
+    };
+
     if (usingAbsoluteUploadLimit() && !_absoluteUploadDeviceList.empty()) {
-        qint64 quotaPerDevice = _currentUploadLimit / qMax((std::list<UploadDevice *>::size_type)1, _absoluteUploadDeviceList.size());
-        qCDebug(lcBandwidthManager) << quotaPerDevice << _absoluteUploadDeviceList.size() << _currentUploadLimit;
-        Q_FOREACH (UploadDevice *device, _absoluteUploadDeviceList) {
-            device->giveBandwidthQuota(quotaPerDevice);
-            qCDebug(lcBandwidthManager) << "Gave " << quotaPerDevice / 1024.0 << " kB to" << device;
+        const qint64 maxQuota = refill(_uploadTokens, _currentUploadLimit);
+        QVector<QuotaRequest> requests;
+        for (UploadDevice *device : _absoluteUploadDeviceList)
+            requests.append({ _transferAccounts.value(device), qMax<qint64>(0, maxQuota - device->_bandwidthQuota) });
+        const auto grants = fairShares(_uploadTokens, requests, _accountWeights);
+        int i = 0;
+        for (UploadDevice *device : _absoluteUploadDeviceList) {
+            const qint64 grant = grants[i++];
+            if (grant > 0) {
+                _uploadTokens -= grant;
+                device->giveBandwidthQuota(device->_bandwidthQuota + grant);
+                qCDebug(lcBandwidthManager) << "Gave " << grant / 1024.0 << " kB to" << device;
+            }
         }
     }
     if (usingAbsoluteDownloadLimit() && !_downloadJobList.empty()) {
-        qint64 quotaPerJob = _currentDownloadLimit / qMax((std::list<GETFileJob *>::size_type)1, _downloadJobList.size());
-        qCDebug(lcBandwidthManager) << quotaPerJob << _downloadJobList.size() << _currentDownloadLimit;
-        Q_FOREACH (GETFileJob *j, _downloadJobList) {
-            j->giveBandwidthQuota(quotaPerJob);
-            qCDebug(lcBandwidthManager) << "Gave " << quotaPerJob / 1024.0 << " kB to" << j;
+        const qint64 maxQuota = refill(_downloadTokens, _currentDownloadLimit);
+        QVector<QuotaRequest> requests;
+        for (GETFileJob *j : _downloadJobList)
+            requests.append({ _transferAccounts.value(j), qMax<qint64>(0, maxQuota - j->_bandwidthQuota) });
+        const auto grants = fairShares(_downloadTokens, requests, _accountWeights);
+        int i = 0;
+        for (GETFileJob *j : _downloadJobList) {
+            const qint64 grant = grants[i++];
+            if (grant > 0) {
+                _downloadTokens -= grant;
+                j->giveBandwidthQuota(j->_bandwidthQuota + grant);
+                qCDebug(lcBandwidthManager) << "Gave " << grant / 1024.0 << " kB to" << j;
+            }
         }
     }
 }
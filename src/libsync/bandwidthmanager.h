@@ -15,8 +15,12 @@
 #ifndef BANDWIDTHMANAGER_H
 #define BANDWIDTHMANAGER_H
 
+#include "owncloudlib.h"
 #include <QObject>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QVector>
 #include <QIODevice>
 #include <list>
 
@@ -24,34 +28,74 @@ namespace OCC {
 
 class UploadDevice;
 class GETFileJob;
-class OwncloudPropagator;
 
 /**
- * @brief The BandwidthManager class
+ * @brief Limits the bandwidth of all uploads and downloads of the process
+ *
+ * There is one instance for all folders and accounts, so a configured limit
+ * holds no matter how many syncs and transfers run at the same time.
+ *
+ * Absolute limits work as a token bucket that is refilled at the limit's
+ * rate. The tokens are split between the accounts according to their
+ * weights and evenly between the transfers of an account.
+ *
  * @ingroup libsync
  */
-class BandwidthManager : public QObject
+class OWNCLOUDSYNC_EXPORT BandwidthManager : public QObject
 {
     Q_OBJECT
 public:
-    BandwidthManager(OwncloudPropagator *p);
+    explicit BandwidthManager(QObject *parent = nullptr);
     ~BandwidthManager();
 
+    static BandwidthManager *instance();
+
+    /** Sets the limits in bytes per second.
+     *
+     * Negative values are a percentage of the measured bandwidth, 0 means no limit.
+     */
+    void setUploadLimit(qint64 limit);
+    void setDownloadLimit(qint64 limit);
+
+    /** The share an account gets compared to the other accounts, 1 by default */
+    void setAccountWeight(const QString &accountId, int weight);
+    int accountWeight(const QString &accountId) const { return _accountWeights.value(accountId, 1); }
+
+    struct QuotaRequest
+    {
+        QString accountId;
+        /// How many more bytes the transfer may hold
+        qint64 room;
+    };
+
+    /** Splits \a tokens between the \a requests.
+     *
+     * Each account gets a share according to its weight, split evenly between
+     * its requests. Tokens a request has no room for go to the other ones.
+     * Returns the grant for each request, in the same order.
+     */
+    static QVector<qint64> fairShares(qint64 tokens, const QVector<QuotaRequest> &requests,
+        const QHash<QString, int> &accountWeights);
+
     bool usingAbsoluteUploadLimit() { return _currentUploadLimit > 0; }
     bool usingRelativeUploadLimit() { return _currentUploadLimit < 0; }
     bool usingAbsoluteDownloadLimit() { return _currentDownloadLimit > 0; }
     bool usingRelativeDownloadLimit() { return _currentDownloadLimit < 0; }
 
+    /** Whether any of the limiting timers runs.
+     *
+     * They only run while a limit applies to a registered upload device or download job.
+     */
+    bool isTimerActive() const;
 
 public slots:
-    void registerUploadDevice(UploadDevice *);
+    void registerUploadDevice(UploadDevice *, const QString &accountId);
     void unregisterUploadDevice(QObject *);
 
     void registerDownloadJob(GETFileJob *);
     void unregisterDownloadJob(QObject *);
 
     void absoluteLimitTimerExpired();
-    void switchingTimerExpired();
 
     void relativeUploadMeasuringTimerExpired();
     void relativeUploadDelayTimerExpired();
@@ -60,15 +104,18 @@ public slots:
     void relativeDownloadDelayTimerExpired();
 
 private:
-    // for switching between absolute and relative bw limiting
-    QTimer _switchingTimer;
-
-    // FIXME this timer and this variable should be replaced
-    // by the propagator emitting the changed limit values to us as signal
-    OwncloudPropagator *_propagator;
+    /// Starts the timers that have work to do and stops the other ones
+    void updateTimers();
 
     // for absolute up/down bw limiting
     QTimer _absoluteLimitTimer;
+    QElapsedTimer _absoluteLimitClock;
+    qint64 _uploadTokens = 0;
+    qint64 _downloadTokens = 0;
+
+    QHash<QString, int> _accountWeights;
+    // the account of each registered upload device and download job
+    QHash<QObject *, QString> _transferAccounts;
 
     // FIXME merge these two lists
     std::list<UploadDevice *> _absoluteUploadDeviceList;
@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+#pragma once
+
+#include "owncloudpropagator.h"
+#include "common/asserts.h"
+
+#include <QNetworkReply>
+#include <QPointer>
+#include <QSharedPointer>
+
+namespace OCC {
+
+/**
+ * @brief Collects the files of one bulk request
+ * @ingroup libsync
+ *
+ * The request is sent once every file of the batch is either ready to be
+ * transferred or done, for example because it could be handled without it.
+ * Subclasses create the request of their direction and hand its reply to
+ * the files.
+ *
+ * \a File is the propagation job of one file, a BulkBatchFile, and \a Job
+ * the network job of the request, which emits finishedSignal().
+ */
+template <typename File, typename Job>
+class BulkBatch : public QObject
+{
+public:
+    using FileType = File;
+
+    BulkBatch(OwncloudPropagator *propagator, int fileCount)
+        : _propagator(propagator)
+        , _waitingFor(fileCount)
+    {
+    }
+
+    void fileReady(File *file)
+    {
+        ASSERT(!_sent);
+        _files.append(file);
+        --_waitingFor;
+        sendIfComplete();
+
+        // The file no longer occupies a slot, other files of the batch may start
+        _propagator->scheduleNextJob();
+    }
+
+    void fileLeft(File *file)
+    {
+        if (_sent) {
+            return;
+        }
+        const int index = _files.indexOf(file);
+        if (index >= 0) {
+            _files.remove(index);
+        } else {
+            --_waitingFor;
+        }
+        sendIfComplete();
+    }
+
+protected:
+    using Files = QVector<QPointer<File>>;
+
+    /// Whether the server is known to reject bulk requests of this direction
+    virtual bool isUnsupported() const = 0;
+    virtual void setUnsupported() = 0;
+
+    /// Creates the request for the files of the batch, it is started by the batch
+    virtual Job *createJob() = 0;
+
+    /// The request of \a job succeeded, every file takes its result from the reply
+    virtual void jobSucceeded(Job *job, const Files &files) = 0;
+
+    /// The request of \a job failed for all \a files
+    virtual void jobFailed(Job *job, const Files &files) = 0;
+
+    OwncloudPropagator *_propagator;
+    Files _files; /// the files that are ready, in the order they became ready
+
+private:
+    void sendIfComplete()
+    {
+        if (_sent) {
+            return;
+        }
+        if (_propagator->_abortRequested) {
+            // The request won't be sent, resolve the files that wait for it
+            const auto files = _files;
+            _files.clear();
+            for (const auto &file : files) {
+                if (file) {
+                    file->batchAborted();
+                }
+            }
+            return;
+        }
+        if (_waitingFor > 0) {
+            return;
+        }
+        _sent = true;
+        if (_files.isEmpty()) {
+            return;
+        }
+
+        if (isUnsupported()) {
+            // Another batch found out in the meantime
+            for (const auto &file : qAsConst(_files)) {
+                if (file) {
+                    file->fallBackToSingleTransfer();
+                }
+            }
+            return;
+        }
+
+        auto job = createJob();
+        QObject::connect(job, &Job::finishedSignal, this, [this, job] { jobFinished(job); });
+        for (const auto &file : qAsConst(_files)) {
+            file->trackJob(job);
+        }
+        _activeFile = _files.first();
+        _propagator->_activeJobList.append(_activeFile);
+        job->start();
+    }
+
+    void jobFinished(Job *job)
+    {
+        _propagator->_activeJobList.removeOne(_activeFile);
+        _activeFile = nullptr;
+
+        const auto files = _files;
+        for (const auto &file : files) {
+            if (file) {
+                file->untrackJob(job);
+            }
+        }
+
+        const int httpStatus = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (job->reply()->error() != QNetworkReply::NoError) {
+            // Servers without the endpoint: don't lose the sync over it
+            if ((httpStatus == 404 || httpStatus == 405 || httpStatus == 501) && !_propagator->_abortRequested) {
+                qCWarning(lcPropagator) << "Bulk request rejected with" << httpStatus << ", transferring the files one by one";
+                setUnsupported();
+                for (const auto &file : files) {
+                    if (file) {
+                        file->fallBackToSingleTransfer();
+                    }
+                }
+                return;
+            }
+            jobFailed(job, files);
+            return;
+        }
+        jobSucceeded(job, files);
+    }
+
+    int _waitingFor; /// number of files that are neither ready nor left
+    PropagateItemJob *_activeFile = nullptr; /// represents the request in the active job list
+    bool _sent = false;
+};
+
+/**
+ * @brief Propagation job of \a Base for a file that is transferred with others in one bulk request
+ * @ingroup libsync
+ *
+ * The file counts for its \a Batch until it is done or falls back to a
+ * request of its own. Subclasses provide trackJob() and untrackJob() for
+ * the network job of the batch.
+ */
+template <typename Base, typename Batch>
+class BulkBatchFile : public Base
+{
+public:
+    BulkBatchFile(OwncloudPropagator *propagator, const SyncFileItemPtr &item, const QSharedPointer<Batch> &batch)
+        : Base(propagator, item)
+        , _batch(batch)
+    {
+    }
+
+protected:
+    template <typename, typename>
+    friend class BulkBatch;
+
+    /// Transfers the file with a request of its own
+    virtual void startSingleTransfer() = 0;
+
+    /// The sync was aborted while the file waited for the request of the batch
+    virtual void batchAborted()
+    {
+        _inBatch = false;
+        done(SyncFileItem::SoftError, Base::tr("Aborted"));
+    }
+
+    void fallBackToSingleTransfer()
+    {
+        leaveBatch();
+        startSingleTransfer();
+    }
+
+    void leaveBatch()
+    {
+        if (_inBatch) {
+            _inBatch = false;
+            _batch->fileLeft(static_cast<typename Batch::FileType *>(this));
+        }
+    }
+
+    void done(SyncFileItem::Status status, const QString &errorString = QString()) override
+    {
+        Base::done(status, errorString);
+        leaveBatch();
+    }
+
+    /// Shared by the files of the batch, which outlives them all
+    QSharedPointer<Batch> _batch;
+    bool _inBatch = true; /// whether the batch still counts on this file
+};
+
+}
@@ -229,6 +229,38 @@ bool Capabilities::chunkingParallelUploadDisabled() const
     return _capabilities["dav"].toMap()["chunkingParallelUploadDisabled"].toBool();
 }
 
+bool Capabilities::propfindDepthInfinity() const
+{
+    static const auto depthInfinity = qgetenv("OWNCLOUD_PROPFIND_DEPTH_INFINITY");
+    if (depthInfinity == "0")
+        return false;
+    return _capabilities["dav"].toMap()["propfind"].toMap()["depth_infinity"].toBool();
+}
+
+bool Capabilities::bulkUpload() const
+{
+    static const auto bulkUpload = qgetenv("OWNCLOUD_BULK_UPLOAD");
+    if (bulkUpload == "0")
+        return false;
+    return _capabilities["dav"].toMap()["bulkupload"].toByteArray() >= "1.0";
+}
+
+bool Capabilities::bulkDownload() const
+{
+    static const auto bulkDownload = qgetenv("OWNCLOUD_BULK_DOWNLOAD");
+    if (bulkDownload == "0")
+        return false;
+    return _capabilities["dav"].toMap()["bulkdownload"].toByteArray() >= "1.0";
+}
+
+bool Capabilities::deltaSync() const
+{
+    static const auto deltaSync = qgetenv("OWNCLOUD_DELTA_SYNC");
+    if (deltaSync == "0")
+        return false;
+    return _capabilities["dav"].toMap()["deltasync"].toByteArray() >= "1.0";
+}
+
 bool Capabilities::privateLinkPropertyAvailable() const
 {
     return _capabilities["files"].toMap()["privateLinks"].toBool();
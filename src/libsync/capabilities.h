@@ -69,6 +69,18 @@ public:
     /// disable parallel upload in chunking
     bool chunkingParallelUploadDisabled() const;
 
+    /// Whether the server allows PROPFIND requests with "Depth: infinity"
+    bool propfindDepthInfinity() const;
+
+    /// Whether several files may be uploaded in one request to the bulk endpoint
+    bool bulkUpload() const;
+
+    /// Whether several files may be downloaded in one request to the bulk download endpoint
+    bool bulkDownload() const;
+
+    /// Whether the server stores block manifests for delta downloads, see BlockManifest
+    bool deltaSync() const;
+
     /// Whether the "privatelink" DAV property is available
     bool privateLinkPropertyAvailable() const;
 
@@ -19,6 +19,7 @@
 #include <algorithm>
 
 #include <cstdio>
+#include <cstring>
 
 #include <QDebug>
 #include <QLoggingCategory>
@@ -37,6 +38,8 @@
 
 #include <qt5keychain/keychain.h>
 #include "common/utility.h"
+#include "common/filesystembase.h"
+#include "common/asserts.h"
 
 #include "wordlist.h"
 
@@ -93,11 +96,34 @@ namespace {
 } // ns
 
 namespace {
+    const int fileEncryptionBlockSize = 256 * 1024;
+
     unsigned char* unsignedData(QByteArray& array)
     {
         return (unsigned char*)array.data();
     }
 
+    // Multiplies x by h in GF(2^128) as defined for GHASH, see NIST SP 800-38D 6.3
+    void gcmMultiply(unsigned char *x, const unsigned char *h)
+    {
+        unsigned char z[16] = {};
+        unsigned char v[16];
+        memcpy(v, h, 16);
+        for (int i = 0; i < 128; ++i) {
+            if (x[i / 8] & (0x80 >> (i % 8))) {
+                for (int j = 0; j < 16; ++j)
+                    z[j] ^= v[j];
+            }
+            const bool lowestBit = v[15] & 1;
+            for (int j = 15; j > 0; --j)
+                v[j] = (unsigned char)((v[j] >> 1) | (v[j - 1] << 7));
+            v[0] >>= 1;
+            if (lowestBit)
+                v[0] ^= 0xe1;
+        }
+        memcpy(x, z, 16);
+    }
+
     //
     // Simple classes for safe (RAII) handling of OpenSSL
     // data structures
@@ -1617,7 +1643,7 @@ bool EncryptionHelper::fileEncryption(const QByteArray &key, const QByteArray &i
     if (!input->open(QIODevice::ReadOnly)) {
       qCDebug(lcCse) << "Could not open input file for reading" << input->errorString();
     }
-    if (!output->open(QIODevice::WriteOnly)) {
+    if (output && !output->open(QIODevice::WriteOnly)) {
       qCDebug(lcCse) << "Could not oppen output file for writing" << output->errorString();
     }
 
@@ -1650,48 +1676,50 @@ bool EncryptionHelper::fileEncryption(const QByteArray &key, const QByteArray &i
         return false;
     }
 
-    QByteArray out(1024 + 16 - 1, '\0');
+    // Large blocks keep the number of read calls and cipher updates low,
+    // the data is encrypted in place
+    QByteArray data(fileEncryptionBlockSize, Qt::Uninitialized);
     int len = 0;
-    int total_len = 0;
 
     qCDebug(lcCse) << "Starting to encrypt the file" << input->fileName() << input->atEnd();
     while(!input->atEnd()) {
-        QByteArray data = input->read(1024);
+        const qint64 read = input->read(data.data(), data.size());
 
-        if (data.size() == 0) {
+        if (read <= 0) {
             qCInfo(lcCse()) << "Could not read data from file";
             return false;
         }
 
-        qCDebug(lcCse) << "Encrypting " << data;
-        if(!EVP_EncryptUpdate(ctx, unsignedData(out), &len, (unsigned char *)data.constData(), data.size())) {
+        if(!EVP_EncryptUpdate(ctx, unsignedData(data), &len, unsignedData(data), int(read))) {
             qCInfo(lcCse()) << "Could not encrypt";
             return false;
         }
 
-        output->write(out, len);
-        total_len += len;
+        if (output)
+            output->write(data.constData(), len);
     }
 
-    if(1 != EVP_EncryptFinal_ex(ctx, unsignedData(out), &len)) {
+    if(1 != EVP_EncryptFinal_ex(ctx, unsignedData(data), &len)) {
         qCInfo(lcCse()) << "Could finalize encryption";
         return false;
     }
-    output->write(out, len);
-    total_len += len;
+    if (output)
+        output->write(data.constData(), len);
 
     /* Get the tag */
-    QByteArray tag(16, '\0');
-    if(1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, 16, unsignedData(tag))) {
+    QByteArray tag(EncryptedFileDevice::tagSize, '\0');
+    if(1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, EncryptedFileDevice::tagSize, unsignedData(tag))) {
         qCInfo(lcCse()) << "Could not get tag";
         return false;
     }
 
     returnTag = tag;
-    output->write(tag, 16);
 
     input->close();
-    output->close();
+    if (output) {
+        output->write(tag, EncryptedFileDevice::tagSize);
+        output->close();
+    }
     qCDebug(lcCse) << "File Encrypted Successfully";
     return true;
 }
@@ -1702,78 +1730,339 @@ bool EncryptionHelper::fileDecryption(const QByteArray &key, const QByteArray& i
     input->open(QIODevice::ReadOnly);
     output->open(QIODevice::WriteOnly);
 
-    // Init
-    CipherCtx ctx;
+    StreamingDecryptor decryptor(key, iv);
+    if (!decryptor.isInitialized()) {
+        return false;
+    }
 
-    /* Create and initialise the context */
-    if(!ctx) {
-        qCInfo(lcCse()) << "Could not create context";
+    QByteArray data(fileEncryptionBlockSize, Qt::Uninitialized);
+    QByteArray out(fileEncryptionBlockSize, Qt::Uninitialized);
+
+    while(!input->atEnd()) {
+        const qint64 read = input->read(data.data(), data.size());
+
+        if (read <= 0) {
+            qCInfo(lcCse()) << "Could not read data from file";
+            return false;
+        }
+
+        const int len = decryptor.update(data.constData(), int(read), out.data());
+        if (len < 0) {
+            return false;
+        }
+
+        output->write(out.constData(), len);
+    }
+
+    if (!decryptor.finish()) {
         return false;
     }
 
-    /* Initialise the decryption operation. */
-    if(!EVP_DecryptInit_ex(ctx, EVP_aes_128_gcm(), nullptr, nullptr, nullptr)) {
-        qCInfo(lcCse()) << "Could not init cipher";
+    input->close();
+    output->close();
+    return true;
+}
+
+
+EncryptedFileDevice::EncryptedFileDevice(const QString &fileName, const QByteArray &key, const QByteArray &iv, const QByteArray &tag)
+    : _file(fileName)
+    , _key(key)
+    , _iv(iv)
+    , _tag(tag)
+{
+    Q_ASSERT(_tag.size() == tagSize);
+}
+
+EncryptedFileDevice::~EncryptedFileDevice()
+{
+    EVP_CIPHER_CTX_free(_ctx);
+}
+
+bool EncryptedFileDevice::open(QIODevice::OpenMode mode)
+{
+    if (mode & QIODevice::WriteOnly)
+        return false;
+
+    QString openError;
+    if (!FileSystem::openAndSeekFileSharedRead(&_file, &openError, 0)) {
+        setErrorString(openError);
         return false;
     }
+    _plaintextSize = _file.size();
+    _pos = 0;
 
-    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    if (!_ctx)
+        _ctx = EVP_CIPHER_CTX_new();
+    if (!_ctx || !computeFirstCounter() || !startKeyStream(0)) {
+        setErrorString(tr("Could not initialize the encryption of %1").arg(_file.fileName()));
+        _file.close();
+        return false;
+    }
 
-    /* Set IV length. */
-    if(!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN,  iv.size(), nullptr)) {
-        qCInfo(lcCse()) << "Could not set iv length";
+    return QIODevice::open(mode);
+}
+
+void EncryptedFileDevice::close()
+{
+    _file.close();
+    QIODevice::close();
+}
+
+qint64 EncryptedFileDevice::size() const
+{
+    return (isOpen() ? _plaintextSize : _file.size()) + tagSize;
+}
+
+bool EncryptedFileDevice::isSequential() const
+{
+    return false;
+}
+
+bool EncryptedFileDevice::seek(qint64 pos)
+{
+    if (pos < 0 || pos > size() || !QIODevice::seek(pos))
+        return false;
+    if (pos < _plaintextSize && (!_file.seek(pos) || !startKeyStream(pos)))
         return false;
+    _pos = pos;
+    return true;
+}
+
+qint64 EncryptedFileDevice::readData(char *data, qint64 maxlen)
+{
+    qint64 done = 0;
+    if (_pos < _plaintextSize) {
+        const qint64 read = _file.read(data, qMin(maxlen, _plaintextSize - _pos));
+        if (read <= 0) {
+            setErrorString(read < 0 ? _file.errorString() : tr("%1 became shorter while it was read").arg(_file.fileName()));
+            return -1;
+        }
+
+        // Encrypt in place, restarting the key stream where the counter wraps around
+        auto bytes = reinterpret_cast<unsigned char *>(data);
+        while (done < read) {
+            if (_pos == _keyStreamEnd && !startKeyStream(_pos)) {
+                setErrorString(tr("Could not encrypt %1").arg(_file.fileName()));
+                return -1;
+            }
+            const int len = int(qMin(read - done, _keyStreamEnd - _pos));
+            int outLen = 0;
+            if (!EVP_EncryptUpdate(_ctx, bytes + done, &outLen, bytes + done, len) || outLen != len) {
+                setErrorString(tr("Could not encrypt %1").arg(_file.fileName()));
+                return -1;
+            }
+            done += len;
+            _pos += len;
+        }
     }
 
-    /* Initialise key and IV */
-    if(!EVP_DecryptInit_ex(ctx, nullptr, nullptr, (const unsigned char *) key.constData(), (const unsigned char *) iv.constData())) {
-        qCInfo(lcCse()) << "Could not set key and iv";
+    // The tag follows the data
+    if (done < maxlen && _pos >= _plaintextSize && _pos < size()) {
+        const qint64 tagPos = _pos - _plaintextSize;
+        const qint64 len = qMin(maxlen - done, tagSize - tagPos);
+        memcpy(data + done, _tag.constData() + tagPos, size_t(len));
+        done += len;
+        _pos += len;
+    }
+    return done;
+}
+
+qint64 EncryptedFileDevice::writeData(const char *, qint64)
+{
+    ASSERT(false, "write to read only device");
+    return -1;
+}
+
+bool EncryptedFileDevice::computeFirstCounter()
+{
+    // H is the encryption of the zero block
+    unsigned char h[16] = {};
+    int len = 0;
+    if (!EVP_EncryptInit_ex(_ctx, EVP_aes_128_ecb(), nullptr, (const unsigned char *)_key.constData(), nullptr)
+        || !EVP_CIPHER_CTX_set_padding(_ctx, 0)
+        || !EVP_EncryptUpdate(_ctx, h, &len, h, sizeof(h))) {
         return false;
     }
 
-    qint64 size = input->size() - 16;
+    // The pre-counter block J0 is IV || 0^31 || 1 for 96 bit IVs
+    // and GHASH(IV || padding || [bit length of IV]_64) otherwise
+    unsigned char j0[16] = {};
+    if (_iv.size() == 12) {
+        memcpy(j0, _iv.constData(), 12);
+        j0[15] = 1;
+        _firstCounter = QByteArray(reinterpret_cast<const char *>(j0), sizeof(j0));
+        return true;
+    }
+    for (int i = 0; i < _iv.size(); i += 16) {
+        for (int j = 0; j < 16 && i + j < _iv.size(); ++j)
+            j0[j] ^= (unsigned char)_iv.at(i + j);
+        gcmMultiply(j0, h);
+    }
+    const quint64 ivBits = quint64(_iv.size()) * 8;
+    for (int j = 0; j < 8; ++j)
+        j0[15 - j] ^= (unsigned char)(ivBits >> (8 * j));
+    gcmMultiply(j0, h);
+
+    _firstCounter = QByteArray(reinterpret_cast<const char *>(j0), sizeof(j0));
+    return true;
+}
+
+bool EncryptedFileDevice::startKeyStream(qint64 pos)
+{
+    // GCM increments only the low 32 bits of the counter block, starting at J0 + 1,
+    // while counter mode carries into the other bits: the key stream has to be
+    // restarted where the low 32 bits wrap around.
+    const auto first = reinterpret_cast<const unsigned char *>(_firstCounter.constData());
+    const quint32 firstLow = (quint32(first[12]) << 24) | (quint32(first[13]) << 16) | (quint32(first[14]) << 8) | quint32(first[15]);
+    const quint32 low = firstLow + 1 + quint32(pos / 16);
+
+    unsigned char counter[16];
+    memcpy(counter, first, 12);
+    counter[12] = (unsigned char)(low >> 24);
+    counter[13] = (unsigned char)(low >> 16);
+    counter[14] = (unsigned char)(low >> 8);
+    counter[15] = (unsigned char)low;
+
+    if (!EVP_EncryptInit_ex(_ctx, EVP_aes_128_ctr(), nullptr, (const unsigned char *)_key.constData(), counter))
+        return false;
+    _keyStreamEnd = (pos / 16 + (qint64(0xffffffff) - low + 1)) * 16;
 
-    QByteArray out(1024 + 16 - 1, '\0');
+    // Skip to pos inside the block
+    unsigned char skipped[16] = {};
     int len = 0;
+    return pos % 16 == 0 || EVP_EncryptUpdate(_ctx, skipped, &len, skipped, int(pos % 16));
+}
 
-    while(input->pos() < size) {
+StreamingDecryptor::StreamingDecryptor(const QByteArray &key, const QByteArray &iv)
+    : _key(key)
+    , _iv(iv)
+{
+    restart();
+}
 
-        auto toRead = size - input->pos();
-        if (toRead > 1024) {
-            toRead = 1024;
-        }
+StreamingDecryptor::~StreamingDecryptor()
+{
+    EVP_CIPHER_CTX_free(_ctx);
+}
+
+bool StreamingDecryptor::restart()
+{
+    _pending.clear();
+    _tag.clear();
+
+    EVP_CIPHER_CTX_free(_ctx);
+    _ctx = EVP_CIPHER_CTX_new();
+    if (!_ctx) {
+        qCInfo(lcCse()) << "Could not create context";
+        return false;
+    }
+
+    if (!EVP_DecryptInit_ex(_ctx, EVP_aes_128_gcm(), nullptr, nullptr, nullptr)
+        || !EVP_CIPHER_CTX_ctrl(_ctx, EVP_CTRL_GCM_SET_IVLEN, _iv.size(), nullptr)
+        || !EVP_DecryptInit_ex(_ctx, nullptr, nullptr, (const unsigned char *)_key.constData(), (const unsigned char *)_iv.constData())) {
+        qCInfo(lcCse()) << "Could not init cipher";
+        EVP_CIPHER_CTX_free(_ctx);
+        _ctx = nullptr;
+        return false;
+    }
+    EVP_CIPHER_CTX_set_padding(_ctx, 0);
+    return true;
+}
 
-        QByteArray data = input->read(toRead);
+bool StreamingDecryptor::resume(QIODevice *plaintext)
+{
+    Q_ASSERT(_pending.isEmpty());
+    if (!_ctx) {
+        return false;
+    }
+
+    CipherCtx encryptCtx;
+    if (!encryptCtx
+        || !EVP_EncryptInit_ex(encryptCtx, EVP_aes_128_gcm(), nullptr, nullptr, nullptr)
+        || !EVP_CIPHER_CTX_ctrl(encryptCtx, EVP_CTRL_GCM_SET_IVLEN, _iv.size(), nullptr)
+        || !EVP_EncryptInit_ex(encryptCtx, nullptr, nullptr, (const unsigned char *)_key.constData(), (const unsigned char *)_iv.constData())) {
+        qCInfo(lcCse()) << "Could not init cipher";
+        return false;
+    }
 
-        if (data.size() == 0) {
+    // Encrypt the plaintext again and pass the ciphertext through the decryption,
+    // both in place: only the state of _ctx is needed
+    QByteArray data(fileEncryptionBlockSize, Qt::Uninitialized);
+    int len = 0;
+    while (!plaintext->atEnd()) {
+        const qint64 read = plaintext->read(data.data(), data.size());
+        if (read <= 0) {
             qCInfo(lcCse()) << "Could not read data from file";
             return false;
         }
-
-        if(!EVP_DecryptUpdate(ctx, unsignedData(out), &len, (unsigned char *)data.constData(), data.size())) {
-            qCInfo(lcCse()) << "Could not decrypt";
+        if (!EVP_EncryptUpdate(encryptCtx, unsignedData(data), &len, unsignedData(data), int(read))
+            || !EVP_DecryptUpdate(_ctx, unsignedData(data), &len, unsignedData(data), len)) {
+            qCInfo(lcCse()) << "Could not encrypt";
             return false;
         }
+    }
+    return true;
+}
+
+int StreamingDecryptor::update(const char *data, int size, char *output)
+{
+    if (!_ctx) {
+        return -1;
+    }
+
+    // Decrypt everything but the last tagSize bytes
+    const int toDecrypt = _pending.size() + size - EncryptedFileDevice::tagSize;
+    if (toDecrypt <= 0) {
+        _pending.append(data, size);
+        return 0;
+    }
 
-        output->write(out, len);
+    const int fromPending = qMin(toDecrypt, _pending.size());
+    const int fromData = toDecrypt - fromPending;
+    int written = 0;
+    int len = 0;
+    if (fromPending > 0) {
+        if (!EVP_DecryptUpdate(_ctx, (unsigned char *)output, &len, unsignedData(_pending), fromPending)) {
+            qCInfo(lcCse()) << "Could not decrypt";
+            return -1;
+        }
+        written += len;
+    }
+    if (fromData > 0) {
+        if (!EVP_DecryptUpdate(_ctx, (unsigned char *)output + written, &len, (const unsigned char *)data, fromData)) {
+            qCInfo(lcCse()) << "Could not decrypt";
+            return -1;
+        }
+        written += len;
     }
 
-    QByteArray tag = input->read(16);
+    _pending.remove(0, fromPending);
+    _pending.append(data + fromData, size - fromData);
+    return written;
+}
+
+bool StreamingDecryptor::finish()
+{
+    if (!_ctx || _pending.size() != EncryptedFileDevice::tagSize) {
+        qCInfo(lcCse()) << "The data is too short for the tag";
+        return false;
+    }
 
     /* Set expected tag value. Works in OpenSSL 1.0.1d and later */
-    if(!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, tag.size(), (unsigned char *)tag.constData())) {
+    if (!EVP_CIPHER_CTX_ctrl(_ctx, EVP_CTRL_GCM_SET_TAG, _pending.size(), unsignedData(_pending))) {
         qCInfo(lcCse()) << "Could not set expected tag";
         return false;
     }
 
-    if(1 != EVP_DecryptFinal_ex(ctx, unsignedData(out), &len)) {
+    unsigned char out[EncryptedFileDevice::tagSize];
+    int len = 0;
+    if (1 != EVP_DecryptFinal_ex(_ctx, out, &len)) {
         qCInfo(lcCse()) << "Could finalize decryption";
         return false;
     }
-    output->write(out, len);
 
-    input->close();
-    output->close();
+    _tag = _pending;
+    _pending.clear();
     return true;
 }
 
@@ -60,9 +60,19 @@ namespace EncryptionHelper {
             const QByteArray& data
     );
 
+    /**
+     * Encrypts input into output and returns the tag, which is also appended to output.
+     *
+     * Without output only the tag is computed, see EncryptedFileDevice.
+     */
     bool fileEncryption(const QByteArray &key, const QByteArray &iv,
                       QFile *input, QFile *output, QByteArray& returnTag);
 
+    /**
+     * Decrypts input, which ends with the tag, into output.
+     *
+     * Downloads decrypt while receiving the data instead, see StreamingDecryptor.
+     */
     bool fileDecryption(const QByteArray &key, const QByteArray& iv,
                                QFile *input, QFile *output);
 }
@@ -133,6 +143,106 @@ struct EncryptedFile {
     int metadataKey;
 };
 
+/**
+ * Read-only device with the AES-GCM encryption of a file, followed by its tag.
+ *
+ * The ciphertext is computed while reading, so no encrypted copy of the file is
+ * written. GCM encrypts with a counter mode key stream that doesn't depend on the
+ * data, so the device can seek like the file, for example for upload chunks.
+ *
+ * The tag can only be computed from the whole file: get it beforehand with
+ * EncryptionHelper::fileEncryption() without output.
+ */
+class OWNCLOUDSYNC_EXPORT EncryptedFileDevice : public QIODevice
+{
+    Q_OBJECT
+public:
+    static constexpr int tagSize = 16;
+
+    EncryptedFileDevice(const QString &fileName, const QByteArray &key, const QByteArray &iv, const QByteArray &tag);
+    ~EncryptedFileDevice() override;
+
+    bool open(QIODevice::OpenMode mode) override;
+    void close() override;
+    qint64 size() const override;
+    bool isSequential() const override;
+    bool seek(qint64 pos) override;
+
+protected:
+    qint64 readData(char *data, qint64 maxlen) override;
+    qint64 writeData(const char *data, qint64 len) override;
+
+private:
+    bool computeFirstCounter();
+    bool startKeyStream(qint64 pos);
+
+    QFile _file;
+    QByteArray _key;
+    QByteArray _iv;
+    QByteArray _tag;
+    qint64 _plaintextSize = 0;
+
+    EVP_CIPHER_CTX *_ctx = nullptr;
+    // The GCM counter block of the first block of data
+    QByteArray _firstCounter;
+    // The position in the ciphertext
+    qint64 _pos = 0;
+    // Where the low 32 bits of the counter wrap around, see startKeyStream()
+    qint64 _keyStreamEnd = 0;
+};
+
+/**
+ * Decrypts the AES-GCM encryption of a file piece by piece, as it is received.
+ *
+ * The data ends with the tag, but where it ends is only known once all of it
+ * was passed to update(): the last tagSize bytes are always held back, and
+ * finish() checks them.
+ */
+class OWNCLOUDSYNC_EXPORT StreamingDecryptor
+{
+public:
+    StreamingDecryptor(const QByteArray &key, const QByteArray &iv);
+    ~StreamingDecryptor();
+
+    bool isInitialized() const { return _ctx != nullptr; }
+
+    /// Forgets the data passed so far, to decrypt from the start again
+    bool restart();
+
+    /**
+     * Continues after the plaintext in \a plaintext, up to its end.
+     *
+     * For resuming a download: the tag covers the whole ciphertext, so the
+     * plaintext is encrypted again. Must be called before update().
+     */
+    bool resume(QIODevice *plaintext);
+
+    /**
+     * Decrypts \a size bytes of data into \a output.
+     *
+     * \a output must have room for \a size bytes. Returns the number of bytes
+     * written to it, which may be less because of the held back bytes, or -1
+     * on error.
+     */
+    int update(const char *data, int size, char *output);
+
+    /// Checks the tag after all data was passed to update()
+    bool finish();
+
+    /// The tag, once finish() succeeded
+    QByteArray tag() const { return _tag; }
+
+private:
+    Q_DISABLE_COPY(StreamingDecryptor)
+
+    QByteArray _key;
+    QByteArray _iv;
+    EVP_CIPHER_CTX *_ctx = nullptr;
+    // The last bytes passed to update(), the tag if no more data follows
+    QByteArray _pending;
+    QByteArray _tag;
+};
+
 class OWNCLOUDSYNC_EXPORT FolderMetadata {
 public:
     FolderMetadata(AccountPtr account, const QByteArray& metadata = QByteArray(), int statusCode = -1);
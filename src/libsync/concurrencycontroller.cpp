@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "concurrencycontroller.h"
+
+#include <QLoggingCategory>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcConcurrencyController, "nextcloud.sync.concurrencycontroller", QtInfoMsg)
+
+// A larger window must improve the throughput by this factor to be kept
+static const double improvementFactor = 1.05;
+
+// The latency of small transfers may grow by this factor (plus some slack
+// against jitter) before the server is considered to be congested
+static const double latencyFactor = 2.0;
+static const double latencySlackMs = 50.0;
+
+// Number of rounds after which a window that did not help is probed again
+static const int ceilingRounds = 8;
+
+void ConcurrencyController::setBounds(int minimum, int maximum, int initial)
+{
+    _minimum = qMax(1, minimum);
+    _maximum = qMax(_minimum, maximum);
+    if (_window == 0) {
+        _window = qBound(_minimum, initial, _maximum);
+    } else {
+        _window = qBound(_minimum, _window, _maximum);
+    }
+}
+
+void ConcurrencyController::setWindow(int window)
+{
+    window = qBound(_minimum, window, _maximum);
+    if (window != _window) {
+        qCInfo(lcConcurrencyController) << "Changing the number of parallel transfers from" << _window << "to" << window;
+        _window = window;
+    }
+}
+
+void ConcurrencyController::transferFinished(qint64 bytes, std::chrono::milliseconds duration, Outcome outcome)
+{
+    if (_window == 0)
+        setBounds(_minimum, _maximum, _minimum);
+
+    switch (outcome) {
+    case Outcome::ServerOverloaded:
+        // Like a packet loss: back off multiplicatively and start measuring afresh
+        qCInfo(lcConcurrencyController) << "Server reported to be overloaded";
+        setWindow(_window / 2);
+        _roundTransfers = 0;
+        _roundBytes = 0;
+        _roundDurationMs = 0;
+        _roundProbes = 0;
+        _roundProbeDurationMs = 0;
+        _previousWindow = -1;
+        return;
+    case Outcome::Failure:
+        // Says nothing about the throughput or the server load
+        return;
+    case Outcome::Success:
+        break;
+    }
+
+    const qint64 durationMs = qMax<qint64>(1, duration.count());
+    ++_roundTransfers;
+    _roundBytes += bytes;
+    _roundDurationMs += durationMs;
+    if (bytes < latencyProbeSize) {
+        ++_roundProbes;
+        _roundProbeDurationMs += durationMs;
+    }
+
+    if (_roundTransfers >= _window)
+        finishRound();
+}
+
+void ConcurrencyController::finishRound()
+{
+    // Little's law: with _window transfers in flight that take d on average,
+    // _window / d transfers complete per time unit.
+    const double byteRate = double(_window) * _roundBytes / _roundDurationMs;
+    const double jobRate = double(_window) * _roundTransfers / _roundDurationMs;
+
+    bool latencyIncreased = false;
+    if (_roundProbes > 0) {
+        const double latencyMs = double(_roundProbeDurationMs) / _roundProbes;
+        if (_baseLatencyMs < 0 || latencyMs < _baseLatencyMs)
+            _baseLatencyMs = latencyMs;
+        latencyIncreased = latencyMs > _baseLatencyMs * latencyFactor + latencySlackMs;
+    }
+
+    const bool grew = _previousWindow > 0 && _previousWindow < _window;
+    const bool improved = byteRate > _previousByteRate * improvementFactor
+        || jobRate > _previousJobRate * improvementFactor;
+
+    if (_ceiling > 0 && ++_roundsSinceCeiling > ceilingRounds)
+        _ceiling = 0;
+
+    int newWindow = _window + 1;
+    if (latencyIncreased) {
+        newWindow = _window - 1;
+    } else if (grew && !improved) {
+        // The last step up did not pay off: go back and stay there for a while
+        _ceiling = _window;
+        _roundsSinceCeiling = 0;
+        newWindow = _previousWindow;
+    } else if (_ceiling > 0 && newWindow >= _ceiling) {
+        newWindow = _window;
+    }
+
+    _previousWindow = _window;
+    _previousByteRate = byteRate;
+    _previousJobRate = jobRate;
+    _roundTransfers = 0;
+    _roundBytes = 0;
+    _roundDurationMs = 0;
+    _roundProbes = 0;
+    _roundProbeDurationMs = 0;
+
+    setWindow(newWindow);
+}
+
+ConcurrencyController::Outcome ConcurrencyController::outcomeForHttpStatus(int httpStatusCode, bool success)
+{
+    switch (httpStatusCode) {
+    case 429: // Too Many Requests
+    case 502: // Bad Gateway
+    case 503: // Service Unavailable
+    case 504: // Gateway Timeout
+        return Outcome::ServerOverloaded;
+    default:
+        return success ? Outcome::Success : Outcome::Failure;
+    }
+}
+
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "owncloudlib.h"
+#include <QtGlobal>
+#include <chrono>
+
+namespace OCC {
+
+/**
+ * @brief Adapts the number of transfers that run in parallel
+ *
+ * Works similar to TCP congestion control: the window of parallel transfers
+ * grows additively as long as it increases the throughput and the server
+ * keeps answering quickly. It shrinks by one when the latency of small
+ * transfers goes up or a larger window did not help, and it is halved when
+ * the server reports to be overloaded.
+ *
+ * The window is evaluated in rounds: a round ends once as many transfers
+ * completed as the window allows to run in parallel. The aggregate throughput
+ * of a round is estimated from the completed transfers with Little's law,
+ * so it does not depend on wall clock time between rounds.
+ *
+ * The controller lives in SyncOptions and is shared by the copies of them,
+ * so the window survives from one sync run to the next.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT ConcurrencyController
+{
+public:
+    enum class Outcome {
+        Success,
+        /// The transfer failed for reasons unrelated to the server load
+        Failure,
+        /// The server or a proxy reported to be overloaded (429, 502, 503, 504)
+        ServerOverloaded,
+    };
+
+    /** Transfers smaller than this are dominated by the request latency
+     * and are used to measure it.
+     */
+    static constexpr qint64 latencyProbeSize = 100 * 1024;
+
+    /** Sets the bounds of the window.
+     *
+     * If the window was not set up yet it starts at \a initial, otherwise
+     * the current window is kept within the new bounds.
+     */
+    void setBounds(int minimum, int maximum, int initial);
+
+    int window() const { return _window; }
+    int minimum() const { return _minimum; }
+    int maximum() const { return _maximum; }
+
+    /** Records a finished transfer of \a bytes that took \a duration */
+    void transferFinished(qint64 bytes, std::chrono::milliseconds duration, Outcome outcome);
+
+    /** Classifies the outcome of a transfer based on its http status code */
+    static Outcome outcomeForHttpStatus(int httpStatusCode, bool success);
+
+private:
+    void setWindow(int window);
+    void finishRound();
+
+    int _minimum = 1;
+    int _maximum = 1;
+    int _window = 0;
+
+    // Samples of the current round
+    int _roundTransfers = 0;
+    qint64 _roundBytes = 0;
+    qint64 _roundDurationMs = 0;
+    int _roundProbes = 0;
+    qint64 _roundProbeDurationMs = 0;
+
+    // Results of the previous round, -1 when unknown
+    int _previousWindow = -1;
+    double _previousByteRate = -1;
+    double _previousJobRate = -1;
+
+    /// Smallest average latency of small transfers seen so far, -1 when unknown
+    double _baseLatencyMs = -1;
+
+    /// A window size that turned out not to help; avoided for a few rounds
+    int _ceiling = 0;
+    int _roundsSinceCeiling = 0;
+};
+
+}
@@ -81,6 +81,14 @@ static const char chunkSizeC[] = "chunkSize";
 static const char minChunkSizeC[] = "minChunkSize";
 static const char maxChunkSizeC[] = "maxChunkSize";
 static const char targetChunkUploadDurationC[] = "targetChunkUploadDuration";
+static const char parallelChunkUploadsC[] = "parallelChunkUploads";
+static const char deltaSyncMinFileSizeC[] = "deltaSyncMinFileSize";
+static const char minParallelTransfersC[] = "minParallelTransfers";
+static const char maxParallelTransfersC[] = "maxParallelTransfers";
+static const char maxConcurrentSyncsC[] = "maxConcurrentSyncs";
+static const char maxParallelLocalScansC[] = "maxParallelLocalScans";
+static const char useJournalSnapshotC[] = "useJournalSnapshot";
+static const char asyncJournalWritesC[] = "asyncJournalWrites";
 static const char automaticLogDirC[] = "logToTemporaryLogDir";
 static const char logDirC[] = "logDir";
 static const char logDebugC[] = "logDebug";
@@ -244,6 +252,54 @@ chrono::milliseconds ConfigFile::targetChunkUploadDuration() const
     return millisecondsValue(settings, targetChunkUploadDurationC, chrono::minutes(1));
 }
 
+int ConfigFile::parallelChunkUploads() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(parallelChunkUploadsC), 1).toInt(); // default to sequential chunks
+}
+
+qint64 ConfigFile::deltaSyncMinFileSize() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(deltaSyncMinFileSizeC), 10 * 1000 * 1000).toLongLong(); // default to 10 MB
+}
+
+int ConfigFile::minParallelTransfers() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(minParallelTransfersC), 1).toInt();
+}
+
+int ConfigFile::maxParallelTransfers() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(maxParallelTransfersC), 0).toInt(); // 0: as many as parallel jobs
+}
+
+int ConfigFile::maxParallelLocalScans() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(maxParallelLocalScansC), 0).toInt(); // 0: one per CPU core
+}
+
+bool ConfigFile::useJournalSnapshot() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(useJournalSnapshotC), false).toBool();
+}
+
+bool ConfigFile::asyncJournalWrites() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(asyncJournalWritesC), false).toBool();
+}
+
+int ConfigFile::maxConcurrentSyncs() const
+{
+    QSettings settings(configFile(), QSettings::IniFormat);
+    return settings.value(QLatin1String(maxConcurrentSyncsC), 3).toInt();
+}
+
 void ConfigFile::setOptionalServerNotifications(bool show)
 {
     QSettings settings(configFile(), QSettings::IniFormat);
@@ -163,6 +163,22 @@ public:
     qint64 maxChunkSize() const;
     qint64 minChunkSize() const;
     std::chrono::milliseconds targetChunkUploadDuration() const;
+    int parallelChunkUploads() const;
+    qint64 deltaSyncMinFileSize() const;
+    int minParallelTransfers() const;
+    int maxParallelTransfers() const;
+
+    /// How many local directories discovery lists in parallel, 0 for one per CPU core
+    int maxParallelLocalScans() const;
+
+    /// Whether discovery reads the journal into memory at the start of each sync
+    bool useJournalSnapshot() const;
+
+    /// Whether the journal is written by a separate thread during the sync
+    bool asyncJournalWrites() const;
+
+    /// How many folders may sync at the same time, at most one per account
+    int maxConcurrentSyncs() const;
 
     void saveGeometry(QWidget *w);
     void restoreGeometry(QWidget *w);
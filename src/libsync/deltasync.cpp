@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "deltasync.h"
+#include "account.h"
+#include "common/checksums.h"
+#include "common/utility.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QMultiHash>
+
+#include <memory>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcDeltaSync, "nextcloud.sync.deltasync", QtInfoMsg)
+
+namespace {
+    constexpr quint32 manifestMagic = 0x4e43424d; // "NCBM"
+    constexpr quint32 manifestVersion = 1;
+    constexpr qint64 minBlockSize = 64 * 1024;
+    constexpr qint64 maxBlockCount = 64 * 1024;
+    constexpr int strongHashSize = 16; // MD5
+
+    QByteArray strongHash(const char *data, qint64 length)
+    {
+        return QCryptographicHash::hash(QByteArray::fromRawData(data, int(length)), QCryptographicHash::Md5);
+    }
+
+    /// Reads until \a length bytes are read or the device is at its end
+    qint64 readFully(QIODevice *device, char *data, qint64 length)
+    {
+        qint64 done = 0;
+        while (done < length) {
+            const auto read = device->read(data + done, length - done);
+            if (read < 0)
+                return -1;
+            if (read == 0)
+                break;
+            done += read;
+        }
+        return done;
+    }
+}
+
+qint64 BlockManifest::blockSizeFor(qint64 fileSize)
+{
+    qint64 blockSize = minBlockSize;
+    while (fileSize / blockSize > maxBlockCount)
+        blockSize *= 2;
+    return blockSize;
+}
+
+quint32 BlockManifest::weakChecksum(const char *data, qint64 length)
+{
+    quint32 a = 0;
+    quint32 b = 0;
+    for (qint64 i = 0; i < length; ++i) {
+        const auto byte = uchar(data[i]);
+        a += byte;
+        b += quint32(length - i) * byte;
+    }
+    return (a & 0xffff) | ((b & 0xffff) << 16);
+}
+
+BlockManifest BlockManifest::compute(QIODevice *device, qint64 blockSize,
+    const QByteArray &checksumType, QByteArray *checksum)
+{
+    BlockManifest manifest;
+    if (blockSize <= 0)
+        return manifest;
+
+    std::unique_ptr<ChecksumCalculator> calculator;
+    if (!checksumType.isEmpty())
+        calculator = std::make_unique<ChecksumCalculator>(checksumType);
+
+    QByteArray buffer(int(blockSize), Qt::Uninitialized);
+    while (true) {
+        const auto read = readFully(device, buffer.data(), blockSize);
+        if (read < 0) {
+            qCWarning(lcDeltaSync) << "Could not read block" << manifest.blocks.size() << device->errorString();
+            return BlockManifest();
+        }
+        if (read == 0)
+            break;
+        manifest.blocks.append({ weakChecksum(buffer.constData(), read), strongHash(buffer.constData(), read) });
+        manifest.fileSize += read;
+        if (calculator)
+            calculator->addData(buffer.constData(), read);
+        if (read < blockSize)
+            break;
+    }
+    manifest.blockSize = blockSize;
+    if (calculator && checksum)
+        *checksum = calculator->result();
+    return manifest;
+}
+
+bool BlockManifest::isValid() const
+{
+    if (blockSize <= 0 || fileSize < 0)
+        return false;
+    if (blocks.size() != (fileSize + blockSize - 1) / blockSize)
+        return false;
+    for (const auto &block : blocks) {
+        if (block.strong.size() != strongHashSize)
+            return false;
+    }
+    return true;
+}
+
+qint64 BlockManifest::blockLength(int index) const
+{
+    return qMin(blockSize, fileSize - index * blockSize);
+}
+
+QByteArray BlockManifest::serialize() const
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << manifestMagic << manifestVersion << fileSize << blockSize << etag << quint32(blocks.size());
+    for (const auto &block : blocks) {
+        stream << block.weak;
+        stream.writeRawData(block.strong.constData(), block.strong.size());
+    }
+    return data;
+}
+
+BlockManifest BlockManifest::parse(const QByteArray &data)
+{
+    QDataStream stream(data);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    quint32 count = 0;
+    BlockManifest manifest;
+    stream >> magic >> version >> manifest.fileSize >> manifest.blockSize >> manifest.etag >> count;
+    if (stream.status() != QDataStream::Ok || magic != manifestMagic || version != manifestVersion
+        || manifest.blockSize <= 0 || manifest.fileSize < 0
+        || qint64(count) != (manifest.fileSize + manifest.blockSize - 1) / manifest.blockSize) {
+        return BlockManifest();
+    }
+
+    manifest.blocks.reserve(int(count));
+    for (quint32 i = 0; i < count; ++i) {
+        Block block;
+        block.strong.resize(strongHashSize);
+        stream >> block.weak;
+        if (stream.readRawData(block.strong.data(), strongHashSize) != strongHashSize)
+            return BlockManifest();
+        manifest.blocks.append(block);
+    }
+    if (stream.status() != QDataStream::Ok)
+        return BlockManifest();
+    return manifest;
+}
+
+QUrl BlockManifest::url(const AccountPtr &account, const QByteArray &fileId)
+{
+    return Utility::concatUrlPath(account->url(),
+        QStringLiteral("remote.php/dav/manifests/") + account->davUser() + QLatin1Char('/') + QString::fromUtf8(fileId));
+}
+
+DeltaPlan DeltaPlan::match(const BlockManifest &manifest, QIODevice *local)
+{
+    DeltaPlan plan;
+    plan.localOffsets.fill(-1, manifest.blocks.size());
+    if (!manifest.isValid())
+        return plan;
+
+    const qint64 blockSize = manifest.blockSize;
+    QMultiHash<quint32, int> blocksByWeak;
+    for (int i = 0; i < manifest.blocks.size(); ++i) {
+        if (manifest.blockLength(i) == blockSize)
+            blocksByWeak.insert(manifest.blocks[i].weak, i);
+    }
+    int unmatched = blocksByWeak.size();
+
+    // The window [pos, pos + blockSize) slides over the local file, buffer
+    // holds the data starting at bufferOffset.
+    const qint64 readSize = qMax<qint64>(4 * blockSize, 1024 * 1024);
+    QByteArray buffer;
+    qint64 bufferOffset = 0;
+    qint64 pos = 0;
+    const auto windowAvailable = [&]() {
+        if (pos + blockSize <= bufferOffset + buffer.size())
+            return true;
+        buffer.remove(0, int(pos - bufferOffset));
+        bufferOffset = pos;
+        buffer.append(local->read(readSize));
+        return pos + blockSize <= bufferOffset + buffer.size();
+    };
+
+    quint32 a = 0;
+    quint32 b = 0;
+    bool rolling = false;
+    while (unmatched > 0 && windowAvailable()) {
+        const char *window = buffer.constData() + (pos - bufferOffset);
+        if (!rolling) {
+            const auto weak = BlockManifest::weakChecksum(window, blockSize);
+            a = weak & 0xffff;
+            b = weak >> 16;
+            rolling = true;
+        }
+
+        const quint32 weak = a | (b << 16);
+        bool found = false;
+        auto it = blocksByWeak.constFind(weak);
+        if (it != blocksByWeak.constEnd()) {
+            const auto strong = strongHash(window, blockSize);
+            for (; it != blocksByWeak.constEnd() && it.key() == weak; ++it) {
+                if (manifest.blocks[it.value()].strong != strong)
+                    continue;
+                found = true;
+                if (plan.localOffsets[it.value()] == -1) {
+                    plan.localOffsets[it.value()] = pos;
+                    --unmatched;
+                }
+            }
+        }
+        if (found) {
+            pos += blockSize;
+            rolling = false;
+            continue;
+        }
+
+        // Roll the window forward by one byte
+        const auto out = uchar(window[0]);
+        ++pos;
+        if (!windowAvailable())
+            break;
+        const auto in = uchar(buffer.at(int(pos - bufferOffset + blockSize - 1)));
+        a = (a - out + in) & 0xffff;
+        b = (b - quint32(blockSize) * out + a) & 0xffff;
+    }
+    return plan;
+}
+
+QVector<DeltaPlan::Range> DeltaPlan::missingRanges(const BlockManifest &manifest) const
+{
+    QVector<Range> ranges;
+    for (int i = 0; i < localOffsets.size(); ++i) {
+        if (localOffsets[i] != -1)
+            continue;
+        const qint64 start = i * manifest.blockSize;
+        if (!ranges.isEmpty() && ranges.last().start + ranges.last().length == start) {
+            ranges.last().length += manifest.blockLength(i);
+        } else {
+            ranges.append({ start, manifest.blockLength(i) });
+        }
+    }
+    return ranges;
+}
+
+qint64 DeltaPlan::missingBytes(const BlockManifest &manifest) const
+{
+    qint64 bytes = 0;
+    for (const auto &range : missingRanges(manifest))
+        bytes += range.length;
+    return bytes;
+}
+
+}
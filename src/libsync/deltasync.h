@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+#pragma once
+
+#include "owncloudlib.h"
+#include "accountfwd.h"
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QLoggingCategory>
+#include <QUrl>
+#include <QVector>
+
+namespace OCC {
+
+Q_DECLARE_LOGGING_CATEGORY(lcDeltaSync)
+
+/**
+ * @brief The block hashes of one version of a file
+ * @ingroup libsync
+ *
+ * The file is split into blocks of blockSize bytes, the last one may be
+ * shorter. Each block has an rsync-style rolling checksum, which is cheap to
+ * compute for every offset of another file, and an MD5 hash that confirms a
+ * match.
+ *
+ * Clients publish the manifest of a file they uploaded next to it on the
+ * server. Other clients then only download the blocks they don't have
+ * locally, see PropagateDownloadDelta.
+ */
+class OWNCLOUDSYNC_EXPORT BlockManifest
+{
+public:
+    struct Block
+    {
+        quint32 weak = 0;
+        QByteArray strong;
+    };
+
+    qint64 fileSize = 0;
+    qint64 blockSize = 0;
+    /// The etag of the file version the manifest describes
+    QByteArray etag;
+    QVector<Block> blocks;
+
+    /// The block size used for a file of \a fileSize bytes, at least 64 KiB
+    static qint64 blockSizeFor(qint64 fileSize);
+
+    /// The rolling checksum of \a length bytes
+    static quint32 weakChecksum(const char *data, qint64 length);
+
+    /**
+     * Computes the manifest of the remaining content of \a device.
+     *
+     * If \a checksumType is set, the checksum of the whole content is computed
+     * in the same pass and stored in \a checksum.
+     * Returns an invalid manifest if reading fails.
+     */
+    static BlockManifest compute(QIODevice *device, qint64 blockSize,
+        const QByteArray &checksumType = QByteArray(), QByteArray *checksum = nullptr);
+
+    /// Whether the sizes and the number of blocks are consistent
+    bool isValid() const;
+
+    /// The length of the block at \a index, only the last one may be shorter
+    qint64 blockLength(int index) const;
+
+    QByteArray serialize() const;
+    /// Returns an invalid manifest if \a data is not a manifest
+    static BlockManifest parse(const QByteArray &data);
+
+    /// Where the manifest of the file with \a fileId is stored on the server
+    static QUrl url(const AccountPtr &account, const QByteArray &fileId);
+};
+
+/**
+ * @brief Which blocks of a remote file version are available locally
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT DeltaPlan
+{
+public:
+    struct Range
+    {
+        qint64 start;
+        qint64 length;
+    };
+
+    /// For each block of the manifest, its offset in the local file or -1 if it must be downloaded
+    QVector<qint64> localOffsets;
+
+    /**
+     * Finds the blocks of \a manifest in \a local.
+     *
+     * Blocks are found at any offset, so data that moved because something
+     * was inserted before it is reused as well. The last block is only
+     * looked for if it has the full block size.
+     */
+    static DeltaPlan match(const BlockManifest &manifest, QIODevice *local);
+
+    /// The ranges of the remote file that must be downloaded, adjacent blocks merged
+    QVector<Range> missingRanges(const BlockManifest &manifest) const;
+    qint64 missingBytes(const BlockManifest &manifest) const;
+};
+
+}
@@ -16,6 +16,7 @@
 #include "common/filesystembase.h"
 #include "common/syncjournaldb.h"
 #include "syncfileitem.h"
+#include "account.h"
 #include <QDebug>
 #include <algorithm>
 #include <set>
@@ -23,7 +24,6 @@
 #include "vio/csync_vio_local.h"
 #include <QFileInfo>
 #include <QFile>
-#include <QThreadPool>
 #include "common/checksums.h"
 #include "csync_exclude.h"
 #include "csync.h"
@@ -38,19 +38,21 @@ void ProcessDirectoryJob::start()
     qCInfo(lcDisco) << "STARTING" << _currentFolder._server << _queryServer << _currentFolder._local << _queryLocal;
 
     if (_queryServer == NormalQuery) {
-        _serverJob = startAsyncServerQuery();
+        auto prefetched = _discoveryData->_prefetchedListings.find(_currentFolder._server);
+        if (prefetched != _discoveryData->_prefetchedListings.end()) {
+            // Came with the "Depth: infinity" listing of a parent directory
+            _serverNormalQueryEntries = std::move(prefetched->entries);
+            _rootPermissions = prefetched->permissions;
+            _discoveryData->_prefetchedListings.erase(prefetched);
+            _serverQueryDone = true;
+        } else {
+            _serverJob = startAsyncServerQuery();
+        }
     } else {
         _serverQueryDone = true;
     }
 
-    // Check whether a normal local query is even necessary
-    if (_queryLocal == NormalQuery) {
-        if (!_discoveryData->_shouldDiscoverLocaly(_currentFolder._local)
-            && (_currentFolder._local == _currentFolder._original || !_discoveryData->_shouldDiscoverLocaly(_currentFolder._original))) {
-            _queryLocal = ParentNotChanged;
-        }
-    }
-
+    skipUnneededLocalQuery();
     if (_queryLocal == NormalQuery) {
         startAsyncLocalQuery();
     } else {
@@ -88,7 +90,7 @@ void ProcessDirectoryJob::process()
 
     // fetch all the name from the DB
     auto pathU8 = _currentFolder._original.toUtf8();
-    if (!_discoveryData->_statedb->listFilesInPath(pathU8, [&](const SyncJournalFileRecord &rec) {
+    if (!_discoveryData->listDbFilesInPath(pathU8, [&](const SyncJournalFileRecord &rec) {
             auto name = pathU8.isEmpty() ? rec._path : QString::fromUtf8(rec._path.constData() + (pathU8.size() + 1));
             if (rec.isVirtualFile() && isVfsWithSuffix())
                 chopVirtualFileSuffix(name);
@@ -750,7 +752,7 @@ void ProcessDirectoryJob::processFileAnalyzeLocalInfo(
         } else if (noServerEntry) {
             // Not locally, not on the server. The entry is stale!
             qCInfo(lcDisco) << "Stale DB entry";
-            _discoveryData->_statedb->deleteFileRecord(path._original, true);
+            _discoveryData->deleteDbFileRecord(path._original, true);
             return;
         } else if (dbEntry._type == ItemTypeVirtualFile && isVfsWithSuffix()) {
             // If the virtual file is removed, recreate it.
@@ -1066,7 +1068,7 @@ void ProcessDirectoryJob::processFileAnalyzeLocalInfo(
         if (wasDeletedOnClient.first) {
             // More complicated. The REMOVE is canceled. Restore will happen next sync.
             qCInfo(lcDisco) << "Undid remove instruction on source" << originalPath;
-            _discoveryData->_statedb->deleteFileRecord(originalPath, true);
+            _discoveryData->deleteDbFileRecord(originalPath, true);
             _discoveryData->_statedb->schedulePathForRemoteDiscovery(originalPath);
             _discoveryData->_anotherSyncNeeded = true;
         } else {
@@ -1190,7 +1192,7 @@ void ProcessDirectoryJob::processFileConflict(const SyncFileItemPtr &item, Proce
         // (We can't use a typical CSYNC_INSTRUCTION_UPDATE_METADATA because
         // we must not store the size/modtime from the file system)
         OCC::SyncJournalFileRecord rec;
-        if (_discoveryData->_statedb->getFileRecord(path._original, &rec)) {
+        if (_discoveryData->getDbFileRecord(path._original.toUtf8(), &rec)) {
             rec._path = path._original.toUtf8();
             rec._etag = serverEntry.etag;
             rec._fileId = serverEntry.fileId;
@@ -1199,7 +1201,7 @@ void ProcessDirectoryJob::processFileConflict(const SyncFileItemPtr &item, Proce
             rec._fileSize = serverEntry.size;
             rec._remotePerm = serverEntry.remotePerm;
             rec._checksumHeader = serverEntry.checksumHeader;
-            _discoveryData->_statedb->setFileRecord(rec);
+            _discoveryData->setDbFileRecord(rec);
         }
         return;
     }
@@ -1261,6 +1263,7 @@ void ProcessDirectoryJob::processFileFinalize(
         } else {
             connect(job, &ProcessDirectoryJob::finished, this, &ProcessDirectoryJob::subJobFinished);
             _queuedJobs.push_back(job);
+            job->prefetchLocalQuery();
         }
     } else {
         if (removed
@@ -1299,6 +1302,7 @@ void ProcessDirectoryJob::processBlacklisted(const PathTuple &path, const OCC::L
         auto job = new ProcessDirectoryJob(path, item, NormalQuery, InBlackList, _lastSyncTimestamp, this);
         connect(job, &ProcessDirectoryJob::finished, this, &ProcessDirectoryJob::subJobFinished);
         _queuedJobs.push_back(job);
+        job->prefetchLocalQuery();
     } else {
         emit _discoveryData->itemDiscovered(item);
     }
@@ -1433,6 +1437,10 @@ void ProcessDirectoryJob::subJobFinished()
     if (job->_dirItem)
         emit _discoveryData->itemDiscovered(job->_dirItem);
 
+    // Its listing was prefetched but not used, don't let it count against the prefetch limit
+    if (job->_localScanPending)
+        _discoveryData->dropLocalScan(job->_currentFolder._local);
+
     int count = _runningJobs.removeAll(job);
     ASSERT(count == 1);
     job->deleteLater();
@@ -1515,15 +1523,30 @@ DiscoverySingleDirectoryJob *ProcessDirectoryJob::startAsyncServerQuery()
         _discoveryData->_remoteFolder + _currentFolder._server, this);
     if (!_dirItem)
         serverJob->setIsRootPath(); // query the fingerprint on the root
+    const bool depthInfinity = shouldQuerySubtree();
+    if (depthInfinity)
+        serverJob->setDepthInfinity();
     connect(serverJob, &DiscoverySingleDirectoryJob::etag, this, &ProcessDirectoryJob::etag);
     _discoveryData->_currentlyActiveJobs++;
     _pendingAsyncJobs++;
-    connect(serverJob, &DiscoverySingleDirectoryJob::finished, this, [this, serverJob](const auto &results) {
+    connect(serverJob, &DiscoverySingleDirectoryJob::finished, this, [this, serverJob, depthInfinity](const auto &results) {
         _discoveryData->_currentlyActiveJobs--;
         _pendingAsyncJobs--;
+        if (!results && depthInfinity) {
+            // Servers may refuse such a query, or fail to produce the listing in time:
+            // fall back to one query per directory
+            qCWarning(lcDisco) << "Depth infinity query failed for" << _currentFolder._server
+                               << results.error().code << results.error().message << "- listing directories one by one";
+            _discoveryData->_depthInfinityFailed = true;
+            _serverJob = startAsyncServerQuery();
+            return;
+        }
         if (results) {
             _serverNormalQueryEntries = *results;
             _serverQueryDone = true;
+            const QString prefix = _currentFolder._server.isEmpty() ? QString() : _currentFolder._server + QLatin1Char('/');
+            for (auto it = serverJob->_subtreeListings.begin(); it != serverJob->_subtreeListings.end(); ++it)
+                _discoveryData->_prefetchedListings.insert(prefix + it.key(), std::move(it.value()));
             if (!serverJob->_dataFingerprint.isEmpty() && _discoveryData->_dataFingerprint.isEmpty())
                 _discoveryData->_dataFingerprint = serverJob->_dataFingerprint;
             if (_localQueryDone)
@@ -1542,6 +1565,8 @@ DiscoverySingleDirectoryJob *ProcessDirectoryJob::startAsyncServerQuery()
                 // Similarly, the server might also return 404 or 50x in case of bugs. #7199 #7586
                 _dirItem->_instruction = CSYNC_INSTRUCTION_IGNORE;
                 _dirItem->_errorString = results.error().message;
+                // The local listing is not needed anymore, don't hold its budget
+                stopWaitingForLocalQuery();
                 emit this->finished();
             } else {
                 // Fatal for the root job since it has no SyncFileItem, or for the network errors
@@ -1556,56 +1581,101 @@ DiscoverySingleDirectoryJob *ProcessDirectoryJob::startAsyncServerQuery()
     return serverJob;
 }
 
+bool ProcessDirectoryJob::shouldQuerySubtree() const
+{
+    if (_discoveryData->_depthInfinityFailed
+        || !_discoveryData->_account->capabilities().propfindDepthInfinity()) {
+        return false;
+    }
+    // The metadata of encrypted directories must be fetched for each directory
+    if (isInsideEncryptedTree() || (_dirItem && _dirItem->_isEncrypted))
+        return false;
+    // Only worth it when everything below is going to be listed anyway: on the
+    // initial sync, or for a directory that is new on the server
+    if (!_dirItem)
+        return _discoveryData->isDbEmpty();
+    return _dirItem->_instruction == CSYNC_INSTRUCTION_NEW
+        && _dirItem->_direction == SyncFileItem::Down;
+}
+
+void ProcessDirectoryJob::skipUnneededLocalQuery()
+{
+    // Check whether a normal local query is even necessary
+    if (_queryLocal == NormalQuery) {
+        if (!_discoveryData->_shouldDiscoverLocaly(_currentFolder._local)
+            && (_currentFolder._local == _currentFolder._original || !_discoveryData->_shouldDiscoverLocaly(_currentFolder._original))) {
+            _queryLocal = ParentNotChanged;
+        }
+    }
+}
+
+void ProcessDirectoryJob::prefetchLocalQuery()
+{
+    skipUnneededLocalQuery();
+    if (_queryLocal == NormalQuery)
+        _localScanPending = _discoveryData->prefetchLocalScan(_currentFolder._local);
+}
+
 void ProcessDirectoryJob::startAsyncLocalQuery()
 {
-    QString localPath = _discoveryData->_localDir + _currentFolder._local;
-    auto localJob = new DiscoverySingleLocalDirectoryJob(_discoveryData->_account, localPath, _discoveryData->_syncOptions._vfs.data());
+    const QString path = _currentFolder._local;
 
-    _discoveryData->_currentlyActiveJobs++;
+    _discoveryData->_currentlyActiveLocalJobs++;
     _pendingAsyncJobs++;
+    _localScanPending = true;
 
-    connect(localJob, &DiscoverySingleLocalDirectoryJob::itemDiscovered, _discoveryData, &DiscoveryPhase::itemDiscovered);
+    _localScanConnection = connect(_discoveryData, &DiscoveryPhase::localScanFinished, this, [this, path](const QString &scannedPath) {
+        if (scannedPath != path)
+            return;
+        const auto scan = _discoveryData->takeLocalScan(path);
+        if (scan.status == LocalScan::Running) {
+            // Taken by another job for the same directory: list it again
+            _discoveryData->requestLocalScan(path);
+            return;
+        }
+        _localScanPending = false;
+        stopWaitingForLocalQuery();
 
-    connect(localJob, &DiscoverySingleLocalDirectoryJob::childIgnored, this, [this](bool b) {
-        _childIgnored = b;
-    });
+        _childIgnored = scan.childIgnored;
 
-    connect(localJob, &DiscoverySingleLocalDirectoryJob::finishedFatalError, this, [this](const QString &msg) {
-        _discoveryData->_currentlyActiveJobs--;
-        _pendingAsyncJobs--;
-        if (_serverJob)
-            _serverJob->abort();
+        switch (scan.status) {
+        case LocalScan::FatalError:
+            if (_serverJob)
+                _serverJob->abort();
 
-        emit _discoveryData->fatalError(msg);
-    });
-
-    connect(localJob, &DiscoverySingleLocalDirectoryJob::finishedNonFatalError, this, [this](const QString &msg) {
-        _discoveryData->_currentlyActiveJobs--;
-        _pendingAsyncJobs--;
+            emit _discoveryData->fatalError(scan.errorString);
+            break;
+        case LocalScan::NonFatalError:
+            if (_dirItem) {
+                _dirItem->_instruction = CSYNC_INSTRUCTION_IGNORE;
+                _dirItem->_errorString = scan.errorString;
+                emit this->finished();
+            } else {
+                // Fatal for the root job since it has no SyncFileItem
+                emit _discoveryData->fatalError(scan.errorString);
+            }
+            break;
+        case LocalScan::Finished:
+            _localNormalQueryEntries = scan.entries;
+            _localQueryDone = true;
 
-        if (_dirItem) {
-            _dirItem->_instruction = CSYNC_INSTRUCTION_IGNORE;
-            _dirItem->_errorString = msg;
-            emit this->finished();
-        } else {
-            // Fatal for the root job since it has no SyncFileItem
-            emit _discoveryData->fatalError(msg);
+            if (_serverQueryDone)
+                this->process();
+            break;
+        case LocalScan::Running:
+            break;
         }
     });
 
-    connect(localJob, &DiscoverySingleLocalDirectoryJob::finished, this, [this](const auto &results) {
-        _discoveryData->_currentlyActiveJobs--;
-        _pendingAsyncJobs--;
-
-        _localNormalQueryEntries = results;
-        _localQueryDone = true;
-
-        if (_serverQueryDone)
-            this->process();
-    });
+    _discoveryData->requestLocalScan(path);
+}
 
-    QThreadPool *pool = QThreadPool::globalInstance();
-    pool->start(localJob); // QThreadPool takes ownership
+void ProcessDirectoryJob::stopWaitingForLocalQuery()
+{
+    if (disconnect(_localScanConnection)) {
+        _discoveryData->_currentlyActiveLocalJobs--;
+        _pendingAsyncJobs--;
+    }
 }
 
 
@@ -219,12 +219,27 @@ private:
      */
     DiscoverySingleDirectoryJob *startAsyncServerQuery();
 
+    /** Whether the server query should list the whole subtree at once
+     *
+     * The listings of the subdirectories are stored in DiscoveryPhase::_prefetchedListings.
+     */
+    bool shouldQuerySubtree() const;
+
     /** Discover the local directory
       *
       * Fills _localNormalQueryEntries.
       */
     void startAsyncLocalQuery();
 
+    /// Downgrades a normal local query to ParentNotChanged if the directory is known to be unchanged
+    void skipUnneededLocalQuery();
+
+    /// Starts listing the local directory before the job itself is started
+    void prefetchLocalQuery();
+
+    /// Gives up on a running local query, releasing its slot in the local budget
+    void stopWaitingForLocalQuery();
+
 
     /** Sets _pinState, the directory's pin state
      *
@@ -261,6 +276,10 @@ private:
 
     RemotePermissions _rootPermissions;
     QPointer<DiscoverySingleDirectoryJob> _serverJob;
+    QMetaObject::Connection _localScanConnection;
+
+    /// Whether a listing of the local directory was started for this job and not taken yet
+    bool _localScanPending = false;
 
 
     /** Number of currently running async jobs.
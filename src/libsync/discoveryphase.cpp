@@ -29,6 +29,7 @@
 #include <QFile>
 #include <QFileInfo>
 #include <QTextCodec>
+#include <QThread>
 #include <cstring>
 #include <QDateTime>
 
@@ -236,14 +237,153 @@ void DiscoveryPhase::setSelectiveSyncWhiteList(const QStringList &list)
     std::sort(_selectiveSyncWhiteList.begin(), _selectiveSyncWhiteList.end());
 }
 
+// How many local listings may wait for their ProcessDirectoryJob, per scanning thread
+static const int prefetchedLocalScansPerThread = 16;
+
+DiscoveryPhase::~DiscoveryPhase()
+{
+    // Don't start the listings that did not run yet, wait for the others
+    _localScanPool.clear();
+    _localScanPool.waitForDone();
+}
+
+bool DiscoveryPhase::listDbFilesInPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord &)> &rowCallback)
+{
+    if (_journalSnapshot) {
+        _journalSnapshot->listFilesInPath(path, rowCallback);
+        return true;
+    }
+    return _statedb->listFilesInPath(path, rowCallback);
+}
+
+bool DiscoveryPhase::getDbFileRecord(const QByteArray &path, SyncJournalFileRecord *rec)
+{
+    if (_journalSnapshot) {
+        const auto found = _journalSnapshot->findFileRecord(path);
+        *rec = found ? *found : SyncJournalFileRecord();
+        return true;
+    }
+    return _statedb->getFileRecord(path, rec);
+}
+
+void DiscoveryPhase::setDbFileRecord(const SyncJournalFileRecord &rec)
+{
+    _statedb->setFileRecord(rec);
+    if (_journalSnapshot)
+        _journalSnapshot->setFileRecord(rec);
+}
+
+void DiscoveryPhase::deleteDbFileRecord(const QString &path, bool recursively)
+{
+    _statedb->deleteFileRecord(path, recursively);
+    if (_journalSnapshot)
+        _journalSnapshot->deleteFileRecord(path.toUtf8(), recursively);
+}
+
+bool DiscoveryPhase::isDbEmpty()
+{
+    if (_journalSnapshot)
+        return _journalSnapshot->isEmpty();
+    return _statedb->getFileRecordCount() == 0;
+}
+
 void DiscoveryPhase::scheduleMoreJobs()
 {
+    // Remote and local listings have separate budgets, a job may need both
     auto limit = qMax(1, _syncOptions._parallelNetworkJobs);
-    if (_currentRootJob && _currentlyActiveJobs < limit) {
-        _currentRootJob->processSubJobs(limit - _currentlyActiveJobs);
+    auto room = qMin(limit - _currentlyActiveJobs, localScanLimit() - _currentlyActiveLocalJobs);
+    if (_currentRootJob && room > 0) {
+        _currentRootJob->processSubJobs(room);
+    }
+}
+
+int DiscoveryPhase::localScanLimit() const
+{
+    if (_syncOptions._parallelLocalScans > 0)
+        return _syncOptions._parallelLocalScans;
+    return qMax(2, QThread::idealThreadCount());
+}
+
+void DiscoveryPhase::startLocalScan(const QString &path)
+{
+    if (_localScans.contains(path))
+        return;
+    _localScans.insert(path, LocalScan());
+
+    if (_localScanPool.maxThreadCount() != localScanLimit())
+        _localScanPool.setMaxThreadCount(localScanLimit());
+
+    auto localJob = new DiscoverySingleLocalDirectoryJob(_account, _localDir + path, _syncOptions._vfs.data());
+
+    connect(localJob, &DiscoverySingleLocalDirectoryJob::itemDiscovered, this, &DiscoveryPhase::itemDiscovered);
+
+    connect(localJob, &DiscoverySingleLocalDirectoryJob::childIgnored, this, [this, path](bool b) {
+        auto it = _localScans.find(path);
+        if (it != _localScans.end())
+            it->childIgnored = b;
+    });
+
+    connect(localJob, &DiscoverySingleLocalDirectoryJob::finishedFatalError, this, [this, path](const QString &msg) {
+        localScanDone(path, LocalScan::FatalError, {}, msg);
+    });
+
+    connect(localJob, &DiscoverySingleLocalDirectoryJob::finishedNonFatalError, this, [this, path](const QString &msg) {
+        localScanDone(path, LocalScan::NonFatalError, {}, msg);
+    });
+
+    connect(localJob, &DiscoverySingleLocalDirectoryJob::finished, this, [this, path](const auto &results) {
+        localScanDone(path, LocalScan::Finished, results, QString());
+    });
+
+    _localScanPool.start(localJob); // QThreadPool takes ownership
+}
+
+void DiscoveryPhase::localScanDone(const QString &path, LocalScan::Status status, const QVector<LocalInfo> &entries, const QString &errorString)
+{
+    auto it = _localScans.find(path);
+    if (it != _localScans.end()) {
+        it->status = status;
+        it->entries = entries;
+        it->errorString = errorString;
+    }
+    // Also if it was dropped: a job still waiting for it then lists the directory again
+    emit localScanFinished(path);
+}
+
+bool DiscoveryPhase::prefetchLocalScan(const QString &path)
+{
+    if (_localScans.size() >= localScanLimit() * prefetchedLocalScansPerThread || _localScans.contains(path))
+        return false;
+    startLocalScan(path);
+    return true;
+}
+
+void DiscoveryPhase::requestLocalScan(const QString &path)
+{
+    auto it = _localScans.constFind(path);
+    if (it == _localScans.constEnd()) {
+        startLocalScan(path);
+    } else if (it->status != LocalScan::Running) {
+        // Prefetched: deliver it like a listing that just finished
+        QMetaObject::invokeMethod(this, [this, path] { emit localScanFinished(path); }, Qt::QueuedConnection);
     }
 }
 
+LocalScan DiscoveryPhase::takeLocalScan(const QString &path)
+{
+    auto it = _localScans.find(path);
+    if (it == _localScans.end() || it->status == LocalScan::Running)
+        return LocalScan();
+    LocalScan scan = std::move(*it);
+    _localScans.erase(it);
+    return scan;
+}
+
+void DiscoveryPhase::dropLocalScan(const QString &path)
+{
+    _localScans.remove(path);
+}
+
 DiscoverySingleLocalDirectoryJob::DiscoverySingleLocalDirectoryJob(const AccountPtr &account, const QString &localPath, OCC::Vfs *vfs, QObject *parent)
  : QObject(parent), QRunnable(), _localPath(localPath), _account(account), _vfs(vfs)
 {
@@ -336,6 +476,7 @@ DiscoverySingleDirectoryJob::DiscoverySingleDirectoryJob(const AccountPtr &accou
     , _isRootPath(false)
     , _isExternalStorage(false)
     , _isE2eEncrypted(false)
+    , _depthInfinity(false)
 {
 }
 
@@ -365,6 +506,8 @@ void DiscoverySingleDirectoryJob::start()
     }
 
     lsColJob->setProperties(props);
+    if (_depthInfinity)
+        lsColJob->setDepth("infinity");
 
     QObject::connect(lsColJob, &LsColJob::directoryListingIterated,
         this, &DiscoverySingleDirectoryJob::directoryListingIteratedSlot);
@@ -436,6 +579,7 @@ void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(const QString &fi
     if (!_ignoredFirst) {
         // The first entry is for the folder itself, we should process it differently.
         _ignoredFirst = true;
+        _rootHref = file;
         if (map.contains("permissions")) {
             auto perm = RemotePermissions::fromServerString(map.value("permissions"));
             emit firstDirectoryPermissions(perm);
@@ -465,6 +609,26 @@ void DiscoverySingleDirectoryJob::directoryListingIteratedSlot(const QString &fi
         if (result.isDirectory)
             result.size = 0;
 
+        if (_depthInfinity) {
+            if (!file.startsWith(_rootHref + QLatin1Char('/'))) {
+                qCWarning(lcDiscovery) << "Ignoring entry outside of the queried directory" << file;
+                return;
+            }
+            const QString relativePath = file.mid(_rootHref.size() + 1);
+            if (result.isDirectory) {
+                // Also creates the listing of empty directories
+                _subtreeListings[relativePath].permissions = result.remotePerm;
+                if (result.isE2eEncrypted)
+                    _encryptedSubdirectories.append(relativePath);
+            }
+            const int relativeSlash = relativePath.lastIndexOf(QLatin1Char('/'));
+            if (relativeSlash != -1) {
+                // Deeper in the tree, external storage is handled in finalizeSubtreeListings()
+                _subtreeListings[relativePath.left(relativeSlash)].entries.push_back(std::move(result));
+                return;
+            }
+        }
+
         if (_isExternalStorage && result.remotePerm.hasPermission(RemotePermissions::IsMounted)) {
             /* All the entries in a external storage have 'M' in their permission. However, for all
                purposes in the desktop client, we only need to know about the mount points.
@@ -502,15 +666,48 @@ void DiscoverySingleDirectoryJob::lsJobFinishedWithoutErrorSlot()
         deleteLater();
         return;
     } else if (_isE2eEncrypted) {
+        // The names below an encrypted directory need their own metadata
+        _subtreeListings.clear();
         emit etag(_firstEtag, QDateTime::fromString(QString::fromUtf8(_lsColJob->responseTimestamp()), Qt::RFC2822Date));
         fetchE2eMetadata();
         return;
     }
     emit etag(_firstEtag, QDateTime::fromString(QString::fromUtf8(_lsColJob->responseTimestamp()), Qt::RFC2822Date));
+    if (_depthInfinity)
+        finalizeSubtreeListings();
     emit finished(_results);
     deleteLater();
 }
 
+void DiscoverySingleDirectoryJob::finalizeSubtreeListings()
+{
+    for (const auto &encrypted : qAsConst(_encryptedSubdirectories)) {
+        const QString prefix = encrypted + QLatin1Char('/');
+        for (auto it = _subtreeListings.begin(); it != _subtreeListings.end();) {
+            if (it.key() == encrypted || it.key().startsWith(prefix)) {
+                it = _subtreeListings.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Same as in directoryListingIteratedSlot for the direct entries: only the mount
+    // points keep the 'M'
+    for (auto &listing : _subtreeListings) {
+        if (!listing.permissions.hasPermission(RemotePermissions::IsMounted))
+            continue;
+        for (auto &entry : listing.entries) {
+            if (entry.remotePerm.hasPermission(RemotePermissions::IsMounted)) {
+                entry.remotePerm.unsetPermission(RemotePermissions::IsMounted);
+                entry.remotePerm.setPermission(RemotePermissions::IsMountedSub);
+            }
+        }
+    }
+
+    qCInfo(lcDiscovery) << "Received the listings of" << _subtreeListings.size() << "directories below" << _subPath;
+}
+
 void DiscoverySingleDirectoryJob::lsJobFinishedWithErrorSlot(QNetworkReply *r)
 {
     QString contentType = r->header(QNetworkRequest::ContentTypeHeader).toString();
@@ -19,14 +19,18 @@
 #include <QStringList>
 #include <csync.h>
 #include <QMap>
+#include <QHash>
 #include <QSet>
 #include "networkjobs.h"
 #include <QMutex>
 #include <QWaitCondition>
 #include <QRunnable>
+#include <QThreadPool>
 #include <deque>
+#include <memory>
 #include "syncoptions.h"
 #include "syncfileitem.h"
+#include "common/syncjournalsnapshot.h"
 
 class ExcludedFiles;
 
@@ -65,6 +69,19 @@ struct RemoteInfo
     QString directDownloadCookies;
 };
 
+/**
+ * The contents of a remote directory that were received as part of the
+ * listing of one of its parent directories.
+ *
+ * See DiscoverySingleDirectoryJob::setDepthInfinity()
+ */
+struct RemoteListing
+{
+    QVector<RemoteInfo> entries;
+    /// The permissions of the directory itself
+    RemotePermissions permissions;
+};
+
 struct LocalInfo
 {
     /** FileName of the entry (this does not contains any directory or path, just the plain name */
@@ -80,6 +97,23 @@ struct LocalInfo
     bool isValid() const { return !name.isNull(); }
 };
 
+/**
+ * The outcome of listing a local directory, see DiscoveryPhase::requestLocalScan()
+ */
+struct LocalScan
+{
+    enum Status {
+        Running,
+        Finished,
+        NonFatalError,
+        FatalError,
+    };
+    Status status = Running;
+    QVector<LocalInfo> entries;
+    QString errorString;
+    bool childIgnored = false;
+};
+
 /**
  * @brief Run list on a local directory and process the results for Discovery
  *
@@ -120,6 +154,12 @@ public:
     explicit DiscoverySingleDirectoryJob(const AccountPtr &account, const QString &path, QObject *parent = nullptr);
     // Specify that this is the root and we need to check the data-fingerprint
     void setIsRootPath() { _isRootPath = true; }
+    /** Query the whole subtree with a single "Depth: infinity" PROPFIND
+     *
+     * The entries of the directory itself are reported through finished() as usual,
+     * the ones of the directories below end up in _subtreeListings.
+     */
+    void setDepthInfinity() { _depthInfinity = true; }
     void start();
     void abort();
 
@@ -138,6 +178,9 @@ private slots:
     void metadataError(const QByteArray& fileId, int httpReturnCode);
 
 private:
+    /// Moves the entries of the subtree into place once the whole listing was received
+    void finalizeSubtreeListings();
+
     QVector<RemoteInfo> _results;
     QString _subPath;
     QString _firstEtag;
@@ -152,12 +195,25 @@ private:
     bool _isExternalStorage;
     // If this directory is e2ee
     bool _isE2eEncrypted;
+    // Set to true if the whole subtree is queried
+    bool _depthInfinity;
+    // The href of the directory itself, the entries of the subtree are relative to it
+    QString _rootHref;
+    // The directories of the subtree that are e2ee, their listings can't be used as is
+    QStringList _encryptedSubdirectories;
     // If set, the discovery will finish with an error
     QString _error;
     QPointer<LsColJob> _lsColJob;
 
 public:
     QByteArray _dataFingerprint;
+
+    /** The listings of the directories below this one, keyed by their path relative to it
+     *
+     * Only filled with setDepthInfinity(). Encrypted directories and their subtrees are left
+     * out, they are queried separately.
+     */
+    QHash<QString, RemoteListing> _subtreeListings;
 };
 
 class DiscoveryPhase : public QObject
@@ -211,6 +267,64 @@ class DiscoveryPhase : public QObject
 
     int _currentlyActiveJobs = 0;
 
+    /** Listings of remote directories that came with the "Depth: infinity" query of
+     * one of their parents, keyed by their server path relative to the sync root.
+     *
+     * ProcessDirectoryJob takes its listing from here instead of querying the server.
+     */
+    QHash<QString, RemoteListing> _prefetchedListings;
+
+    /// Set if the server refused a "Depth: infinity" PROPFIND; it is not tried again
+    bool _depthInfinityFailed = false;
+
+    /** Access to the file records of _statedb
+     *
+     * Reads come from _journalSnapshot if there is one. Writes go to the journal
+     * and are mirrored into the snapshot, so later reads of this sync see them.
+     */
+    bool listDbFilesInPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord &)> &rowCallback);
+    bool getDbFileRecord(const QByteArray &path, SyncJournalFileRecord *rec);
+    void setDbFileRecord(const SyncJournalFileRecord &rec);
+    void deleteDbFileRecord(const QString &path, bool recursively);
+    bool isDbEmpty();
+
+    /** Local directory listings, running or done, keyed by their path relative to _localDir
+     *
+     * They run on _localScanPool, independently of the network jobs, and may be started
+     * before the ProcessDirectoryJob that needs them. See requestLocalScan().
+     */
+    QHash<QString, LocalScan> _localScans;
+    QThreadPool _localScanPool;
+
+    /// Number of ProcessDirectoryJobs waiting for their local listing
+    int _currentlyActiveLocalJobs = 0;
+
+    /// How many local directories may be listed in parallel
+    int localScanLimit() const;
+
+    void startLocalScan(const QString &path);
+    void localScanDone(const QString &path, LocalScan::Status status, const QVector<LocalInfo> &entries, const QString &errorString);
+
+    /** Starts listing the local directory \a path ahead of time
+     *
+     * Does nothing if too many listings are already waiting for their job.
+     * Returns whether a listing was started.
+     */
+    bool prefetchLocalScan(const QString &path);
+
+    /** Asks for the listing of the local directory \a path
+     *
+     * localScanFinished() is emitted once it is available, also if it had been
+     * prefetched already. It can then be retrieved with takeLocalScan().
+     */
+    void requestLocalScan(const QString &path);
+
+    /// Removes and returns the finished listing of \a path; its status is Running if there is none
+    LocalScan takeLocalScan(const QString &path);
+
+    /// Forgets the listing of \a path, running or done, once its job won't take it any more
+    void dropLocalScan(const QString &path);
+
     // both must contain a sorted list
     QStringList _selectiveSyncBlackList;
     QStringList _selectiveSyncWhiteList;
@@ -245,10 +359,14 @@ class DiscoveryPhase : public QObject
     QPair<bool, QByteArray> findAndCancelDeletedJob(const QString &originalPath);
 
 public:
+    ~DiscoveryPhase() override;
+
     // input
     QString _localDir; // absolute path to the local directory. ends with '/'
     QString _remoteFolder; // remote folder, ends with '/'
     SyncJournalDb *_statedb;
+    /// The file records of _statedb read at the start of the sync, optional, see SyncOptions::_useJournalSnapshot
+    std::unique_ptr<SyncJournalSnapshot> _journalSnapshot;
     AccountPtr _account;
     SyncOptions _syncOptions;
     ExcludedFiles *_excludes;
@@ -281,6 +399,9 @@ signals:
     void silentlyExcluded(const QString &folderPath);
 
     void addErrorToGui(SyncFileItem::Status status, const QString &errorMessage, const QString &subject);
+
+    /// The listing of the local directory at \a path is available, see requestLocalScan()
+    void localScanFinished(const QString &path);
 };
 
 /// Implementation of DiscoveryPhase::adjustRenamedPath
@@ -30,6 +30,12 @@ void LocalDiscoveryTracker::addTouchedPath(const QString &relativePath)
     _localDiscoveryPaths.insert(relativePath);
 }
 
+void LocalDiscoveryTracker::addTouchedPaths(const QStringList &relativePaths)
+{
+    qCDebug(lcLocalDiscoveryTracker) << "inserted touched" << relativePaths;
+    _localDiscoveryPaths.insert(relativePaths.cbegin(), relativePaths.cend());
+}
+
 void LocalDiscoveryTracker::startSyncFullDiscovery()
 {
     _localDiscoveryPaths.clear();
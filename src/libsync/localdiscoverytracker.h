@@ -20,6 +20,7 @@
 #include <QObject>
 #include <QByteArray>
 #include <QSharedPointer>
+#include <QStringList>
 
 namespace OCC {
 
@@ -59,6 +60,9 @@ public:
      */
     void addTouchedPath(const QString &relativePath);
 
+    /** Adds a batch of paths, like addTouchedPath() */
+    void addTouchedPaths(const QStringList &relativePaths);
+
     /** Call when a sync run starts that rediscovers all local files */
     void startSyncFullDiscovery();
 
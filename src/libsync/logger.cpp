@@ -18,8 +18,8 @@
 
 #include <QDir>
 #include <QStringList>
+#include <QThread>
 #include <QtGlobal>
-#include <QTextCodec>
 #include <qmetaobject.h>
 
 #include <iostream>
@@ -34,6 +34,84 @@
 
 namespace OCC {
 
+namespace {
+    // Must be a power of two
+    const quint32 logQueueCapacity = 16 * 1024;
+    // The writer is woken up whenever this many messages were queued since the last time,
+    // and in any case after writeIntervalMs
+    const quint32 writerWakeupInterval = logQueueCapacity / 4;
+    const unsigned long writeIntervalMs = 200;
+    // Larger batches are split into several writes
+    const int maxBatchSize = 256 * 1024;
+}
+
+/**
+ * Bounded queue of log messages, with any number of producers and one consumer.
+ *
+ * Each slot has a sequence number that tells whether it is free for the producer
+ * that claimed its position or holds a message for the consumer, like in Dmitry
+ * Vyukov's bounded MPMC queue. Producers never block.
+ */
+class Logger::LogQueue
+{
+public:
+    LogQueue()
+        : _slots(new Slot[logQueueCapacity])
+    {
+        for (quint32 i = 0; i < logQueueCapacity; ++i)
+            _slots[i].sequence.store(i);
+    }
+
+    /// Returns false if the queue is full, sets \a position to the position of the message otherwise
+    bool push(QString &&message, quint32 *position)
+    {
+        quint32 pos = _pushPosition.load();
+        forever {
+            Slot &slot = _slots[pos & (logQueueCapacity - 1)];
+            const auto diff = qint32(slot.sequence.loadAcquire() - pos);
+            if (diff == 0) {
+                // On failure pos is set to the current value
+                if (_pushPosition.testAndSetRelaxed(pos, pos + 1, pos)) {
+                    slot.message = std::move(message);
+                    slot.sequence.storeRelease(pos + 1);
+                    *position = pos;
+                    return true;
+                }
+            } else if (diff < 0) {
+                // The consumer didn't take the message of the previous round yet
+                return false;
+            } else {
+                // Another producer claimed pos
+                pos = _pushPosition.load();
+            }
+        }
+    }
+
+    /// Must only be called by one thread at a time
+    bool pop(QString *message)
+    {
+        Slot &slot = _slots[_popPosition & (logQueueCapacity - 1)];
+        if (qint32(slot.sequence.loadAcquire() - (_popPosition + 1)) < 0)
+            return false;
+        *message = std::move(slot.message);
+        slot.message.clear();
+        slot.sequence.storeRelease(_popPosition + logQueueCapacity);
+        ++_popPosition;
+        return true;
+    }
+
+private:
+    struct Slot
+    {
+        QAtomicInteger<quint32> sequence;
+        QString message;
+    };
+
+    std::unique_ptr<Slot[]> _slots;
+    QAtomicInteger<quint32> _pushPosition;
+    quint32 _popPosition = 0;
+};
+
 QtMessageHandler s_originalMessageHandler = nullptr;
 
 static void mirallLogCatcher(QtMsgType type, const QMessageLogContext &ctx, const QString &message)
@@ -70,6 +148,7 @@ Logger *Logger::instance()
 
 Logger::Logger(QObject *parent)
     : QObject(parent)
+    , _queue(new LogQueue)
 {
     qSetMessagePattern("%{time yyyy-MM-dd hh:mm:ss:zzz} [ %{type} %{category} ]%{if-debug}\t[ %{function} ]%{endif}:\t%{message}");
 #ifndef NO_MSG_HANDLER
@@ -84,6 +163,9 @@ Logger::~Logger()
 #ifndef NO_MSG_HANDLER
     qInstallMessageHandler(nullptr);
 #endif
+    stopWriter();
+    close();
+    compressRotatedLogs();
 }
 
 
@@ -121,40 +203,101 @@ void Logger::log(Log log)
  */
 bool Logger::isNoop() const
 {
-    QMutexLocker lock(&_mutex);
-    return !_logstream;
+    return !_loggingToFile.load();
 }
 
 bool Logger::isLoggingToFile() const
 {
-    QMutexLocker lock(&_mutex);
-    return _logstream;
+    return _loggingToFile.load();
 }
 
 void Logger::doLog(const QString &msg)
 {
-    {
-        QMutexLocker lock(&_mutex);
-        if (_logstream) {
-            (*_logstream) << msg << endl;
-            if (_doFileFlush)
-                _logstream->flush();
+    if (_loggingToFile.load()) {
+        quint32 position = 0;
+        if (!_queue->push(QString(msg), &position)) {
+            _droppedMessageCount.ref();
+        } else if (_doFileFlush || position % writerWakeupInterval == 0) {
+            _writerWakeup.wakeOne();
         }
     }
-    emit logWindowLog(msg);
+
+    // Nothing needs to be done for the usual case of no log window
+    if (isSignalConnected(QMetaMethod::fromSignal(&Logger::logWindowLog)))
+        emit logWindowLog(msg);
 }
 
 void Logger::close()
 {
     QMutexLocker lock(&_mutex);
-    if (_logstream)
+    if (_loggingToFile.load())
     {
-        _logstream->flush();
+        writeQueuedMessages();
         _logFile.close();
-        _logstream.reset();
+        _loggingToFile.store(0);
+    }
+}
+
+void Logger::writerLoop()
+{
+    QMutexLocker wakeupLock(&_writerMutex);
+    while (!_stopWriter) {
+        _writerWakeup.wait(&_writerMutex, writeIntervalMs);
+        wakeupLock.unlock();
+
+        {
+            QMutexLocker lock(&_mutex);
+            writeQueuedMessages();
+        }
+        compressRotatedLogs();
+
+        wakeupLock.relock();
     }
 }
 
+void Logger::stopWriter()
+{
+    if (!_writerThread)
+        return;
+    {
+        QMutexLocker lock(&_writerMutex);
+        _stopWriter = true;
+        _writerWakeup.wakeOne();
+    }
+    _writerThread->wait();
+    _writerThread.reset();
+}
+
+void Logger::writeQueuedMessages()
+{
+    QString batch;
+    QString message;
+    const auto writeBatch = [&] {
+        if (_loggingToFile.load())
+            _logFile.write(batch.toUtf8());
+        batch.clear();
+    };
+
+    while (_queue->pop(&message)) {
+        batch += message;
+        batch += QLatin1Char('\n');
+        if (batch.size() >= maxBatchSize)
+            writeBatch();
+    }
+
+    const int droppedMessageCount = _droppedMessageCount.load();
+    if (droppedMessageCount != _reportedDroppedMessageCount) {
+        batch += QStringLiteral("[ Logger ]:\t%1 log messages were dropped because the log file could not be written fast enough\n")
+                     .arg(droppedMessageCount - _reportedDroppedMessageCount);
+        _reportedDroppedMessageCount = droppedMessageCount;
+    }
+
+    if (!batch.isEmpty())
+        writeBatch();
+    if (_loggingToFile.load())
+        _logFile.flush();
+}
+
 void Logger::mirallLog(const QString &message)
 {
     Log log_;
@@ -172,8 +315,10 @@ QString Logger::logFile() const
 void Logger::setLogFile(const QString &name)
 {
     QMutexLocker locker(&_mutex);
-    if (_logstream) {
-        _logstream.reset(nullptr);
+    if (_loggingToFile.load()) {
+        // The messages up to now belong to the previous file
+        writeQueuedMessages();
+        _loggingToFile.store(0);
         _logFile.close();
     }
 
@@ -198,8 +343,14 @@ void Logger::setLogFile(const QString &name)
         return;
     }
 
-    _logstream.reset(new QTextStream(&_logFile));
-    _logstream->setCodec(QTextCodec::codecForName("UTF-8"));
+    _loggingToFile.store(1);
+    locker.unlock();
+
+    if (!_writerThread) {
+        _writerThread.reset(QThread::create([this] { writerLoop(); }));
+        _writerThread->setObjectName(QStringLiteral("Log writer"));
+        _writerThread->start();
+    }
 }
 
 void Logger::setLogExpire(int expire)
@@ -323,14 +474,35 @@ void Logger::enterNextLogFile()
         if (logToCompress.isEmpty() && files.size() > 0 && !files.last().endsWith(".gz"))
             logToCompress = dir.absoluteFilePath(files.last());
         if (!logToCompress.isEmpty()) {
-            QString compressedName = logToCompress + ".gz";
-            if (compressLog(logToCompress, compressedName)) {
-                QFile::remove(logToCompress);
+            // The writer thread compresses it, unless there is none because the new file could not be opened
+            QMutexLocker lock(&_mutex);
+            _logsToCompress.append(logToCompress);
+            if (_writerThread) {
+                _writerWakeup.wakeOne();
             } else {
-                QFile::remove(compressedName);
+                lock.unlock();
+                compressRotatedLogs();
             }
         }
     }
 }
 
+void Logger::compressRotatedLogs()
+{
+    QStringList logsToCompress;
+    {
+        QMutexLocker lock(&_mutex);
+        logsToCompress.swap(_logsToCompress);
+    }
+
+    for (const auto &logToCompress : qAsConst(logsToCompress)) {
+        QString compressedName = logToCompress + ".gz";
+        if (compressLog(logToCompress, compressedName)) {
+            QFile::remove(logToCompress);
+        } else {
+            QFile::remove(compressedName);
+        }
+    }
+}
+
 } // namespace OCC
@@ -19,12 +19,19 @@
 #include <QList>
 #include <QDateTime>
 #include <QFile>
-#include <QTextStream>
+#include <QStringList>
+#include <QAtomicInt>
+#include <QWaitCondition>
 #include <qmutex.h>
 
+#include <memory>
+
 #include "common/utility.h"
 #include "owncloudlib.h"
 
+class QThread;
+class TestLogger;
+
 namespace OCC {
 
 struct Log
@@ -36,6 +43,10 @@ struct Log
 /**
  * @brief The Logger class
  * @ingroup libsync
+ *
+ * Messages for the log file are put into a bounded lock-free queue and written
+ * in batches by a writer thread. If the writer can't keep up and the queue is
+ * full, messages are dropped and counted, see droppedMessageCount().
  */
 class OWNCLOUDSYNC_EXPORT Logger : public QObject
 {
@@ -66,8 +77,12 @@ public:
     QString logDir() const;
     void setLogDir(const QString &dir);
 
+    /** Writes each message as soon as possible instead of in periodic batches */
     void setLogFlush(bool flush);
 
+    /** The number of messages that were not written because the queue was full */
+    int droppedMessageCount() const { return _droppedMessageCount.load(); }
+
     bool logDebug() const { return _logDebug; }
     void setLogDebug(bool debug);
 
@@ -98,18 +113,38 @@ public slots:
     void enterNextLogFile();
 
 private:
+    friend class ::TestLogger;
+    class LogQueue;
+
     Logger(QObject *parent = nullptr);
     ~Logger();
+
+    void writerLoop();
+    void stopWriter();
+    /// Writes the queued messages to _logFile, _mutex must be locked
+    void writeQueuedMessages();
+    void compressRotatedLogs();
+
     QList<Log> _logs;
     bool _showTime = true;
     QFile _logFile;
     bool _doFileFlush = false;
     int _logExpire = 0;
     bool _logDebug = false;
-    QScopedPointer<QTextStream> _logstream;
+    QAtomicInt _loggingToFile;
     mutable QMutex _mutex;
     QString _logDirectory;
     bool _temporaryFolderLogDir = false;
+
+    std::unique_ptr<LogQueue> _queue;
+    QAtomicInt _droppedMessageCount;
+    int _reportedDroppedMessageCount = 0; // protected by _mutex
+    QStringList _logsToCompress; // protected by _mutex
+
+    std::unique_ptr<QThread> _writerThread;
+    QMutex _writerMutex;
+    QWaitCondition _writerWakeup;
+    bool _stopWriter = false; // protected by _writerMutex
 };
 
 } // namespace OCC
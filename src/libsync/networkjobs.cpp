@@ -187,134 +187,182 @@ bool MkColJob::finished()
 }
 
 /*********************************************************************************************/
-// supposed to read <D:collection> when pointing to <D:resourcetype><D:collection></D:resourcetype>..
-static QString readContentsAsString(QXmlStreamReader &reader)
+
+LsColXMLParser::LsColXMLParser() = default;
+
+bool LsColXMLParser::parse(const QByteArray &xml, QHash<QString, ExtraFolderInfo> *fileInfo, const QString &expectedPath)
 {
-    QString result;
-    int level = 0;
-    do {
-        QXmlStreamReader::TokenType type = reader.readNext();
-        if (type == QXmlStreamReader::StartElement) {
-            level++;
-            result += "<" + reader.name().toString() + ">";
-        } else if (type == QXmlStreamReader::Characters) {
-            result += reader.text();
-        } else if (type == QXmlStreamReader::EndElement) {
-            level--;
-            if (level < 0) {
-                break;
-            }
-            result += "</" + reader.name().toString() + ">";
-        }
+    startParsing(fileInfo, expectedPath);
+    if (!addData(xml))
+        return false;
+    return finishParsing();
+}
 
-    } while (!reader.atEnd());
-    return result;
+void LsColXMLParser::startParsing(QHash<QString, ExtraFolderInfo> *fileInfo, const QString &expectedPath)
+{
+    _reader.clear();
+    _reader.addExtraNamespaceDeclaration(QXmlStreamNamespaceDeclaration("d", "DAV:"));
+    _fileInfo = fileInfo;
+    _expectedPath = expectedPath;
+    _failed = false;
+
+    _folders.clear();
+    _currentHref.clear();
+    _currentTmpProperties.clear();
+    _currentHttp200Properties.clear();
+    _currentPropsHaveHttp200 = false;
+    _insidePropstat = false;
+    _insideProp = false;
+    _insideMultiStatus = false;
+    _collecting = Collecting::Nothing;
 }
 
+bool LsColXMLParser::addData(const QByteArray &data)
+{
+    if (_failed)
+        return false;
 
-LsColXMLParser::LsColXMLParser() = default;
+    // Parse DAV response
+    _reader.addData(data);
+    while (!_reader.atEnd()) {
+        QXmlStreamReader::TokenType type = _reader.readNext();
+        if (type == QXmlStreamReader::Invalid)
+            break;
+        if (!processToken(type)) {
+            _failed = true;
+            return false;
+        }
+    }
 
-bool LsColXMLParser::parse(const QByteArray &xml, QHash<QString, ExtraFolderInfo> *fileInfo, const QString &expectedPath)
+    // Running out of data only means we have to wait for more
+    if (_reader.hasError() && _reader.error() != QXmlStreamReader::PrematureEndOfDocumentError) {
+        // XML Parser error? Whatever had been emitted before will come as directoryListingIterated
+        qCWarning(lcLsColJob) << "ERROR" << _reader.errorString() << "at line" << _reader.lineNumber()
+                              << "column" << _reader.columnNumber();
+        _failed = true;
+        return false;
+    }
+    return true;
+}
+
+bool LsColXMLParser::finishParsing()
 {
-    // Parse DAV response
-    QXmlStreamReader reader(xml);
-    reader.addExtraNamespaceDeclaration(QXmlStreamNamespaceDeclaration("d", "DAV:"));
-
-    QStringList folders;
-    QString currentHref;
-    QMap<QString, QString> currentTmpProperties;
-    QMap<QString, QString> currentHttp200Properties;
-    bool currentPropsHaveHttp200 = false;
-    bool insidePropstat = false;
-    bool insideProp = false;
-    bool insideMultiStatus = false;
-
-    while (!reader.atEnd()) {
-        QXmlStreamReader::TokenType type = reader.readNext();
-        QString name = reader.name().toString();
-        // Start elements with DAV:
-        if (type == QXmlStreamReader::StartElement && reader.namespaceUri() == QLatin1String("DAV:")) {
-            if (name == QLatin1String("href")) {
-                // We don't use URL encoding in our request URL (which is the expected path) (QNAM will do it for us)
-                // but the result will have URL encoding..
-                QString hrefString = QUrl::fromLocalFile(QUrl::fromPercentEncoding(reader.readElementText().toUtf8()))
-                        .adjusted(QUrl::NormalizePathSegments)
-                        .path();
-                if (!hrefString.startsWith(expectedPath)) {
-                    qCWarning(lcLsColJob) << "Invalid href" << hrefString << "expected starting with" << expectedPath;
-                    return false;
-                }
-                currentHref = hrefString;
-            } else if (name == QLatin1String("response")) {
-            } else if (name == QLatin1String("propstat")) {
-                insidePropstat = true;
-            } else if (name == QLatin1String("status") && insidePropstat) {
-                QString httpStatus = reader.readElementText();
-                if (httpStatus.startsWith("HTTP/1.1 200")) {
-                    currentPropsHaveHttp200 = true;
-                } else {
-                    currentPropsHaveHttp200 = false;
-                }
-            } else if (name == QLatin1String("prop")) {
-                insideProp = true;
-                continue;
-            } else if (name == QLatin1String("multistatus")) {
-                insideMultiStatus = true;
-                continue;
-            }
+    if (_failed) {
+        return false;
+    } else if (_reader.hasError()) {
+        qCWarning(lcLsColJob) << "ERROR" << _reader.errorString() << "at line" << _reader.lineNumber()
+                              << "column" << _reader.columnNumber();
+        return false;
+    } else if (!_insideMultiStatus) {
+        qCWarning(lcLsColJob) << "ERROR no WebDAV response?";
+        return false;
+    }
+    emit directoryListingSubfolders(_folders);
+    emit finishedWithoutError();
+    return true;
+}
+
+bool LsColXMLParser::processToken(QXmlStreamReader::TokenType type)
+{
+    if (_collecting != Collecting::Nothing) {
+        // Properties like <d:resourcetype><d:collection/></d:resourcetype> are read as a string
+        if (type == QXmlStreamReader::StartElement) {
+            _collectedLevel++;
+            if (_collecting == Collecting::Property)
+                _collectedContents += "<" + _reader.name().toString() + ">";
+        } else if (type == QXmlStreamReader::Characters) {
+            _collectedContents += _reader.text();
+        } else if (type == QXmlStreamReader::EndElement) {
+            if (_collectedLevel == 0)
+                return collectedElementFinished();
+            _collectedLevel--;
+            if (_collecting == Collecting::Property)
+                _collectedContents += "</" + _reader.name().toString() + ">";
         }
+        return true;
+    }
 
-        if (type == QXmlStreamReader::StartElement && insidePropstat && insideProp) {
+    if (type == QXmlStreamReader::StartElement) {
+        const QStringRef name = _reader.name();
+        if (_insidePropstat && _insideProp) {
             // All those elements are properties
-            QString propertyContent = readContentsAsString(reader);
-            if (name == QLatin1String("resourcetype") && propertyContent.contains("collection")) {
-                folders.append(currentHref);
-            } else if (name == QLatin1String("size")) {
-                bool ok = false;
-                auto s = propertyContent.toLongLong(&ok);
-                if (ok && fileInfo) {
-                    (*fileInfo)[currentHref].size = s;
-                }
-            } else if (name == QLatin1String("fileid")) {
-                (*fileInfo)[currentHref].fileId = propertyContent.toUtf8();
-            }
-            currentTmpProperties.insert(reader.name().toString(), propertyContent);
+            _collecting = Collecting::Property;
+        } else if (_reader.namespaceUri() != QLatin1String("DAV:")) {
+            return true;
+        } else if (name == QLatin1String("href")) {
+            _collecting = Collecting::Href;
+        } else if (name == QLatin1String("propstat")) {
+            _insidePropstat = true;
+        } else if (name == QLatin1String("status") && _insidePropstat) {
+            _collecting = Collecting::Status;
+        } else if (name == QLatin1String("prop")) {
+            _insideProp = true;
+        } else if (name == QLatin1String("multistatus")) {
+            _insideMultiStatus = true;
+        }
+        if (_collecting != Collecting::Nothing) {
+            _collectedName = name.toString();
+            _collectedContents.clear();
+            _collectedLevel = 0;
         }
+        return true;
+    }
 
-        // End elements with DAV:
-        if (type == QXmlStreamReader::EndElement) {
-            if (reader.namespaceUri() == QLatin1String("DAV:")) {
-                if (reader.name() == "response") {
-                    if (currentHref.endsWith('/')) {
-                        currentHref.chop(1);
-                    }
-                    emit directoryListingIterated(currentHref, currentHttp200Properties);
-                    currentHref.clear();
-                    currentHttp200Properties.clear();
-                } else if (reader.name() == "propstat") {
-                    insidePropstat = false;
-                    if (currentPropsHaveHttp200) {
-                        currentHttp200Properties = QMap<QString, QString>(currentTmpProperties);
-                    }
-                    currentTmpProperties.clear();
-                    currentPropsHaveHttp200 = false;
-                } else if (reader.name() == "prop") {
-                    insideProp = false;
-                }
+    // End elements with DAV:
+    if (type == QXmlStreamReader::EndElement && _reader.namespaceUri() == QLatin1String("DAV:")) {
+        if (_reader.name() == "response") {
+            if (_currentHref.endsWith('/')) {
+                _currentHref.chop(1);
+            }
+            emit directoryListingIterated(_currentHref, _currentHttp200Properties);
+            _currentHref.clear();
+            _currentHttp200Properties.clear();
+        } else if (_reader.name() == "propstat") {
+            _insidePropstat = false;
+            if (_currentPropsHaveHttp200) {
+                _currentHttp200Properties = QMap<QString, QString>(_currentTmpProperties);
             }
+            _currentTmpProperties.clear();
+            _currentPropsHaveHttp200 = false;
+        } else if (_reader.name() == "prop") {
+            _insideProp = false;
         }
     }
+    return true;
+}
 
-    if (reader.hasError()) {
-        // XML Parser error? Whatever had been emitted before will come as directoryListingIterated
-        qCWarning(lcLsColJob) << "ERROR" << reader.errorString() << xml;
-        return false;
-    } else if (!insideMultiStatus) {
-        qCWarning(lcLsColJob) << "ERROR no WebDAV response?" << xml;
-        return false;
-    } else {
-        emit directoryListingSubfolders(folders);
-        emit finishedWithoutError();
+bool LsColXMLParser::collectedElementFinished()
+{
+    const auto collecting = _collecting;
+    _collecting = Collecting::Nothing;
+
+    if (collecting == Collecting::Href) {
+        // We don't use URL encoding in our request URL (which is the expected path) (QNAM will do it for us)
+        // but the result will have URL encoding..
+        QString hrefString = QUrl::fromLocalFile(QUrl::fromPercentEncoding(_collectedContents.toUtf8()))
+                .adjusted(QUrl::NormalizePathSegments)
+                .path();
+        if (!hrefString.startsWith(_expectedPath)) {
+            qCWarning(lcLsColJob) << "Invalid href" << hrefString << "expected starting with" << _expectedPath;
+            return false;
+        }
+        _currentHref = hrefString;
+    } else if (collecting == Collecting::Status) {
+        _currentPropsHaveHttp200 = _collectedContents.startsWith("HTTP/1.1 200");
+    } else if (collecting == Collecting::Property) {
+        const QString &propertyContent = _collectedContents;
+        if (_collectedName == QLatin1String("resourcetype") && propertyContent.contains("collection")) {
+            _folders.append(_currentHref);
+        } else if (_collectedName == QLatin1String("size")) {
+            bool ok = false;
+            auto s = propertyContent.toLongLong(&ok);
+            if (ok && _fileInfo) {
+                (*_fileInfo)[_currentHref].size = s;
+            }
+        } else if (_collectedName == QLatin1String("fileid") && _fileInfo) {
+            (*_fileInfo)[_currentHref].fileId = propertyContent.toUtf8();
+        }
+        _currentTmpProperties.insert(_collectedName, propertyContent);
     }
     return true;
 }
@@ -365,7 +413,7 @@ void LsColJob::start()
     }
 
     QNetworkRequest req;
-    req.setRawHeader("Depth", "1");
+    req.setRawHeader("Depth", _depth);
     QByteArray xml("<?xml version=\"1.0\" ?>\n"
                    "<d:propfind xmlns:d=\"DAV:\" xmlns:oc=\"http://owncloud.org/ns\">\n"
                    "  <d:prop>\n"
@@ -382,29 +430,53 @@ void LsColJob::start()
     AbstractNetworkJob::start();
 }
 
-// TODO: Instead of doing all in this slot, we should iteratively parse in readyRead(). This
-// would allow us to be more asynchronous in processing while data is coming from the network,
-// not all in one big blob at the end.
-bool LsColJob::finished()
+void LsColJob::newReplyHook(QNetworkReply *reply)
 {
-    qCInfo(lcLsColJob) << "LSCOL of" << reply()->request().url() << "FINISHED WITH STATUS"
-                       << replyStatusString();
+    // A resent or redirected request starts over
+    _parser.reset();
+    _parserFailed = false;
+    connect(reply, &QIODevice::readyRead, this, &LsColJob::slotReadyRead);
+}
 
-    QString contentType = reply()->header(QNetworkRequest::ContentTypeHeader).toString();
-    int httpCode = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
-    if (httpCode == 207 && contentType.contains("application/xml; charset=utf-8")) {
-        LsColXMLParser parser;
-        connect(&parser, &LsColXMLParser::directoryListingSubfolders,
+void LsColJob::slotReadyRead()
+{
+    if (!_parser) {
+        // Errors and redirects are handled once the job finished
+        QString contentType = reply()->header(QNetworkRequest::ContentTypeHeader).toString();
+        int httpCode = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (httpCode != 207 || !contentType.contains("application/xml; charset=utf-8"))
+            return;
+
+        _parser.reset(new LsColXMLParser);
+        connect(_parser.get(), &LsColXMLParser::directoryListingSubfolders,
             this, &LsColJob::directoryListingSubfolders);
-        connect(&parser, &LsColXMLParser::directoryListingIterated,
+        connect(_parser.get(), &LsColXMLParser::directoryListingIterated,
             this, &LsColJob::directoryListingIterated);
-        connect(&parser, &LsColXMLParser::finishedWithError,
+        connect(_parser.get(), &LsColXMLParser::finishedWithError,
             this, &LsColJob::finishedWithError);
-        connect(&parser, &LsColXMLParser::finishedWithoutError,
+        connect(_parser.get(), &LsColXMLParser::finishedWithoutError,
             this, &LsColJob::finishedWithoutError);
 
         QString expectedPath = reply()->request().url().path(); // something like "/owncloud/remote.php/webdav/folder"
-        if (!parser.parse(reply()->readAll(), &_folderInfos, expectedPath)) {
+        _parser->startParsing(&_folderInfos, expectedPath);
+    }
+
+    // Consume the data even after an error so it does not pile up in the reply
+    const QByteArray data = reply()->readAll();
+    if (!_parserFailed && !_parser->addData(data))
+        _parserFailed = true;
+}
+
+bool LsColJob::finished()
+{
+    qCInfo(lcLsColJob) << "LSCOL of" << reply()->request().url() << "FINISHED WITH STATUS"
+                       << replyStatusString();
+
+    // Parse whatever was not announced through readyRead yet
+    slotReadyRead();
+
+    if (_parser && reply()->error() == QNetworkReply::NoError) {
+        if (_parserFailed || !_parser->finishParsing()) {
             // XML parse error
             emit finishedWithError(reply());
         }
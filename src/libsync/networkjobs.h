@@ -22,7 +22,9 @@
 
 #include <QBuffer>
 #include <QUrlQuery>
+#include <QXmlStreamReader>
 #include <functional>
+#include <memory>
 
 class QUrl;
 class QJsonObject;
@@ -95,15 +97,66 @@ class OWNCLOUDSYNC_EXPORT LsColXMLParser : public QObject
 public:
     explicit LsColXMLParser();
 
+    /** Parses a complete PROPFIND reply
+     *
+     * Same as startParsing(), addData() and finishParsing() in one go.
+     */
     bool parse(const QByteArray &xml,
                QHash<QString, ExtraFolderInfo> *sizes,
                const QString &expectedPath);
 
+    /** Prepares for parsing a reply that is fed with addData()
+     *
+     * The entries are reported through directoryListingIterated() as soon as
+     * they are complete, so they can be processed while the reply is still
+     * being received.
+     */
+    void startParsing(QHash<QString, ExtraFolderInfo> *sizes, const QString &expectedPath);
+
+    /** Parses the next part of the reply; returns false if it is invalid */
+    bool addData(const QByteArray &data);
+
+    /** To be called once the whole reply was fed; returns whether it was valid
+     *
+     * Emits directoryListingSubfolders() and finishedWithoutError() on success.
+     */
+    bool finishParsing();
+
 signals:
     void directoryListingSubfolders(const QStringList &items);
     void directoryListingIterated(const QString &name, const QMap<QString, QString> &properties);
     void finishedWithError(QNetworkReply *reply);
     void finishedWithoutError();
+
+private:
+    bool processToken(QXmlStreamReader::TokenType type);
+    bool collectedElementFinished();
+
+    QXmlStreamReader _reader;
+    QHash<QString, ExtraFolderInfo> *_fileInfo = nullptr;
+    QString _expectedPath;
+    bool _failed = false;
+
+    QStringList _folders;
+    QString _currentHref;
+    QMap<QString, QString> _currentTmpProperties;
+    QMap<QString, QString> _currentHttp200Properties;
+    bool _currentPropsHaveHttp200 = false;
+    bool _insidePropstat = false;
+    bool _insideProp = false;
+    bool _insideMultiStatus = false;
+
+    // The element whose contents are being read; they may span several addData() calls
+    enum class Collecting {
+        Nothing,
+        Href,
+        Status,
+        Property,
+    };
+    Collecting _collecting = Collecting::Nothing;
+    QString _collectedName;
+    QString _collectedContents;
+    int _collectedLevel = 0;
 };
 
 class OWNCLOUDSYNC_EXPORT LsColJob : public AbstractNetworkJob
@@ -126,18 +179,34 @@ public:
     void setProperties(QList<QByteArray> properties);
     QList<QByteArray> properties() const;
 
+    /**
+     * The value of the Depth header, "1" by default.
+     *
+     * With "infinity" the listing contains the whole subtree.
+     */
+    void setDepth(const QByteArray &depth) { _depth = depth; }
+
 signals:
     void directoryListingSubfolders(const QStringList &items);
     void directoryListingIterated(const QString &name, const QMap<QString, QString> &properties);
     void finishedWithError(QNetworkReply *reply);
     void finishedWithoutError();
 
+protected:
+    void newReplyHook(QNetworkReply *reply) override;
+
 private slots:
     bool finished() override;
+    void slotReadyRead();
 
 private:
     QList<QByteArray> _properties;
     QUrl _url; // Used instead of path() if the url is specified in the constructor
+    QByteArray _depth = "1";
+
+    // Parses the reply while it is being received, created with the first data of a listing
+    std::unique_ptr<LsColXMLParser> _parser;
+    bool _parserFailed = false;
 };
 
 /**
@@ -18,6 +18,8 @@
 #include "common/syncjournalfilerecord.h"
 #include "propagatedownload.h"
 #include "propagateupload.h"
+#include "propagateuploadbulk.h"
+#include "propagatedownloadbulk.h"
 #include "propagateremotedelete.h"
 #include "propagateremotemove.h"
 #include "propagateremotemkdir.h"
@@ -77,19 +79,16 @@ qint64 freeSpaceLimit()
 OwncloudPropagator::~OwncloudPropagator() = default;
 
 
-int OwncloudPropagator::maximumActiveTransferJob()
+int OwncloudPropagator::maximumActiveTransferJob() const
 {
-    if (_downloadLimit != 0
-        || _uploadLimit != 0
-        || !_syncOptions._parallelNetworkJobs) {
-        // disable parallelism when there is a network limit.
+    if (!_syncOptions._parallelNetworkJobs) {
         return 1;
     }
-    return qMin(3, qCeil(_syncOptions._parallelNetworkJobs / 2.));
+    return qMin(_syncOptions._transferConcurrency->window(), hardMaximumActiveJob());
 }
 
 /* The maximum number of active jobs in parallel  */
-int OwncloudPropagator::hardMaximumActiveJob()
+int OwncloudPropagator::hardMaximumActiveJob() const
 {
     if (!_syncOptions._parallelNetworkJobs)
         return 1;
@@ -106,6 +105,15 @@ PropagateItemJob::~PropagateItemJob()
     }
 }
 
+void PropagateItemJob::queueRunnableJobs()
+{
+    if (_state != NotYetStarted || _queued) {
+        return;
+    }
+    _queued = true;
+    propagator()->queueReadyJob(this);
+}
+
 static qint64 getMinBlacklistTime()
 {
     return qMax(qEnvironmentVariableIntValue("OWNCLOUD_BLACKLIST_TIME_MIN"),
@@ -276,6 +284,13 @@ void PropagateItemJob::done(SyncFileItem::Status statusArg, const QString &error
         qCWarning(lcPropagator) << "Could not complete propagation of" << _item->destination() << "by" << this << "with status" << _item->_status << "and error:" << _item->_errorString;
     else
         qCInfo(lcPropagator) << "Completed propagation of" << _item->destination() << "by" << this << "with status" << _item->_status;
+
+    if (isTransferJob() && _runningTime.isValid()) {
+        const auto outcome = ConcurrencyController::outcomeForHttpStatus(_item->_httpErrorCode, !_item->hasErrorStatus());
+        propagator()->syncOptions()._transferConcurrency->transferFinished(
+            _item->_size, std::chrono::milliseconds(_runningTime.elapsed()), outcome);
+    }
+
     emit propagator()->itemCompleted(_item);
     emit finished(_item->_status);
 
@@ -387,6 +402,91 @@ qint64 OwncloudPropagator::smallFileSize()
     return smallFileSize;
 }
 
+bool OwncloudPropagator::isBulkUploadCandidate(const SyncFileItem &item)
+{
+    if (_bulkUploadUnsupported || !account()->capabilities().bulkUpload()) {
+        return false;
+    }
+    // The request body is built in memory and can't be throttled
+    if (_bandwidthManager->usingAbsoluteUploadLimit() || _bandwidthManager->usingRelativeUploadLimit()) {
+        return false;
+    }
+    return item._direction == SyncFileItem::Up
+        && (item._instruction == CSYNC_INSTRUCTION_NEW || item._instruction == CSYNC_INSTRUCTION_SYNC)
+        && item._type == ItemTypeFile
+        && item._size < smallFileSize();
+}
+
+bool OwncloudPropagator::isBulkDownloadCandidate(const SyncFileItem &item)
+{
+    if (_bulkDownloadUnsupported || !account()->capabilities().bulkDownload()) {
+        return false;
+    }
+    // The reply is split into the files as it arrives and can't be throttled
+    if (_bandwidthManager->usingAbsoluteDownloadLimit() || _bandwidthManager->usingRelativeDownloadLimit()) {
+        return false;
+    }
+    return item._direction == SyncFileItem::Down
+        && (item._instruction == CSYNC_INSTRUCTION_NEW || item._instruction == CSYNC_INSTRUCTION_SYNC)
+        && item._type == ItemTypeFile
+        && item._directDownloadUrl.isEmpty()
+        && item._size < smallFileSize();
+}
+
+void OwncloudPropagator::appendBulkUploads(PropagateDirectory *directory, const SyncFileItemVector &items)
+{
+    const qint64 maxBatchSize = syncOptions()._initialChunkSize;
+    int first = 0;
+    while (first < items.size()) {
+        int last = first;
+        qint64 batchSize = items[first]->_size;
+        while (last + 1 < items.size()
+            && last + 1 - first < PropagateUploadFileBulk::maxBatchFiles
+            && batchSize + items[last + 1]->_size <= maxBatchSize) {
+            ++last;
+            batchSize += items[last]->_size;
+        }
+
+        if (first == last) {
+            // Not worth a multipart request
+            directory->appendTask(items[first]);
+        } else {
+            auto batch = QSharedPointer<BulkUploadBatch>::create(this, last - first + 1);
+            for (int i = first; i <= last; ++i) {
+                directory->appendJob(new PropagateUploadFileBulk(this, items[i], batch));
+            }
+        }
+        first = last + 1;
+    }
+}
+
+void OwncloudPropagator::appendBulkDownloads(PropagateDirectory *directory, const SyncFileItemVector &items)
+{
+    const qint64 maxBatchSize = syncOptions()._initialChunkSize;
+    int first = 0;
+    while (first < items.size()) {
+        int last = first;
+        qint64 batchSize = items[first]->_size;
+        while (last + 1 < items.size()
+            && last + 1 - first < PropagateDownloadFileBulk::maxBatchFiles
+            && batchSize + items[last + 1]->_size <= maxBatchSize) {
+            ++last;
+            batchSize += items[last]->_size;
+        }
+
+        if (first == last) {
+            // Not worth a multipart reply
+            directory->appendTask(items[first]);
+        } else {
+            auto batch = QSharedPointer<BulkDownloadBatch>::create(this, last - first + 1);
+            for (int i = first; i <= last; ++i) {
+                directory->appendJob(new PropagateDownloadFileBulk(this, items[i], batch));
+            }
+        }
+        first = last + 1;
+    }
+}
+
 void OwncloudPropagator::start(const SyncFileItemVector &items)
 {
     Q_ASSERT(std::is_sorted(items.begin(), items.end()));
@@ -402,6 +502,8 @@ void OwncloudPropagator::start(const SyncFileItemVector &items)
     QVector<PropagatorJob *> directoriesToRemove;
     QString removedDirectory;
     QString maybeConflictDirectory;
+    QHash<PropagateDirectory *, SyncFileItemVector> bulkUploads;
+    QHash<PropagateDirectory *, SyncFileItemVector> bulkDownloads;
     foreach (const SyncFileItemPtr &item, items) {
         if (!removedDirectory.isEmpty() && item->_file.startsWith(removedDirectory)) {
             // this is an item in a directory which is going to be removed.
@@ -492,6 +594,10 @@ void OwncloudPropagator::start(const SyncFileItemVector &items)
                 // will delete directories, so defer execution
                 directoriesToRemove.prepend(createJob(item));
                 removedDirectory = item->_file + "/";
+            } else if (isBulkUploadCandidate(*item)) {
+                bulkUploads[directories.top().second].append(item);
+            } else if (isBulkDownloadCandidate(*item)) {
+                bulkDownloads[directories.top().second].append(item);
             } else {
                 directories.top().second->appendTask(item);
             }
@@ -504,6 +610,13 @@ void OwncloudPropagator::start(const SyncFileItemVector &items)
         }
     }
 
+    for (auto it = bulkUploads.cbegin(); it != bulkUploads.cend(); ++it) {
+        appendBulkUploads(it.key(), it.value());
+    }
+    for (auto it = bulkDownloads.cbegin(); it != bulkDownloads.cend(); ++it) {
+        appendBulkDownloads(it.key(), it.value());
+    }
+
     foreach (PropagatorJob *it, directoriesToRemove) {
         _rootJob->_dirDeletionJobs.appendJob(it);
     }
@@ -511,6 +624,11 @@ void OwncloudPropagator::start(const SyncFileItemVector &items)
     connect(_rootJob.data(), &PropagatorJob::finished, this, &OwncloudPropagator::emitFinished);
 
     _jobScheduled = false;
+    _startedJobsCount = 0;
+    _schedulingRounds = 0;
+    _readyJobs.clear();
+    _compositesWaitingForRoom.clear();
+    _rootJob->queueRunnableJobs();
     scheduleNextJob();
 }
 
@@ -523,6 +641,13 @@ void OwncloudPropagator::setSyncOptions(const SyncOptions &syncOptions)
 {
     _syncOptions = syncOptions;
     _chunkSize = syncOptions._initialChunkSize;
+
+    const int maxTransfers = _syncOptions._maxParallelTransfers > 0
+        ? qMin(_syncOptions._maxParallelTransfers, hardMaximumActiveJob())
+        : hardMaximumActiveJob();
+    // Start out with the number of parallel transfers that used to be fixed
+    const int initialTransfers = qMin(3, qCeil(_syncOptions._parallelNetworkJobs / 2.));
+    _syncOptions._transferConcurrency->setBounds(_syncOptions._minParallelTransfers, maxTransfers, initialTransfers);
 }
 
 bool OwncloudPropagator::localFileNameClash(const QString &relFile)
@@ -618,7 +743,31 @@ void OwncloudPropagator::scheduleNextJob()
 {
     if (_jobScheduled) return; // don't schedule more than 1
     _jobScheduled = true;
-    QTimer::singleShot(3, this, &OwncloudPropagator::scheduleNextJobImpl);
+    // Dispatch as soon as control returns to the event loop
+    QMetaObject::invokeMethod(this, "scheduleNextJobImpl", Qt::QueuedConnection);
+}
+
+bool OwncloudPropagator::mayStartAnotherJob() const
+{
+    const int activeCount = _activeJobList.count();
+    if (activeCount < maximumActiveTransferJob()) {
+        return true;
+    }
+    if (activeCount >= hardMaximumActiveJob()) {
+        return false;
+    }
+
+    int likelyFinishedQuicklyCount = 0;
+    // NOTE: Only counts the first 3 jobs! Then for each
+    // one that is likely finished quickly, we can launch another one.
+    // When a job finishes another one will "move up" to be one of the first 3 and then
+    // be counted too.
+    for (int i = 0; i < maximumActiveTransferJob() && i < _activeJobList.count(); i++) {
+        if (_activeJobList.at(i)->isLikelyFinishedQuickly()) {
+            likelyFinishedQuicklyCount++;
+        }
+    }
+    return activeCount < maximumActiveTransferJob() + likelyFinishedQuicklyCount;
 }
 
 void OwncloudPropagator::scheduleNextJobImpl()
@@ -630,27 +779,81 @@ void OwncloudPropagator::scheduleNextJobImpl()
 
     _jobScheduled = false;
 
-    if (_activeJobList.count() < maximumActiveTransferJob()) {
-        if (_rootJob->scheduleSelfOrChild()) {
-            scheduleNextJob();
-        }
-    } else if (_activeJobList.count() < hardMaximumActiveJob()) {
-        int likelyFinishedQuicklyCount = 0;
-        // NOTE: Only counts the first 3 jobs! Then for each
-        // one that is likely finished quickly, we can launch another one.
-        // When a job finishes another one will "move up" to be one of the first 3 and then
-        // be counted too.
-        for (int i = 0; i < maximumActiveTransferJob() && i < _activeJobList.count(); i++) {
-            if (_activeJobList.at(i)->isLikelyFinishedQuickly()) {
-                likelyFinishedQuicklyCount++;
+    if (!_rootJob) {
+        return;
+    }
+
+    // Fill all the free slots at once instead of starting one job per event
+    // loop iteration. The composite jobs queued the jobs that may start
+    // according to their JobParallelism. startQueued() runs the start() of
+    // the job right away, so the jobs that register themselves in
+    // _activeJobList are counted by the next mayStartAnotherJob().
+    int started = 0;
+    while (mayStartAnotherJob()) {
+        if (_readyJobs.empty()) {
+            refillReadyQueue();
+            if (_readyJobs.empty()) {
+                break;
             }
         }
-        if (_activeJobList.count() < maximumActiveTransferJob() + likelyFinishedQuicklyCount) {
-            qCDebug(lcPropagator) << "Can pump in another request! activeJobs =" << _activeJobList.count();
-            if (_rootJob->scheduleSelfOrChild()) {
-                scheduleNextJob();
-            }
+        const QPointer<PropagateItemJob> job = _readyJobs.front();
+        _readyJobs.pop_front();
+        if (!job || job->_state != PropagatorJob::NotYetStarted) {
+            continue;
         }
+        job->startQueued();
+        ++started;
+    }
+    refillReadyQueue();
+    ++_schedulingRounds;
+
+    if (started > 0) {
+        qCDebug(lcPropagator) << "Started" << started << "jobs, activeJobs =" << _activeJobList.count();
+        _startedJobsCount += started;
+        // Once these jobs ran their start(), there may be room for more, for example
+        // if they are likely to finish quickly.
+        scheduleNextJob();
+    }
+}
+
+void OwncloudPropagator::queueReadyJob(PropagateItemJob *job)
+{
+    _readyJobs.emplace_back(job);
+    scheduleNextJob();
+}
+
+bool OwncloudPropagator::readyQueueIsFull() const
+{
+    return _readyJobs.size() >= static_cast<size_t>(hardMaximumActiveJob());
+}
+
+void OwncloudPropagator::waitForRoom(PropagatorCompositeJob *composite)
+{
+    if (composite->_waitingForRoom) {
+        return;
+    }
+    composite->_waitingForRoom = true;
+    _compositesWaitingForRoom.emplace_back(composite);
+}
+
+void OwncloudPropagator::refillReadyQueue()
+{
+    // In the order they ran out of room, a composite that still has more
+    // than fits registers again at the end
+    while (!readyQueueIsFull() && !_compositesWaitingForRoom.empty()) {
+        const QPointer<PropagatorCompositeJob> composite = _compositesWaitingForRoom.front();
+        _compositesWaitingForRoom.pop_front();
+        if (composite) {
+            composite->_waitingForRoom = false;
+            composite->queueRunnableJobs();
+        }
+    }
+}
+
+void OwncloudPropagator::queueRunnableJobs()
+{
+    if (_rootJob) {
+        _rootJob->queueRunnableJobs();
     }
 }
 
@@ -822,10 +1025,10 @@ void PropagatorCompositeJob::appendJob(PropagatorJob *job)
     _jobsToDo.append(job);
 }
 
-bool PropagatorCompositeJob::scheduleSelfOrChild()
+void PropagatorCompositeJob::queueRunnableJobs()
 {
     if (_state == Finished) {
-        return false;
+        return;
     }
 
     // Start the composite job
@@ -833,57 +1036,67 @@ bool PropagatorCompositeJob::scheduleSelfOrChild()
         _state = Running;
     }
 
-    // Ask all the running composite jobs if they have something new to schedule.
+    // The running sub jobs came first, let them queue their jobs first.
     for (auto runningJob : qAsConst(_runningJobs)) {
-        ASSERT(runningJob->_state == Running);
-
-        if (possiblyRunNextJob(runningJob)) {
-            return true;
+        if (propagator()->readyQueueIsFull()) {
+            propagator()->waitForRoom(this);
+            return;
         }
+        runningJob->queueRunnableJobs();
 
-        // If any of the running sub jobs is not parallel, we have to cancel the scheduling
-        // of the rest of the list and wait for the blocking job to finish and schedule the next one.
-        auto paral = runningJob->parallelism();
-        if (paral == WaitForFinished) {
-            return false;
+        // If any of the running sub jobs is not parallel, we have to wait
+        // for the blocking job to finish before queueing the rest of the list.
+        if (runningJob->parallelism() == WaitForFinished) {
+            return;
         }
     }
 
-    // Now it's our turn, check if we have something left to do.
-    // First, convert a task to a job if necessary
-    while (_jobsToDo.isEmpty() && !_tasksToDo.isEmpty()) {
-        SyncFileItemPtr nextTask = _tasksToDo.first();
-        _tasksToDo.remove(0);
-        PropagatorJob *job = propagator()->createJob(nextTask);
-        if (!job) {
-            qCWarning(lcDirectory) << "Useless task found for file" << nextTask->destination() << "instruction" << nextTask->_instruction;
-            continue;
+    // Now it's our turn. Convert the tasks to jobs only as they are needed,
+    // the queue of ready jobs holds just enough to fill the free slots.
+    while (!_jobsToDo.isEmpty() || !_tasksToDo.isEmpty()) {
+        if (propagator()->readyQueueIsFull()) {
+            propagator()->waitForRoom(this);
+            return;
         }
-        appendJob(job);
-        break;
-    }
-    // Then run the next job
-    if (!_jobsToDo.isEmpty()) {
-        PropagatorJob *nextJob = _jobsToDo.first();
-        _jobsToDo.remove(0);
+
+        PropagatorJob *nextJob = nullptr;
+        if (!_jobsToDo.isEmpty()) {
+            nextJob = _jobsToDo.first();
+            _jobsToDo.remove(0);
+        } else {
+            SyncFileItemPtr nextTask = _tasksToDo.first();
+            _tasksToDo.remove(0);
+            nextJob = propagator()->createJob(nextTask);
+            if (!nextJob) {
+                qCWarning(lcDirectory) << "Useless task found for file" << nextTask->destination() << "instruction" << nextTask->_instruction;
+                continue;
+            }
+            nextJob->setAssociatedComposite(this);
+        }
+
         _runningJobs.append(nextJob);
-        return possiblyRunNextJob(nextJob);
+        connect(nextJob, &PropagatorJob::finished, this, &PropagatorCompositeJob::slotSubJobFinished);
+        nextJob->queueRunnableJobs();
+
+        if (nextJob->parallelism() == WaitForFinished) {
+            return;
+        }
     }
 
     // If neither us or our children had stuff left to do we could hang. Make sure
     // we mark this job as finished so that the propagator can schedule a new one.
-    if (_jobsToDo.isEmpty() && _tasksToDo.isEmpty() && _runningJobs.isEmpty()) {
+    if (_runningJobs.isEmpty()) {
         // Our parent jobs are already iterating over their running jobs, post to the event loop
         // to avoid removing ourself from that list while they iterate.
         QMetaObject::invokeMethod(this, "finalize", Qt::QueuedConnection);
     }
-    return false;
 }
 
 void PropagatorCompositeJob::slotSubJobFinished(SyncFileItem::Status status)
 {
     auto *subJob = static_cast<PropagatorJob *>(sender());
     ASSERT(subJob);
+    const bool wasBlocking = subJob->parallelism() == WaitForFinished;
 
     // Delete the job and remove it from our list of jobs.
     subJob->deleteLater();
@@ -903,9 +1116,16 @@ void PropagatorCompositeJob::slotSubJobFinished(SyncFileItem::Status status)
 
     if (_jobsToDo.isEmpty() && _tasksToDo.isEmpty() && _runningJobs.isEmpty()) {
         finalize();
+        return;
+    }
+
+    if (wasBlocking) {
+        // Jobs anywhere in the tree may have waited for this one
+        propagator()->queueRunnableJobs();
     } else {
-        propagator()->scheduleNextJob();
+        queueRunnableJobs();
     }
+    propagator()->scheduleNextJob();
 }
 
 void PropagatorCompositeJob::finalize()
@@ -956,30 +1176,28 @@ PropagatorJob::JobParallelism PropagateDirectory::parallelism()
 }
 
 
-bool PropagateDirectory::scheduleSelfOrChild()
+void PropagateDirectory::queueRunnableJobs()
 {
     if (_state == Finished) {
-        return false;
+        return;
     }
 
     if (_state == NotYetStarted) {
         _state = Running;
     }
 
-    if (_firstJob && _firstJob->_state == NotYetStarted) {
-        return _firstJob->scheduleSelfOrChild();
-    }
-
-    if (_firstJob && _firstJob->_state == Running) {
-        // Don't schedule any more job until this is done.
-        return false;
+    if (_firstJob) {
+        // Don't queue any more job until this is done.
+        _firstJob->queueRunnableJobs();
+        return;
     }
 
-    return _subJobs.scheduleSelfOrChild();
+    _subJobs.queueRunnableJobs();
 }
 
 void PropagateDirectory::slotFirstJobFinished(SyncFileItem::Status status)
 {
+    const bool wasBlocking = _firstJob->parallelism() == WaitForFinished;
     _firstJob.take()->deleteLater();
 
     if (status != SyncFileItem::Success
@@ -994,6 +1212,12 @@ void PropagateDirectory::slotFirstJobFinished(SyncFileItem::Status status)
         return;
     }
 
+    if (wasBlocking) {
+        // Jobs anywhere in the tree may have waited for this one
+        propagator()->queueRunnableJobs();
+    } else {
+        queueRunnableJobs();
+    }
     propagator()->scheduleNextJob();
 }
 
@@ -1081,19 +1305,18 @@ qint64 PropagateRootDirectory::committedDiskSpace() const
     return _subJobs.committedDiskSpace() + _dirDeletionJobs.committedDiskSpace();
 }
 
-bool PropagateRootDirectory::scheduleSelfOrChild()
+void PropagateRootDirectory::queueRunnableJobs()
 {
     if (_state == Finished)
-        return false;
+        return;
 
-    if (PropagateDirectory::scheduleSelfOrChild())
-        return true;
+    PropagateDirectory::queueRunnableJobs();
 
     // Important: Finish _subJobs before scheduling any deletes.
     if (_subJobs._state != Finished)
-        return false;
+        return;
 
-    return _dirDeletionJobs.scheduleSelfOrChild();
+    _dirDeletionJobs.queueRunnableJobs();
 }
 
 void PropagateRootDirectory::slotSubJobsFinished(SyncFileItem::Status status)
@@ -1110,6 +1333,7 @@ void PropagateRootDirectory::slotSubJobsFinished(SyncFileItem::Status status)
         return;
     }
 
+    _dirDeletionJobs.queueRunnableJobs();
     propagator()->scheduleNextJob();
 }
 
@@ -24,6 +24,9 @@
 #include <QIODevice>
 #include <QMutex>
 
+#include <algorithm>
+#include <deque>
+
 #include "csync.h"
 #include "syncfileitem.h"
 #include "common/syncjournaldb.h"
@@ -110,6 +113,14 @@ public:
      */
     void setAssociatedComposite(PropagatorCompositeJob *job) { _associatedComposite = job; }
 
+    /** Queues the jobs that may start now, see OwncloudPropagator::queueReadyJob()
+     *
+     * Item jobs queue themselves. Composite jobs queue their sub jobs as far
+     * as the JobParallelism of the running ones allows, and queue more of
+     * them when one finishes.
+     */
+    virtual void queueRunnableJobs() = 0;
+
 public slots:
     /*
      * Asynchronous abort requires emit of abortFinished() signal,
@@ -120,10 +131,6 @@ public slots:
             emit abortFinished();
     }
 
-    /** Starts this job, or a new subjob
-     * returns true if a job was started.
-     */
-    virtual bool scheduleSelfOrChild() = 0;
 signals:
     /**
      * Emitted when the job is fully finished
@@ -173,12 +180,21 @@ protected:
 
     bool hasEncryptedAncestor() const;
 
+    /** Whether the job transfers file contents.
+     *
+     * The completion of such jobs feeds the adaptive number of parallel
+     * transfers, see SyncOptions::_transferConcurrency.
+     */
+    virtual bool isTransferJob() const { return false; }
+
 protected slots:
     void slotRestoreJobFinished(SyncFileItem::Status status);
 
 private:
     QScopedPointer<PropagateItemJob> _restoreJob;
     JobParallelism _parallelism;
+    QElapsedTimer _runningTime;
+    bool _queued = false; // whether the job is in the propagator's queue of ready jobs
 
 public:
     PropagateItemJob(OwncloudPropagator *propagator, const SyncFileItemPtr &item)
@@ -194,16 +210,16 @@ public:
     }
     ~PropagateItemJob();
 
-    bool scheduleSelfOrChild() override
+    void queueRunnableJobs() override;
+
+    /// Starts the queued job, called by the propagator once there is a free slot
+    void startQueued()
     {
-        if (_state != NotYetStarted) {
-            return false;
-        }
         qCInfo(lcPropagator) << "Starting" << _item->_instruction << "propagation of" << _item->destination() << "by" << this;
 
         _state = Running;
+        _runningTime.start();
         QMetaObject::invokeMethod(this, "start"); // We could be in a different thread (neon jobs)
-        return true;
     }
 
     virtual JobParallelism parallelism() override { return _parallelism; }
@@ -227,6 +243,7 @@ public:
     QVector<PropagatorJob *> _runningJobs;
     SyncFileItem::Status _hasError; // NoStatus,  or NormalError / SoftError if there was an error
     quint64 _abortsCount;
+    bool _waitingForRoom = false; // whether the propagator asks again once its queue of ready jobs has room
 
     explicit PropagatorCompositeJob(OwncloudPropagator *propagator)
         : PropagatorJob(propagator)
@@ -245,7 +262,7 @@ public:
         _tasksToDo.append(item);
     }
 
-    bool scheduleSelfOrChild() override;
+    void queueRunnableJobs() override;
     JobParallelism parallelism() override;
 
     /*
@@ -255,9 +272,13 @@ public:
      */
     void abort(PropagatorJob::AbortType abortType) override
     {
-        if (!_runningJobs.empty()) {
-            _abortsCount = _runningJobs.size();
+        // Queued jobs that didn't start yet have nothing to abort
+        const auto started = [](PropagatorJob *j) { return j->_state != NotYetStarted; };
+        _abortsCount = std::count_if(_runningJobs.cbegin(), _runningJobs.cend(), started);
+        if (_abortsCount > 0) {
             foreach (PropagatorJob *j, _runningJobs) {
+                if (!started(j))
+                    continue;
                 if (abortType == AbortType::Asynchronous) {
                     connect(j, &PropagatorJob::abortFinished,
                             this, &PropagatorCompositeJob::slotSubJobAbortFinished);
@@ -273,14 +294,6 @@ public:
 
 private slots:
     void slotSubJobAbortFinished();
-    bool possiblyRunNextJob(PropagatorJob *next)
-    {
-        if (next->_state == NotYetStarted) {
-            connect(next, &PropagatorJob::finished, this, &PropagatorCompositeJob::slotSubJobFinished);
-        }
-        return next->scheduleSelfOrChild();
-    }
-
     void slotSubJobFinished(SyncFileItem::Status status);
     void finalize();
 };
@@ -311,7 +324,7 @@ public:
         _subJobs.appendTask(item);
     }
 
-    bool scheduleSelfOrChild() override;
+    void queueRunnableJobs() override;
     JobParallelism parallelism() override;
     void abort(PropagatorJob::AbortType abortType) override
     {
@@ -359,7 +372,7 @@ public:
 
     explicit PropagateRootDirectory(OwncloudPropagator *propagator);
 
-    bool scheduleSelfOrChild() override;
+    void queueRunnableJobs() override;
     JobParallelism parallelism() override;
     void abort(PropagatorJob::AbortType abortType) override;
 
@@ -411,7 +424,7 @@ public:
         , _remoteFolder((remoteFolder.endsWith(QChar('/'))) ? remoteFolder : remoteFolder + '/')
         , _journal(progressDb)
         , _finishedEmited(false)
-        , _bandwidthManager(this)
+        , _bandwidthManager(BandwidthManager::instance())
         , _anotherSyncNeeded(false)
         , _chunkSize(10 * 1000 * 1000) // 10 MB, overridden in setSyncOptions
         , _account(account)
@@ -426,9 +439,8 @@ public:
     const SyncOptions &syncOptions() const;
     void setSyncOptions(const SyncOptions &syncOptions);
 
-    int _downloadLimit = 0;
-    int _uploadLimit = 0;
-    BandwidthManager _bandwidthManager;
+    /// Shared by all propagators, so that the limits hold across folders and accounts
+    BandwidthManager *const _bandwidthManager;
 
     bool _abortRequested = false;
 
@@ -443,6 +455,12 @@ public:
     /** We detected that another sync is required after this one */
     bool _anotherSyncNeeded;
 
+    /** The server rejected a bulk upload request; upload files one by one */
+    bool _bulkUploadUnsupported = false;
+
+    /** The server rejected a bulk download request; download files one by one */
+    bool _bulkDownloadUnsupported = false;
+
     /** Per-folder quota guesses.
      *
      * This starts out empty. When an upload in a folder fails due to insufficent
@@ -457,7 +475,7 @@ public:
     QHash<QString, qint64> _folderQuota;
 
     /* the maximum number of jobs using bandwidth (uploads or downloads, in parallel) */
-    int maximumActiveTransferJob();
+    int maximumActiveTransferJob() const;
 
     /** The size to use for upload chunks.
      *
@@ -469,7 +487,7 @@ public:
     qint64 smallFileSize();
 
     /* The maximum number of active jobs in parallel  */
-    int hardMaximumActiveJob();
+    int hardMaximumActiveJob() const;
 
     /** Check whether a download would clash with an existing file
      * in filesystems that are only case-preserving.
@@ -501,13 +519,53 @@ public:
      */
     PropagateItemJob *createJob(const SyncFileItemPtr &item);
 
+    /** Whether an item may be uploaded along with others in one bulk request */
+    bool isBulkUploadCandidate(const SyncFileItem &item);
+
+    /** Whether an item may be downloaded along with others in one bulk request */
+    bool isBulkDownloadCandidate(const SyncFileItem &item);
+
+    /** Dispatches runnable jobs into the free job slots
+     *
+     * Called whenever a slot may have become free, e.g. when a job finished.
+     * The dispatch happens once control returns to the event loop.
+     */
     void scheduleNextJob();
     void reportProgress(const SyncFileItem &, qint64 bytes);
 
+    /** Number of jobs dispatched by the scheduler since the propagation started */
+    qint64 startedJobsCount() const { return _startedJobsCount; }
+
+    /** Number of dispatch rounds of the scheduler since the propagation started */
+    qint64 schedulingRounds() const { return _schedulingRounds; }
+
+    /** Adds a job that may start now to the queue of ready jobs
+     *
+     * The scheduler starts the queued jobs in order as slots become free.
+     */
+    void queueReadyJob(PropagateItemJob *job);
+
+    /** Whether the queue of ready jobs holds enough jobs to fill all slots
+     *
+     * Composite jobs stop queueing then and register with waitForRoom().
+     */
+    bool readyQueueIsFull() const;
+
+    /// Asks \a composite to queue more jobs once the queue of ready jobs has room
+    void waitForRoom(PropagatorCompositeJob *composite);
+
+    /** Queues the runnable jobs of the whole job tree
+     *
+     * Needed when a job that had to finish before any other job could
+     * start is done, see PropagatorJob::WaitForFinished.
+     */
+    void queueRunnableJobs();
+
     void abort()
     {
         if (_abortRequested)
             return;
+        _abortRequested = true;
         if (_rootJob) {
             // Connect to abortFinished  which signals that abort has been asynchronously finished
             connect(_rootJob.data(), &PropagateDirectory::abortFinished, this, &OwncloudPropagator::emitFinished);
@@ -611,10 +669,26 @@ signals:
     void insufficientRemoteStorage();
 
 private:
+    /// Whether there's a free slot for another job
+    bool mayStartAnotherJob() const;
+
+    /// Lets the composites that wait for room queue more jobs
+    void refillReadyQueue();
+
+    /// Adds the uploads of \a items to \a directory, packed into bulk upload batches
+    void appendBulkUploads(PropagateDirectory *directory, const SyncFileItemVector &items);
+
+    /// Adds the downloads of \a items to \a directory, packed into bulk download batches
+    void appendBulkDownloads(PropagateDirectory *directory, const SyncFileItemVector &items);
+
     AccountPtr _account;
     QScopedPointer<PropagateRootDirectory> _rootJob;
     SyncOptions _syncOptions;
     bool _jobScheduled = false;
+    qint64 _startedJobsCount = 0;
+    qint64 _schedulingRounds = 0;
+    std::deque<QPointer<PropagateItemJob>> _readyJobs; // jobs that may start, in order
+    std::deque<QPointer<PropagatorCompositeJob>> _compositesWaitingForRoom;
 
     const QString _localDir; // absolute path to the local directory. ends with '/'
     const QString _remoteFolder; // remote folder, ends with '/'
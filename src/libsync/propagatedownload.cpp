@@ -26,6 +26,7 @@
 #include "common/asserts.h"
 #include "clientsideencryptionjobs.h"
 #include "propagatedownloadencrypted.h"
+#include "propagatedownloaddelta.h"
 #include "common/vfs.h"
 
 #include "configfile.h"
@@ -120,8 +121,9 @@ GETFileJob::GETFileJob(AccountPtr account, const QUrl &url, QIODevice *device,
 
 void GETFileJob::start()
 {
-    if (_resumeStart > 0) {
-        _headers["Range"] = "bytes=" + QByteArray::number(_resumeStart) + '-';
+    if (_resumeStart > 0 || _rangeEnd >= 0) {
+        _headers["Range"] = "bytes=" + QByteArray::number(_resumeStart) + '-'
+            + (_rangeEnd >= 0 ? QByteArray::number(_rangeEnd) : QByteArray());
         _headers["Accept-Ranges"] = "bytes";
         qCDebug(lcGetJob) << "Retry with range " << _headers["Range"];
     }
@@ -223,6 +225,14 @@ void GETFileJob::slotMetaDataChanged()
         return;
     }
 
+    if (_rangeEnd >= 0 && httpStatus != 206) {
+        qCWarning(lcGetJob) << "Server did not reply with the requested range, status" << httpStatus;
+        _errorString = tr("Server does not support range requests");
+        _errorStatus = SyncFileItem::NormalError;
+        reply()->abort();
+        return;
+    }
+
     qint64 start = 0;
     QByteArray ranges = reply()->rawHeader("Content-Range");
     if (!ranges.isEmpty()) {
@@ -233,10 +243,10 @@ void GETFileJob::slotMetaDataChanged()
     }
     if (start != _resumeStart) {
         qCWarning(lcGetJob) << "Wrong content-range: " << ranges << " while expecting start was" << _resumeStart;
-        if (ranges.isEmpty()) {
+        if (ranges.isEmpty() && _rangeEnd < 0) {
             // device doesn't support range, just try again from scratch
             _device->close();
-            if (!_device->open(QIODevice::WriteOnly)) {
+            if (!_device->open(QIODevice::WriteOnly) || (_decryptor && !_decryptor->restart())) {
                 _errorString = _device->errorString();
                 _errorStatus = SyncFileItem::NormalError;
                 reply()->abort();
@@ -256,9 +266,56 @@ void GETFileJob::slotMetaDataChanged()
         _lastModified = Utility::qDateTimeToTime_t(lastModified.toDateTime());
     }
 
+    // Checksum the body while writing it, unless earlier parts of the file were
+    // written by a previous attempt: these would have to be read from disk anyway.
+    _checksumCalculator.reset();
+    _streamedChecksum.clear();
+    if (_resumeStart == 0 && _rangeEnd < 0) {
+        auto checksumHeader = findBestChecksum(reply()->rawHeader(checkSumHeaderC));
+        if (checksumHeader.isEmpty() && !reply()->rawHeader(contentMd5HeaderC).isEmpty())
+            checksumHeader = "MD5:" + reply()->rawHeader(contentMd5HeaderC);
+        const auto checksumType = parseChecksumHeaderType(checksumHeader);
+        if (!checksumType.isEmpty()) {
+            _checksumCalculator = std::make_unique<ChecksumCalculator>(checksumType);
+            if (!_checksumCalculator->isValid()) {
+                _checksumCalculator.reset();
+            }
+        }
+    }
+
     _saveBodyToFile = true;
 }
 
+QByteArray GETFileJob::streamedChecksumType() const
+{
+    return _checksumCalculator ? _checksumCalculator->checksumType() : QByteArray();
+}
+
+void GETFileJob::finishStreamedChecksum()
+{
+    if (!_checksumCalculator || !_checksumCalculator->isValid()) {
+        return;
+    }
+    if (reply()->error() != QNetworkReply::NoError) {
+        _checksumCalculator.reset();
+        return;
+    }
+    _streamedChecksum = _checksumCalculator->result();
+}
+
+void GETFileJob::finishDecryption()
+{
+    if (!_decryptor || !_saveBodyToFile || reply()->error() != QNetworkReply::NoError) {
+        return;
+    }
+    if (!_decryptor->finish()) {
+        qCWarning(lcGetJob) << "The tag of the downloaded file doesn't match, it can't be decrypted";
+        _errorString = tr("The downloaded file could not be decrypted.");
+        _errorStatus = SyncFileItem::NormalError;
+        _decryptionFailed = true;
+    }
+}
+
 void GETFileJob::setBandwidthManager(BandwidthManager *bwm)
 {
     _bandwidthManager = bwm;
@@ -297,6 +354,7 @@ void GETFileJob::slotReadyRead()
         return;
     int bufferSize = qMin(1024 * 8ll, reply()->bytesAvailable());
     QByteArray buffer(bufferSize, Qt::Uninitialized);
+    QByteArray decrypted(_decryptor ? bufferSize : 0, Qt::Uninitialized);
 
     while (reply()->bytesAvailable() > 0 && _saveBodyToFile) {
         if (_bandwidthChoked) {
@@ -322,11 +380,28 @@ void GETFileJob::slotReadyRead()
             return;
         }
 
-        qint64 w = _device->write(buffer.constData(), r);
-        if (w != r) {
+        if (_checksumCalculator) {
+            _checksumCalculator->addData(buffer.constData(), r);
+        }
+
+        const char *data = buffer.constData();
+        qint64 dataSize = r;
+        if (_decryptor) {
+            dataSize = _decryptor->update(buffer.constData(), int(r), decrypted.data());
+            if (dataSize < 0) {
+                _errorString = tr("The downloaded file could not be decrypted.");
+                _errorStatus = SyncFileItem::NormalError;
+                reply()->abort();
+                return;
+            }
+            data = decrypted.constData();
+        }
+
+        qint64 w = _device->write(data, dataSize);
+        if (w != dataSize) {
             _errorString = _device->errorString();
             _errorStatus = SyncFileItem::NormalError;
-            qCWarning(lcGetJob) << "Error while writing to file" << w << r << _errorString;
+            qCWarning(lcGetJob) << "Error while writing to file" << w << dataSize << _errorString;
             reply()->abort();
             return;
         }
@@ -342,6 +417,8 @@ void GETFileJob::slotReadyRead()
                              << replyStatusString()
                              << reply()->rawHeader("Content-Range") << reply()->rawHeader("Content-Length");
 
+            finishStreamedChecksum();
+            finishDecryption();
             emit finishedSignal();
         }
         _hasEmittedFinishedSignal = true;
@@ -542,9 +619,18 @@ void PropagateDownloadFile::startDownload()
 
     propagator()->reportProgress(*_item, 0);
 
+    const SyncJournalDb::DownloadInfo progressInfo = propagator()->_journal->getDownloadInfo(_item->_file);
+
+    // A partially assembled file can't be resumed, so resumable downloads are continued as they are
+    if (!_deltaTried && !_isEncrypted && !progressInfo._valid
+        && PropagateDownloadDelta::isCandidate(propagator(), *_item)
+        && propagator()->diskSpaceCheck() == OwncloudPropagator::DiskSpaceOk) {
+        startDeltaDownload();
+        return;
+    }
+
     QString tmpFileName;
     QByteArray expectedEtagForResume;
-    const SyncJournalDb::DownloadInfo progressInfo = propagator()->_journal->getDownloadInfo(_item->_file);
     if (progressInfo._valid) {
         // if the etag has changed meanwhile, remove the already downloaded part.
         if (progressInfo._etag != _item->_etag) {
@@ -568,6 +654,21 @@ void PropagateDownloadFile::startDownload()
         return;
     }
 
+    if (_isEncrypted) {
+        const auto &encryptedInfo = _downloadEncryptedHelper->encryptedInfo();
+        _decryptor = std::make_unique<StreamingDecryptor>(encryptedInfo.encryptionKey, encryptedInfo.initializationVector);
+        bool decryptorReady = _decryptor->isInitialized();
+        // The temporary file holds plaintext, the tag also covers the part downloaded before
+        if (decryptorReady && _resumeStart > 0) {
+            QFile decrypted(_tmpFile.fileName());
+            decryptorReady = decrypted.open(QIODevice::ReadOnly) && _decryptor->resume(&decrypted);
+        }
+        if (!decryptorReady) {
+            done(SyncFileItem::NormalError, tr("Could not start decrypting the file."));
+            return;
+        }
+    }
+
     // Can't open(Append) read-only files, make sure to make
     // file writable if it exists.
     if (_tmpFile.exists())
@@ -609,7 +710,7 @@ void PropagateDownloadFile::startDownload()
         pi._tmpfile = tmpFileName;
         pi._valid = true;
         propagator()->_journal->setDownloadInfo(_item->_file, pi);
-        propagator()->_journal->commit("download file start");
+        propagator()->_journal->commitIfNeededAndStartNewTransaction("download file start");
     }
 
     QMap<QByteArray, QByteArray> headers;
@@ -632,13 +733,54 @@ void PropagateDownloadFile::startDownload()
             url,
             &_tmpFile, headers, expectedEtagForResume, _resumeStart, this);
     }
-    _job->setBandwidthManager(&propagator()->_bandwidthManager);
+    _job->setBandwidthManager(propagator()->_bandwidthManager);
+    _job->setDecryptor(_decryptor.get());
     connect(_job.data(), &GETFileJob::finishedSignal, this, &PropagateDownloadFile::slotGetFinished);
     connect(_job.data(), &GETFileJob::downloadProgress, this, &PropagateDownloadFile::slotDownloadProgress);
     propagator()->_activeJobList.append(this);
     _job->start();
 }
 
+void PropagateDownloadFile::startDeltaDownload()
+{
+    _deltaTried = true;
+    _tmpFile.setFileName(propagator()->fullLocalPath(createDownloadTmpFileName(_item->_file)));
+
+    _deltaDownload = new PropagateDownloadDelta(propagator(), _item, _tmpFile.fileName(), this);
+    connect(_deltaDownload.data(), &PropagateDownloadDelta::finished, this, &PropagateDownloadFile::slotDeltaDownloadFinished);
+    connect(_deltaDownload.data(), &PropagateDownloadDelta::failed, this, &PropagateDownloadFile::slotDeltaDownloadFailed);
+    connect(_deltaDownload.data(), &PropagateDownloadDelta::downloadProgress, this, [this](qint64 bytes) {
+        propagator()->reportProgress(*_item, bytes);
+    });
+    propagator()->_activeJobList.append(this);
+    _deltaDownload->start();
+}
+
+void PropagateDownloadFile::slotDeltaDownloadFinished(const QByteArray &checksumType, const QByteArray &checksum)
+{
+    propagator()->_activeJobList.removeOne(this);
+    _deltaDownload->deleteLater();
+    qCInfo(lcPropagateDownload) << "Downloaded the changed blocks of" << _item->_file;
+
+    // The blocks were verified against the manifest, the checksum against the server's
+    transmissionChecksumValidated(checksumType, checksum);
+}
+
+void PropagateDownloadFile::slotDeltaDownloadFailed()
+{
+    propagator()->_activeJobList.removeOne(this);
+    const auto error = _deltaDownload->errorString();
+    _deltaDownload->deleteLater();
+    FileSystem::remove(_tmpFile.fileName());
+
+    if (propagator()->_abortRequested) {
+        done(SyncFileItem::SoftError, error);
+        return;
+    }
+    qCInfo(lcPropagateDownload) << "Downloading all of" << _item->_file << "because a delta download is not possible:" << error;
+    startDownload();
+}
+
 qint64 PropagateDownloadFile::committedDiskSpace() const
 {
     if (_state == Running) {
@@ -779,14 +921,17 @@ void PropagateDownloadFile::slotGetFinished()
         return;
     }
 
-    if (bodySize > 0 && bodySize != _tmpFile.size() - job->resumeStart()) {
+    // The tag at the end of encrypted files is not written to the temporary file
+    const qint64 tagSize = _isEncrypted ? EncryptedFileDevice::tagSize : 0;
+
+    if (bodySize > 0 && bodySize != _tmpFile.size() - job->resumeStart() + tagSize) {
         qCDebug(lcPropagateDownload) << bodySize << _tmpFile.size() << job->resumeStart();
         propagator()->_anotherSyncNeeded = true;
         done(SyncFileItem::SoftError, tr("The file could not be downloaded completely."));
         return;
     }
 
-    if (_tmpFile.size() == 0 && _item->_size > 0) {
+    if (_tmpFile.size() == 0 && _item->_size > tagSize) {
         FileSystem::remove(_tmpFile.fileName());
         done(SyncFileItem::NormalError,
             tr("The downloaded file is empty, but the server said it should have been %1.")
@@ -794,6 +939,14 @@ void PropagateDownloadFile::slotGetFinished()
         return;
     }
 
+    if (job->decryptionFailed()) {
+        FileSystem::remove(_tmpFile.fileName());
+        propagator()->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
+        propagator()->_anotherSyncNeeded = true;
+        done(job->errorStatus(), job->errorString());
+        return;
+    }
+
     // Did the file come with conflict headers? If so, store them now!
     // If we download conflict files but the server doesn't send conflict
     // headers, the record will be established by SyncEngine::conflictRecordMaintenance.
@@ -815,6 +968,17 @@ void PropagateDownloadFile::slotGetFinished()
         // job will be deleted later.
     }
 
+    auto checksumHeader = findBestChecksum(job->reply()->rawHeader(checkSumHeaderC));
+    auto contentMd5Header = job->reply()->rawHeader(contentMd5HeaderC);
+    if (checksumHeader.isEmpty() && !contentMd5Header.isEmpty())
+        checksumHeader = "MD5:" + contentMd5Header;
+    // The GETFileJob already computed the checksum while writing the file, if it could
+    validateTransmissionChecksum(checksumHeader, job->streamedChecksumType(), job->streamedChecksum());
+}
+
+void PropagateDownloadFile::validateTransmissionChecksum(const QByteArray &checksumHeader,
+    const QByteArray &streamedChecksumType, const QByteArray &streamedChecksum)
+{
     // Do checksum validation for the download. If there is no checksum header, the validator
     // will also emit the validated() signal to continue the flow in slot transmissionChecksumValidated()
     // as this is (still) also correct.
@@ -823,11 +987,13 @@ void PropagateDownloadFile::slotGetFinished()
         this, &PropagateDownloadFile::transmissionChecksumValidated);
     connect(validator, &ValidateChecksumHeader::validationFailed,
         this, &PropagateDownloadFile::slotChecksumFail);
-    auto checksumHeader = findBestChecksum(job->reply()->rawHeader(checkSumHeaderC));
-    auto contentMd5Header = job->reply()->rawHeader(contentMd5HeaderC);
-    if (checksumHeader.isEmpty() && !contentMd5Header.isEmpty())
-        checksumHeader = "MD5:" + contentMd5Header;
-    validator->start(_tmpFile.fileName(), checksumHeader);
+
+    // The server has the checksum of the encrypted file, but the temporary file was decrypted
+    if (_isEncrypted && (streamedChecksum.isEmpty() || streamedChecksumType != parseChecksumHeaderType(checksumHeader))) {
+        validator->start(encryptedTmpFile(), checksumHeader);
+        return;
+    }
+    validator->start(_tmpFile.fileName(), checksumHeader, streamedChecksumType, streamedChecksum);
 }
 
 void PropagateDownloadFile::slotChecksumFail(const QString &errMsg, const QByteArray &checksumType, const QByteArray &checksum, const QString &filePath)
@@ -898,7 +1064,18 @@ void PropagateDownloadFile::startContentChecksumCompute(const QByteArray &checks
 
     connect(computeChecksum, &ComputeChecksum::done,
         this, &PropagateDownloadFile::contentChecksumComputed);
-    computeChecksum->start(path);
+    if (_isEncrypted) {
+        computeChecksum->start(encryptedTmpFile());
+    } else {
+        computeChecksum->start(path);
+    }
+}
+
+std::unique_ptr<EncryptedFileDevice> PropagateDownloadFile::encryptedTmpFile() const
+{
+    const auto &encryptedInfo = _downloadEncryptedHelper->encryptedInfo();
+    return std::make_unique<EncryptedFileDevice>(_tmpFile.fileName(),
+        encryptedInfo.encryptionKey, encryptedInfo.initializationVector, _decryptor->tag());
 }
 
 namespace { // Anonymous namespace for the recall feature
@@ -998,16 +1175,7 @@ void PropagateDownloadFile::contentChecksumComputed(const QByteArray &checksumTy
 {
     _item->_checksumHeader = makeChecksumHeader(checksumType, checksum);
 
-    if (_isEncrypted) {
-        if (_downloadEncryptedHelper->decryptFile(_tmpFile)) {
-          downloadFinished();
-        } else {
-          done(SyncFileItem::NormalError, _downloadEncryptedHelper->errorString());
-        }
-
-    } else {
-        downloadFinished();
-    }
+    downloadFinished();
 }
 
 void PropagateDownloadFile::downloadFinished()
@@ -1151,7 +1319,7 @@ void PropagateDownloadFile::updateMetadata(bool isConflict)
         propagator()->_journal->setDownloadInfo(_item->_encryptedFileName, SyncJournalDb::DownloadInfo());
     }
 
-    propagator()->_journal->commit("download file start2");
+    propagator()->_journal->commitIfNeededAndStartNewTransaction("download file start2");
 
     done(isConflict ? SyncFileItem::Conflict : SyncFileItem::Success);
 
@@ -1181,6 +1349,8 @@ void PropagateDownloadFile::abort(PropagatorJob::AbortType abortType)
 {
     if (_job && _job->reply())
         _job->reply()->abort();
+    if (_deltaDownload)
+        _deltaDownload->abort();
 
     if (abortType == AbortType::Asynchronous) {
         emit abortFinished();
@@ -17,12 +17,16 @@
 #include "owncloudpropagator.h"
 #include "networkjobs.h"
 #include "clientsideencryption.h"
+#include "common/checksums.h"
 
 #include <QBuffer>
 #include <QFile>
 
+#include <memory>
+
 namespace OCC {
 class PropagateDownloadEncrypted;
+class PropagateDownloadDelta;
 
 /**
  * @brief The GETFileJob class
@@ -38,6 +42,7 @@ class OWNCLOUDSYNC_EXPORT GETFileJob : public AbstractNetworkJob
     qint64 _expectedContentLength;
     qint64 _contentLength;
     qint64 _resumeStart;
+    qint64 _rangeEnd = -1;
     SyncFileItem::Status _errorStatus;
     QUrl _directDownloadUrl;
     QByteArray _etag;
@@ -51,6 +56,16 @@ class OWNCLOUDSYNC_EXPORT GETFileJob : public AbstractNetworkJob
     /// Will be set to true once we've seen a 2xx response header
     bool _saveBodyToFile = false;
 
+    /// Checksum of the body, computed while it is written to the device
+    std::unique_ptr<ChecksumCalculator> _checksumCalculator;
+    QByteArray _streamedChecksum;
+
+    /// Decrypts the body before it is written to the device, not owned
+    StreamingDecryptor *_decryptor = nullptr;
+    bool _decryptionFailed = false;
+
+    friend class BandwidthManager;
+
 public:
     // DOES NOT take ownership of the device.
     explicit GETFileJob(AccountPtr account, const QString &path, QIODevice *device,
@@ -77,6 +92,8 @@ public:
                 _bandwidthManager->unregisterDownloadJob(this);
             }
             if (!_hasEmittedFinishedSignal) {
+                finishStreamedChecksum();
+                finishDecryption();
                 emit finishedSignal();
             }
             _hasEmittedFinishedSignal = true;
@@ -104,18 +121,46 @@ public:
 
     QByteArray &etag() { return _etag; }
     qint64 resumeStart() { return _resumeStart; }
+
+    /** Only download up to and including the byte at \a end, starting at resumeStart
+     *
+     * The server must reply with exactly that range, the body is written at
+     * the current position of the device.
+     */
+    void setRangeEnd(qint64 end) { _rangeEnd = end; }
     time_t lastModified() { return _lastModified; }
 
     qint64 contentLength() const { return _contentLength; }
     qint64 expectedContentLength() const { return _expectedContentLength; }
     void setExpectedContentLength(qint64 size) { _expectedContentLength = size; }
 
+    /** The checksum type and value of the received body, computed while it was written
+     *
+     * Only available once the job finished, if the reply announced a checksum
+     * in its headers and the download was not resumed. Empty otherwise.
+     */
+    QByteArray streamedChecksumType() const;
+    QByteArray streamedChecksum() const { return _streamedChecksum; }
+
+    /** Decrypts the body with \a decryptor while it is written to the device
+     *
+     * The tag at the end of the body is not written, it is checked once the
+     * job finished. DOES NOT take ownership of the decryptor.
+     */
+    void setDecryptor(StreamingDecryptor *decryptor) { _decryptor = decryptor; }
+    /// Whether the body was received completely but its tag didn't match
+    bool decryptionFailed() const { return _decryptionFailed; }
+
 signals:
     void finishedSignal();
     void downloadProgress(qint64, qint64);
 private slots:
     void slotReadyRead();
     void slotMetaDataChanged();
+
+private:
+    void finishStreamedChecksum();
+    void finishDecryption();
 };
 
 /**
@@ -137,6 +182,8 @@ private slots:
     +-> startDownload() <--------------------------+
           |                                        |
           +-> run a GETFileJob                     | checksum identical?
+          |   (decrypting while it writes)         |
+          |   or a PropagateDownloadDelta          |
                                                    |
       done?-> slotGetFinished()                    |
                 |                                  |
@@ -173,6 +220,12 @@ public:
     // We think it might finish quickly because it is a small file.
     bool isLikelyFinishedQuickly() override { return _item->_size < propagator()->smallFileSize(); }
 
+    // Creating or dehydrating a placeholder does not transfer anything.
+    bool isTransferJob() const override
+    {
+        return _item->_type != ItemTypeVirtualFile && _item->_type != ItemTypeVirtualFileDehydration;
+    }
+
     /**
      * Whether an existing folder with the same name may be deleted before
      * the download.
@@ -184,12 +237,15 @@ public:
      */
     void setDeleteExistingFolder(bool enabled);
 
+protected slots:
+    /// Called to start downloading the remote file
+    virtual void startDownload();
+    void abort(PropagatorJob::AbortType abortType) override;
+
 private slots:
     /// Called when ComputeChecksum on the local file finishes,
     /// maybe the local and remote checksums are identical?
     void conflictChecksumComputed(const QByteArray &checksumType, const QByteArray &checksum);
-    /// Called to start downloading the remote file
-    void startDownload();
     /// Called when the GETFileJob finishes
     void slotGetFinished();
     /// Called when the download's checksum header was validated
@@ -200,27 +256,48 @@ private slots:
     /// Called when it's time to update the db metadata
     void updateMetadata(bool isConflict);
 
-    void abort(PropagatorJob::AbortType abortType) override;
     void slotDownloadProgress(qint64, qint64);
     void slotChecksumFail(const QString &errMsg, const QByteArray &checksumType, const QByteArray &checksum, const QString &filePath);
+    /// Called when the new version was assembled from local blocks and downloaded ranges
+    void slotDeltaDownloadFinished(const QByteArray &checksumType, const QByteArray &checksum);
+    void slotDeltaDownloadFailed();
+
+protected:
+    /** Continues with the downloaded temporary file
+     *
+     * \a checksumHeader is the checksum the server announced for it, if the
+     * checksum of the body was computed while it was received it is passed
+     * as \a streamedChecksumType and \a streamedChecksum.
+     */
+    void validateTransmissionChecksum(const QByteArray &checksumHeader,
+        const QByteArray &streamedChecksumType = QByteArray(), const QByteArray &streamedChecksum = QByteArray());
+
+    QFile _tmpFile;
+    bool _isEncrypted = false;
 
 private:
     void startAfterIsEncryptedIsChecked();
     void deleteExistingFolder();
+    /// Only downloads the blocks of the new version that are not in the local file
+    void startDeltaDownload();
 
     void startContentChecksumCompute(const QByteArray &checksumType, const QString &path);
+    /// The temporary file of an encrypted download, encrypted again like on the server
+    std::unique_ptr<EncryptedFileDevice> encryptedTmpFile() const;
 
     qint64 _resumeStart;
     qint64 _downloadProgress;
     QPointer<GETFileJob> _job;
-    QFile _tmpFile;
     bool _deleteExisting;
-    bool _isEncrypted = false;
     EncryptedFile _encryptedInfo;
     ConflictRecord _conflictRecord;
 
     QElapsedTimer _stopwatch;
 
     PropagateDownloadEncrypted *_downloadEncryptedHelper;
+    std::unique_ptr<StreamingDecryptor> _decryptor;
+
+    QPointer<PropagateDownloadDelta> _deltaDownload;
+    bool _deltaTried = false; /// a failed delta download falls back to downloading the whole file
 };
 }
@@ -0,0 +1,407 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "propagatedownloadbulk.h"
+#include "owncloudpropagator_p.h"
+#include "networkjobs.h"
+#include "account.h"
+#include "common/syncjournaldb.h"
+#include "common/utility.h"
+#include "filesystem.h"
+#include "propagatorjobs.h"
+#include "common/checksums.h"
+
+#include <QBuffer>
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcBulkDownloadJob, "nextcloud.sync.networkjob.bulkdownload", QtInfoMsg)
+Q_LOGGING_CATEGORY(lcPropagateDownloadBulk, "nextcloud.sync.propagator.download.bulk", QtInfoMsg)
+
+// Defined in propagatedownload.cpp
+QString createDownloadTmpFileName(const QString &previous);
+
+namespace {
+    /// Part headers larger than this mean the reply is not what we expect
+    constexpr int maxPartHeaderSize = 64 * 1024;
+}
+
+BulkDownloadJob::BulkDownloadJob(AccountPtr account, const QHash<QString, QString> &tmpFiles, QObject *parent)
+    : AbstractNetworkJob(account, QStringLiteral("remote.php/dav/bulkdownload"), parent)
+    , _tmpFiles(tmpFiles)
+{
+}
+
+void BulkDownloadJob::start()
+{
+    QJsonArray files;
+    for (auto it = _tmpFiles.cbegin(); it != _tmpFiles.cend(); ++it) {
+        files.append(it.key());
+    }
+    auto buffer = new QBuffer(this);
+    buffer->setData(QJsonDocument(QJsonObject{ { QStringLiteral("files"), files } }).toJson(QJsonDocument::Compact));
+
+    QNetworkRequest req;
+    req.setRawHeader("Content-Type", "application/json");
+    req.setRawHeader("Accept", "multipart/related");
+    req.setPriority(QNetworkRequest::LowPriority); // Long downloads must not block non-propagation jobs.
+    sendRequest("POST", makeAccountUrl(path()), req, buffer);
+
+    if (reply()->error() != QNetworkReply::NoError) {
+        qCWarning(lcBulkDownloadJob) << " Network error: " << reply()->errorString();
+    }
+
+    connect(this, &AbstractNetworkJob::networkActivity, account().data(), &Account::propagatorNetworkActivity);
+    AbstractNetworkJob::start();
+}
+
+void BulkDownloadJob::newReplyHook(QNetworkReply *reply)
+{
+    connect(reply, &QIODevice::readyRead, this, &BulkDownloadJob::slotReadyRead);
+}
+
+void BulkDownloadJob::slotReadyRead()
+{
+    // Error bodies are left for errorStringParsingBody()
+    const int httpStatus = reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (httpStatus / 100 != 2) {
+        return;
+    }
+    if (_done) {
+        reply()->readAll();
+        return;
+    }
+
+    if (_boundary.isEmpty()) {
+        const QByteArray contentType = reply()->rawHeader("Content-Type");
+        const int boundaryIndex = contentType.indexOf("boundary=");
+        if (!contentType.startsWith("multipart/") || boundaryIndex < 0) {
+            failParsing(QStringLiteral("Unexpected content type %1").arg(QString::fromUtf8(contentType)));
+            return;
+        }
+        _boundary = contentType.mid(boundaryIndex + 9);
+        const int end = _boundary.indexOf(';');
+        if (end >= 0) {
+            _boundary.truncate(end);
+        }
+        _boundary = _boundary.trimmed();
+        if (_boundary.startsWith('"') && _boundary.endsWith('"') && _boundary.size() > 1) {
+            _boundary = _boundary.mid(1, _boundary.size() - 2);
+        }
+    }
+
+    _buffer.append(reply()->readAll());
+    processBuffer();
+}
+
+void BulkDownloadJob::processBuffer()
+{
+    const QByteArray delimiter = "--" + _boundary;
+    while (!_done) {
+        if (_inBody) {
+            const qint64 length = qMin<qint64>(_remaining, _buffer.size());
+            if (length == 0 && _remaining > 0) {
+                return;
+            }
+            if (_currentFile.isOpen() && _currentFile.write(_buffer.constData(), length) != length) {
+                qCWarning(lcBulkDownloadJob) << "Could not write" << _currentFile.fileName() << _currentFile.errorString();
+                _currentFile.close();
+            }
+            _buffer.remove(0, int(length));
+            _remaining -= length;
+            if (_remaining == 0) {
+                finishPart();
+            }
+            continue;
+        }
+
+        // Skip the line break that ends the previous part
+        while (_buffer.startsWith("\r\n")) {
+            _buffer.remove(0, 2);
+        }
+        if (_buffer.size() < delimiter.size() + 2) {
+            return;
+        }
+        if (_buffer.startsWith(delimiter + "--")) {
+            _done = true;
+            _buffer.clear();
+            return;
+        }
+
+        const int headersEnd = _buffer.indexOf("\r\n\r\n");
+        if (headersEnd < 0) {
+            if (_buffer.size() > maxPartHeaderSize) {
+                failParsing(QStringLiteral("Part headers are too large"));
+            }
+            return;
+        }
+        const auto lines = _buffer.left(headersEnd).split('\n');
+        _buffer.remove(0, headersEnd + 4);
+        if (lines.first().trimmed() != delimiter) {
+            failParsing(QStringLiteral("Expected a multipart delimiter"));
+            return;
+        }
+
+        Part part;
+        for (int i = 1; i < lines.size(); ++i) {
+            const int colon = lines[i].indexOf(':');
+            if (colon > 0) {
+                part.headers[lines[i].left(colon).trimmed().toLower()] = lines[i].mid(colon + 1).trimmed();
+            }
+        }
+        bool ok = false;
+        part.size = part.headers.value("content-length").toLongLong(&ok);
+        if (!ok || part.size < 0) {
+            failParsing(QStringLiteral("Part without Content-Length"));
+            return;
+        }
+
+        _currentPath = QString::fromUtf8(part.headers.value("x-file-path"));
+        const QString tmpFile = _tmpFiles.value(_currentPath);
+        if (tmpFile.isEmpty()) {
+            qCWarning(lcBulkDownloadJob) << "Skipping unexpected part" << _currentPath;
+        } else {
+            _parts[_currentPath] = part;
+            _currentFile.setFileName(tmpFile);
+            if (!_currentFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+                qCWarning(lcBulkDownloadJob) << "Could not open" << tmpFile << _currentFile.errorString();
+            }
+        }
+        _inBody = true;
+        _remaining = part.size;
+        if (_remaining == 0) {
+            finishPart();
+        }
+    }
+}
+
+void BulkDownloadJob::finishPart()
+{
+    if (_currentFile.isOpen()) {
+        _currentFile.close();
+        _parts[_currentPath].complete = _currentFile.error() == QFileDevice::NoError;
+    }
+    _inBody = false;
+    _currentPath.clear();
+}
+
+void BulkDownloadJob::failParsing(const QString &error)
+{
+    // The parts that were received completely are still good
+    qCWarning(lcBulkDownloadJob) << "Could not parse the bulk download reply:" << error;
+    if (_currentFile.isOpen()) {
+        _currentFile.close();
+    }
+    _buffer.clear();
+    _done = true;
+}
+
+bool BulkDownloadJob::finished()
+{
+    qCInfo(lcBulkDownloadJob) << "POST of" << reply()->request().url().toString() << "FINISHED WITH STATUS"
+                              << replyStatusString()
+                              << reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute)
+                              << reply()->attribute(QNetworkRequest::HttpReasonPhraseAttribute);
+
+    slotReadyRead();
+    if (_currentFile.isOpen()) {
+        // The reply ended within this part
+        _currentFile.close();
+    }
+
+    emit finishedSignal();
+    return true;
+}
+
+bool BulkDownloadBatch::isUnsupported() const
+{
+    return _propagator->_bulkDownloadUnsupported;
+}
+
+void BulkDownloadBatch::setUnsupported()
+{
+    _propagator->_bulkDownloadUnsupported = true;
+}
+
+BulkDownloadJob *BulkDownloadBatch::createJob()
+{
+    QHash<QString, QString> tmpFiles;
+    for (const auto &file : qAsConst(_files)) {
+        tmpFiles.insert(_propagator->fullRemotePath(file->_item->_file), file->_tmpFile.fileName());
+    }
+    // The download infos of all files of the batch
+    _propagator->_journal->commitIfNeededAndStartNewTransaction("bulk download start");
+
+    qCInfo(lcPropagateDownloadBulk) << "Downloading" << _files.size() << "files with one request";
+    return new BulkDownloadJob(_propagator->account(), tmpFiles, this);
+}
+
+void BulkDownloadBatch::jobSucceeded(BulkDownloadJob *job, const Files &files)
+{
+    for (const auto &file : files) {
+        if (file) {
+            file->bulkDownloadFinished(job, job->parts().value(_propagator->fullRemotePath(file->_item->_file)));
+        }
+    }
+}
+
+void BulkDownloadBatch::jobFailed(BulkDownloadJob *job, const Files &files)
+{
+    const int httpStatus = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    QByteArray errorBody;
+    const QString errorString = httpStatus >= 400 ? job->errorStringParsingBody(&errorBody) : job->errorString();
+    for (const auto &file : files) {
+        if (file) {
+            file->bulkDownloadFailed(job, errorString, errorBody);
+        }
+    }
+}
+
+void PropagateDownloadFileBulk::startDownload()
+{
+    if (!_inBatch || _isEncrypted) {
+        // Encrypted files are decrypted one by one with their own metadata
+        fallBackToSingleTransfer();
+        return;
+    }
+    if (propagator()->_abortRequested)
+        return;
+
+    // A partial download from an earlier sync is resumed with a GET of its own,
+    // and that path also reports a lack of disk space properly
+    if (propagator()->_journal->getDownloadInfo(_item->_file)._valid
+        || propagator()->diskSpaceCheck() != OwncloudPropagator::DiskSpaceOk) {
+        fallBackToSingleTransfer();
+        return;
+    }
+
+    // do a klaas' case clash check.
+    if (propagator()->localFileNameClash(_item->_file)) {
+        done(SyncFileItem::NormalError, tr("File %1 cannot be downloaded because of a local file name clash!").arg(QDir::toNativeSeparators(_item->_file)));
+        return;
+    }
+
+    propagator()->reportProgress(*_item, 0);
+
+    _tmpFileName = createDownloadTmpFileName(_item->_file);
+    _tmpFile.setFileName(propagator()->fullLocalPath(_tmpFileName));
+
+    // Lets the next sync clean up the temporary file, the batch commits once for all files
+    SyncJournalDb::DownloadInfo pi;
+    pi._etag = _item->_etag;
+    pi._tmpfile = _tmpFileName;
+    pi._valid = true;
+    propagator()->_journal->setDownloadInfo(_item->_file, pi);
+
+    _batch->fileReady(this);
+}
+
+void PropagateDownloadFileBulk::trackJob(BulkDownloadJob *job)
+{
+    _bulkJob = job;
+}
+
+void PropagateDownloadFileBulk::untrackJob(BulkDownloadJob *job)
+{
+    Q_UNUSED(job)
+    _bulkJob.clear();
+}
+
+void PropagateDownloadFileBulk::bulkDownloadFailed(BulkDownloadJob *job, const QString &errorString, const QByteArray &errorBody)
+{
+    if (_state != Running) {
+        return;
+    }
+    discardTmpFile();
+
+    _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    _item->_requestId = job->requestId();
+    const auto status = classifyError(job->reply()->error(), _item->_httpErrorCode,
+        &propagator()->_anotherSyncNeeded, errorBody);
+    done(status, errorString);
+}
+
+void PropagateDownloadFileBulk::bulkDownloadFinished(BulkDownloadJob *job, const BulkDownloadJob::Part &part)
+{
+    if (_state != Running) {
+        return;
+    }
+    if (!part.complete) {
+        // The server left it out, for example because it changed meanwhile
+        qCInfo(lcPropagateDownloadBulk) << _item->_file << "is missing from the bulk download reply, downloading it alone";
+        fallBackToSingleTransfer();
+        return;
+    }
+
+    _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    _item->_responseTimeStamp = job->responseTimestamp();
+    _item->_requestId = job->requestId();
+
+    const QByteArray etag = part.headers.value("oc-etag");
+    if (!etag.isEmpty()) {
+        _item->_etag = parseEtag(etag);
+    }
+    const QByteArray mtime = part.headers.value("x-file-mtime");
+    if (!mtime.isEmpty()) {
+        // The file may have been modified on the server since the discovery
+        _item->_modtime = mtime.toLongLong();
+    }
+
+    if (part.size == 0 && _item->_size > 0) {
+        discardTmpFile();
+        done(SyncFileItem::NormalError,
+            tr("The downloaded file is empty, but the server said it should have been %1.")
+                .arg(Utility::octetsToString(_item->_size)));
+        return;
+    }
+
+    FileSystem::setFileHidden(_tmpFile.fileName(), true);
+    propagator()->reportProgress(*_item, part.size);
+    validateTransmissionChecksum(findBestChecksum(part.headers.value("oc-checksum")));
+}
+
+void PropagateDownloadFileBulk::discardTmpFile()
+{
+    if (_tmpFileName.isEmpty()) {
+        return;
+    }
+    FileSystem::remove(_tmpFile.fileName());
+    propagator()->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
+    _tmpFileName.clear();
+}
+
+void PropagateDownloadFileBulk::startSingleTransfer()
+{
+    discardTmpFile();
+    PropagateDownloadFile::startDownload();
+}
+
+void PropagateDownloadFileBulk::batchAborted()
+{
+    discardTmpFile();
+    BulkBatchFile::batchAborted();
+}
+
+void PropagateDownloadFileBulk::abort(PropagatorJob::AbortType abortType)
+{
+    if (_bulkJob && _bulkJob->reply())
+        _bulkJob->reply()->abort();
+    PropagateDownloadFile::abort(abortType);
+}
+
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+#pragma once
+
+#include "propagatedownload.h"
+#include "bulkbatch.h"
+
+#include <QHash>
+#include <QPointer>
+
+namespace OCC {
+
+Q_DECLARE_LOGGING_CATEGORY(lcPropagateDownloadBulk)
+
+/**
+ * @brief Downloads several files with one POST to the bulk download endpoint
+ * @ingroup libsync
+ *
+ * The request body is a JSON object listing the paths of the files. The
+ * server replies with a multipart/related body, each part holds the content
+ * of one file along with the headers describing it:
+ *
+ *  - X-File-Path: the path of the file, as requested
+ *  - Content-Length: the size of the content, required
+ *  - OC-ETag, X-File-Mtime and OC-Checksum: like for a GET
+ *
+ * The reply is split into the temporary files while it is received, so
+ * the files are never held in memory. Files the server left out of the
+ * reply are not part of parts().
+ */
+class OWNCLOUDSYNC_EXPORT BulkDownloadJob : public AbstractNetworkJob
+{
+    Q_OBJECT
+public:
+    struct Part
+    {
+        QMap<QByteArray, QByteArray> headers; /// names are lower case
+        qint64 size = 0;
+        bool complete = false; /// whether all of the content was written to the temporary file
+    };
+
+    /// \a tmpFiles maps the remote path of each file to the temporary file its content is written to
+    explicit BulkDownloadJob(AccountPtr account, const QHash<QString, QString> &tmpFiles, QObject *parent = nullptr);
+
+    void start() override;
+    bool finished() override;
+    void newReplyHook(QNetworkReply *reply) override;
+
+    /// The parts of the reply by remote path, complete once the job finished
+    const QHash<QString, Part> &parts() const { return _parts; }
+
+signals:
+    void finishedSignal();
+
+private slots:
+    void slotReadyRead();
+
+private:
+    void processBuffer();
+    void finishPart();
+    void failParsing(const QString &error);
+
+    QHash<QString, QString> _tmpFiles;
+    QHash<QString, Part> _parts;
+
+    QByteArray _boundary;
+    QByteArray _buffer; /// received data that was not processed yet
+    bool _inBody = false;
+    qint64 _remaining = 0; /// bytes of the current part's content that are still to be received
+    QString _currentPath;
+    QFile _currentFile;
+    bool _done = false; /// the closing delimiter was seen, or the reply could not be parsed
+};
+
+class PropagateDownloadFileBulk;
+
+/**
+ * @brief Collects the files of one bulk download request
+ * @ingroup libsync
+ *
+ * The request is sent once every file of the batch is either ready to be
+ * downloaded or done, for example because it could be handled locally.
+ */
+class BulkDownloadBatch : public BulkBatch<PropagateDownloadFileBulk, BulkDownloadJob>
+{
+public:
+    using BulkBatch::BulkBatch;
+
+protected:
+    bool isUnsupported() const override;
+    void setUnsupported() override;
+    BulkDownloadJob *createJob() override;
+    void jobSucceeded(BulkDownloadJob *job, const Files &files) override;
+    void jobFailed(BulkDownloadJob *job, const Files &files) override;
+};
+
+/**
+ * @ingroup libsync
+ *
+ * Propagation job for a small file that is downloaded along with others in
+ * one bulk request. Once its part of the reply is written the file goes
+ * through the same checksum validation and metadata update as a regular
+ * download, so it completes on its own. Falls back to a regular download
+ * for encrypted and partially downloaded files, for files the server left
+ * out of the reply and when the server rejects the bulk request.
+ */
+class PropagateDownloadFileBulk : public BulkBatchFile<PropagateDownloadFile, BulkDownloadBatch>
+{
+    Q_OBJECT
+public:
+    /// Maximum number of files that are downloaded with one request
+    static constexpr int maxBatchFiles = 100;
+
+    using BulkBatchFile::BulkBatchFile;
+
+protected slots:
+    void startDownload() override;
+    void abort(PropagatorJob::AbortType abortType) override;
+
+protected:
+    void startSingleTransfer() override;
+    void batchAborted() override;
+
+private:
+    friend class BulkBatch<PropagateDownloadFileBulk, BulkDownloadJob>;
+    friend class BulkDownloadBatch;
+
+    void trackJob(BulkDownloadJob *job);
+    void untrackJob(BulkDownloadJob *job);
+    void bulkDownloadFailed(BulkDownloadJob *job, const QString &errorString, const QByteArray &errorBody);
+    void bulkDownloadFinished(BulkDownloadJob *job, const BulkDownloadJob::Part &part);
+    void discardTmpFile();
+
+    QString _tmpFileName; /// relative to the sync folder, set while the file is in the batch
+    QPointer<BulkDownloadJob> _bulkJob;
+};
+
+}
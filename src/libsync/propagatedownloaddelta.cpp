@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "propagatedownloaddelta.h"
+#include "propagatedownload.h"
+#include "networkjobs.h"
+#include "account.h"
+#include "filesystem.h"
+#include "common/checksums.h"
+#include "common/asserts.h"
+
+#include <QFileInfo>
+#include <qtconcurrentrun.h>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcPropagateDownloadDelta, "nextcloud.sync.propagator.download.delta", QtInfoMsg)
+
+namespace {
+    /// Beyond this, downloading the whole file is about as fast
+    constexpr int maxDeltaRanges = 1000;
+}
+
+PropagateDownloadDelta::PropagateDownloadDelta(OwncloudPropagator *propagator, const SyncFileItemPtr &item,
+    const QString &tmpFileName, QObject *parent)
+    : QObject(parent)
+    , _propagator(propagator)
+    , _item(item)
+    , _tmpFile(tmpFileName)
+{
+    connect(&_assembleWatcher, &QFutureWatcherBase::finished, this, &PropagateDownloadDelta::slotAssembled);
+    connect(&_verifyWatcher, &QFutureWatcherBase::finished, this, &PropagateDownloadDelta::slotVerified);
+}
+
+bool PropagateDownloadDelta::isCandidate(OwncloudPropagator *propagator, const SyncFileItem &item)
+{
+    if (!propagator->account()->capabilities().deltaSync())
+        return false;
+    // Only modified files have local blocks worth reusing
+    return item._direction == SyncFileItem::Down
+        && (item._instruction == CSYNC_INSTRUCTION_SYNC || item._instruction == CSYNC_INSTRUCTION_CONFLICT)
+        && item._type == ItemTypeFile
+        && item._directDownloadUrl.isEmpty()
+        && !item._fileId.isEmpty()
+        && item._size > 0
+        && item._size >= propagator->syncOptions()._deltaSyncMinFileSize
+        && QFileInfo(propagator->fullLocalPath(item._file)).isFile();
+}
+
+void PropagateDownloadDelta::start()
+{
+    const auto account = _propagator->account();
+    auto job = new SimpleNetworkJob(account, this);
+    connect(job, &SimpleNetworkJob::finishedSignal, this, &PropagateDownloadDelta::slotManifestFetched);
+    job->startRequest("GET", BlockManifest::url(account, _item->_fileId));
+}
+
+void PropagateDownloadDelta::abort()
+{
+    _aborted = true;
+    if (_job && _job->reply())
+        _job->reply()->abort();
+}
+
+void PropagateDownloadDelta::fail(const QString &error)
+{
+    _errorString = error;
+    if (_tmpFile.isOpen())
+        _tmpFile.close();
+    emit failed();
+}
+
+void PropagateDownloadDelta::slotManifestFetched(QNetworkReply *reply)
+{
+    if (_aborted) {
+        fail(tr("Operation was canceled"));
+        return;
+    }
+    if (reply->error() != QNetworkReply::NoError) {
+        fail(tr("No block manifest available: %1").arg(reply->errorString()));
+        return;
+    }
+
+    // The manifest must describe exactly the version that is to be downloaded
+    _manifest = BlockManifest::parse(reply->readAll());
+    if (!_manifest.isValid() || _manifest.etag != _item->_etag || _manifest.fileSize != _item->_size) {
+        fail(tr("The block manifest does not match the file"));
+        return;
+    }
+
+    // Find the blocks in the local file and copy them into place. The plan is
+    // returned without assembling anything if a delta is not worthwhile.
+    const auto manifest = _manifest;
+    const auto localPath = _propagator->fullLocalPath(_item->_file);
+    const auto tmpPath = _tmpFile.fileName();
+    _assembleWatcher.setFuture(QtConcurrent::run([manifest, localPath, tmpPath]() {
+        QFile local(localPath);
+        if (!local.open(QIODevice::ReadOnly)) {
+            qCWarning(lcPropagateDownloadDelta) << "Could not open" << localPath << local.errorString();
+            return DeltaPlan();
+        }
+        const auto plan = DeltaPlan::match(manifest, &local);
+        if (plan.missingBytes(manifest) > manifest.fileSize / 2)
+            return plan;
+
+        QFile tmp(tmpPath);
+        if (!tmp.open(QIODevice::WriteOnly | QIODevice::Truncate) || !tmp.resize(manifest.fileSize)) {
+            qCWarning(lcPropagateDownloadDelta) << "Could not create" << tmpPath << tmp.errorString();
+            return DeltaPlan();
+        }
+        for (int i = 0; i < plan.localOffsets.size(); ++i) {
+            const auto offset = plan.localOffsets[i];
+            if (offset == -1)
+                continue;
+            const auto length = manifest.blockLength(i);
+            if (!local.seek(offset) || !tmp.seek(i * manifest.blockSize)) {
+                return DeltaPlan();
+            }
+            const auto data = local.read(length);
+            if (data.size() != length || tmp.write(data) != length) {
+                qCWarning(lcPropagateDownloadDelta) << "Could not copy block" << i << "to" << tmpPath << tmp.errorString();
+                return DeltaPlan();
+            }
+        }
+        return plan;
+    }));
+}
+
+void PropagateDownloadDelta::slotAssembled()
+{
+    const auto plan = _assembleWatcher.result();
+    if (_aborted) {
+        fail(tr("Operation was canceled"));
+        return;
+    }
+    if (plan.localOffsets.size() != _manifest.blocks.size()) {
+        fail(tr("Could not reuse the local file"));
+        return;
+    }
+
+    const auto missingBytes = plan.missingBytes(_manifest);
+    _ranges = plan.missingRanges(_manifest);
+    if (missingBytes > _manifest.fileSize / 2 || _ranges.size() > maxDeltaRanges) {
+        fail(tr("Too much of the file changed"));
+        return;
+    }
+    qCInfo(lcPropagateDownloadDelta) << "Reusing" << _manifest.fileSize - missingBytes << "bytes of" << _item->_file
+                                     << "downloading" << missingBytes << "bytes in" << _ranges.size() << "ranges";
+
+    FileSystem::setFileHidden(_tmpFile.fileName(), true);
+    if (!_tmpFile.open(QIODevice::ReadWrite)) {
+        fail(_tmpFile.errorString());
+        return;
+    }
+    _availableBytes = _manifest.fileSize - missingBytes;
+    emit downloadProgress(_availableBytes);
+    downloadNextRange();
+}
+
+void PropagateDownloadDelta::downloadNextRange()
+{
+    if (_nextRange == _ranges.size()) {
+        _tmpFile.close();
+
+        // Verify every block, and the content checksum the server knows if any
+        QByteArray expectedChecksum;
+        if (!parseChecksumHeader(_item->_checksumHeader, &_checksumType, &expectedChecksum) || _checksumType.isEmpty())
+            _checksumType = _propagator->account()->capabilities().preferredUploadChecksumType();
+        _checksum = QSharedPointer<QByteArray>::create();
+
+        const auto manifest = _manifest;
+        const auto tmpPath = _tmpFile.fileName();
+        const auto checksumType = _checksumType;
+        const auto checksum = _checksum;
+        _verifyWatcher.setFuture(QtConcurrent::run([manifest, tmpPath, checksumType, expectedChecksum, checksum]() {
+            QFile tmp(tmpPath);
+            if (!tmp.open(QIODevice::ReadOnly))
+                return false;
+            const auto assembled = BlockManifest::compute(&tmp, manifest.blockSize, checksumType, checksum.data());
+            if (assembled.fileSize != manifest.fileSize || assembled.blocks.size() != manifest.blocks.size())
+                return false;
+            for (int i = 0; i < manifest.blocks.size(); ++i) {
+                if (assembled.blocks[i].strong != manifest.blocks[i].strong)
+                    return false;
+            }
+            return expectedChecksum.isEmpty() || checksum->isNull() || *checksum == expectedChecksum;
+        }));
+        return;
+    }
+
+    const auto range = _ranges[_nextRange];
+    if (!_tmpFile.seek(range.start)) {
+        fail(_tmpFile.errorString());
+        return;
+    }
+    // Passing the etag makes the job fail if the file changed on the server meanwhile
+    _job = new GETFileJob(_propagator->account(), _propagator->fullRemotePath(_item->_file),
+        &_tmpFile, {}, _item->_etag, range.start, this);
+    _job->setRangeEnd(range.start + range.length - 1);
+    _job->setExpectedContentLength(range.length);
+    _job->setBandwidthManager(_propagator->_bandwidthManager);
+    connect(_job.data(), &GETFileJob::finishedSignal, this, &PropagateDownloadDelta::slotRangeFinished);
+    connect(_job.data(), &GETFileJob::downloadProgress, this, [this](qint64 received, qint64) {
+        emit downloadProgress(_availableBytes + received);
+    });
+    _job->start();
+}
+
+void PropagateDownloadDelta::slotRangeFinished()
+{
+    GETFileJob *job = _job;
+    ASSERT(job);
+    if (job->reply()->error() != QNetworkReply::NoError) {
+        fail(job->errorString());
+        return;
+    }
+
+    const auto range = _ranges[_nextRange];
+    if (_tmpFile.pos() != range.start + range.length) {
+        fail(tr("The file could not be downloaded completely."));
+        return;
+    }
+    _availableBytes += range.length;
+    emit downloadProgress(_availableBytes);
+
+    ++_nextRange;
+    downloadNextRange();
+}
+
+void PropagateDownloadDelta::slotVerified()
+{
+    if (_aborted) {
+        fail(tr("Operation was canceled"));
+        return;
+    }
+    if (!_verifyWatcher.result()) {
+        fail(tr("The assembled file does not match the block manifest"));
+        return;
+    }
+    if (_checksum->isNull()) {
+        emit finished(QByteArray(), QByteArray());
+    } else {
+        emit finished(_checksumType, *_checksum);
+    }
+}
+
+}
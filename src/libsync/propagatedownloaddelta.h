@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+#pragma once
+
+#include "deltasync.h"
+#include "owncloudpropagator.h"
+#include "syncfileitem.h"
+
+#include <QFile>
+#include <QFutureWatcher>
+#include <QObject>
+#include <QPointer>
+#include <QSharedPointer>
+
+class QNetworkReply;
+
+namespace OCC {
+
+class GETFileJob;
+
+/**
+ * @brief Downloads a new version of a file by reusing the blocks of the local file
+ * @ingroup libsync
+ *
+ * This is the flow:
+ *  1. Fetch the BlockManifest of the remote version of the file
+ *  2. Find its blocks in the local file and copy them to the temporary file
+ *  3. Download the remaining ranges with one GET request each
+ *  4. Verify every block and the checksum of the assembled file
+ *
+ * Emits failed() if the delta download is not possible or not worthwhile,
+ * the caller is then expected to download the whole file.
+ */
+class PropagateDownloadDelta : public QObject
+{
+    Q_OBJECT
+public:
+    PropagateDownloadDelta(OwncloudPropagator *propagator, const SyncFileItemPtr &item,
+        const QString &tmpFileName, QObject *parent = nullptr);
+
+    /// Whether the new version of \a item could be downloaded as a delta
+    static bool isCandidate(OwncloudPropagator *propagator, const SyncFileItem &item);
+
+    void start();
+    void abort();
+
+    QString errorString() const { return _errorString; }
+
+signals:
+    /// The temporary file holds the new version, with the given content checksum
+    void finished(const QByteArray &checksumType, const QByteArray &checksum);
+    void failed();
+    /// How many bytes of the new version are in the temporary file
+    void downloadProgress(qint64 bytes);
+
+private slots:
+    void slotManifestFetched(QNetworkReply *reply);
+    void slotAssembled();
+    void slotRangeFinished();
+    void slotVerified();
+
+private:
+    void downloadNextRange();
+    void fail(const QString &error);
+
+    OwncloudPropagator *_propagator;
+    SyncFileItemPtr _item;
+    QFile _tmpFile;
+    QString _errorString;
+    bool _aborted = false;
+
+    BlockManifest _manifest;
+    QVector<DeltaPlan::Range> _ranges;
+    int _nextRange = 0;
+    qint64 _availableBytes = 0;
+    QPointer<GETFileJob> _job;
+
+    QFutureWatcher<DeltaPlan> _assembleWatcher;
+    QFutureWatcher<bool> _verifyWatcher;
+    QByteArray _checksumType;
+    QSharedPointer<QByteArray> _checksum; /// of the assembled file, set by the verification
+};
+
+}
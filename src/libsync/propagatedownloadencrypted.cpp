@@ -91,42 +91,4 @@ void PropagateDownloadEncrypted::checkFolderEncryptedMetadata(const QJsonDocumen
   qCCritical(lcPropagateDownloadEncrypted) << "Failed to find encrypted metadata information of remote file" << filename;
 }
 
-// TODO: Fix this. Exported in the wrong place.
-QString createDownloadTmpFileName(const QString &previous);
-
-bool PropagateDownloadEncrypted::decryptFile(QFile& tmpFile)
-{
-    const QString tmpFileName = createDownloadTmpFileName(_item->_file + QLatin1String("_dec"));
-    qCDebug(lcPropagateDownloadEncrypted) << "Content Checksum Computed starting decryption" << tmpFileName;
-
-    tmpFile.close();
-    QFile _tmpOutput(_propagator->fullLocalPath(tmpFileName), this);
-    EncryptionHelper::fileDecryption(_encryptedInfo.encryptionKey,
-                                     _encryptedInfo.initializationVector,
-                                     &tmpFile,
-                                     &_tmpOutput);
-
-    qCDebug(lcPropagateDownloadEncrypted) << "Decryption finished" << tmpFile.fileName() << _tmpOutput.fileName();
-
-    tmpFile.close();
-    _tmpOutput.close();
-
-    // we decripted the temporary into another temporary, so good bye old one
-    if (!tmpFile.remove()) {
-        qCDebug(lcPropagateDownloadEncrypted) << "Failed to remove temporary file" << tmpFile.errorString();
-        _errorString = tmpFile.errorString();
-        return false;
-    }
-
-    // Let's fool the rest of the logic into thinking this was the actual download
-    tmpFile.setFileName(_tmpOutput.fileName());
-
-    return true;
-}
-
-QString PropagateDownloadEncrypted::errorString() const
-{
-  return _errorString;
-}
-
 }
@@ -17,8 +17,9 @@ class PropagateDownloadEncrypted : public QObject {
 public:
   PropagateDownloadEncrypted(OwncloudPropagator *propagator, const QString &localParentPath, SyncFileItemPtr item, QObject *parent = nullptr);
   void start();
-  bool decryptFile(QFile& tmpFile);
-  QString errorString() const;
+
+  /// The key and iv of the file, available once fileMetadataFound() was emitted
+  const EncryptedFile &encryptedInfo() const { return _encryptedInfo; }
 
 public slots:
   void checkFolderId(const QStringList &list);
@@ -38,7 +39,6 @@ private:
   SyncFileItemPtr _item;
   QFileInfo _info;
   EncryptedFile _encryptedInfo;
-  QString _errorString;
 };
 
 }
@@ -30,6 +30,7 @@
 #include "networkjobs.h"
 #include "clientsideencryption.h"
 #include "clientsideencryptionjobs.h"
+#include "deltasync.h"
 
 #include <QNetworkAccessManager>
 #include <QFileInfo>
@@ -37,6 +38,8 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QFileInfo>
+#include <QFutureWatcher>
+#include <qtconcurrentrun.h>
 
 #include <cmath>
 #include <cstring>
@@ -316,7 +319,9 @@ void PropagateUploadFileCommon::slotComputeContentChecksum()
     // change during the checksum calculation - This goes inside of the _item->_file
     // and not the _fileToUpload because we are checking the original file, not there
     // probably temporary one.
-    _item->_modtime = FileSystem::getModTime(filePath);
+    // Encrypted uploads did that before computing the tag already.
+    if (!_uploadingEncrypted)
+        _item->_modtime = FileSystem::getModTime(filePath);
 
     const QByteArray checksumType = propagator()->account()->capabilities().preferredUploadChecksumType();
 
@@ -331,15 +336,58 @@ void PropagateUploadFileCommon::slotComputeContentChecksum()
         return;
     }
 
-    // Compute the content checksum.
+    // Compute the content checksum. If the transmission checksum needs another
+    // type, compute it in the same pass instead of reading the file twice.
     auto computeChecksum = new ComputeChecksum(this);
     computeChecksum->setChecksumType(checksumType);
+    const auto transmissionChecksumType = separateTransmissionChecksumType(checksumType);
+    if (!transmissionChecksumType.isEmpty()) {
+        computeChecksum->setAdditionalChecksumTypes({ transmissionChecksumType });
+    }
 
     connect(computeChecksum, &ComputeChecksum::done,
-        this, &PropagateUploadFileCommon::slotComputeTransmissionChecksum);
+        this, [this, computeChecksum, transmissionChecksumType](const QByteArray &contentChecksumType, const QByteArray &contentChecksum) {
+            if (!transmissionChecksumType.isEmpty()) {
+                _precomputedTransmissionChecksumType = transmissionChecksumType;
+                _precomputedTransmissionChecksum = computeChecksum->additionalChecksums().value(transmissionChecksumType);
+            }
+            slotComputeTransmissionChecksum(contentChecksumType, contentChecksum);
+        });
     connect(computeChecksum, &ComputeChecksum::done,
         computeChecksum, &QObject::deleteLater);
-    computeChecksum->start(_fileToUpload._path);
+    startChecksumOfFileToUpload(computeChecksum);
+}
+
+void PropagateUploadFileCommon::startChecksumOfFileToUpload(ComputeChecksum *computeChecksum)
+{
+    if (_uploadingEncrypted) {
+        const auto &encryptedFile = _uploadEncryptedHelper->encryptedFile();
+        computeChecksum->start(std::make_unique<EncryptedFileDevice>(_fileToUpload._path,
+            encryptedFile.encryptionKey, encryptedFile.initializationVector, encryptedFile.authenticationTag));
+    } else {
+        computeChecksum->start(_fileToUpload._path);
+    }
+}
+
+std::unique_ptr<UploadDevice> PropagateUploadFileCommon::makeUploadDevice(qint64 start, qint64 size)
+{
+    auto device = std::make_unique<UploadDevice>(
+        _fileToUpload._path, start, size, propagator()->_bandwidthManager, propagator()->account()->id());
+    if (_uploadingEncrypted) {
+        const auto &encryptedFile = _uploadEncryptedHelper->encryptedFile();
+        device->setEncryption(encryptedFile.encryptionKey, encryptedFile.initializationVector, encryptedFile.authenticationTag);
+    }
+    return device;
+}
+
+QByteArray PropagateUploadFileCommon::separateTransmissionChecksumType(const QByteArray &contentChecksumType) const
+{
+    const auto &capabilities = propagator()->account()->capabilities();
+    if (capabilities.supportedChecksumTypes().contains(contentChecksumType) || !uploadChecksumEnabled()) {
+        return QByteArray();
+    }
+    const auto transmissionChecksumType = capabilities.uploadChecksumType();
+    return transmissionChecksumType != contentChecksumType ? transmissionChecksumType : QByteArray();
 }
 
 void PropagateUploadFileCommon::slotComputeTransmissionChecksum(const QByteArray &contentChecksumType, const QByteArray &contentChecksum)
@@ -354,6 +402,14 @@ void PropagateUploadFileCommon::slotComputeTransmissionChecksum(const QByteArray
         return;
     }
 
+    // Use the transmission checksum if it was computed along with the content checksum
+    if (!_precomputedTransmissionChecksum.isEmpty()
+        && uploadChecksumEnabled()
+        && _precomputedTransmissionChecksumType == propagator()->account()->capabilities().uploadChecksumType()) {
+        slotStartUpload(_precomputedTransmissionChecksumType, _precomputedTransmissionChecksum);
+        return;
+    }
+
     // Compute the transmission checksum.
     auto computeChecksum = new ComputeChecksum(this);
     if (uploadChecksumEnabled()) {
@@ -366,7 +422,7 @@ void PropagateUploadFileCommon::slotComputeTransmissionChecksum(const QByteArray
         this, &PropagateUploadFileCommon::slotStartUpload);
     connect(computeChecksum, &ComputeChecksum::done,
         computeChecksum, &QObject::deleteLater);
-    computeChecksum->start(_fileToUpload._path);
+    startChecksumOfFileToUpload(computeChecksum);
 }
 
 void PropagateUploadFileCommon::slotStartUpload(const QByteArray &transmissionChecksumType, const QByteArray &transmissionChecksum)
@@ -400,6 +456,8 @@ void PropagateUploadFileCommon::slotStartUpload(const QByteArray &transmissionCh
     }
 
     _fileToUpload._size = FileSystem::getSize(fullFilePath);
+    if (_uploadingEncrypted)
+        _fileToUpload._size += EncryptedFileDevice::tagSize;
     _item->_size = FileSystem::getSize(originalFilePath);
 
     // But skip the file if the mtime is too close to 'now'!
@@ -434,13 +492,13 @@ void PropagateUploadFileCommon::slotOnErrorStartFolderUnlock(SyncFileItem::Statu
     }
 }
 
-UploadDevice::UploadDevice(const QString &fileName, qint64 start, qint64 size, BandwidthManager *bwm)
+UploadDevice::UploadDevice(const QString &fileName, qint64 start, qint64 size, BandwidthManager *bwm, const QString &accountId)
     : _file(fileName)
     , _start(start)
     , _size(size)
     , _bandwidthManager(bwm)
 {
-    _bandwidthManager->registerUploadDevice(this);
+    _bandwidthManager->registerUploadDevice(this, accountId);
 }
 
 
@@ -451,11 +509,33 @@ UploadDevice::~UploadDevice()
     }
 }
 
+void UploadDevice::setEncryption(const QByteArray &key, const QByteArray &iv, const QByteArray &tag)
+{
+    _encryptedFile = std::make_unique<EncryptedFileDevice>(_file.fileName(), key, iv, tag);
+}
+
+QIODevice *UploadDevice::source()
+{
+    if (_encryptedFile)
+        return _encryptedFile.get();
+    return &_file;
+}
+
 bool UploadDevice::open(QIODevice::OpenMode mode)
 {
     if (mode & QIODevice::WriteOnly)
         return false;
 
+    if (_encryptedFile) {
+        if (!_encryptedFile->open(QIODevice::ReadOnly) || !_encryptedFile->seek(_start)) {
+            setErrorString(_encryptedFile->errorString());
+            return false;
+        }
+        _size = qBound(0ll, _size, _encryptedFile->size() - _start);
+        _read = 0;
+        return QIODevice::open(mode);
+    }
+
     // Get the file size now: _file.fileName() is no longer reliable
     // on all platforms after openAndSeekFileSharedRead().
     auto fileDiskSize = FileSystem::getSize(_file.fileName());
@@ -474,7 +554,7 @@ bool UploadDevice::open(QIODevice::OpenMode mode)
 
 void UploadDevice::close()
 {
-    _file.close();
+    source()->close();
     QIODevice::close();
 }
 
@@ -508,9 +588,9 @@ qint64 UploadDevice::readData(char *data, qint64 maxlen)
         _bandwidthQuota -= maxlen;
     }
 
-    auto c = _file.read(data, maxlen);
+    auto c = source()->read(data, maxlen);
     if (c < 0) {
-        setErrorString(_file.errorString());
+        setErrorString(source()->errorString());
         return -1;
     }
     _read += c;
@@ -555,7 +635,7 @@ bool UploadDevice::seek(qint64 pos)
         return false;
     }
     _read = pos;
-    _file.seek(_start + pos);
+    source()->seek(_start + pos);
     return true;
 }
 
@@ -634,7 +714,7 @@ void PropagateUploadFileCommon::checkResettingErrors()
                                       << "is" << uploadInfo._errorCount;
         }
         propagator()->_journal->setUploadInfo(_item->_file, uploadInfo);
-        propagator()->_journal->commit("Upload info");
+        propagator()->_journal->commitIfNeededAndStartNewTransaction("Upload info");
     }
 }
 
@@ -787,15 +867,79 @@ void PropagateUploadFileCommon::finalize()
 
     // Remove from the progress database:
     propagator()->_journal->setUploadInfo(_item->_file, SyncJournalDb::UploadInfo());
-    propagator()->_journal->commit("upload file start");
+    propagator()->_journal->commitIfNeededAndStartNewTransaction("upload file start");
 
     if (_uploadingEncrypted) {
         _uploadStatus = { SyncFileItem::Success, QString() };
         connect(_uploadEncryptedHelper, &PropagateUploadEncrypted::folderUnlocked, this, &PropagateUploadFileCommon::slotFolderUnlocked);
         _uploadEncryptedHelper->unlockFolder();
     } else {
+        publishBlockManifest();
+    }
+}
+
+void PropagateUploadFileCommon::publishBlockManifest()
+{
+    const auto account = propagator()->account();
+    QByteArray checksumType;
+    QByteArray checksum;
+    if (!account->capabilities().deltaSync()
+        || _uploadingEncrypted
+        || _fileToUpload._size <= 0
+        || _fileToUpload._size < propagator()->syncOptions()._deltaSyncMinFileSize
+        || _item->_fileId.isEmpty()
+        || _item->_etag.isEmpty()
+        || !parseChecksumHeader(_item->_checksumHeader, &checksumType, &checksum)
+        || checksumType.isEmpty()) {
         done(SyncFileItem::Success);
+        return;
     }
+
+    // Hash the file in a thread. The content checksum confirms that the
+    // file did not change since it was uploaded.
+    const auto path = _fileToUpload._path;
+    const auto size = _fileToUpload._size;
+    const auto etag = _item->_etag;
+    auto watcher = new QFutureWatcher<QByteArray>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, account] {
+        const auto data = watcher->result();
+        watcher->deleteLater();
+        if (_finished)
+            return;
+        if (data.isEmpty() || propagator()->_abortRequested) {
+            qCInfo(lcPropagateUpload) << "No block manifest published for" << _item->_file;
+            done(SyncFileItem::Success);
+            return;
+        }
+
+        auto job = new SimpleNetworkJob(account, this);
+        _jobs.append(job);
+        connect(job, &QObject::destroyed, this, &PropagateUploadFileCommon::slotJobDestroyed);
+        connect(job, &SimpleNetworkJob::finishedSignal, this, [this](QNetworkReply *reply) {
+            // The upload itself succeeded, other clients just download the whole file
+            if (reply->error() != QNetworkReply::NoError) {
+                qCWarning(lcPropagateUpload) << "Could not publish the block manifest of" << _item->_file << reply->errorString();
+            }
+            if (!_finished)
+                done(SyncFileItem::Success);
+        });
+        auto buffer = new QBuffer(job);
+        buffer->setData(data);
+        QNetworkRequest req;
+        req.setHeader(QNetworkRequest::ContentTypeHeader, QByteArrayLiteral("application/octet-stream"));
+        job->startRequest("PUT", BlockManifest::url(account, _item->_fileId), req, buffer);
+    });
+    watcher->setFuture(QtConcurrent::run([path, size, etag, checksumType, checksum]() {
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly))
+            return QByteArray();
+        QByteArray contentChecksum;
+        auto manifest = BlockManifest::compute(&file, BlockManifest::blockSizeFor(size), checksumType, &contentChecksum);
+        if (!manifest.isValid() || manifest.fileSize != size || contentChecksum != checksum)
+            return QByteArray();
+        manifest.etag = etag;
+        return manifest.serialize();
+    }));
 }
 
 void PropagateUploadFileCommon::abortNetworkJobs(
@@ -29,6 +29,8 @@ Q_DECLARE_LOGGING_CATEGORY(lcPropagateUploadV1)
 Q_DECLARE_LOGGING_CATEGORY(lcPropagateUploadNG)
 
 class BandwidthManager;
+class ComputeChecksum;
+class EncryptedFileDevice;
 
 /**
  * @brief The UploadDevice class
@@ -38,9 +40,12 @@ class UploadDevice : public QIODevice
 {
     Q_OBJECT
 public:
-    UploadDevice(const QString &fileName, qint64 start, qint64 size, BandwidthManager *bwm);
+    UploadDevice(const QString &fileName, qint64 start, qint64 size, BandwidthManager *bwm, const QString &accountId);
     ~UploadDevice();
 
+    /// Uploads the encryption of the file instead, see EncryptedFileDevice. Call before open().
+    void setEncryption(const QByteArray &key, const QByteArray &iv, const QByteArray &tag);
+
     bool open(QIODevice::OpenMode mode) override;
     void close() override;
 
@@ -63,6 +68,9 @@ signals:
 private:
     /// The local file to read data from
     QFile _file;
+    /// Encrypts _file while it is read, if the upload is encrypted
+    std::unique_ptr<EncryptedFileDevice> _encryptedFile;
+    QIODevice *source();
 
     /// Start of the file data to use
     qint64 _start = 0;
@@ -190,8 +198,8 @@ class PropagateUploadEncrypted;
  *   +---> start()  --> (delete job) -------+
  *   |                                      |
  *   +--> slotComputeContentChecksum()  <---+
- *                   |
- *                   v
+ *                   |   (also computes the transmission checksum
+ *                   v    in the same pass if it has another type)
  *    slotComputeTransmissionChecksum()
  *         |
  *         v
@@ -237,6 +245,10 @@ protected:
     UploadFileInfo _fileToUpload;
     QByteArray _transmissionChecksumHeader;
 
+    /// Transmission checksum computed in the same pass as the content checksum, if any
+    QByteArray _precomputedTransmissionChecksumType;
+    QByteArray _precomputedTransmissionChecksum;
+
 public:
     PropagateUploadFileCommon(OwncloudPropagator *propagator, const SyncFileItemPtr &item);
 
@@ -255,6 +267,17 @@ public:
     void startUploadFile();
     void callUnlockFolder();
     bool isLikelyFinishedQuickly() override { return _item->_size < propagator()->smallFileSize(); }
+    bool isTransferJob() const override { return true; }
+
+private:
+    /// Starts computeChecksum on the data that is uploaded, which is encrypted for encrypted uploads
+    void startChecksumOfFileToUpload(ComputeChecksum *computeChecksum);
+
+    /** The checksum type to send to the server along with a content checksum of the given type
+     *
+     * Empty if the content checksum is reused, or no transmission checksum is sent.
+     */
+    QByteArray separateTransmissionChecksumType(const QByteArray &contentChecksumType) const;
 
 private slots:
     void slotComputeContentChecksum();
@@ -280,6 +303,10 @@ public slots:
 private slots:
     void slotPollFinished();
 
+private:
+    /// Stores the block manifest of large files on the server and finishes the job, see BlockManifest
+    void publishBlockManifest();
+
 protected:
     void done(SyncFileItem::Status status, const QString &errorString = QString()) override;
 
@@ -316,6 +343,11 @@ protected:
 
     /** Bases headers that need to be sent on the PUT, or in the MOVE for chunking-ng */
     QMap<QByteArray, QByteArray> headers();
+
+    /// The device for the data of _fileToUpload between start and start + size, not opened yet
+    std::unique_ptr<UploadDevice> makeUploadDevice(qint64 start, qint64 size);
+
+    bool isUploadingEncrypted() const { return _uploadingEncrypted; }
 private:
   PropagateUploadEncrypted *_uploadEncryptedHelper;
   bool _uploadingEncrypted;
@@ -379,10 +411,9 @@ class PropagateUploadFileNG : public PropagateUploadFileCommon
 {
     Q_OBJECT
 private:
-    qint64 _sent = 0; /// amount of data (bytes) that was already sent
+    qint64 _sent = 0; /// amount of data (bytes) that was already sent, including the chunks still in transit
     uint _transferId = 0; /// transfer id (part of the url)
     int _currentChunk = 0; /// Id of the next chunk that will be sent
-    qint64 _currentChunkSize = 0; /// current chunk size
     bool _removeJobError = false; /// If not null, there was an error removing the job
 
     // Map chunk number with its size  from the PROPFIND on resume.
@@ -411,6 +442,10 @@ public:
 private:
     void startNewUpload();
     void startNextChunk();
+    /** Whether another chunk of this file may be sent while other chunks are still in transit */
+    bool mayUploadChunkInParallel();
+    /** Number of PUT jobs of this file that are currently in transit */
+    int runningChunkCount() const;
 public slots:
     void abort(AbortType abortType) override;
 private slots:
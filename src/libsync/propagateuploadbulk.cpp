@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "propagateuploadbulk.h"
+#include "owncloudpropagator_p.h"
+#include "networkjobs.h"
+#include "account.h"
+#include "common/syncjournaldb.h"
+#include "filesystem.h"
+#include "propagatorjobs.h"
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QJsonDocument>
+#include <QUuid>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcBulkUploadJob, "nextcloud.sync.networkjob.bulkupload", QtInfoMsg)
+Q_LOGGING_CATEGORY(lcPropagateUploadBulk, "nextcloud.sync.propagator.upload.bulk", QtInfoMsg)
+
+BulkUploadJob::BulkUploadJob(AccountPtr account, const QVector<Part> &parts, QObject *parent)
+    : AbstractNetworkJob(account, QStringLiteral("remote.php/dav/bulk"), parent)
+    , _parts(parts)
+{
+}
+
+QByteArray BulkUploadJob::multipartBody(const QVector<Part> &parts, const QByteArray &boundary)
+{
+    QByteArray body;
+    for (const auto &part : parts) {
+        body += "--" + boundary + "\r\n";
+        for (auto it = part.headers.cbegin(); it != part.headers.cend(); ++it) {
+            body += it.key() + ": " + it.value() + "\r\n";
+        }
+        body += "\r\n" + part.data + "\r\n";
+    }
+    body += "--" + boundary + "--\r\n";
+    return body;
+}
+
+void BulkUploadJob::start()
+{
+    const QByteArray boundary = "boundary_" + QUuid::createUuid().toRfc4122().toHex();
+    auto buffer = new QBuffer(this);
+    buffer->setData(multipartBody(_parts, boundary));
+    // The parts were copied into the body
+    _parts.clear();
+
+    QNetworkRequest req;
+    req.setRawHeader("Content-Type", "multipart/related; boundary=" + boundary);
+    req.setPriority(QNetworkRequest::LowPriority); // Long uploads must not block non-propagation jobs.
+    sendRequest("POST", makeAccountUrl(path()), req, buffer);
+
+    if (reply()->error() != QNetworkReply::NoError) {
+        qCWarning(lcBulkUploadJob) << " Network error: " << reply()->errorString();
+    }
+
+    connect(this, &AbstractNetworkJob::networkActivity, account().data(), &Account::propagatorNetworkActivity);
+    AbstractNetworkJob::start();
+}
+
+bool BulkUploadJob::finished()
+{
+    qCInfo(lcBulkUploadJob) << "POST of" << reply()->request().url().toString() << "FINISHED WITH STATUS"
+                            << replyStatusString()
+                            << reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute)
+                            << reply()->attribute(QNetworkRequest::HttpReasonPhraseAttribute);
+
+    emit finishedSignal();
+    return true;
+}
+
+bool BulkUploadBatch::isUnsupported() const
+{
+    return _propagator->_bulkUploadUnsupported;
+}
+
+void BulkUploadBatch::setUnsupported()
+{
+    _propagator->_bulkUploadUnsupported = true;
+}
+
+BulkUploadJob *BulkUploadBatch::createJob()
+{
+    QVector<BulkUploadJob::Part> parts;
+    for (const auto &file : qAsConst(_files)) {
+        parts.append(std::move(file->_part));
+        file->_part = BulkUploadJob::Part();
+    }
+
+    qCInfo(lcPropagateUploadBulk) << "Uploading" << _files.size() << "files with one request";
+    return new BulkUploadJob(_propagator->account(), parts, this);
+}
+
+void BulkUploadBatch::jobSucceeded(BulkUploadJob *job, const Files &files)
+{
+    const QByteArray replyContent = job->reply()->readAll();
+    QJsonParseError jsonParseError;
+    const QJsonObject results = QJsonDocument::fromJson(replyContent, &jsonParseError).object();
+    if (jsonParseError.error != QJsonParseError::NoError) {
+        qCWarning(lcPropagateUploadBulk) << "Invalid JSON reply to the bulk upload:" << jsonParseError.errorString() << replyContent;
+    }
+
+    for (const auto &file : files) {
+        if (file) {
+            const auto remotePath = _propagator->fullRemotePath(file->_fileToUpload._file);
+            file->bulkUploadFinished(job, results.value(remotePath).toObject());
+        }
+    }
+}
+
+void BulkUploadBatch::jobFailed(BulkUploadJob *job, const Files &files)
+{
+    for (const auto &file : files) {
+        if (file) {
+            file->bulkUploadFailed(job);
+        }
+    }
+}
+
+void PropagateUploadFileBulk::doStartUpload()
+{
+    if (!_inBatch || isUploadingEncrypted()) {
+        // Encrypted files are uploaded one by one while their folder is locked
+        fallBackToSingleTransfer();
+        return;
+    }
+
+    const QString fileName = _fileToUpload._path;
+    QFile file(fileName);
+    QString openError;
+    if (!FileSystem::openAndSeekFileSharedRead(&file, &openError, 0)) {
+        qCWarning(lcPropagateUploadBulk) << "Could not open file for upload: " << openError;
+
+        // If the file is currently locked, we want to retry the sync
+        // when it becomes available again.
+        if (FileSystem::isFileLocked(fileName)) {
+            emit propagator()->seenLockedFile(fileName);
+        }
+        // Soft error because this is likely caused by the user modifying his files while syncing
+        abortWithError(SyncFileItem::SoftError, openError);
+        return;
+    }
+
+    _part.data = file.readAll();
+    file.close();
+    if (_part.data.size() != _fileToUpload._size) {
+        propagator()->_anotherSyncNeeded = true;
+        abortWithError(SyncFileItem::SoftError, tr("Local file changed during sync."));
+        return;
+    }
+
+    _part.headers = headers();
+    _part.headers[QByteArrayLiteral("X-File-Path")] = propagator()->fullRemotePath(_fileToUpload._file).toUtf8();
+    _part.headers[QByteArrayLiteral("X-File-Mtime")] = QByteArray::number(qint64(_item->_modtime));
+    _part.headers[QByteArrayLiteral("X-File-MD5")] = QCryptographicHash::hash(_part.data, QCryptographicHash::Md5).toHex();
+    _part.headers[QByteArrayLiteral("Content-Length")] = QByteArray::number(_part.data.size());
+    if (!_transmissionChecksumHeader.isEmpty()) {
+        _part.headers[checkSumHeaderC] = _transmissionChecksumHeader;
+    }
+
+    if (!_item->_checksumHeader.isEmpty()) {
+        // Like for single uploads: if the request reaches the server but the reply
+        // gets lost, reconcile can still match the checksum (issue #5106)
+        SyncJournalDb::UploadInfo pi;
+        pi._valid = true;
+        pi._chunk = 0;
+        pi._transferid = 0;
+        pi._modtime = _item->_modtime;
+        pi._errorCount = 0;
+        pi._contentChecksum = _item->_checksumHeader;
+        pi._size = _item->_size;
+        propagator()->_journal->setUploadInfo(_item->_file, pi);
+        propagator()->_journal->commitIfNeededAndStartNewTransaction("Upload info");
+    }
+
+    propagator()->reportProgress(*_item, 0);
+    _batch->fileReady(this);
+}
+
+void PropagateUploadFileBulk::trackJob(AbstractNetworkJob *job)
+{
+    _jobs.append(job);
+    connect(job, &QObject::destroyed, this, &PropagateUploadFileCommon::slotJobDestroyed);
+}
+
+void PropagateUploadFileBulk::untrackJob(AbstractNetworkJob *job)
+{
+    slotJobDestroyed(job); // remove it from the _jobs list
+}
+
+void PropagateUploadFileBulk::bulkUploadFailed(AbstractNetworkJob *job)
+{
+    if (_finished || _aborting) {
+        return;
+    }
+    _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    _item->_responseTimeStamp = job->responseTimestamp();
+    _item->_requestId = job->requestId();
+    commonErrorHandling(job);
+}
+
+void PropagateUploadFileBulk::bulkUploadFinished(AbstractNetworkJob *job, const QJsonObject &result)
+{
+    if (_finished || _aborting) {
+        return;
+    }
+    _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    _item->_responseTimeStamp = job->responseTimestamp();
+    _item->_requestId = job->requestId();
+
+    if (result.isEmpty()) {
+        done(SyncFileItem::NormalError, tr("The server did not report the result of the upload"));
+        return;
+    }
+    if (result.value(QStringLiteral("error")).toBool()) {
+        done(SyncFileItem::NormalError, result.value(QStringLiteral("message")).toString());
+        return;
+    }
+
+    const QByteArray etag = parseEtag(result.value(QStringLiteral("etag")).toString().toUtf8());
+    if (etag.isEmpty()) {
+        done(SyncFileItem::NormalError, tr("The server did not acknowledge the upload. (No e-tag was present)"));
+        return;
+    }
+    _finished = true;
+
+    // The file is on the server, but it may have changed locally in the meantime
+    const QString fullFilePath(propagator()->fullLocalPath(_item->_file));
+    if (!FileSystem::fileExists(fullFilePath)
+        || !FileSystem::verifyFileUnchanged(fullFilePath, _item->_size, _item->_modtime)) {
+        propagator()->_anotherSyncNeeded = true;
+    }
+
+    // the file id should only be empty for new files up- or downloaded
+    const QByteArray fid = result.value(QStringLiteral("fileid")).toString().toUtf8();
+    if (!fid.isEmpty()) {
+        if (!_item->_fileId.isEmpty() && _item->_fileId != fid) {
+            qCWarning(lcPropagateUploadBulk) << "File ID changed!" << _item->_fileId << fid;
+        }
+        _item->_fileId = fid;
+    }
+    _item->_etag = etag;
+
+    finalize();
+}
+
+void PropagateUploadFileBulk::startSingleTransfer()
+{
+    _part = BulkUploadJob::Part();
+    PropagateUploadFileV1::doStartUpload();
+}
+
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) by Nextcloud GmbH
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+#pragma once
+
+#include "propagateupload.h"
+#include "bulkbatch.h"
+
+#include <QJsonObject>
+
+namespace OCC {
+
+Q_DECLARE_LOGGING_CATEGORY(lcPropagateUploadBulk)
+
+/**
+ * @brief Uploads several files with one multipart POST to the bulk endpoint
+ * @ingroup libsync
+ *
+ * Each part holds the content of one file along with the headers describing
+ * it. The server replies with a JSON object that maps the path of each file
+ * to the result of storing it.
+ */
+class OWNCLOUDSYNC_EXPORT BulkUploadJob : public AbstractNetworkJob
+{
+    Q_OBJECT
+public:
+    struct Part
+    {
+        QMap<QByteArray, QByteArray> headers;
+        QByteArray data;
+    };
+
+    explicit BulkUploadJob(AccountPtr account, const QVector<Part> &parts, QObject *parent = nullptr);
+
+    void start() override;
+    bool finished() override;
+
+    /** Serializes \a parts to a multipart/related body using \a boundary */
+    static QByteArray multipartBody(const QVector<Part> &parts, const QByteArray &boundary);
+
+signals:
+    void finishedSignal();
+
+private:
+    QVector<Part> _parts;
+};
+
+class PropagateUploadFileBulk;
+
+/**
+ * @brief Collects the files of one bulk upload request
+ * @ingroup libsync
+ *
+ * The request is sent once every file of the batch is either ready to be
+ * uploaded or done, for example because it changed while being checksummed.
+ */
+class BulkUploadBatch : public BulkBatch<PropagateUploadFileBulk, BulkUploadJob>
+{
+public:
+    using BulkBatch::BulkBatch;
+
+protected:
+    bool isUnsupported() const override;
+    void setUnsupported() override;
+    BulkUploadJob *createJob() override;
+    void jobSucceeded(BulkUploadJob *job, const Files &files) override;
+    void jobFailed(BulkUploadJob *job, const Files &files) override;
+};
+
+/**
+ * @ingroup libsync
+ *
+ * Propagation job for a small file that is uploaded along with others in one
+ * bulk request. Falls back to a regular upload for encrypted files and when
+ * the server rejects the bulk request.
+ */
+class PropagateUploadFileBulk : public BulkBatchFile<PropagateUploadFileV1, BulkUploadBatch>
+{
+    Q_OBJECT
+public:
+    /// Maximum number of files that are uploaded with one request
+    static constexpr int maxBatchFiles = 100;
+
+    using BulkBatchFile::BulkBatchFile;
+
+    void doStartUpload() override;
+
+protected:
+    void startSingleTransfer() override;
+
+private:
+    friend class BulkBatch<PropagateUploadFileBulk, BulkUploadJob>;
+    friend class BulkUploadBatch;
+
+    void trackJob(AbstractNetworkJob *job);
+    void untrackJob(AbstractNetworkJob *job);
+    void bulkUploadFailed(AbstractNetworkJob *job);
+    void bulkUploadFinished(AbstractNetworkJob *job, const QJsonObject &result);
+
+    BulkUploadJob::Part _part; /// the content and headers of the file, until the request is created
+};
+
+}
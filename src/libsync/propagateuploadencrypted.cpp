@@ -3,6 +3,7 @@
 #include "networkjobs.h"
 #include "clientsideencryption.h"
 #include "account.h"
+#include "filesystem.h"
 
 #include <QFileInfo>
 #include <QDir>
@@ -168,14 +169,18 @@ void PropagateUploadEncrypted::slotFolderEncryptedMetadataReceived(const QJsonDo
   if (info.isDir()) {
       _completeFileName = encryptedFile.encryptedFilename;
   } else {
+      // The file is encrypted again while it is uploaded, see EncryptedFileDevice.
+      // Only the tag is needed now, for the metadata.
       QFile input(info.absoluteFilePath());
-      QFile output(QDir::tempPath() + QDir::separator() + encryptedFile.encryptedFilename);
+
+      // The tag is only valid for the file as it is now: the upload checks against this modtime
+      _item->_modtime = FileSystem::getModTime(info.absoluteFilePath());
 
       QByteArray tag;
       bool encryptionResult = EncryptionHelper::fileEncryption(
         encryptedFile.encryptionKey,
         encryptedFile.initializationVector,
-        &input, &output, tag);
+        &input, nullptr, tag);
 
       if (!encryptionResult) {
         qCDebug(lcPropagateUploadEncrypted()) << "There was an error encrypting the file, aborting upload.";
@@ -185,7 +190,7 @@ void PropagateUploadEncrypted::slotFolderEncryptedMetadataReceived(const QJsonDo
       }
 
       encryptedFile.authenticationTag = tag;
-      _completeFileName = output.fileName();
+      _completeFileName = info.absoluteFilePath();
   }
 
   qCDebug(lcPropagateUploadEncrypted) << "Creating the metadata for the encrypted file.";
@@ -218,13 +223,13 @@ void PropagateUploadEncrypted::slotUpdateMetadataSuccess(const QByteArray& fileI
 {
     Q_UNUSED(fileId);
     qCDebug(lcPropagateUploadEncrypted) << "Uploading of the metadata success, Encrypting the file";
-    QFileInfo outputInfo(_completeFileName);
+    QFileInfo inputInfo(_completeFileName);
 
-    qCDebug(lcPropagateUploadEncrypted) << "Encrypted Info:" << outputInfo.path() << outputInfo.fileName() << outputInfo.size();
+    qCDebug(lcPropagateUploadEncrypted) << "Plaintext Info:" << inputInfo.path() << inputInfo.fileName() << inputInfo.size();
     qCDebug(lcPropagateUploadEncrypted) << "Finalizing the upload part, now the actuall uploader will take over";
-    emit finalized(outputInfo.path() + QLatin1Char('/') + outputInfo.fileName(),
-                   _remoteParentPath + QLatin1Char('/') + outputInfo.fileName(),
-                   outputInfo.size());
+    emit finalized(inputInfo.absoluteFilePath(),
+                   _remoteParentPath + QLatin1Char('/') + _encryptedFile.encryptedFilename,
+                   inputInfo.size() + EncryptedFileDevice::tagSize);
 }
 
 void PropagateUploadEncrypted::slotUpdateMetadataError(const QByteArray& fileId, int httpErrorResponse)
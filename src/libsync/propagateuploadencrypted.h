@@ -22,7 +22,7 @@ class FolderMetadata;
  * encrypted on the server.
  *
  * emits:
- * finalized() if the encrypted file is ready to be uploaded
+ * finalized() if the file is ready to be uploaded encrypted
  * error() if there was an error with the encryption
  * folderNotEncrypted() if the file is within a folder that's not encrypted.
  *
@@ -42,6 +42,8 @@ public:
     bool isUnlockRunning() const { return _isUnlockRunning; }
     bool isFolderLocked() const { return _isFolderLocked; }
     const QByteArray folderToken() const { return _folderToken; }
+    /// The key, iv and tag the file is encrypted with, once finalized() was emitted
+    const EncryptedFile &encryptedFile() const { return _encryptedFile; }
 
 private slots:
     void slotFolderEncryptedIdReceived(const QStringList &list);
@@ -55,7 +57,8 @@ private slots:
     void slotUpdateMetadataError(const QByteArray& fileId, int httpReturnCode);
 
 signals:
-    // Emmited after the file is encrypted and everythign is setup.
+    // Emmited after the tag of the file is known and everythign is setup.
+    // path is the plaintext file, size the size of its encryption with the tag.
     void finalized(const QString& path, const QString& filename, quint64 size);
     void error();
     void folderUnlocked(const QByteArray &folderId, int httpStatus);
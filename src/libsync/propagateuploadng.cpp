@@ -30,6 +30,7 @@
 #include <QNetworkAccessManager>
 #include <QFileInfo>
 #include <QDir>
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 
@@ -75,6 +76,8 @@ QUrl PropagateUploadFileNG::chunkUrl(int chunk)
     |
     +-> MOVE ------> moveJobFinished() ---> finalize()
 
+  When parallel chunk uploads are enabled, startNextChunk() may start several
+  PUTs before returning. The MOVE is only sent once all of them have finished.
 
  */
 
@@ -242,7 +245,7 @@ void PropagateUploadFileNG::startNewUpload()
     pi._contentChecksum = _item->_checksumHeader;
     pi._size = _item->_size;
     propagator()->_journal->setUploadInfo(_item->_file, pi);
-    propagator()->_journal->commit("Upload info");
+    propagator()->_journal->commitIfNeededAndStartNewTransaction("Upload info");
     QMap<QByteArray, QByteArray> headers;
 
     // But we should send the temporary (or something) one.
@@ -273,6 +276,27 @@ void PropagateUploadFileNG::slotMkColFinished(QNetworkReply::NetworkError)
     startNextChunk();
 }
 
+int PropagateUploadFileNG::runningChunkCount() const
+{
+    return std::count_if(_jobs.cbegin(), _jobs.cend(), [](AbstractNetworkJob *job) {
+        return qobject_cast<PUTFileJob *>(job) != nullptr;
+    });
+}
+
+bool PropagateUploadFileNG::mayUploadChunkInParallel()
+{
+    if (_sent >= _fileToUpload._size) {
+        return false;
+    }
+
+    if (propagator()->account()->capabilities().chunkingParallelUploadDisabled()) {
+        return false;
+    }
+
+    return runningChunkCount() < propagator()->syncOptions()._parallelChunkUploads
+        && propagator()->_activeJobList.count() < propagator()->maximumActiveTransferJob();
+}
+
 void PropagateUploadFileNG::startNextChunk()
 {
     if (propagator()->_abortRequested)
@@ -282,10 +306,24 @@ void PropagateUploadFileNG::startNextChunk()
     ENFORCE(fileSize >= _sent, "Sent data exceeds file size");
 
     // prevent situation that chunk size is bigger then required one to send
-    _currentChunkSize = qMin(propagator()->_chunkSize, fileSize - _sent);
+    const qint64 currentChunkSize = qMin(propagator()->_chunkSize, fileSize - _sent);
 
-    if (_currentChunkSize == 0) {
+    if (currentChunkSize == 0) {
+        if (runningChunkCount() > 0) {
+            // All the data was sent, but some chunks are still in transit.
+            // The MOVE is started once the last of them is finished.
+            return;
+        }
         Q_ASSERT(_jobs.isEmpty()); // There should be no running job anymore
+
+        // The tag in the metadata was computed before the upload, a file that
+        // changed meanwhile was encrypted into chunks that don't match it
+        if (isUploadingEncrypted()
+            && !FileSystem::verifyFileUnchanged(propagator()->fullLocalPath(_item->_file), _item->_size, _item->_modtime)) {
+            propagator()->_anotherSyncNeeded = true;
+            abortWithError(SyncFileItem::SoftError, tr("Local file changed during sync."));
+            return;
+        }
         _finished = true;
 
         // Finish with a MOVE
@@ -317,8 +355,7 @@ void PropagateUploadFileNG::startNextChunk()
     }
 
     const QString fileName = _fileToUpload._path;
-    auto device = std::make_unique<UploadDevice>(
-            fileName, _sent, _currentChunkSize, &propagator()->_bandwidthManager);
+    auto device = makeUploadDevice(_sent, currentChunkSize);
     if (!device->open(QIODevice::ReadOnly)) {
         qCWarning(lcPropagateUploadNG) << "Could not prepare upload device: " << device->errorString();
 
@@ -335,7 +372,7 @@ void PropagateUploadFileNG::startNextChunk()
     QMap<QByteArray, QByteArray> headers;
     headers["OC-Chunk-Offset"] = QByteArray::number(_sent);
 
-    _sent += _currentChunkSize;
+    _sent += currentChunkSize;
     QUrl url = chunkUrl(_currentChunk);
 
     // job takes ownership of device via a QScopedPointer. Job deletes itself when finishing
@@ -351,6 +388,13 @@ void PropagateUploadFileNG::startNextChunk()
     job->start();
     propagator()->_activeJobList.append(this);
     _currentChunk++;
+
+    // The chunks are only assembled by the final MOVE, so they may be sent in any order.
+    // If the upload is interrupted, slotPropfindFinished() only resumes after the
+    // contiguous chunks and removes the ones that are stored beyond a gap.
+    if (mayUploadChunkInParallel()) {
+        startNextChunk();
+    }
 }
 
 void PropagateUploadFileNG::slotPutFinished()
@@ -383,9 +427,10 @@ void PropagateUploadFileNG::slotPutFinished()
     // Dynamic chunk sizing is enabled if the server configured a
     // target duration for each chunk upload.
     auto targetDuration = propagator()->syncOptions()._targetChunkUploadDuration;
+    const qint64 chunkSize = job->device()->size();
     if (targetDuration.count() > 0) {
         auto uploadTime = ++job->msSinceStart(); // add one to avoid div-by-zero
-        qint64 predictedGoodSize = (_currentChunkSize * targetDuration) / uploadTime;
+        qint64 predictedGoodSize = (chunkSize * targetDuration) / uploadTime;
 
         // The whole targeting is heuristic. The predictedGoodSize will fluctuate
         // quite a bit because of external factors (like available bandwidth)
@@ -401,13 +446,13 @@ void PropagateUploadFileNG::slotPutFinished()
             targetSize,
             propagator()->syncOptions()._maxChunkSize);
 
-        qCInfo(lcPropagateUploadNG) << "Chunked upload of" << _currentChunkSize << "bytes took" << uploadTime.count()
+        qCInfo(lcPropagateUploadNG) << "Chunked upload of" << chunkSize << "bytes took" << uploadTime.count()
                                   << "ms, desired is" << targetDuration.count() << "ms, expected good chunk size is"
                                   << predictedGoodSize << "bytes and nudged next chunk size to "
                                   << propagator()->_chunkSize << "bytes";
     }
 
-    _finished = _sent == _item->_size;
+    _finished = _sent == _item->_size && runningChunkCount() == 0;
 
     // Check if the file still exists
     const QString fullFilePath(propagator()->fullLocalPath(_item->_file));
@@ -440,7 +485,7 @@ void PropagateUploadFileNG::slotPutFinished()
         auto uploadInfo = propagator()->_journal->getUploadInfo(_item->_file);
         uploadInfo._errorCount = 0;
         propagator()->_journal->setUploadInfo(_item->_file, uploadInfo);
-        propagator()->_journal->commit("Upload info");
+        propagator()->_journal->commitIfNeededAndStartNewTransaction("Upload info");
     }
     startNextChunk();
 }
@@ -508,7 +553,18 @@ void PropagateUploadFileNG::slotUploadProgress(qint64 sent, qint64 total)
     if (sent == 0 && total == 0) {
         return;
     }
-    propagator()->reportProgress(*_item, _sent + sent - total);
+
+    // _sent also includes the chunks that are still in transit: replace their
+    // full size by the amount that was actually written so far.
+    sender()->setProperty("byteWritten", sent);
+    qint64 amount = _sent;
+    for (auto *job : qAsConst(_jobs)) {
+        if (auto *putJob = qobject_cast<PUTFileJob *>(job)) {
+            amount -= putJob->device()->size();
+            amount += putJob->property("byteWritten").toLongLong();
+        }
+    }
+    propagator()->reportProgress(*_item, amount);
 }
 
 void PropagateUploadFileNG::abort(PropagatorJob::AbortType abortType)
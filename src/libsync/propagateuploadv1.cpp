@@ -61,7 +61,7 @@ void PropagateUploadFileV1::doStartUpload()
         pi._contentChecksum = _item->_checksumHeader;
         pi._size = _item->_size;
         propagator()->_journal->setUploadInfo(_item->_file, pi);
-        propagator()->_journal->commit("Upload info");
+        propagator()->_journal->commitIfNeededAndStartNewTransaction("Upload info");
     }
 
     _currentChunk = 0;
@@ -122,9 +122,17 @@ void PropagateUploadFileV1::startNextChunk()
         headers[checkSumHeaderC] = _transmissionChecksumHeader;
     }
 
+    // The tag in the metadata was computed before the upload, a file that
+    // changed meanwhile would be stored with content that doesn't match it
+    if (isFinalChunk && isUploadingEncrypted()
+        && !FileSystem::verifyFileUnchanged(propagator()->fullLocalPath(_item->_file), _item->_size, _item->_modtime)) {
+        propagator()->_anotherSyncNeeded = true;
+        abortWithError(SyncFileItem::SoftError, tr("Local file changed during sync."));
+        return;
+    }
+
     const QString fileName = _fileToUpload._path;
-    auto device = std::make_unique<UploadDevice>(
-            fileName, chunkStart, currentChunkSize, &propagator()->_bandwidthManager);
+    auto device = makeUploadDevice(chunkStart, currentChunkSize);
     if (!device->open(QIODevice::ReadOnly)) {
         qCWarning(lcPropagateUploadV1) << "Could not prepare upload device: " << device->errorString();
 
@@ -247,7 +255,9 @@ void PropagateUploadFileV1::slotPutFinished()
     // Check whether the file changed since discovery. the file check here is the original and not the temprary.
     if (!FileSystem::verifyFileUnchanged(fullFilePath, _item->_size, _item->_modtime)) {
         propagator()->_anotherSyncNeeded = true;
-        if (!_finished) {
+        // An encrypted file that changed while it was streamed doesn't match the
+        // tag in the metadata, don't record it even if the server has it
+        if (!_finished || isUploadingEncrypted()) {
             abortWithError(SyncFileItem::SoftError, tr("Local file changed during sync."));
             // FIXME:  the legacy code was retrying for a few seconds.
             //         and also checking that after the last chunk, and removed the file in case of INSTRUCTION_NEW
@@ -288,7 +298,7 @@ void PropagateUploadFileV1::slotPutFinished()
         pi._contentChecksum = _item->_checksumHeader;
         pi._size = _item->_size;
         propagator()->_journal->setUploadInfo(_item->_file, pi);
-        propagator()->_journal->commit("Upload info");
+        propagator()->_journal->commitIfNeededAndStartNewTransaction("Upload info");
         startNextChunk();
         return;
     }
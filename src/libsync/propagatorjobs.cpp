@@ -233,6 +233,10 @@ void PropagateLocalRename::start()
             return;
         }
 
+        // The records of the source may still be queued, the journal has to
+        // know them before the file is moved away from under them
+        propagator()->_journal->waitForQueuedWrites();
+
         emit propagator()->touchedFile(existingFile);
         emit propagator()->touchedFile(targetFile);
         QString renameError;
@@ -59,8 +59,6 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcEngine, "nextcloud.sync.engine", QtInfoMsg)
 
-bool SyncEngine::s_anySyncRunning = false;
-
 /** When the client touches a file, block change notifications for this duration (ms)
  *
  * On Linux and Windows the file watcher can't distinguish a change that originates
@@ -114,6 +112,7 @@ SyncEngine::SyncEngine(AccountPtr account, const QString &localPath,
     connect(this, &SyncEngine::finished, [this](bool /* finished */) {
         _journal->keyValueStoreSet("last_sync", QDateTime::currentSecsSinceEpoch());
     });
+    connect(_journal, &SyncJournalDb::queuedWriteFailed, this, &SyncEngine::slotQueuedWriteFailed, Qt::QueuedConnection);
 }
 
 SyncEngine::~SyncEngine()
@@ -433,12 +432,11 @@ void SyncEngine::startSync()
         }
     }
 
-    if (s_anySyncRunning || _syncRunning) {
+    if (_syncRunning) {
         ASSERT(false);
         return;
     }
 
-    s_anySyncRunning = true;
     _syncRunning = true;
     _anotherSyncNeeded = NoFollowUpSync;
     _clearTouchedFilesTimer.stop();
@@ -504,6 +502,9 @@ void SyncEngine::startSync()
         // database creation error!
     }
 
+    _journal->setAsyncWrites(_syncOptions._asyncJournalWrites);
+    _completedItems.clear();
+
     // Functionality like selective sync might have set up etag storage
     // filtering via schedulePathForRemoteDiscovery(). This *is* the next sync, so
     // undo the filter to allow this sync to retrieve and store the correct etags.
@@ -545,6 +546,18 @@ void SyncEngine::startSync()
     _discoveryPhase->_account = _account;
     _discoveryPhase->_excludes = _excludedFiles.data();
     _discoveryPhase->_statedb = _journal;
+    if (_syncOptions._useJournalSnapshot) {
+        QElapsedTimer snapshotTimer;
+        snapshotTimer.start();
+        _discoveryPhase->_journalSnapshot.reset(new SyncJournalSnapshot);
+        if (!_discoveryPhase->_journalSnapshot->load(_journal)) {
+            qCWarning(lcEngine) << "Unable to read the journal snapshot, aborting.";
+            syncError(tr("Unable to read from the sync journal."));
+            finalize(false);
+            return;
+        }
+        qCInfo(lcEngine) << "Read" << _discoveryPhase->_journalSnapshot->size() << "journal records in" << snapshotTimer.elapsed() << "ms";
+    }
     _discoveryPhase->_localDir = _localPath;
     if (!_discoveryPhase->_localDir.endsWith('/'))
         _discoveryPhase->_localDir+='/';
@@ -637,6 +650,9 @@ void SyncEngine::slotDiscoveryFinished()
 
     qCInfo(lcEngine) << "#### Discovery end #################################################### " << _stopWatch.addLapTime(QLatin1String("Discovery Finished")) << "ms";
 
+    // The propagation reads and writes the journal directly
+    _discoveryPhase->_journalSnapshot.reset();
+
     // Sanity check
     if (!_journal->open()) {
         qCWarning(lcEngine) << "Bailing out, DB failure";
@@ -777,8 +793,9 @@ void SyncEngine::setNetworkLimits(int upload, int download)
     if (!_propagator)
         return;
 
-    _propagator->_uploadLimit = upload;
-    _propagator->_downloadLimit = download;
+    // The limits are process-wide: all folders apply the same configuration
+    _propagator->_bandwidthManager->setUploadLimit(upload);
+    _propagator->_bandwidthManager->setDownloadLimit(download);
 
     if (upload != 0 || download != 0) {
         qCInfo(lcEngine) << "Network Limits (down/up) " << upload << download;
@@ -787,12 +804,27 @@ void SyncEngine::setNetworkLimits(int upload, int download)
 
 void SyncEngine::slotItemCompleted(const SyncFileItemPtr &item)
 {
+    if (_syncOptions._asyncJournalWrites)
+        _completedItems.insert(item->destination(), item);
+
     _progressInfo->setProgressComplete(*item);
 
     emit transmissionProgress(*_progressInfo);
     emit itemCompleted(item);
 }
 
+void SyncEngine::slotQueuedWriteFailed(const QString &path, const QString &error)
+{
+    // The item was reported as done before its metadata got written
+    const auto item = _completedItems.value(path);
+    if (!item || item->hasErrorStatus())
+        return;
+
+    item->_status = SyncFileItem::NormalError;
+    item->_errorString = tr("Error writing metadata to the database: %1").arg(error);
+    emit itemCompleted(item);
+}
+
 void SyncEngine::slotPropagationFinished(bool success)
 {
     if (_propagator->_anotherSyncNeeded && _anotherSyncNeeded == NoFollowUpSync) {
@@ -853,7 +885,12 @@ void SyncEngine::slotPropagationFinished(bool success)
     conflictRecordMaintenance();
 
     _journal->deleteStaleFlagsEntries();
-    _journal->commit("All Finished.", false);
+    const auto commitResult = _journal->commit("All Finished.", false);
+    if (!commitResult) {
+        // A write that was queued during the sync failed
+        syncError(tr("Error writing metadata to the database: %1").arg(commitResult.error()));
+        success = false;
+    }
 
     // Send final progress information even if no
     // files needed propagation, but clear the lastCompletedItem
@@ -879,7 +916,6 @@ void SyncEngine::finalize(bool success)
     if (_discoveryPhase) {
         _discoveryPhase.take()->deleteLater();
     }
-    s_anySyncRunning = false;
     _syncRunning = false;
     emit finished(success);
 
@@ -22,6 +22,7 @@
 #include <QString>
 #include <QSet>
 #include <QMap>
+#include <QHash>
 #include <QStringList>
 #include <QSharedPointer>
 #include <set>
@@ -188,6 +189,9 @@ private slots:
     void slotNewItem(const SyncFileItemPtr &item);
 
     void slotItemCompleted(const SyncFileItemPtr &item);
+
+    /** A queued journal write failed, see SyncJournalDb::setAsyncWrites() */
+    void slotQueuedWriteFailed(const QString &path, const QString &error);
     void slotDiscoveryFinished();
     void slotPropagationFinished(bool success);
     void slotProgress(const SyncFileItem &item, qint64 curent);
@@ -224,8 +228,6 @@ private:
     // cleanup and emit the finished signal
     void finalize(bool success);
 
-    static bool s_anySyncRunning; //true when one sync is running somewhere (for debugging)
-
     // Must only be acessed during update and reconcile
     QVector<SyncFileItemPtr> _syncItems;
 
@@ -242,6 +244,12 @@ private:
     // List of all files with conflicts
     QSet<QString> _seenConflictFiles;
 
+    /** The completed items of the sync by destination, while their journal writes may be queued.
+     *
+     * Kept until the next sync starts, failures of the last writes arrive after the sync finished.
+     */
+    QHash<QString, SyncFileItemPtr> _completedItems;
+
     QScopedPointer<ProgressInfo> _progressInfo;
 
     QScopedPointer<ExcludedFiles> _excludedFiles;
@@ -20,6 +20,7 @@
 #include "common/asserts.h"
 #include "csync_exclude.h"
 
+#include <QDir>
 #include <QLoggingCategory>
 
 namespace OCC {
@@ -120,17 +121,112 @@ SyncFileStatusTracker::SyncFileStatusTracker(SyncEngine *syncEngine)
     connect(syncEngine, &SyncEngine::finished, this, &SyncFileStatusTracker::slotSyncFinished);
     connect(syncEngine, &SyncEngine::started, this, &SyncFileStatusTracker::slotSyncEngineRunningChanged);
     connect(syncEngine, &SyncEngine::finished, this, &SyncFileStatusTracker::slotSyncEngineRunningChanged);
+    // The exclude list might have been reloaded
+    connect(syncEngine, &SyncEngine::started, this, &SyncFileStatusTracker::slotClearStatusCache);
 }
 
 SyncFileStatus SyncFileStatusTracker::fileStatus(const QString &relativePath)
 {
     ASSERT(!relativePath.endsWith(QLatin1Char('/')));
 
+    if (relativePath.isEmpty())
+        return uncachedFileStatus(relativePath);
+
+    // The shell asks for the entries of a directory one by one, so the statuses
+    // of all of them are computed with a single journal query on the first request.
+    const int lastSlashIndex = relativePath.lastIndexOf('/');
+    auto &directory = cachedDirectory(lastSlashIndex == -1 ? QString() : relativePath.left(lastSlashIndex));
+    const QString name = relativePath.mid(lastSlashIndex + 1);
+    auto it = directory.constFind(name);
+    if (it != directory.constEnd())
+        return *it;
+
+    const SyncFileStatus status = computeFileStatus(relativePath, nullptr);
+    directory.insert(name, status);
+    return status;
+}
+
+QHash<QString, SyncFileStatus> SyncFileStatusTracker::directoryStatuses(const QString &relativeDirectory)
+{
+    ASSERT(!relativeDirectory.endsWith(QLatin1Char('/')));
+
+    // Read the directory again, the cache might have lost some entries
+    removeCachedDirectory(relativeDirectory);
+    auto &directory = cachedDirectory(relativeDirectory);
+
+    // New files are not in the journal yet
+    const QString prefix = relativeDirectory.isEmpty() ? QString() : relativeDirectory + QLatin1Char('/');
+    auto addEntry = [&](const QString &path) {
+        if (path.size() > prefix.size() && path.startsWith(prefix) && path.indexOf(QLatin1Char('/'), prefix.size()) == -1
+            && !directory.contains(path.mid(prefix.size()))) {
+            directory.insert(path.mid(prefix.size()), computeFileStatus(path, nullptr));
+        }
+    };
+    for (const auto &dirtyPath : qAsConst(_dirtyPaths))
+        addEntry(dirtyPath);
+    for (auto it = _syncCount.cbegin(); it != _syncCount.cend(); ++it)
+        addEntry(it.key());
+    for (auto it = _syncProblems.lower_bound(prefix); it != _syncProblems.cend() && pathStartsWith(it->first, prefix); ++it)
+        addEntry(it->first);
+
+    // Excluded entries and errors of new files are not in the journal either
+    const auto entries = QDir(_syncEngine->localPath() + prefix).entryList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System);
+    for (const auto &name : entries)
+        addEntry(prefix + name);
+
+    return directory;
+}
+
+QHash<QString, SyncFileStatus> &SyncFileStatusTracker::cachedDirectory(const QString &relativeDirectory)
+{
+    auto it = _statusCache.find(relativeDirectory);
+    if (it != _statusCache.end()) {
+        _cachedDirectoryUse.splice(_cachedDirectoryUse.begin(), _cachedDirectoryUse, it->usePosition);
+        return it->statuses;
+    }
+
+    if (_statusCache.size() >= maxCachedDirectories)
+        removeCachedDirectory(_cachedDirectoryUse.back());
+    _cachedDirectoryUse.push_front(relativeDirectory);
+    it = _statusCache.insert(relativeDirectory, { {}, _cachedDirectoryUse.begin() });
+    auto &directory = it->statuses;
+    const bool ok = _syncEngine->journal()->listFilesInPath(relativeDirectory.toUtf8(), [&](const SyncJournalFileRecord &rec) {
+        const QString path = rec.path();
+        directory.insert(path.mid(path.lastIndexOf('/') + 1), computeFileStatus(path, &rec));
+    });
+    if (!ok) {
+        // Entries that are missing will be looked up one by one
+        qCWarning(lcStatusTracker) << "Could not read the journal entries of" << relativeDirectory;
+    }
+    return directory;
+}
+
+void SyncFileStatusTracker::removeCachedDirectory(const QString &relativeDirectory)
+{
+    auto it = _statusCache.find(relativeDirectory);
+    if (it == _statusCache.end())
+        return;
+    _cachedDirectoryUse.erase(it->usePosition);
+    _statusCache.erase(it);
+}
+
+SyncFileStatus SyncFileStatusTracker::uncachedFileStatus(const QString &relativePath)
+{
     if (relativePath.isEmpty()) {
         // This is the root sync folder, it doesn't have an entry in the database and won't be walked by csync, so resolve manually.
         return resolveSyncAndErrorStatus(QString(), NotShared);
     }
+    return computeFileStatus(relativePath, nullptr);
+}
+
+void SyncFileStatusTracker::slotClearStatusCache()
+{
+    _statusCache.clear();
+    _cachedDirectoryUse.clear();
+}
 
+SyncFileStatus SyncFileStatusTracker::computeFileStatus(const QString &relativePath, const SyncJournalFileRecord *record)
+{
     // The SyncEngine won't notify us at all for CSYNC_FILE_SILENTLY_EXCLUDED
     // and CSYNC_FILE_EXCLUDE_AND_REMOVE excludes. Even though it's possible
     // that the status of CSYNC_FILE_EXCLUDE_LIST excludes will change if the user
@@ -150,8 +246,10 @@ SyncFileStatus SyncFileStatusTracker::fileStatus(const QString &relativePath)
 
     // First look it up in the database to know if it's shared
     SyncJournalFileRecord rec;
-    if (_syncEngine->journal()->getFileRecord(relativePath, &rec) && rec.isValid()) {
-        return resolveSyncAndErrorStatus(relativePath, rec._remotePerm.hasPermission(RemotePermissions::IsShared) ? Shared : NotShared);
+    if (!record && _syncEngine->journal()->getFileRecord(relativePath, &rec) && rec.isValid())
+        record = &rec;
+    if (record) {
+        return resolveSyncAndErrorStatus(relativePath, record->_remotePerm.hasPermission(RemotePermissions::IsShared) ? Shared : NotShared);
     }
 
     // Must be a new file not yet in the database, check if it's syncing or has an error.
@@ -166,13 +264,13 @@ void SyncFileStatusTracker::slotPathTouched(const QString &fileName)
     QString localPath = fileName.mid(folderPath.size());
     _dirtyPaths.insert(localPath);
 
-    emit fileStatusChanged(fileName, SyncFileStatus::StatusSync);
+    emitFileStatusChanged(localPath, SyncFileStatus::StatusSync);
 }
 
 void SyncFileStatusTracker::slotAddSilentlyExcluded(const QString &folderPath)
 {
     _syncProblems[folderPath] = SyncFileStatus::StatusExcluded;
-    emit fileStatusChanged(getSystemDestination(folderPath), resolveSyncAndErrorStatus(folderPath, NotShared));
+    emitFileStatusChanged(folderPath, resolveSyncAndErrorStatus(folderPath, NotShared));
 }
 
 void SyncFileStatusTracker::incSyncCountAndEmitStatusChanged(const QString &relativePath, SharedFlag sharedFlag)
@@ -181,9 +279,9 @@ void SyncFileStatusTracker::incSyncCountAndEmitStatusChanged(const QString &rela
     int count = _syncCount[relativePath]++;
     if (!count) {
         SyncFileStatus status = sharedFlag == UnknownShared
-            ? fileStatus(relativePath)
+            ? uncachedFileStatus(relativePath)
             : resolveSyncAndErrorStatus(relativePath, sharedFlag);
-        emit fileStatusChanged(getSystemDestination(relativePath), status);
+        emitFileStatusChanged(relativePath, status);
 
         // We passed from OK to SYNC, increment the parent to keep it marked as
         // SYNC while we propagate ourselves and our own children.
@@ -204,9 +302,9 @@ void SyncFileStatusTracker::decSyncCountAndEmitStatusChanged(const QString &rela
         _syncCount.remove(relativePath);
 
         SyncFileStatus status = sharedFlag == UnknownShared
-            ? fileStatus(relativePath)
+            ? uncachedFileStatus(relativePath)
             : resolveSyncAndErrorStatus(relativePath, sharedFlag);
-        emit fileStatusChanged(getSystemDestination(relativePath), status);
+        emitFileStatusChanged(relativePath, status);
 
         // We passed from SYNC to OK, decrement our parent.
         ASSERT(!relativePath.endsWith('/'));
@@ -244,17 +342,17 @@ void SyncFileStatusTracker::slotAboutToPropagate(SyncFileItemVector &items)
             // Mark this path as syncing for instructions that will result in propagation.
             incSyncCountAndEmitStatusChanged(item->destination(), sharedFlag);
         } else {
-            emit fileStatusChanged(getSystemDestination(item->destination()), resolveSyncAndErrorStatus(item->destination(), sharedFlag));
+            emitFileStatusChanged(item->destination(), resolveSyncAndErrorStatus(item->destination(), sharedFlag));
         }
     }
 
     // Some metadata status won't trigger files to be synced, make sure that we
     // push the OK status for dirty files that don't need to be propagated.
-    // Swap into a copy since fileStatus() reads _dirtyPaths to determine the status
+    // Swap into a copy since uncachedFileStatus() reads _dirtyPaths to determine the status
     QSet<QString> oldDirtyPaths;
     std::swap(_dirtyPaths, oldDirtyPaths);
     for (const auto &oldDirtyPath : qAsConst(oldDirtyPaths))
-        emit fileStatusChanged(getSystemDestination(oldDirtyPath), fileStatus(oldDirtyPath));
+        emitFileStatusChanged(oldDirtyPath, uncachedFileStatus(oldDirtyPath));
 
     // Make sure to push any status that might have been resolved indirectly since the last sync
     // (like an error file being deleted from disk)
@@ -265,7 +363,7 @@ void SyncFileStatusTracker::slotAboutToPropagate(SyncFileItemVector &items)
         SyncFileStatus::SyncFileStatusTag severity = oldProblem.second;
         if (severity == SyncFileStatus::StatusError)
             invalidateParentPaths(path);
-        emit fileStatusChanged(getSystemDestination(path), fileStatus(path));
+        emitFileStatusChanged(path, uncachedFileStatus(path));
     }
 }
 
@@ -290,7 +388,7 @@ void SyncFileStatusTracker::slotItemCompleted(const SyncFileItemPtr &item)
         // decSyncCount calls *must* be symetric with incSyncCount calls in slotAboutToPropagate
         decSyncCountAndEmitStatusChanged(item->destination(), sharedFlag);
     } else {
-        emit fileStatusChanged(getSystemDestination(item->destination()), resolveSyncAndErrorStatus(item->destination(), sharedFlag));
+        emitFileStatusChanged(item->destination(), resolveSyncAndErrorStatus(item->destination(), sharedFlag));
     }
 }
 
@@ -305,13 +403,13 @@ void SyncFileStatusTracker::slotSyncFinished()
             continue;
         }
 
-        emit fileStatusChanged(getSystemDestination(it.key()), fileStatus(it.key()));
+        emitFileStatusChanged(it.key(), uncachedFileStatus(it.key()));
     }
 }
 
 void SyncFileStatusTracker::slotSyncEngineRunningChanged()
 {
-    emit fileStatusChanged(getSystemDestination(QString()), resolveSyncAndErrorStatus(QString(), NotShared));
+    emitFileStatusChanged(QString(), resolveSyncAndErrorStatus(QString(), NotShared));
 }
 
 SyncFileStatus SyncFileStatusTracker::resolveSyncAndErrorStatus(const QString &relativePath, SharedFlag sharedFlag, PathKnownFlag isPathKnown)
@@ -337,12 +435,23 @@ SyncFileStatus SyncFileStatusTracker::resolveSyncAndErrorStatus(const QString &r
     return status;
 }
 
+void SyncFileStatusTracker::emitFileStatusChanged(const QString &relativePath, SyncFileStatus status)
+{
+    // The cached status might be out of date, it is computed again when asked for
+    const int lastSlashIndex = relativePath.lastIndexOf('/');
+    auto it = _statusCache.find(lastSlashIndex == -1 ? QString() : relativePath.left(lastSlashIndex));
+    if (it != _statusCache.end())
+        it->statuses.remove(relativePath.mid(lastSlashIndex + 1));
+
+    emit fileStatusChanged(getSystemDestination(relativePath), status);
+}
+
 void SyncFileStatusTracker::invalidateParentPaths(const QString &path)
 {
     QStringList splitPath = path.split('/', QString::SkipEmptyParts);
     for (int i = 0; i < splitPath.size(); ++i) {
         QString parentPath = QStringList(splitPath.mid(0, i)).join(QLatin1String("/"));
-        emit fileStatusChanged(getSystemDestination(parentPath), fileStatus(parentPath));
+        emitFileStatusChanged(parentPath, uncachedFileStatus(parentPath));
     }
 }
 
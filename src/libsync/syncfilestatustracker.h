@@ -19,12 +19,15 @@
 // #include "ownsql.h"
 #include "syncfileitem.h"
 #include "common/syncfilestatus.h"
+#include <list>
 #include <map>
+#include <QHash>
 #include <QSet>
 
 namespace OCC {
 
 class SyncEngine;
+class SyncJournalFileRecord;
 
 /**
  * @brief Takes care of tracking the status of individual files as they
@@ -37,6 +40,13 @@ class OWNCLOUDSYNC_EXPORT SyncFileStatusTracker : public QObject
 public:
     explicit SyncFileStatusTracker(SyncEngine *syncEngine);
     SyncFileStatus fileStatus(const QString &relativePath);
+    /**
+     * The statuses of the entries of a directory by name, read with a single journal query.
+     *
+     * Covers the entries that are in the journal, the new ones that are being synced
+     * or had problems and the other entries on disk, like excluded ones.
+     */
+    QHash<QString, SyncFileStatus> directoryStatuses(const QString &relativeDirectory);
 
 public slots:
     void slotPathTouched(const QString &fileName);
@@ -51,6 +61,7 @@ private slots:
     void slotItemCompleted(const SyncFileItemPtr &item);
     void slotSyncFinished();
     void slotSyncEngineRunningChanged();
+    void slotClearStatusCache();
 
 private:
     struct PathComparator {
@@ -65,6 +76,13 @@ private:
     enum PathKnownFlag { PathUnknown = 0,
         PathKnown };
     SyncFileStatus resolveSyncAndErrorStatus(const QString &relativePath, SharedFlag sharedState, PathKnownFlag isPathKnown = PathKnown);
+    // Looks up the journal record unless \a record is given
+    SyncFileStatus computeFileStatus(const QString &relativePath, const SyncJournalFileRecord *record);
+    // Like fileStatus() without the cache, for the statuses that are about to be emitted
+    SyncFileStatus uncachedFileStatus(const QString &relativePath);
+    QHash<QString, SyncFileStatus> &cachedDirectory(const QString &relativeDirectory);
+    void removeCachedDirectory(const QString &relativeDirectory);
+    void emitFileStatusChanged(const QString &relativePath, SyncFileStatus status);
 
     void invalidateParentPaths(const QString &path);
     QString getSystemDestination(const QString &relativePath);
@@ -79,6 +97,18 @@ private:
     // We'll show a file/directory as SYNC as long as its sync count is > 0.
     // A directory that starts/ends propagation will in turn increase/decrease its own parent by 1.
     QHash<QString, int> _syncCount;
+
+    struct CachedDirectory {
+        QHash<QString, SyncFileStatus> statuses;
+        std::list<QString>::iterator usePosition; // in _cachedDirectoryUse
+    };
+
+    // The statuses fileStatus() computed, by directory and then by name.
+    // An entry is dropped whenever fileStatusChanged is emitted for it.
+    QHash<QString, CachedDirectory> _statusCache;
+    // The directories of _statusCache, the most recently used first
+    std::list<QString> _cachedDirectoryUse;
+    static constexpr int maxCachedDirectories = 100;
 };
 }
 
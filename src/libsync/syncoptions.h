@@ -19,6 +19,7 @@
 #include <QSharedPointer>
 #include <chrono>
 #include "common/vfs.h"
+#include "concurrencycontroller.h"
 
 namespace OCC {
 
@@ -29,6 +30,7 @@ struct OWNCLOUDSYNC_EXPORT SyncOptions
 {
     SyncOptions()
         : _vfs(new VfsOff)
+        , _transferConcurrency(new ConcurrencyController)
     {}
 
     /** Maximum size (in Bytes) a folder can have without asking for confirmation.
@@ -67,6 +69,56 @@ struct OWNCLOUDSYNC_EXPORT SyncOptions
 
     /** The maximum number of active jobs in parallel  */
     int _parallelNetworkJobs = 6;
+
+    /** The maximum number of local directories listed in parallel during discovery.
+     *
+     * Independent of _parallelNetworkJobs. 0 means one per CPU core.
+     */
+    int _parallelLocalScans = 0;
+
+    /** Read all file records of the journal into memory before discovery.
+     *
+     * Discovery then looks records up in the SyncJournalSnapshot instead of
+     * querying the database for each directory. Costs memory in proportion to
+     * the number of synced files.
+     */
+    bool _useJournalSnapshot = false;
+
+    /** Let a writer thread execute the journal updates of the sync, see
+     * SyncJournalDb::setAsyncWrites().
+     */
+    bool _asyncJournalWrites = false;
+
+    /** The maximum number of chunks of a single file that may be uploaded in
+     * parallel with chunking-NG.
+     *
+     * Each chunk still counts as an active transfer job, so the propagator's
+     * maximumActiveTransferJob() limit applies on top of this value.
+     * Set to 1 to upload the chunks of a file one after another.
+     */
+    int _parallelChunkUploads = 1;
+
+    /** The minimum size of files for which block manifests are published and
+     * modified versions are downloaded as a delta, see BlockManifest.
+     *
+     * Only used if the server supports delta sync.
+     */
+    qint64 _deltaSyncMinFileSize = 10 * 1000 * 1000; // 10MB
+
+    /** The bounds for the number of transfers (uploads or downloads) that run in parallel.
+     *
+     * Within these bounds the window is adapted to the measured throughput and
+     * server latency. A maximum of 0 means up to _parallelNetworkJobs.
+     */
+    int _minParallelTransfers = 1;
+    int _maxParallelTransfers = 0;
+
+    /** Adapts the number of parallel transfers, see _minParallelTransfers.
+     *
+     * Shared between copies of the options, its window() is the number of
+     * transfers currently allowed to run in parallel. May not be null.
+     */
+    QSharedPointer<ConcurrencyController> _transferConcurrency;
 };
 
 
@@ -0,0 +1,105 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QVector>
+
+#include "csync_exclude.h"
+
+#define EXCLUDE_LIST_FILE SOURCEDIR "/../../sync-exclude.lst"
+
+// Runs traversalPatternMatch() with the default sync-exclude.lst over a corpus of
+// generated paths, with one and with two base paths that have exclude patterns.
+// Only files are matched: for directories the matcher also looks for an in-tree
+// exclude file on disk, which would dominate the measurement.
+
+static const int pathCount = 1000000;
+
+static QVector<QString> generatePaths()
+{
+    static const char *const directories[] = { "Documents", "Photos/2020", "Photos/2021/Holiday", "src/project/lib",
+        "Music/Artist/Album", ".config/app", "Downloads", "work/reports/q3" };
+    static const char *const names[] = { "report", "IMG_", "notes", "track", "main", "~$budget", ".~lock.letter", "data" };
+    static const char *const suffixes[] = { ".pdf", ".jpg", ".txt", ".mp3", ".cpp", ".docx#", ".part", "~", ".swp", ".odt",
+        ".crdownload", ".kate-swp", "" };
+
+    // A small linear congruential generator keeps the corpus the same on every run
+    quint32 seed = 42;
+    auto next = [&seed](int bound) {
+        seed = seed * 1664525u + 1013904223u;
+        return int((seed >> 8) % quint32(bound));
+    };
+
+    QVector<QString> paths;
+    paths.reserve(pathCount);
+    for (int i = 0; i < pathCount; ++i) {
+        QString path = QLatin1String(directories[next(int(sizeof(directories) / sizeof(*directories)))]);
+        path += QLatin1Char('/') + QLatin1String(names[next(int(sizeof(names) / sizeof(*names)))]);
+        path += QString::number(next(100000));
+        path += QLatin1String(suffixes[next(int(sizeof(suffixes) / sizeof(*suffixes)))]);
+        switch (next(50)) {
+        case 0:
+            path = QStringLiteral("Photos/2021/.DS_Store");
+            break;
+        case 1:
+            path = QStringLiteral("Photos/Thumbs.db");
+            break;
+        default:
+            break;
+        }
+        paths.append(path);
+    }
+    return paths;
+}
+
+static qint64 matchPaths(ExcludedFiles &excludedFiles, const QVector<QString> &paths, int *excludedCount)
+{
+    // Compile the patterns outside of the measurement
+    excludedFiles.traversalPatternMatch(QStringLiteral("warmup"), ItemTypeFile);
+
+    *excludedCount = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (const auto &path : paths) {
+        if (excludedFiles.traversalPatternMatch(path, ItemTypeFile) != CSYNC_NOT_EXCLUDED)
+            ++*excludedCount;
+    }
+    return timer.elapsed();
+}
+
+static qint64 pathsPerSecond(int paths, qint64 elapsedMs)
+{
+    return elapsedMs > 0 ? paths * qint64(1000) / elapsedMs : paths;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    const auto paths = generatePaths();
+
+    ExcludedFiles excludedFiles;
+    excludedFiles.addExcludeFilePath(EXCLUDE_LIST_FILE);
+    if (!excludedFiles.reloadExcludeFiles())
+        return -1;
+    int excludedOneBase = 0;
+    const auto elapsedOneBase = matchPaths(excludedFiles, paths, &excludedOneBase);
+
+    // Like an in-tree .sync-exclude.lst in Photos/
+    excludedFiles.addManualExclude(QStringLiteral("*.jpg~"), QStringLiteral("/Photos/"));
+    excludedFiles.addManualExclude(QStringLiteral("]IMG_?.tmp"), QStringLiteral("/Photos/"));
+    int excludedTwoBases = 0;
+    const auto elapsedTwoBases = matchPaths(excludedFiles, paths, &excludedTwoBases);
+
+    qDebug() << "PATHS" << paths.size();
+    qDebug() << "ONE BASE PATH EXCLUDED" << excludedOneBase;
+    qDebug() << "ONE BASE PATH PATHS PER SECOND" << pathsPerSecond(paths.size(), elapsedOneBase);
+    qDebug() << "TWO BASE PATHS EXCLUDED" << excludedTwoBases;
+    qDebug() << "TWO BASE PATHS PATHS PER SECOND" << pathsPerSecond(paths.size(), elapsedTwoBases);
+    return 0;
+}
@@ -0,0 +1,45 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+#include <owncloudpropagator.h>
+
+using namespace OCC;
+
+// Measures how fast the propagator dispatches many tiny jobs, where the
+// scheduling overhead dominates over the actual transfers.
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    FakeFolder fakeFolder{FileInfo{}};
+
+    const int numDirs = 20;
+    const int filesPerDir = 250;
+    for (int dirNum = 1; dirNum <= numDirs; ++dirNum) {
+        const QString dir = QStringLiteral("dir") + QString::number(dirNum);
+        fakeFolder.remoteModifier().mkdir(dir);
+        for (int fileNum = 1; fileNum <= filesPerDir; ++fileNum)
+            fakeFolder.remoteModifier().insert(dir + QStringLiteral("/file") + QString::number(fileNum), 1);
+    }
+
+    int completed = 0;
+    QElapsedTimer timer;
+    QObject::connect(&fakeFolder.syncEngine(), &SyncEngine::aboutToPropagate, [&] { timer.start(); });
+    QObject::connect(&fakeFolder.syncEngine(), &SyncEngine::itemCompleted, [&] { ++completed; });
+
+    bool result = fakeFolder.syncOnce();
+    const qint64 elapsed = timer.elapsed();
+    auto propagator = fakeFolder.syncEngine().getPropagator();
+
+    qDebug() << "JOBS COMPLETED" << completed;
+    qDebug() << "JOBS STARTED" << propagator->startedJobsCount();
+    qDebug() << "SCHEDULING ROUNDS" << propagator->schedulingRounds();
+    qDebug() << "PROPAGATION MS" << elapsed;
+    qDebug() << "JOBS PER SECOND" << (elapsed > 0 ? completed * 1000 / elapsed : completed);
+    return result ? 0 : -1;
+}
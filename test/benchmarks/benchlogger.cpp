@@ -0,0 +1,70 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include "logger.h"
+
+#include <memory>
+#include <vector>
+
+using namespace OCC;
+
+// Logs from several threads at once, like the sync engine's threads with --logdebug,
+// and measures how long the logging threads are held up.
+
+static const int threadCount = 4;
+static const int messagesPerThread = 250000;
+
+static qint64 messagesPerSecond(qint64 messages, qint64 elapsedMs)
+{
+    return elapsedMs > 0 ? messages * 1000 / elapsedMs : messages;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QTemporaryDir dir;
+    const auto logFile = dir.filePath(QStringLiteral("bench.log"));
+    auto logger = Logger::instance();
+    logger->setLogFile(logFile);
+    if (!logger->isLoggingToFile())
+        return -1;
+
+    const QString message = QStringLiteral("2021-01-01 12:00:00:000 [ debug nextcloud.sync.propagator ]\t[ OCC::PropagateDownloadFile::start ]:\tStarting download of \"Photos/2021/IMG_%1.jpg\"");
+
+    QElapsedTimer timer;
+    timer.start();
+    std::vector<std::unique_ptr<QThread>> threads;
+    for (int i = 0; i < threadCount; ++i) {
+        threads.emplace_back(QThread::create([&message, logger, i] {
+            for (int j = 0; j < messagesPerThread; ++j)
+                logger->doLog(message.arg(i * messagesPerThread + j));
+        }));
+        threads.back()->start();
+    }
+    for (const auto &thread : threads)
+        thread->wait();
+    const auto elapsedLogging = timer.elapsed();
+
+    logger->close();
+    const auto elapsedWritten = timer.elapsed();
+
+    const qint64 messages = qint64(threadCount) * messagesPerThread;
+    qDebug() << "MESSAGES" << messages;
+    qDebug() << "DROPPED MESSAGES" << logger->droppedMessageCount();
+    qDebug() << "LOGGED MESSAGES PER SECOND" << messagesPerSecond(messages, elapsedLogging);
+    qDebug() << "WRITTEN MESSAGES PER SECOND" << messagesPerSecond(messages - logger->droppedMessageCount(), elapsedWritten);
+    qDebug() << "LOG FILE SIZE" << QFileInfo(logFile).size();
+    return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+
+#include "common/ownsql.h"
+
+using namespace OCC;
+
+// Compares the QVariant based bindValue()/baValue() with the typed
+// bindAll()/baView() on a table shaped like the journal's metadata table.
+
+static const int rowCount = 200000;
+
+static constexpr SqlStatement<qint64, QByteArray, qint64, QByteArray, QByteArray> insertStatement{
+    "INSERT INTO files (phash, path, modtime, etag, perm) VALUES (?1, ?2, ?3, ?4, ?5);"};
+
+static qint64 rowsPerSecond(int rows, qint64 elapsedMs)
+{
+    return elapsedMs > 0 ? rows * qint64(1000) / elapsedMs : rows;
+}
+
+static bool prepareTable(SqlDatabase &db)
+{
+    SqlQuery drop("DROP TABLE IF EXISTS files;", db);
+    SqlQuery create("CREATE TABLE files (phash INTEGER PRIMARY KEY, path TEXT, modtime INTEGER, etag TEXT, perm TEXT);", db);
+    return drop.exec() && create.exec();
+}
+
+template <typename Bind>
+static qint64 insertRows(SqlDatabase &db, Bind bind)
+{
+    if (!prepareTable(db))
+        return -1;
+    QElapsedTimer timer;
+    timer.start();
+    db.transaction();
+    SqlQuery query;
+    for (int i = 0; i < rowCount; ++i) {
+        if (!query.initOrReset(insertStatement, db))
+            return -1;
+        const QByteArray path = "some/directory/file" + QByteArray::number(i);
+        bind(query, i, path);
+        if (!query.exec())
+            return -1;
+    }
+    db.commit();
+    return timer.elapsed();
+}
+
+template <typename Read>
+static qint64 selectRows(SqlDatabase &db, Read read)
+{
+    QElapsedTimer timer;
+    timer.start();
+    SqlQuery query("SELECT path, modtime, etag, perm FROM files;", db);
+    if (!query.exec())
+        return -1;
+    qint64 checksum = 0;
+    forever {
+        const auto next = query.next();
+        if (!next.ok)
+            return -1;
+        if (!next.hasData)
+            break;
+        checksum += read(query);
+    }
+    if (checksum == 0)
+        qDebug() << "no data read";
+    return timer.elapsed();
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QTemporaryDir dir;
+    SqlDatabase db;
+    if (!db.openOrCreateReadWrite(dir.path() + "/bench.db"))
+        return -1;
+
+    const auto insertVariant = insertRows(db, [](SqlQuery &query, int i, const QByteArray &path) {
+        query.bindValue(1, qint64(i));
+        query.bindValue(2, path);
+        query.bindValue(3, qint64(1600000000 + i));
+        query.bindValue(4, QByteArray("5f2a3b4c5d6e7"));
+        query.bindValue(5, QByteArray("WDNVCKR"));
+    });
+    const auto insertTyped = insertRows(db, [](SqlQuery &query, int i, const QByteArray &path) {
+        query.bindAll(insertStatement, i, path, 1600000000 + i, QByteArray("5f2a3b4c5d6e7"), QByteArray("WDNVCKR"));
+    });
+
+    // Reads the columns like fillFileRecordFromGetQuery(): kept values are copied, the permissions are only parsed
+    const auto selectCopy = selectRows(db, [](SqlQuery &query) {
+        const auto path = query.baValue(0);
+        const auto etag = query.baValue(2);
+        const auto perm = query.baValue(3);
+        return path.size() + etag.size() + perm.count('W') + qint64(query.int64Value(1));
+    });
+    const auto selectView = selectRows(db, [](SqlQuery &query) {
+        const auto path = query.baValue(0);
+        const auto etag = query.baValue(2);
+        return path.size() + etag.size() + query.baView(3).count('W') + qint64(query.int64Value(1));
+    });
+
+    if (insertVariant < 0 || insertTyped < 0 || selectCopy < 0 || selectView < 0)
+        return -1;
+
+    qDebug() << "ROWS" << rowCount;
+    qDebug() << "INSERT bindValue ROWS PER SECOND" << rowsPerSecond(rowCount, insertVariant);
+    qDebug() << "INSERT bindAll ROWS PER SECOND" << rowsPerSecond(rowCount, insertTyped);
+    qDebug() << "SELECT baValue ROWS PER SECOND" << rowsPerSecond(rowCount, selectCopy);
+    qDebug() << "SELECT baView ROWS PER SECOND" << rowsPerSecond(rowCount, selectView);
+    return 0;
+}
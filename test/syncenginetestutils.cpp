@@ -9,7 +9,10 @@
 #include "httplogger.h"
 #include "accessmanager.h"
 
-
+#include <QCryptographicHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <memory>
 
 
@@ -318,9 +321,17 @@ FakePropfindReply::FakePropfindReply(FileInfo &remoteRootFileInfo, QNetworkAcces
         xml.writeEndElement(); // response
     };
 
+    const bool depthInfinity = request.rawHeader("Depth") == "infinity";
+    std::function<void(const FileInfo &)> writeChildren = [&](const FileInfo &dirInfo) {
+        foreach (const FileInfo &childFileInfo, dirInfo.children) {
+            writeFileResponse(childFileInfo);
+            if (depthInfinity)
+                writeChildren(childFileInfo);
+        }
+    };
+
     writeFileResponse(*fileInfo);
-    foreach (const FileInfo &childFileInfo, fileInfo->children)
-        writeFileResponse(childFileInfo);
+    writeChildren(*fileInfo);
     xml.writeEndElement(); // multistatus
     xml.writeEndDocument();
 
@@ -406,6 +417,152 @@ void FakePutReply::abort()
     emit finished();
 }
 
+FakeBulkUploadReply::FakeBulkUploadReply(FileInfo &remoteRootFileInfo, const QHash<QString, int> &errorPaths,
+    QNetworkAccessManager::Operation op, const QNetworkRequest &request, const QByteArray &body, QObject *parent)
+    : FakeReply { parent }
+{
+    setRequest(request);
+    setUrl(request.url());
+    setOperation(op);
+    open(QIODevice::ReadOnly);
+
+    const QByteArray contentType = request.rawHeader("Content-Type");
+    const QByteArray delimiter = "--" + contentType.mid(contentType.indexOf("boundary=") + 9);
+
+    QJsonObject results;
+    int pos = body.indexOf(delimiter);
+    while (pos >= 0 && body.mid(pos + delimiter.size(), 2) != "--") {
+        const int headersStart = pos + delimiter.size() + 2;
+        const int headersEnd = body.indexOf("\r\n\r\n", headersStart);
+        Q_ASSERT(headersEnd > 0);
+
+        // Turn the part into the PUT it replaces
+        QNetworkRequest partRequest;
+        for (const auto &line : body.mid(headersStart, headersEnd - headersStart).split('\n')) {
+            const int colon = line.indexOf(':');
+            partRequest.setRawHeader(line.left(colon).trimmed(), line.mid(colon + 1).trimmed());
+        }
+        const QByteArray data = body.mid(headersEnd + 4, partRequest.rawHeader("Content-Length").toInt());
+        pos = body.indexOf(delimiter, headersEnd + 4 + data.size());
+
+        const QString remotePath = QString::fromUtf8(partRequest.rawHeader("X-File-Path"));
+        const QString fileName = remotePath.mid(1);
+        QJsonObject result;
+        if (errorPaths.contains(fileName)
+            || QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex() != partRequest.rawHeader("X-File-MD5")) {
+            result[QStringLiteral("error")] = true;
+            result[QStringLiteral("message")] = QStringLiteral("Fake bulk upload error");
+        } else {
+            QUrl url = sRootUrl2;
+            url.setPath(sRootUrl2.path() + fileName);
+            partRequest.setUrl(url);
+            partRequest.setRawHeader("X-OC-Mtime", partRequest.rawHeader("X-File-Mtime"));
+            const FileInfo *fileInfo = FakePutReply::perform(remoteRootFileInfo, partRequest, data);
+            result[QStringLiteral("error")] = false;
+            result[QStringLiteral("etag")] = QString::fromUtf8(fileInfo->etag);
+            result[QStringLiteral("fileid")] = QString::fromUtf8(fileInfo->fileId);
+        }
+        results[remotePath] = result;
+    }
+    payload = QJsonDocument(results).toJson(QJsonDocument::Compact);
+    QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+}
+
+void FakeBulkUploadReply::respond()
+{
+    setHeader(QNetworkRequest::ContentLengthHeader, payload.size());
+    setHeader(QNetworkRequest::ContentTypeHeader, QByteArrayLiteral("application/json; charset=utf-8"));
+    setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+    setFinished(true);
+    emit metaDataChanged();
+    if (bytesAvailable())
+        emit readyRead();
+    emit finished();
+}
+
+void FakeBulkUploadReply::abort()
+{
+    setError(OperationCanceledError, QStringLiteral("abort"));
+    emit finished();
+}
+
+qint64 FakeBulkUploadReply::bytesAvailable() const
+{
+    return payload.size() + QIODevice::bytesAvailable();
+}
+
+qint64 FakeBulkUploadReply::readData(char *data, qint64 maxlen)
+{
+    qint64 len = std::min(qint64 { payload.size() }, maxlen);
+    std::copy(payload.cbegin(), payload.cbegin() + len, data);
+    payload.remove(0, static_cast<int>(len));
+    return len;
+}
+
+FakeBulkDownloadReply::FakeBulkDownloadReply(FileInfo &remoteRootFileInfo, const QHash<QString, int> &errorPaths,
+    QNetworkAccessManager::Operation op, const QNetworkRequest &request, const QByteArray &body, QObject *parent)
+    : FakeReply { parent }
+{
+    setRequest(request);
+    setUrl(request.url());
+    setOperation(op);
+    open(QIODevice::ReadOnly);
+
+    const QByteArray boundary = "fake_boundary";
+    const auto files = QJsonDocument::fromJson(body).object().value(QStringLiteral("files")).toArray();
+    for (const auto &file : files) {
+        const QString remotePath = file.toString();
+        const QString fileName = remotePath.mid(1);
+        const FileInfo *fileInfo = remoteRootFileInfo.find(fileName);
+        if (!fileInfo || errorPaths.contains(fileName))
+            continue;
+        const QByteArray data(fileInfo->size, fileInfo->contentChar);
+        payload += "--" + boundary + "\r\n";
+        payload += "X-File-Path: " + remotePath.toUtf8() + "\r\n";
+        payload += "OC-ETag: \"" + fileInfo->etag + "\"\r\n";
+        payload += "X-File-Mtime: " + QByteArray::number(fileInfo->lastModified.toSecsSinceEpoch()) + "\r\n";
+        payload += "OC-Checksum: SHA1:" + QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex() + "\r\n";
+        payload += "Content-Length: " + QByteArray::number(data.size()) + "\r\n\r\n";
+        payload += data + "\r\n";
+    }
+    payload += "--" + boundary + "--\r\n";
+    setRawHeader("Content-Type", "multipart/related; boundary=" + boundary);
+    QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+}
+
+void FakeBulkDownloadReply::respond()
+{
+    setHeader(QNetworkRequest::ContentLengthHeader, payload.size());
+    setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+    emit metaDataChanged();
+    while (available < payload.size()) {
+        available = qMin(available + 97, payload.size());
+        emit readyRead();
+    }
+    setFinished(true);
+    emit finished();
+}
+
+void FakeBulkDownloadReply::abort()
+{
+    setError(OperationCanceledError, QStringLiteral("abort"));
+    emit finished();
+}
+
+qint64 FakeBulkDownloadReply::bytesAvailable() const
+{
+    return available + QIODevice::bytesAvailable();
+}
+
+qint64 FakeBulkDownloadReply::readData(char *data, qint64 maxlen)
+{
+    qint64 len = std::min(qint64 { available }, maxlen);
+    std::copy(payload.cbegin(), payload.cbegin() + len, data);
+    payload.remove(0, static_cast<int>(len));
+    available -= static_cast<int>(len);
+    return len;
+}
+
 FakeMkcolReply::FakeMkcolReply(FileInfo &remoteRootFileInfo, QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent)
     : FakeReply { parent }
 {
@@ -557,6 +714,7 @@ FakeGetWithDataReply::FakeGetWithDataReply(FileInfo &remoteRootFileInfo, const Q
         if (match.hasMatch()) {
             const int start = match.captured(QStringLiteral("start")).toInt();
             const int end = match.captured(QStringLiteral("end")).toInt();
+            contentRange = "bytes " + QByteArray::number(start) + '-' + QByteArray::number(end) + '/' + QByteArray::number(payload.size());
             payload = payload.mid(start, end - start + 1);
         }
     }
@@ -571,7 +729,12 @@ void FakeGetWithDataReply::respond()
         return;
     }
     setHeader(QNetworkRequest::ContentLengthHeader, payload.size());
-    setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+    if (contentRange.isEmpty()) {
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+    } else {
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 206);
+        setRawHeader("Content-Range", contentRange);
+    }
     setRawHeader("OC-ETag", fileInfo->etag);
     setRawHeader("ETag", fileInfo->etag);
     setRawHeader("OC-FileId", fileInfo->fileId);
@@ -801,6 +964,26 @@ QNetworkReply *FakeQNAM::createRequest(QNetworkAccessManager::Operation op, cons
         if (auto reply = _override(op, request, outgoingData))
             return reply;
     }
+    if (request.url().path() == sBulkUploadUrl.path()) {
+        auto reply = new FakeBulkUploadReply { _remoteRootFileInfo, _errorPaths, op, request, outgoingData->readAll(), this };
+        OCC::HttpLogger::logRequest(reply, op, outgoingData);
+        return reply;
+    }
+    if (request.url().path() == sBulkDownloadUrl.path()) {
+        auto reply = new FakeBulkDownloadReply { _remoteRootFileInfo, _errorPaths, op, request, outgoingData->readAll(), this };
+        OCC::HttpLogger::logRequest(reply, op, outgoingData);
+        return reply;
+    }
+    if (request.url().path().startsWith(sDeltaManifestUrl.path())) {
+        const auto fileId = request.url().path().mid(sDeltaManifestUrl.path().size()).toUtf8();
+        if (op == QNetworkAccessManager::PutOperation) {
+            _deltaManifests[fileId] = outgoingData->readAll();
+            return new FakePayloadReply { op, request, QByteArray(), this };
+        }
+        if (_deltaManifests.contains(fileId))
+            return new FakePayloadReply { op, request, _deltaManifests[fileId], this };
+        return new FakeErrorReply { op, request, this, 404 };
+    }
     const QString fileName = getFilePathFromUrl(request.url());
     Q_ASSERT(!fileName.isNull());
     if (_errorPaths.contains(fileName))
@@ -37,6 +37,9 @@
 static const QUrl sRootUrl("owncloud://somehost/owncloud/remote.php/webdav/");
 static const QUrl sRootUrl2("owncloud://somehost/owncloud/remote.php/dav/files/admin/");
 static const QUrl sUploadUrl("owncloud://somehost/owncloud/remote.php/dav/uploads/admin/");
+static const QUrl sBulkUploadUrl("owncloud://somehost/owncloud/remote.php/dav/bulk");
+static const QUrl sBulkDownloadUrl("owncloud://somehost/owncloud/remote.php/dav/bulkdownload");
+static const QUrl sDeltaManifestUrl("owncloud://somehost/owncloud/remote.php/dav/manifests/admin/");
 
 inline QString getFilePathFromUrl(const QUrl &url) {
     QString path = url.path();
@@ -212,6 +215,49 @@ public:
     qint64 readData(char *, qint64) override { return 0; }
 };
 
+/** Stores each part of a multipart bulk upload like a PUT and replies
+ * with the JSON object that holds the result for every file.
+ *
+ * Paths in errorPaths are reported as failed, the others are stored.
+ */
+class FakeBulkUploadReply : public FakeReply
+{
+    Q_OBJECT
+public:
+    QByteArray payload;
+
+    FakeBulkUploadReply(FileInfo &remoteRootFileInfo, const QHash<QString, int> &errorPaths,
+        QNetworkAccessManager::Operation op, const QNetworkRequest &request, const QByteArray &body, QObject *parent);
+
+    Q_INVOKABLE void respond();
+
+    void abort() override;
+    qint64 bytesAvailable() const override;
+    qint64 readData(char *data, qint64 maxlen) override;
+};
+
+/** Replies to a bulk download with one multipart part per requested file.
+ *
+ * Files in errorPaths are left out of the reply. The reply is made
+ * available in small pieces to exercise the incremental parsing.
+ */
+class FakeBulkDownloadReply : public FakeReply
+{
+    Q_OBJECT
+public:
+    QByteArray payload;
+    int available = 0; /// how much of the payload was made available so far
+
+    FakeBulkDownloadReply(FileInfo &remoteRootFileInfo, const QHash<QString, int> &errorPaths,
+        QNetworkAccessManager::Operation op, const QNetworkRequest &request, const QByteArray &body, QObject *parent);
+
+    Q_INVOKABLE void respond();
+
+    void abort() override;
+    qint64 bytesAvailable() const override;
+    qint64 readData(char *data, qint64 maxlen) override;
+};
+
 class FakeMkcolReply : public FakeReply
 {
     Q_OBJECT
@@ -276,6 +322,7 @@ public:
     QByteArray payload;
     quint64 offset = 0;
     bool aborted = false;
+    QByteArray contentRange; /// set if only a range of the data was requested
 
     FakeGetWithDataReply(FileInfo &remoteRootFileInfo, const QByteArray &data, QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent);
 
@@ -392,6 +439,8 @@ private:
     QHash<QString, int> _errorPaths;
     // monitor requests and optionally provide custom replies
     Override _override;
+    // block manifests for delta sync by file id
+    QHash<QByteArray, QByteArray> _deltaManifests;
 
 public:
     FakeQNAM(FileInfo initialRoot);
@@ -399,6 +448,7 @@ public:
     FileInfo &uploadState() { return _uploadFileInfo; }
 
     QHash<QString, int> &errorPaths() { return _errorPaths; }
+    QHash<QByteArray, QByteArray> &deltaManifests() { return _deltaManifests; }
 
     void setOverride(const Override &override) { _override = override; }
 
@@ -460,6 +510,7 @@ public:
     };
     ErrorList serverErrorPaths() { return {_fakeQnam}; }
     void setServerOverride(const FakeQNAM::Override &override) { _fakeQnam->setOverride(override); }
+    QHash<QByteArray, QByteArray> &serverDeltaManifests() { return _fakeQnam->deltaManifests(); }
 
     QString localPath() const;
 
@@ -511,6 +562,36 @@ struct ItemCompletedSpy : QSignalSpy {
     OCC::SyncFileItemPtr findItem(const QString &path) const;
 };
 
+/* Announces bulk requests to the client, \a capability is "bulkupload" or "bulkdownload" */
+inline void enableBulkCapability(FakeFolder &folder, const QString &capability)
+{
+    folder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ { capability, "1.0" } } } });
+}
+
+/* Counts the bulk requests to \a bulkUrl and the single transfers with \a singleOperation the server receives */
+struct BulkRequestCounter
+{
+    int bulkRequests = 0;
+    int singleRequests = 0;
+
+    BulkRequestCounter(FakeFolder &folder, const QUrl &bulkUrl, QNetworkAccessManager::Operation singleOperation)
+    {
+        folder.setServerOverride([this, bulkUrl, singleOperation](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (request.url().path() == bulkUrl.path())
+                ++bulkRequests;
+            else if (op == singleOperation)
+                ++singleRequests;
+            return nullptr;
+        });
+    }
+
+    void reset()
+    {
+        bulkRequests = 0;
+        singleRequests = 0;
+    }
+};
+
 // QTest::toString overloads
 namespace OCC {
     inline char *toString(const SyncFileStatus &s) {
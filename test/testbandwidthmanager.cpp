@@ -0,0 +1,106 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include <numeric>
+#include "bandwidthmanager.h"
+
+using namespace OCC;
+
+using Requests = QVector<BandwidthManager::QuotaRequest>;
+
+static qint64 sum(const QVector<qint64> &grants)
+{
+    return std::accumulate(grants.begin(), grants.end(), qint64(0));
+}
+
+class TestBandwidthManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testEvenSplit()
+    {
+        const Requests requests = { { "a", 1000 }, { "a", 1000 }, { "a", 1000 }, { "a", 1000 } };
+        const auto grants = BandwidthManager::fairShares(400, requests, {});
+        QCOMPARE(grants, QVector<qint64>({ 100, 100, 100, 100 }));
+    }
+
+    // Each account gets its share, no matter how many transfers it runs
+    void testSplitBetweenAccounts()
+    {
+        const Requests requests = { { "a", 1000 }, { "a", 1000 }, { "a", 1000 }, { "b", 1000 } };
+        const auto grants = BandwidthManager::fairShares(600, requests, {});
+        QCOMPARE(grants, QVector<qint64>({ 100, 100, 100, 300 }));
+    }
+
+    void testAccountWeights()
+    {
+        const Requests requests = { { "a", 1000 }, { "b", 1000 } };
+        const auto grants = BandwidthManager::fairShares(400, requests, { { "a", 3 } });
+        QCOMPARE(grants, QVector<qint64>({ 300, 100 }));
+    }
+
+    // Tokens a transfer has no room for go to the others
+    void testRedistribution()
+    {
+        const Requests requests = { { "a", 10 }, { "a", 0 }, { "b", 1000 } };
+        const auto grants = BandwidthManager::fairShares(400, requests, {});
+        QCOMPARE(grants, QVector<qint64>({ 10, 0, 390 }));
+    }
+
+    void testNotEnoughRoom()
+    {
+        const Requests requests = { { "a", 10 }, { "b", 20 } };
+        const auto grants = BandwidthManager::fairShares(400, requests, {});
+        QCOMPARE(grants, QVector<qint64>({ 10, 20 }));
+    }
+
+    // Rounding never hands out more than available
+    void testNeverExceedsTokens()
+    {
+        Requests requests;
+        for (int i = 0; i < 7; ++i)
+            requests.append({ QString::number(i % 3), 1000 });
+        for (qint64 tokens : { 0, 1, 5, 13, 999, 4000, 10000 }) {
+            const auto grants = BandwidthManager::fairShares(tokens, requests, { { "1", 2 } });
+            QCOMPARE(sum(grants), qMin<qint64>(tokens, 7000));
+            for (int i = 0; i < grants.size(); ++i)
+                QVERIFY(grants[i] <= requests[i].room);
+        }
+    }
+
+    void testLimits()
+    {
+        BandwidthManager manager;
+        QVERIFY(!manager.usingAbsoluteUploadLimit());
+        manager.setUploadLimit(1000);
+        QVERIFY(manager.usingAbsoluteUploadLimit());
+        manager.setDownloadLimit(-50);
+        QVERIFY(manager.usingRelativeDownloadLimit());
+
+        QCOMPARE(manager.accountWeight("a"), 1);
+        manager.setAccountWeight("a", 4);
+        QCOMPARE(manager.accountWeight("a"), 4);
+    }
+
+    // Without a registered transfer, the limits don't need any timer
+    void testIdleWithoutTransfers()
+    {
+        BandwidthManager manager;
+        QVERIFY(!manager.isTimerActive());
+        manager.setUploadLimit(1000);
+        manager.setDownloadLimit(-50);
+        QVERIFY(!manager.isTimerActive());
+        manager.setUploadLimit(-50);
+        manager.setDownloadLimit(1000);
+        QVERIFY(!manager.isTimerActive());
+    }
+};
+
+QTEST_GUILESS_MAIN(TestBandwidthManager)
+#include "testbandwidthmanager.moc"
@@ -0,0 +1,140 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+#include "propagatedownloadbulk.h"
+
+using namespace OCC;
+
+class TestBulkDownload : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // A file the server left out of the reply is downloaded alone, and fails alone
+    void testMissingPart()
+    {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        enableBulkCapability(fakeFolder, "bulkdownload");
+        BulkRequestCounter counter(fakeFolder, sBulkDownloadUrl, QNetworkAccessManager::GetOperation);
+
+        fakeFolder.remoteModifier().insert("A/ok1", 100);
+        fakeFolder.remoteModifier().insert("A/ok2", 100);
+        fakeFolder.remoteModifier().insert("A/fail", 100);
+        fakeFolder.serverErrorPaths().append("A/fail");
+
+        ItemCompletedSpy completeSpy(fakeFolder);
+        QVERIFY(!fakeFolder.syncOnce());
+        QCOMPARE(counter.bulkRequests, 1);
+        QCOMPARE(counter.singleRequests, 1);
+        QCOMPARE(completeSpy.findItem("A/ok1")->_status, SyncFileItem::Success);
+        QCOMPARE(completeSpy.findItem("A/ok2")->_status, SyncFileItem::Success);
+        QCOMPARE(completeSpy.findItem("A/fail")->_status, SyncFileItem::NormalError);
+        QVERIFY(fakeFolder.currentLocalState().find("A/ok1"));
+        QVERIFY(fakeFolder.currentLocalState().find("A/ok2"));
+        QVERIFY(!fakeFolder.currentLocalState().find("A/fail"));
+
+        // The journal knows the etag the server reported for the parts of the reply
+        SyncJournalFileRecord record;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArrayLiteral("A/ok1"), &record));
+        QCOMPARE(record._etag, fakeFolder.currentRemoteState().find("A/ok1")->etag);
+        QVERIFY(!record._checksumHeader.isEmpty());
+
+        fakeFolder.serverErrorPaths().clear();
+        fakeFolder.syncJournal().wipeErrorBlacklist();
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    // A partial download from an earlier sync is resumed alone, the other files keep their batch
+    void testPartialDownload()
+    {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        enableBulkCapability(fakeFolder, "bulkdownload");
+        BulkRequestCounter counter(fakeFolder, sBulkDownloadUrl, QNetworkAccessManager::GetOperation);
+
+        for (int i = 0; i < 3; ++i)
+            fakeFolder.remoteModifier().insert(QStringLiteral("A/new%1").arg(i), 100);
+
+        SyncJournalDb::DownloadInfo info;
+        info._etag = fakeFolder.remoteModifier().find("A/new1")->etag;
+        info._tmpfile = QStringLiteral("A/.new1.~partial");
+        info._valid = true;
+        fakeFolder.syncJournal().setDownloadInfo("A/new1", info);
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(counter.bulkRequests, 1);
+        QCOMPARE(counter.singleRequests, 1);
+        QVERIFY(!fakeFolder.syncJournal().getDownloadInfo("A/new1")._valid);
+    }
+
+    // Files in end-to-end encrypted folders are decrypted one by one and never join a batch
+    void testEncryptedFallback()
+    {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.syncEngine().account()->setCapabilities({
+            { "dav", QVariantMap{ { "bulkdownload", "1.0" } } },
+            { "end-to-end-encryption", QVariantMap{ { "enabled", true }, { "api-version", "1.1" } } } });
+
+        SyncJournalFileRecord record;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArrayLiteral("A"), &record));
+        record._isE2eEncrypted = true;
+        QVERIFY(fakeFolder.syncJournal().setFileRecord(record));
+
+        int bulkRequests = 0;
+        int metadataRequests = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (request.url().path() == sBulkDownloadUrl.path())
+                ++bulkRequests;
+            if (request.url().path().contains(QStringLiteral("end_to_end_encryption"))) {
+                // Without metadata, the files can't be decrypted
+                ++metadataRequests;
+                return new FakeErrorReply(op, request, this, 404);
+            }
+            return nullptr;
+        });
+
+        for (int i = 0; i < 3; ++i)
+            fakeFolder.remoteModifier().insert(QStringLiteral("A/new%1").arg(i), 100);
+
+        ItemCompletedSpy completeSpy(fakeFolder);
+        QVERIFY(!fakeFolder.syncOnce());
+        QCOMPARE(bulkRequests, 0);
+        QCOMPARE(metadataRequests, 3);
+        for (int i = 0; i < 3; ++i)
+            QCOMPARE(completeSpy.findItem(QStringLiteral("A/new%1").arg(i))->_status, SyncFileItem::NormalError);
+    }
+
+    // Other errors fail every file of the batch, without leaving temporary files behind
+    void testServerError()
+    {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        enableBulkCapability(fakeFolder, "bulkdownload");
+
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (request.url().path() == sBulkDownloadUrl.path())
+                return new FakeErrorReply(op, request, this, 500);
+            return nullptr;
+        });
+
+        fakeFolder.remoteModifier().insert("A/new1", 100);
+        fakeFolder.remoteModifier().insert("A/new2", 100);
+
+        ItemCompletedSpy completeSpy(fakeFolder);
+        QVERIFY(!fakeFolder.syncOnce());
+        QCOMPARE(completeSpy.findItem("A/new1")->_status, SyncFileItem::NormalError);
+        QCOMPARE(completeSpy.findItem("A/new2")->_status, SyncFileItem::NormalError);
+        QCOMPARE(fakeFolder.currentLocalState(), FileInfo::A12_B12_C12_S12());
+        QVERIFY(!fakeFolder.syncJournal().getDownloadInfo("A/new1")._valid);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestBulkDownload)
+#include "testbulkdownload.moc"
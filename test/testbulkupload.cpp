@@ -0,0 +1,184 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+#include "propagateuploadbulk.h"
+
+using namespace OCC;
+
+class TestBulkUpload : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // The small files of each folder go up with one request
+    void testBulkUpload()
+    {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        enableBulkCapability(fakeFolder, "bulkupload");
+        BulkRequestCounter counter(fakeFolder, sBulkUploadUrl, QNetworkAccessManager::PutOperation);
+
+        for (int i = 0; i < 5; ++i)
+            fakeFolder.localModifier().insert(QStringLiteral("A/bulk%1").arg(i), 100 + i);
+        fakeFolder.localModifier().mkdir("D");
+        for (int i = 0; i < 3; ++i)
+            fakeFolder.localModifier().insert(QStringLiteral("D/new%1").arg(i), 200);
+        // Larger than smallFileSize
+        fakeFolder.localModifier().insert("A/big", 200 * 1024);
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(counter.bulkRequests, 2);
+        QCOMPARE(counter.singleRequests, 1);
+
+        // The journal knows the etag and file id the server reported
+        SyncJournalFileRecord record;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArrayLiteral("D/new1"), &record));
+        QCOMPARE(record._etag, fakeFolder.currentRemoteState().find("D/new1")->etag);
+        QCOMPARE(record._fileId, fakeFolder.currentRemoteState().find("D/new1")->fileId);
+
+        // Changed files are batched as well
+        counter.reset();
+        fakeFolder.localModifier().appendByte("B/b1");
+        fakeFolder.localModifier().appendByte("B/b2");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(counter.bulkRequests, 1);
+        QCOMPARE(counter.singleRequests, 0);
+    }
+
+    void testWithoutCapability()
+    {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        BulkRequestCounter counter(fakeFolder, sBulkUploadUrl, QNetworkAccessManager::PutOperation);
+
+        for (int i = 0; i < 3; ++i)
+            fakeFolder.localModifier().insert(QStringLiteral("A/new%1").arg(i), 100);
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(counter.bulkRequests, 0);
+        QCOMPARE(counter.singleRequests, 3);
+    }
+
+    // A single file is not worth a multipart request
+    void testSingleFile()
+    {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        enableBulkCapability(fakeFolder, "bulkupload");
+        BulkRequestCounter counter(fakeFolder, sBulkUploadUrl, QNetworkAccessManager::PutOperation);
+
+        fakeFolder.localModifier().insert("A/new", 100);
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(counter.bulkRequests, 0);
+        QCOMPARE(counter.singleRequests, 1);
+    }
+
+    // A file the server could not store fails alone
+    void testFileError()
+    {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        enableBulkCapability(fakeFolder, "bulkupload");
+
+        fakeFolder.localModifier().insert("A/ok1", 100);
+        fakeFolder.localModifier().insert("A/ok2", 100);
+        fakeFolder.localModifier().insert("A/fail", 100);
+        fakeFolder.serverErrorPaths().append("A/fail");
+
+        ItemCompletedSpy completeSpy(fakeFolder);
+        QVERIFY(!fakeFolder.syncOnce());
+        QCOMPARE(completeSpy.findItem("A/ok1")->_status, SyncFileItem::Success);
+        QCOMPARE(completeSpy.findItem("A/ok2")->_status, SyncFileItem::Success);
+        QCOMPARE(completeSpy.findItem("A/fail")->_status, SyncFileItem::NormalError);
+        QVERIFY(fakeFolder.currentRemoteState().find("A/ok1"));
+        QVERIFY(fakeFolder.currentRemoteState().find("A/ok2"));
+        QVERIFY(!fakeFolder.currentRemoteState().find("A/fail"));
+
+        fakeFolder.serverErrorPaths().clear();
+        fakeFolder.syncJournal().wipeErrorBlacklist();
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    // Servers that reject the bulk request get the files one by one
+    void testFallbackWhenRejected()
+    {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        enableBulkCapability(fakeFolder, "bulkupload");
+
+        int bulkRequests = 0;
+        int puts = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (request.url().path() == sBulkUploadUrl.path()) {
+                ++bulkRequests;
+                return new FakeErrorReply(op, request, this, 404);
+            }
+            if (op == QNetworkAccessManager::PutOperation)
+                ++puts;
+            return nullptr;
+        });
+
+        for (int i = 0; i < 3; ++i) {
+            fakeFolder.localModifier().insert(QStringLiteral("A/new%1").arg(i), 100);
+            fakeFolder.localModifier().insert(QStringLiteral("B/new%1").arg(i), 100);
+        }
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(bulkRequests >= 1);
+        QCOMPARE(puts, 6);
+    }
+
+    // Aborting while the files wait for their batch resolves them without sending the request
+    void testAbortWhileBatching()
+    {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        enableBulkCapability(fakeFolder, "bulkupload");
+        BulkRequestCounter counter(fakeFolder, sBulkUploadUrl, QNetworkAccessManager::PutOperation);
+
+        for (int i = 0; i < 3; ++i)
+            fakeFolder.localModifier().insert(QStringLiteral("A/new%1").arg(i), 100);
+
+        // The first file reports its progress right before it joins the batch
+        QString abortedFile;
+        connect(&fakeFolder.syncEngine(), &SyncEngine::transmissionProgress, this, [&](const ProgressInfo &progress) {
+            if (abortedFile.isEmpty() && !progress._currentItems.isEmpty()) {
+                abortedFile = progress._currentItems.keys().first();
+                fakeFolder.syncEngine().abort();
+            }
+        });
+
+        ItemCompletedSpy completeSpy(fakeFolder);
+        QVERIFY(!fakeFolder.syncOnce());
+        QVERIFY(!abortedFile.isEmpty());
+        QCOMPARE(completeSpy.findItem(abortedFile)->_status, SyncFileItem::SoftError);
+        QCOMPARE(counter.bulkRequests, 0);
+        QCOMPARE(counter.singleRequests, 0);
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(counter.bulkRequests, 1);
+    }
+
+    void testMultipartBody()
+    {
+        BulkUploadJob::Part part;
+        part.headers["X-File-Path"] = "/A/a1";
+        part.data = "abc";
+        QCOMPARE(BulkUploadJob::multipartBody({ part, part }, "xyz"),
+            QByteArray("--xyz\r\nX-File-Path: /A/a1\r\n\r\nabc\r\n"
+                       "--xyz\r\nX-File-Path: /A/a1\r\n\r\nabc\r\n"
+                       "--xyz--\r\n"));
+    }
+};
+
+QTEST_GUILESS_MAIN(TestBulkUpload)
+#include "testbulkupload.moc"
@@ -213,6 +213,95 @@ using namespace OCC::Utility;
     }
 
 
+    void testChecksumCalculator_data()
+    {
+        QTest::addColumn<QByteArray>("checksumType");
+        QTest::newRow("MD5") << QByteArray(checkSumMD5C);
+        QTest::newRow("SHA1") << QByteArray(checkSumSHA1C);
+        QTest::newRow("SHA256") << QByteArray(checkSumSHA2C);
+#if QT_VERSION >= QT_VERSION_CHECK(5, 9, 0)
+        QTest::newRow("SHA3-256") << QByteArray(checkSumSHA3C);
+#endif
+#ifdef ZLIB_FOUND
+        QTest::newRow("Adler32") << QByteArray(checkSumAdlerC);
+#endif
+    }
+
+    void testChecksumCalculator()
+    {
+        QFETCH(QByteArray, checksumType);
+
+        QFile file(_testfile);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        const QByteArray data = file.readAll();
+
+        // Feed the data in uneven blocks, the way a download arrives
+        ChecksumCalculator calculator(checksumType);
+        QVERIFY(calculator.isValid());
+        for (int pos = 0; pos < data.size(); pos += 1000) {
+            calculator.addData(data.constData() + pos, qMin(1000, data.size() - pos));
+        }
+        const QByteArray checksum = calculator.result();
+        QVERIFY(!checksum.isEmpty());
+        QCOMPARE(checksum, ComputeChecksum::computeNowOnFile(_testfile, checksumType));
+        QVERIFY(!calculator.isValid());
+
+        QVERIFY(!ChecksumCalculator("Klaas32").isValid());
+    }
+
+    void testMultipleChecksumsInOnePass()
+    {
+        auto *vali = new ComputeChecksum(this);
+        _expectedType = OCC::checkSumSHA1C;
+        _expected = ComputeChecksum::computeNowOnFile(_testfile, checkSumSHA1C);
+        vali->setChecksumType(_expectedType);
+        vali->setAdditionalChecksumTypes({ checkSumMD5C, "Klaas32" });
+        connect(vali, SIGNAL(done(QByteArray,QByteArray)), this, SLOT(slotUpValidated(QByteArray,QByteArray)));
+
+        QSignalSpy spy(vali, &ComputeChecksum::done);
+        vali->start(_testfile);
+        QVERIFY(spy.wait());
+
+        const auto additional = vali->additionalChecksums();
+        QCOMPARE(additional.size(), 1);
+        QCOMPARE(additional.value(checkSumMD5C), ComputeChecksum::computeNowOnFile(_testfile, checkSumMD5C));
+
+        QFile file(_testfile);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        const auto checksums = ComputeChecksum::computeNow(&file, { checkSumSHA1C, checkSumSHA2C });
+        QCOMPARE(checksums.value(checkSumSHA1C), _expected);
+        QCOMPARE(checksums.value(checkSumSHA2C), ComputeChecksum::computeNowOnFile(_testfile, checkSumSHA2C));
+
+        delete vali;
+    }
+
+    void testDownloadChecksummingPrecomputed()
+    {
+        auto *vali = new ValidateChecksumHeader(this);
+        connect(vali, &ValidateChecksumHeader::validated, this, &TestChecksumValidator::slotDownValidated);
+        connect(vali, &ValidateChecksumHeader::validationFailed, this, &TestChecksumValidator::slotDownError);
+
+        const QByteArray sha1 = ComputeChecksum::computeNowOnFile(_testfile, checkSumSHA1C);
+        QVERIFY(!sha1.isEmpty());
+
+        // A matching precomputed checksum is validated without reading the file
+        _successDown = false;
+        vali->start(QStringLiteral("/does/not/exist"), "SHA1:" + sha1, checkSumSHA1C, sha1);
+        QVERIFY(_successDown);
+
+        _expectedError = QStringLiteral("The downloaded file does not match the checksum, it will be resumed. '543345' != '%1'").arg(QString::fromUtf8(sha1));
+        _errorSeen = false;
+        vali->start(_testfile, "SHA1:543345", checkSumSHA1C, sha1);
+        QVERIFY(_errorSeen);
+
+        // A precomputed checksum of another type falls back to reading the file
+        _successDown = false;
+        vali->start(_testfile, "SHA1:" + sha1, checkSumMD5C, "543345");
+        QTRY_VERIFY(_successDown);
+
+        delete vali;
+    }
+
     void cleanupTestCase() {
     }
 };
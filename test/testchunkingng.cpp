@@ -75,6 +75,45 @@ private slots:
         QCOMPARE(fakeFolder.uploadState().children.count(), 2); // the transfer was done with chunking
     }
 
+    // Upload the chunks of one file with several PUTs in flight at once
+    void testParallelChunkUpload() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ {"chunking", "1.0"} } } });
+        SyncOptions options;
+        options._maxChunkSize = 1 * 1000 * 1000;
+        options._initialChunkSize = 1 * 1000 * 1000;
+        options._minChunkSize = 1 * 1000 * 1000;
+        options._parallelChunkUploads = 3;
+        fakeFolder.syncEngine().setSyncOptions(options);
+        const int size = 10 * 1000 * 1000; // 10 MB
+
+        QObject parent;
+        int runningPuts = 0;
+        int maxRunningPuts = 0;
+        QSet<qint64> chunkOffsets;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *outgoingData) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation && request.url().path().contains("/uploads/")) {
+                chunkOffsets.insert(request.rawHeader("OC-Chunk-Offset").toLongLong());
+                maxRunningPuts = qMax(maxRunningPuts, ++runningPuts);
+                auto reply = new FakePutReply(fakeFolder.uploadState(), op, request, outgoingData->readAll(), &parent);
+                QObject::connect(reply, &QNetworkReply::finished, &parent, [&] { --runningPuts; });
+                return reply;
+            } else if (request.attribute(QNetworkRequest::CustomVerbAttribute) == "MOVE") {
+                // All chunks must be there before the MOVE
+                Q_ASSERT(runningPuts == 0);
+            }
+            return nullptr;
+        });
+
+        fakeFolder.localModifier().insert("A/a0", size);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fakeFolder.currentRemoteState().find("A/a0")->size, size);
+        QCOMPARE(chunkOffsets.size(), 10);
+        QVERIFY(maxRunningPuts > 1);
+        QVERIFY(maxRunningPuts <= 3);
+    }
+
     // Test resuming when there's a confusing chunk added
     void testResume1() {
         FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
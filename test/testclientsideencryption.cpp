@@ -5,6 +5,8 @@
 */
 
 #include <QtTest>
+#include <QBuffer>
+#include <QTemporaryDir>
 
 #include "clientsideencryption.h"
 
@@ -132,6 +134,105 @@ private slots:
         // THEN
         QCOMPARE(data, originalData);
     }
+
+    void shouldStreamTheFileEncryption_data()
+    {
+        QTest::addColumn<int>("ivSize");
+
+        QTest::newRow("16 byte iv") << 16;
+        QTest::newRow("12 byte iv") << 12;
+    }
+
+    void shouldStreamTheFileEncryption()
+    {
+        QFETCH(int, ivSize);
+
+        // GIVEN
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        QFile plaintext(dir.filePath(QStringLiteral("plaintext")));
+        QVERIFY(plaintext.open(QIODevice::WriteOnly));
+        // More than one encryption block and not a multiple of the cipher block size
+        plaintext.write(EncryptionHelper::generateRandom(600 * 1000 + 7));
+        plaintext.close();
+
+        const auto key = EncryptionHelper::generateRandom(16);
+        const auto iv = EncryptionHelper::generateRandom(ivSize);
+        QFile ciphertext(dir.filePath(QStringLiteral("ciphertext")));
+        QByteArray tag;
+        QVERIFY(EncryptionHelper::fileEncryption(key, iv, &plaintext, &ciphertext, tag));
+        QVERIFY(ciphertext.open(QIODevice::ReadOnly));
+        const auto expected = ciphertext.readAll();
+
+        // WHEN
+        EncryptedFileDevice device(plaintext.fileName(), key, iv, tag);
+        QVERIFY(device.open(QIODevice::ReadOnly));
+
+        // THEN
+        QCOMPARE(device.size(), qint64(expected.size()));
+        QCOMPARE(device.readAll(), expected);
+
+        // Chunked uploads and retries start in the middle of the file
+        for (const qint64 pos : { qint64(0), qint64(1), qint64(4095), qint64(256 * 1024 + 3), qint64(expected.size() - 20) }) {
+            QVERIFY(device.seek(pos));
+            QCOMPARE(device.read(70000), expected.mid(int(pos), 70000));
+        }
+    }
+
+    void shouldStreamTheFileDecryption()
+    {
+        // GIVEN
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        QFile plaintext(dir.filePath(QStringLiteral("plaintext")));
+        QVERIFY(plaintext.open(QIODevice::WriteOnly));
+        const auto data = EncryptionHelper::generateRandom(100 * 1000 + 3);
+        plaintext.write(data);
+        plaintext.close();
+
+        const auto key = EncryptionHelper::generateRandom(16);
+        const auto iv = EncryptionHelper::generateRandom(16);
+        QFile ciphertextFile(dir.filePath(QStringLiteral("ciphertext")));
+        QByteArray tag;
+        QVERIFY(EncryptionHelper::fileEncryption(key, iv, &plaintext, &ciphertextFile, tag));
+        QVERIFY(ciphertextFile.open(QIODevice::ReadOnly));
+        const auto ciphertext = ciphertextFile.readAll();
+
+        // WHEN: the first part was downloaded before, the rest arrives in pieces of varying size
+        const int resumeStart = 12345;
+        QBuffer downloadedBefore;
+        downloadedBefore.setData(data.left(resumeStart));
+        QVERIFY(downloadedBefore.open(QIODevice::ReadOnly));
+        StreamingDecryptor decryptor(key, iv);
+        QVERIFY(decryptor.isInitialized());
+        QVERIFY(decryptor.resume(&downloadedBefore));
+
+        QByteArray decrypted = data.left(resumeStart);
+        int pos = resumeStart;
+        int pieceSize = 1;
+        while (pos < ciphertext.size()) {
+            const int size = qMin(pieceSize, ciphertext.size() - pos);
+            QByteArray output(size, Qt::Uninitialized);
+            const int written = decryptor.update(ciphertext.constData() + pos, size, output.data());
+            QVERIFY(written >= 0);
+            decrypted.append(output.constData(), written);
+            pos += size;
+            pieceSize = pieceSize * 7 % 9001 + 1;
+        }
+
+        // THEN
+        QVERIFY(decryptor.finish());
+        QCOMPARE(decryptor.tag(), tag);
+        QCOMPARE(decrypted, data);
+
+        // A modified file doesn't pass
+        auto modified = ciphertext;
+        modified[5000] = char(modified[5000] ^ 1);
+        QVERIFY(decryptor.restart());
+        QByteArray output(modified.size(), Qt::Uninitialized);
+        QCOMPARE(decryptor.update(modified.constData(), modified.size(), output.data()), modified.size() - EncryptedFileDevice::tagSize);
+        QVERIFY(!decryptor.finish());
+    }
 };
 
 QTEST_APPLESS_MAIN(TestClientSideEncryption)
@@ -0,0 +1,174 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+#include "concurrencycontroller.h"
+
+using namespace OCC;
+using namespace std::chrono_literals;
+using Outcome = ConcurrencyController::Outcome;
+
+/* Completes as many transfers as the window allows, each taking the time
+ * returned by durationForWindow */
+template <typename F>
+static void completeRound(ConcurrencyController &controller, qint64 bytes, F durationForWindow)
+{
+    const int window = controller.window();
+    for (int i = 0; i < window; ++i)
+        controller.transferFinished(bytes, durationForWindow(window), Outcome::Success);
+}
+
+class TestConcurrencyController : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testBounds()
+    {
+        ConcurrencyController controller;
+        controller.setBounds(2, 5, 3);
+        QCOMPARE(controller.window(), 3);
+
+        // The window is kept when the bounds are set again
+        controller.setBounds(1, 10, 7);
+        QCOMPARE(controller.window(), 3);
+
+        controller.setBounds(4, 10, 1);
+        QCOMPARE(controller.window(), 4);
+        controller.setBounds(1, 2, 1);
+        QCOMPARE(controller.window(), 2);
+
+        // Invalid bounds are fixed up
+        controller.setBounds(0, -1, 1);
+        QCOMPARE(controller.minimum(), 1);
+        QCOMPARE(controller.maximum(), 1);
+        QCOMPARE(controller.window(), 1);
+    }
+
+    // A server that is not saturated gets as many transfers as allowed
+    void testGrowsWhileThroughputIncreases()
+    {
+        ConcurrencyController controller;
+        controller.setBounds(1, 10, 2);
+        for (int round = 0; round < 20; ++round)
+            completeRound(controller, 10 * 1000 * 1000, [](int) { return 100ms; });
+        QCOMPARE(controller.window(), 10);
+    }
+
+    // When each transfer gets slower by as much as the window grows, more
+    // parallel transfers don't help
+    void testStopsGrowingWhenSaturated()
+    {
+        ConcurrencyController controller;
+        controller.setBounds(1, 10, 2);
+        for (int round = 0; round < 30; ++round) {
+            completeRound(controller, 10 * 1000 * 1000, [](int window) { return window * 100ms; });
+            QVERIFY(controller.window() >= 2);
+            QVERIFY(controller.window() <= 3);
+        }
+    }
+
+    void testShrinksWhenLatencyIncreases()
+    {
+        ConcurrencyController controller;
+        controller.setBounds(1, 10, 4);
+        completeRound(controller, 1000, [](int) { return 10ms; });
+        QCOMPARE(controller.window(), 5);
+
+        for (int round = 0; round < 10; ++round)
+            completeRound(controller, 1000, [](int) { return 300ms; });
+        QCOMPARE(controller.window(), 1);
+
+        // Large transfers don't probe the latency
+        completeRound(controller, 10 * 1000 * 1000, [](int) { return 300ms; });
+        QCOMPARE(controller.window(), 2);
+    }
+
+    void testHalvesWhenServerOverloaded()
+    {
+        ConcurrencyController controller;
+        controller.setBounds(1, 10, 8);
+        controller.transferFinished(0, 10ms, Outcome::ServerOverloaded);
+        QCOMPARE(controller.window(), 4);
+        controller.transferFinished(0, 10ms, Outcome::ServerOverloaded);
+        QCOMPARE(controller.window(), 2);
+        controller.transferFinished(0, 10ms, Outcome::ServerOverloaded);
+        QCOMPARE(controller.window(), 1);
+        controller.transferFinished(0, 10ms, Outcome::ServerOverloaded);
+        QCOMPARE(controller.window(), 1);
+
+        // Other failures don't change the window
+        controller.transferFinished(0, 10ms, Outcome::Failure);
+        QCOMPARE(controller.window(), 1);
+    }
+
+    void testOutcomeForHttpStatus()
+    {
+        QCOMPARE(ConcurrencyController::outcomeForHttpStatus(200, true), Outcome::Success);
+        QCOMPARE(ConcurrencyController::outcomeForHttpStatus(0, false), Outcome::Failure);
+        QCOMPARE(ConcurrencyController::outcomeForHttpStatus(404, false), Outcome::Failure);
+        QCOMPARE(ConcurrencyController::outcomeForHttpStatus(429, false), Outcome::ServerOverloaded);
+        QCOMPARE(ConcurrencyController::outcomeForHttpStatus(503, false), Outcome::ServerOverloaded);
+    }
+
+    // The propagator never runs more transfers than the window allows
+    void testPropagatorFollowsWindow()
+    {
+        FakeFolder fakeFolder{FileInfo{}};
+        SyncOptions options;
+        options._minParallelTransfers = 1;
+        options._maxParallelTransfers = 1;
+        fakeFolder.syncEngine().setSyncOptions(options);
+
+        QObject parent;
+        int runningGets = 0;
+        int maxRunningGets = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation) {
+                maxRunningGets = qMax(maxRunningGets, ++runningGets);
+                auto reply = new FakeGetReply(fakeFolder.remoteModifier(), op, request, &parent);
+                QObject::connect(reply, &QNetworkReply::finished, &parent, [&] { --runningGets; });
+                return reply;
+            }
+            return nullptr;
+        });
+
+        // Larger than smallFileSize, so they don't count as likely finished quickly
+        for (int i = 0; i < 10; ++i)
+            fakeFolder.remoteModifier().insert(QStringLiteral("file%1").arg(i), 200 * 1024);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(maxRunningGets, 1);
+        QCOMPARE(options._transferConcurrency->window(), 1);
+    }
+
+    // The window shared through the SyncOptions shrinks when the server is overloaded
+    void testOverloadedServerShrinksWindow()
+    {
+        FakeFolder fakeFolder{FileInfo{}};
+        SyncOptions options;
+        options._parallelNetworkJobs = 6;
+        fakeFolder.syncEngine().setSyncOptions(options);
+
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation)
+                return new FakeErrorReply(op, request, this, 503);
+            return nullptr;
+        });
+
+        for (int i = 0; i < 10; ++i)
+            fakeFolder.remoteModifier().insert(QStringLiteral("file%1").arg(i), 200 * 1024);
+        QVERIFY(!fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.syncEngine().syncOptions()._transferConcurrency, options._transferConcurrency);
+        QCOMPARE(options._transferConcurrency->window(), 1);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestConcurrencyController)
+#include "testconcurrencycontroller.moc"
@@ -0,0 +1,248 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+#include "deltasync.h"
+
+using namespace OCC;
+
+static QByteArray randomData(int size, quint32 seed)
+{
+    QByteArray data(size, Qt::Uninitialized);
+    quint32 x = seed;
+    for (auto &c : data) {
+        x = x * 1664525u + 1013904223u;
+        c = char(x >> 24);
+    }
+    return data;
+}
+
+static BlockManifest manifestOf(const QByteArray &data)
+{
+    QBuffer buffer;
+    buffer.setData(data);
+    buffer.open(QIODevice::ReadOnly);
+    return BlockManifest::compute(&buffer, BlockManifest::blockSizeFor(data.size()));
+}
+
+static DeltaPlan planFor(const QByteArray &remote, const QByteArray &local)
+{
+    QBuffer buffer;
+    buffer.setData(local);
+    buffer.open(QIODevice::ReadOnly);
+    return DeltaPlan::match(manifestOf(remote), &buffer);
+}
+
+static void enableDeltaSync(FakeFolder &fakeFolder)
+{
+    fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ { "deltasync", "1.0" } } } });
+    SyncOptions options;
+    options._deltaSyncMinFileSize = 1000;
+    fakeFolder.syncEngine().setSyncOptions(options);
+}
+
+static void writeLocalFile(FakeFolder &fakeFolder, const QString &path, const QByteArray &data)
+{
+    QFile file(fakeFolder.localPath() + path);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    QCOMPARE(file.write(data), qint64(data.size()));
+}
+
+static QByteArray readLocalFile(FakeFolder &fakeFolder, const QString &path)
+{
+    QFile file(fakeFolder.localPath() + path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    return file.readAll();
+}
+
+class TestDeltaSync : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testManifestRoundTrip()
+    {
+        auto manifest = manifestOf(randomData(200 * 1000, 1));
+        manifest.etag = "etag";
+        QVERIFY(manifest.isValid());
+        QCOMPARE(manifest.blockSize, qint64(64 * 1024));
+        QCOMPARE(manifest.blocks.size(), 4);
+        QCOMPARE(manifest.blockLength(3), qint64(200 * 1000 - 3 * 64 * 1024));
+
+        const auto parsed = BlockManifest::parse(manifest.serialize());
+        QVERIFY(parsed.isValid());
+        QCOMPARE(parsed.fileSize, manifest.fileSize);
+        QCOMPARE(parsed.etag, manifest.etag);
+        for (int i = 0; i < manifest.blocks.size(); ++i) {
+            QCOMPARE(parsed.blocks[i].weak, manifest.blocks[i].weak);
+            QCOMPARE(parsed.blocks[i].strong, manifest.blocks[i].strong);
+        }
+
+        QVERIFY(!BlockManifest::parse("garbage").isValid());
+        QVERIFY(!BlockManifest::parse(manifest.serialize().left(100)).isValid());
+    }
+
+    void testBlockSize()
+    {
+        QCOMPARE(BlockManifest::blockSizeFor(0), qint64(64 * 1024));
+        QCOMPARE(BlockManifest::blockSizeFor(4LL * 1024 * 1024 * 1024), qint64(64 * 1024));
+        QCOMPARE(BlockManifest::blockSizeFor(4LL * 1024 * 1024 * 1024 + 1), qint64(128 * 1024));
+    }
+
+    // Blocks are found wherever they moved to in the local file
+    void testMatchShiftedData()
+    {
+        const auto local = randomData(10 * 64 * 1024, 2);
+        auto remote = local;
+        remote.insert(100, randomData(777, 3));
+        remote.remove(remote.size() - 5000, 10);
+
+        const auto manifest = manifestOf(remote);
+        const auto plan = planFor(remote, local);
+        QCOMPARE(plan.localOffsets.size(), 11);
+        QCOMPARE(plan.localOffsets[0], qint64(-1)); // contains the inserted data
+        for (int i = 1; i < 9; ++i)
+            QCOMPARE(plan.localOffsets[i], i * manifest.blockSize - 777);
+        QCOMPARE(plan.localOffsets[9], qint64(-1)); // contains the removed data
+        QCOMPARE(plan.localOffsets[10], qint64(-1)); // the tail is always downloaded
+
+        const auto ranges = plan.missingRanges(manifest);
+        QCOMPARE(ranges.size(), 2);
+        QCOMPARE(ranges[0].start, qint64(0));
+        QCOMPARE(ranges[0].length, manifest.blockSize);
+        QCOMPARE(ranges[1].start, 9 * manifest.blockSize);
+        QCOMPARE(ranges[1].length, remote.size() - 9 * manifest.blockSize);
+        QCOMPARE(plan.missingBytes(manifest), ranges[0].length + ranges[1].length);
+    }
+
+    void testMatchUnrelatedData()
+    {
+        const auto remote = randomData(5 * 64 * 1024, 4);
+        const auto plan = planFor(remote, randomData(5 * 64 * 1024, 5));
+        QCOMPARE(plan.localOffsets, QVector<qint64>(5, -1));
+
+        // Repeated blocks all come from the same local data
+        const auto block = randomData(64 * 1024, 6);
+        const auto repeated = block + block + block;
+        QCOMPARE(planFor(repeated, block).localOffsets, QVector<qint64>({ 0, 0, 0 }));
+    }
+
+    // Uploads of large files publish the manifest of the uploaded version
+    void testManifestPublishedOnUpload()
+    {
+        FakeFolder fakeFolder{FileInfo{}};
+        enableDeltaSync(fakeFolder);
+
+        fakeFolder.localModifier().insert("big", 300 * 1024);
+        fakeFolder.localModifier().insert("small", 100);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        QCOMPARE(fakeFolder.serverDeltaManifests().size(), 1);
+        auto remoteState = fakeFolder.currentRemoteState();
+        const auto remoteFile = remoteState.find("big");
+        const auto manifest = BlockManifest::parse(fakeFolder.serverDeltaManifests().value(remoteFile->fileId));
+        QVERIFY(manifest.isValid());
+        QCOMPARE(manifest.etag, remoteFile->etag);
+        QCOMPARE(manifest.fileSize, qint64(300 * 1024));
+        QCOMPARE(manifest.blocks.size(), 5);
+    }
+
+    // Only the changed blocks of a modified file are downloaded
+    void testDeltaDownload()
+    {
+        FakeFolder fakeFolder{FileInfo{}};
+        enableDeltaSync(fakeFolder);
+
+        const auto oldData = randomData(1024 * 1024, 7);
+        writeLocalFile(fakeFolder, "big", oldData);
+        QVERIFY(fakeFolder.syncOnce());
+
+        auto newData = oldData;
+        newData.insert(200000, randomData(1000, 8));
+        newData.replace(700000, 10, QByteArray(10, 'x'));
+        fakeFolder.remoteModifier().setContents("big", 'x');
+        auto remoteFile = fakeFolder.remoteModifier().find("big");
+        remoteFile->size = newData.size();
+        const auto newEtag = remoteFile->etag;
+
+        auto manifest = manifestOf(newData);
+        manifest.etag = newEtag;
+        fakeFolder.serverDeltaManifests()[remoteFile->fileId] = manifest.serialize();
+
+        QStringList ranges;
+        qint64 downloadedBytes = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation && request.url().path().endsWith("/big")) {
+                ranges.append(QString::fromUtf8(request.rawHeader("Range")));
+                auto reply = new FakeGetWithDataReply(fakeFolder.remoteModifier(), newData, op, request, this);
+                downloadedBytes += reply->payload.size();
+                return reply;
+            }
+            return nullptr;
+        });
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(readLocalFile(fakeFolder, "big"), newData);
+
+        // The block with the inserted data, the one with the changed data and the tail
+        QCOMPARE(ranges.size(), 3);
+        for (const auto &range : ranges)
+            QVERIFY(range.startsWith("bytes="));
+        QCOMPARE(downloadedBytes, 2 * manifest.blockSize + manifest.blockLength(manifest.blocks.size() - 1));
+
+        SyncJournalFileRecord record;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArrayLiteral("big"), &record));
+        QCOMPARE(record._etag, newEtag);
+        QCOMPARE(record._fileSize, qint64(newData.size()));
+    }
+
+    // Without a manifest for the new version the whole file is downloaded
+    void testFallbackToFullDownload()
+    {
+        FakeFolder fakeFolder{FileInfo{}};
+        enableDeltaSync(fakeFolder);
+
+        fakeFolder.remoteModifier().insert("big", 300 * 1024);
+        QVERIFY(fakeFolder.syncOnce());
+
+        int rangeRequests = 0;
+        int fullRequests = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation && request.url().path().endsWith("/big")) {
+                if (request.hasRawHeader("Range"))
+                    ++rangeRequests;
+                else
+                    ++fullRequests;
+            }
+            return nullptr;
+        });
+
+        // No manifest at all
+        fakeFolder.remoteModifier().appendByte("big");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fullRequests, 1);
+
+        // A manifest of another version
+        auto remoteFile = fakeFolder.remoteModifier().find("big");
+        auto manifest = manifestOf(QByteArray(remoteFile->size + 1, 'W'));
+        manifest.etag = remoteFile->etag;
+        fakeFolder.serverDeltaManifests()[remoteFile->fileId] = manifest.serialize();
+        fakeFolder.remoteModifier().appendByte("big");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fullRequests, 2);
+        QCOMPARE(rangeRequests, 0);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestDeltaSync)
+#include "testdeltasync.moc"
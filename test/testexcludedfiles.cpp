@@ -282,6 +282,55 @@ private slots:
         QCOMPARE(check_file_traversal("latex/songbook/my_manuscript.tex.tmp"), CSYNC_FILE_EXCLUDE_LIST);
     }
 
+    void check_csync_excluded_traversal_pattern_kinds()
+    {
+        setup();
+        // Literals and single '*' patterns share the hash tables, the others need a regex
+        excludedFiles->addManualExclude("literal");
+        excludedFiles->addManualExclude("prefix*");
+        excludedFiles->addManualExclude("*.suffix");
+        excludedFiles->addManualExclude("pre*suf");
+        excludedFiles->addManualExclude("]removed*");
+        excludedFiles->addManualExclude("]*both");
+        excludedFiles->addManualExclude("*both");
+        excludedFiles->addManualExclude("dironly*/");
+        excludedFiles->addManualExclude("q?estion");
+        excludedFiles->addManualExclude("]re?move");
+
+        QCOMPARE(check_file_traversal("literal"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("sub/literal"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("literals"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_file_traversal("prefix"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("prefixed"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("aprefix"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_file_traversal("file.suffix"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal(".suffix"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("file.suffix2"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_file_traversal("presuf"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("pre_suf"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("presu"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_file_traversal("presuff"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_file_traversal("removed_file"), CSYNC_FILE_EXCLUDE_AND_REMOVE);
+        QCOMPARE(check_file_traversal("re_move"), CSYNC_FILE_EXCLUDE_AND_REMOVE);
+        QCOMPARE(check_file_traversal("question"), CSYNC_FILE_EXCLUDE_LIST);
+
+        // A plain exclude wins over an exclude-and-remove, wherever it is stored
+        QCOMPARE(check_file_traversal("both"), CSYNC_FILE_EXCLUDE_LIST);
+        excludedFiles->addManualExclude("removed?");
+        QCOMPARE(check_file_traversal("removed1"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("removed12"), CSYNC_FILE_EXCLUDE_AND_REMOVE);
+
+        QCOMPARE(check_dir_traversal("dironly_dir"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("dironly_file"), CSYNC_NOT_EXCLUDED);
+
+        // Patterns of a base path only apply below it
+        excludedFiles->addManualExclude("local*", "/sub/");
+        QCOMPARE(check_file_traversal("sub/local_file"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("sub/deeper/local_file"), CSYNC_FILE_EXCLUDE_LIST);
+        QCOMPARE(check_file_traversal("local_file"), CSYNC_NOT_EXCLUDED);
+        QCOMPARE(check_file_traversal("other/local_file"), CSYNC_NOT_EXCLUDED);
+    }
+
     void check_csync_excluded_traversal()
     {
         setup_init();
@@ -202,6 +202,37 @@ private slots:
         QCOMPARE(folderman->findGoodPathForNewSyncFolder(dirPath + "/ownCloud2", url),
             QString(dirPath + "/ownCloud22"));
     }
+    void testPickSyncsToStart()
+    {
+        QVector<AccountStatePtr> accountStates;
+        for (int i = 0; i < 3; ++i) {
+            AccountPtr account = Account::create();
+            account->setCredentials(new HttpCredentialsTest("testuser", "secret"));
+            account->setUrl(QUrl("http://example.de"));
+            accountStates.append(AccountStatePtr(new AccountState(account)));
+        }
+        auto a = accountStates[0].data();
+        auto b = accountStates[1].data();
+        auto c = accountStates[2].data();
+
+        // The budget limits the number of running syncs
+        QCOMPARE(FolderMan::pickSyncsToStart({ a, b, c }, {}, 2), QVector<int>({ 0, 1 }));
+        QCOMPARE(FolderMan::pickSyncsToStart({ a, b, c }, { c }, 2), QVector<int>({ 0 }));
+        QCOMPARE(FolderMan::pickSyncsToStart({ a, b }, { c }, 1), QVector<int>());
+        QCOMPARE(FolderMan::pickSyncsToStart({ a, b, c }, {}, 5), QVector<int>({ 0, 1, 2 }));
+
+        // Two folders of the same account never run at the same time
+        QCOMPARE(FolderMan::pickSyncsToStart({ a, a, b }, {}, 3), QVector<int>({ 0, 2 }));
+        QCOMPARE(FolderMan::pickSyncsToStart({ a, b, a }, { a }, 3), QVector<int>({ 1 }));
+        QCOMPARE(FolderMan::pickSyncsToStart({ a, a }, { a }, 3), QVector<int>());
+
+        // Once the running sync of an account finished, its oldest waiting folder is next,
+        // even if folders of other accounts were queued later
+        QCOMPARE(FolderMan::pickSyncsToStart({ a, b, a }, { b }, 2), QVector<int>({ 0 }));
+        QCOMPARE(FolderMan::pickSyncsToStart({ a, b, a }, {}, 2), QVector<int>({ 0, 1 }));
+        QCOMPARE(FolderMan::pickSyncsToStart({ a, c, b }, { b }, 2), QVector<int>({ 0 }));
+        QCOMPARE(FolderMan::pickSyncsToStart({ a, c, b }, {}, 2), QVector<int>({ 0, 1 }));
+    }
 };
 
 QTEST_APPLESS_MAIN(TestFolderMan)
@@ -84,11 +84,16 @@ class TestFolderWatcher : public QObject
         QElapsedTimer t;
         t.start();
         while (t.elapsed() < 5000) {
-            // Check if it was already reported as changed by the watcher
+            // Check if it was already reported as changed by the watcher,
+            // by itself or as part of a changed tree
             for (int i = 0; i < _pathChangedSpy->size(); ++i) {
                 const auto &args = _pathChangedSpy->at(i);
-                if (args.first().toString() == path)
+                if (args.at(0).toStringList().contains(path))
                     return true;
+                for (const auto &tree : args.at(1).toStringList()) {
+                    if (path == tree || path.startsWith(tree + '/'))
+                        return true;
+                }
             }
             // Wait a bit and test again (don't bother checking if we timed out or not)
             _pathChangedSpy->wait(200);
@@ -121,7 +126,7 @@ public:
 
         _watcher.reset(new FolderWatcher);
         _watcher->init(_rootPath);
-        _pathChangedSpy.reset(new QSignalSpy(_watcher.data(), SIGNAL(pathChanged(QString))));
+        _pathChangedSpy.reset(new QSignalSpy(_watcher.data(), SIGNAL(pathsChanged(QStringList, QStringList))));
     }
 
     int countFolders(const QString &path)
@@ -170,6 +175,44 @@ private slots:
         QVERIFY(waitForPathChanged(_rootPath + "/a/b/c/empty.txt"));
     }
 
+    void testPathChangeCoalescer()
+    {
+        PathChangeCoalescer coalescer("/root");
+        coalescer.addPath("/root/a/file", false);
+        coalescer.addPath("/root/a/file", false);
+        coalescer.addPath("/root/b", true);
+        coalescer.addPath("/root/b/c/file", false);
+        coalescer.addPath("/root/d/e/file", false);
+        coalescer.addPath("/root/d", true);
+        coalescer.addPath("/elsewhere/file", false);
+        QCOMPARE(coalescer.size(), 4);
+
+        QStringList paths;
+        QStringList trees;
+        coalescer.take(&paths, &trees);
+        QCOMPARE(paths, QStringList({ "/root/a/file", "/elsewhere/file" }));
+        QCOMPARE(trees, QStringList({ "/root/b", "/root/d" }));
+        QVERIFY(coalescer.isEmpty());
+
+        // A directory with too many changes below it becomes a changed tree
+        const int limit = PathChangeCoalescer::maxChangesPerDirectory;
+        for (int i = 0; i <= limit; ++i)
+            coalescer.addPath(QStringLiteral("/root/a/b/%1/file").arg(i % 10) + QString::number(i), false);
+        coalescer.addPath("/root/a/other", false);
+        QCOMPARE(coalescer.size(), 2);
+        coalescer.take(&paths, &trees);
+        QCOMPARE(paths, QStringList({ "/root/a/other" }));
+        QCOMPARE(trees, QStringList({ "/root/a/b" }));
+
+        // Up to the root itself
+        for (int i = 0; i <= limit; ++i)
+            coalescer.addPath(QStringLiteral("/root/file%1").arg(i), false);
+        coalescer.addPath("/root/a/file", false);
+        coalescer.take(&paths, &trees);
+        QVERIFY(paths.isEmpty());
+        QCOMPARE(trees, QStringList({ "/root" }));
+    }
+
 
     void testCreateADir() {
         QString file(_rootPath+"/a1/b1/new_dir");
@@ -177,6 +220,7 @@ private slots:
         QVERIFY(waitForPathChanged(file));
 
         // Notifications from that new folder arrive too
+        _pathChangedSpy->clear();
         QString file2(_rootPath + "/a1/b1/new_dir/contained");
         touch(file2);
         QVERIFY(waitForPathChanged(file2));
@@ -230,6 +274,7 @@ private slots:
         QVERIFY(waitForPathChanged(new_file));
 
         // Verify that further notifications end up with the correct paths
+        _pathChangedSpy->clear();
 
         QString file(_rootPath+"/a1/brename/c1/random.bin");
         touch(file);
@@ -251,6 +296,7 @@ private slots:
         QVERIFY(waitForPathChanged(new_file));
 
         // Verify that further notifications end up with the correct paths
+        _pathChangedSpy->clear();
 
         QString file(_rootPath+"/bren/c1/random.bin");
         touch(file);
@@ -0,0 +1,148 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+#include "common/syncjournalsnapshot.h"
+
+using namespace OCC;
+
+static SyncJournalFileRecord makeRecord(const QByteArray &path, ItemType type = ItemTypeFile)
+{
+    SyncJournalFileRecord record;
+    record._path = path;
+    record._type = type;
+    record._etag = "etag-" + path;
+    record._fileId = "id-" + path;
+    record._remotePerm = RemotePermissions::fromDbValue("RW");
+    return record;
+}
+
+static QList<QByteArray> listPaths(const SyncJournalSnapshot &snapshot, const QByteArray &path)
+{
+    QList<QByteArray> paths;
+    snapshot.listFilesInPath(path, [&](const SyncJournalFileRecord &record) { paths.append(record._path); });
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+static void enableSnapshot(FakeFolder &fakeFolder)
+{
+    auto options = fakeFolder.syncEngine().syncOptions();
+    options._useJournalSnapshot = true;
+    fakeFolder.syncEngine().setSyncOptions(options);
+}
+
+class TestJournalSnapshot : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testLoad()
+    {
+        QTemporaryDir dir;
+        SyncJournalDb db(dir.path() + "/sync.db");
+        // Names that sort between a directory and its children
+        for (const auto &path : { "A", "A/sub", "A-B" })
+            QVERIFY(db.setFileRecord(makeRecord(path, ItemTypeDirectory)));
+        for (const auto &path : { "A/a1", "A/a2", "A/sub/s1", "A-B/x", "A B", "b" })
+            QVERIFY(db.setFileRecord(makeRecord(path)));
+
+        SyncJournalSnapshot snapshot;
+        QVERIFY(snapshot.load(&db));
+        QCOMPARE(snapshot.size(), 9);
+
+        QCOMPARE(listPaths(snapshot, ""), (QList<QByteArray>{ "A", "A B", "A-B", "b" }));
+        QCOMPARE(listPaths(snapshot, "A"), (QList<QByteArray>{ "A/a1", "A/a2", "A/sub" }));
+        QCOMPARE(listPaths(snapshot, "A/sub"), (QList<QByteArray>{ "A/sub/s1" }));
+        QCOMPARE(listPaths(snapshot, "A-B"), (QList<QByteArray>{ "A-B/x" }));
+        QVERIFY(listPaths(snapshot, "b").isEmpty());
+        QVERIFY(listPaths(snapshot, "missing").isEmpty());
+
+        // The same records as the database has
+        for (const auto &path : { "A", "A/sub/s1", "A B", "b" }) {
+            SyncJournalFileRecord stored;
+            QVERIFY(db.getFileRecord(QByteArray(path), &stored));
+            const auto record = snapshot.findFileRecord(path);
+            QVERIFY(record);
+            QVERIFY(*record == stored);
+        }
+        QVERIFY(!snapshot.findFileRecord("A/sub/missing"));
+        QVERIFY(!snapshot.findFileRecord("A/su"));
+        QVERIFY(!snapshot.findFileRecord(""));
+
+        // Loading an empty journal
+        SyncJournalDb emptyDb(dir.path() + "/empty.db");
+        QVERIFY(snapshot.load(&emptyDb));
+        QVERIFY(snapshot.isEmpty());
+        QVERIFY(listPaths(snapshot, "").isEmpty());
+    }
+
+    void testModify()
+    {
+        SyncJournalSnapshot snapshot;
+        snapshot.setFileRecord(makeRecord("A", ItemTypeDirectory));
+        snapshot.setFileRecord(makeRecord("A/sub/s1"));
+        snapshot.setFileRecord(makeRecord("A/a1"));
+        snapshot.setFileRecord(makeRecord("A/sub", ItemTypeDirectory));
+        snapshot.setFileRecord(makeRecord("A-B"));
+        QCOMPARE(snapshot.size(), 5);
+        QCOMPARE(listPaths(snapshot, "A"), (QList<QByteArray>{ "A/a1", "A/sub" }));
+
+        // Replaces the existing record
+        auto record = makeRecord("A/a1");
+        record._etag = "changed";
+        snapshot.setFileRecord(record);
+        QCOMPARE(snapshot.size(), 5);
+        QCOMPARE(snapshot.findFileRecord("A/a1")->_etag, QByteArray("changed"));
+
+        snapshot.deleteFileRecord("A/a1");
+        QVERIFY(!snapshot.findFileRecord("A/a1"));
+        QCOMPARE(snapshot.size(), 4);
+
+        // Only removes the tree below A, not its siblings with the same prefix
+        snapshot.deleteFileRecord("A", true);
+        QCOMPARE(snapshot.size(), 1);
+        QVERIFY(snapshot.findFileRecord("A-B"));
+        QCOMPARE(listPaths(snapshot, ""), (QList<QByteArray>{ "A-B" }));
+    }
+
+    void testSync()
+    {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        enableSnapshot(fakeFolder);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // Nothing changed
+        ItemCompletedSpy completeSpy(fakeFolder);
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(completeSpy.isEmpty());
+
+        fakeFolder.remoteModifier().appendByte("A/a1");
+        fakeFolder.remoteModifier().remove("B");
+        fakeFolder.remoteModifier().rename("C/c1", "C/c1-renamed");
+        fakeFolder.remoteModifier().mkdir("D");
+        fakeFolder.remoteModifier().insert("D/d1");
+        fakeFolder.localModifier().insert("S/s-new");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        SyncJournalFileRecord record;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArrayLiteral("B/b1"), &record));
+        QVERIFY(!record.isValid());
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArrayLiteral("C/c1-renamed"), &record));
+        QVERIFY(record.isValid());
+
+        completeSpy.clear();
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(completeSpy.isEmpty());
+    }
+};
+
+QTEST_GUILESS_MAIN(TestJournalSnapshot)
+#include "testjournalsnapshot.moc"
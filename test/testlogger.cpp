@@ -0,0 +1,68 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include <QTemporaryDir>
+#include "logger.h"
+
+using namespace OCC;
+
+class TestLogger : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    // Messages that don't fit into the queue are counted and reported, the others are written in order
+    void testDroppedMessages()
+    {
+        QTemporaryDir dir;
+        QVERIFY(dir.isValid());
+        const QString logFile = dir.filePath(QStringLiteral("test.log"));
+
+        auto logger = Logger::instance();
+        logger->setLogFile(logFile);
+        QVERIFY(logger->isLoggingToFile());
+        const int droppedBefore = logger->droppedMessageCount();
+
+        QStringList written;
+        {
+            // The writer can't take messages from the queue while we hold its lock
+            QMutexLocker lock(&logger->_mutex);
+            logger->writeQueuedMessages();
+
+            while (logger->droppedMessageCount() == droppedBefore && written.size() < 1000 * 1000) {
+                written.append(QStringLiteral("message %1").arg(written.size()));
+                logger->doLog(written.last());
+            }
+            // The message that filled the queue up wasn't queued
+            written.removeLast();
+            QCOMPARE(logger->droppedMessageCount(), droppedBefore + 1);
+
+            for (int i = 0; i < 9; ++i)
+                logger->doLog(QStringLiteral("dropped %1").arg(i));
+            QCOMPARE(logger->droppedMessageCount(), droppedBefore + 10);
+        }
+
+        // Writes what is left in the queue
+        logger->close();
+        QVERIFY(!logger->isLoggingToFile());
+
+        QFile file(logFile);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QStringList lines = QString::fromUtf8(file.readAll()).split(QLatin1Char('\n'), QString::SkipEmptyParts);
+        QVERIFY(!lines.isEmpty());
+        QCOMPARE(lines.takeLast(), QStringLiteral("[ Logger ]:\t10 log messages were dropped because the log file could not be written fast enough"));
+
+        // Other messages of the process may have been written before ours
+        const int first = lines.indexOf(written.first());
+        QVERIFY(first >= 0);
+        QCOMPARE(lines.mid(first), written);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestLogger)
+#include "testlogger.moc"
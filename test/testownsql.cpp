@@ -126,6 +126,32 @@ private slots:
         }
     }
 
+    void testTypedBinding()
+    {
+        static_assert(sqlParameterCount("SELECT 1") == 0, "");
+        static_assert(sqlParameterCount("SELECT ?, ?") == 2, "");
+        static_assert(sqlParameterCount("SELECT ?2 WHERE x=?1 OR y=?2") == 2, "");
+        static_assert(sqlParameterCount("SELECT '?' || ?1") == 1, "");
+
+        static constexpr SqlStatement<qint64, QString, QByteArray, qint64> insert{
+            "INSERT INTO addresses (id, name, address, entered) VALUES (?1, ?2, ?3, ?4);"};
+        SqlQuery q;
+        QVERIFY(q.initOrReset(insert, _db));
+        q.bindAll(insert, 4, QString::fromUtf8("пятницы"), QByteArray("Moriabata 24"), 1403100844);
+        QVERIFY(q.exec());
+
+        static constexpr SqlStatement<qint64> select{"SELECT name, address, entered FROM addresses WHERE id=?1;"};
+        SqlQuery q2;
+        QVERIFY(q2.initOrReset(select, _db));
+        q2.bindAll(select, 4);
+        QVERIFY(q2.exec());
+        QVERIFY(q2.next().hasData);
+        QCOMPARE(q2.stringValue(0), QString::fromUtf8("пятницы"));
+        QCOMPARE(q2.baView(1), QByteArray("Moriabata 24"));
+        QCOMPARE(q2.int64Value(2), quint64(1403100844));
+        QVERIFY(!q2.next().hasData);
+    }
+
     void testDestructor()
     {
         // This test make sure that the destructor of SqlQuery works even if the SqlDatabase
@@ -171,6 +171,73 @@ private slots:
         QVERIFY(completeSpy.findItem("nofileid")->_errorString.contains("file id"));
         QVERIFY(completeSpy.findItem("nopermissions/A")->_errorString.contains("permissions"));
     }
+
+    // Whole subtrees are listed with a single PROPFIND if the server allows it
+    void testDepthInfinity()
+    {
+        FakeFolder fakeFolder{ FileInfo() };
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav",
+            QVariantMap{ { "propfind", QVariantMap{ { "depth_infinity", true } } } } } });
+        fakeFolder.remoteModifier().mkdir("A");
+        fakeFolder.remoteModifier().insert("A/a1");
+        fakeFolder.remoteModifier().mkdir("A/B");
+        fakeFolder.remoteModifier().insert("A/B/b1");
+        fakeFolder.remoteModifier().mkdir("A/B/C");
+        fakeFolder.remoteModifier().mkdir("D");
+        fakeFolder.remoteModifier().insert("D/d1");
+
+        QByteArrayList depths;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation, const QNetworkRequest &req, QIODevice *) -> QNetworkReply * {
+            if (req.attribute(QNetworkRequest::CustomVerbAttribute) == "PROPFIND")
+                depths.append(req.rawHeader("Depth"));
+            return nullptr;
+        });
+
+        // The initial sync lists everything at once
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(depths, QByteArrayList({ "infinity" }));
+
+        // Afterwards only new directories are listed recursively
+        depths.clear();
+        fakeFolder.remoteModifier().mkdir("E");
+        fakeFolder.remoteModifier().mkdir("E/F");
+        fakeFolder.remoteModifier().insert("E/F/f1");
+        fakeFolder.remoteModifier().appendByte("A/a1");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        std::sort(depths.begin(), depths.end());
+        QCOMPARE(depths, QByteArrayList({ "1", "1", "infinity" }));
+    }
+
+    // Servers that refuse "Depth: infinity" are listed directory by directory
+    void testDepthInfinityFallback()
+    {
+        FakeFolder fakeFolder{ FileInfo() };
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav",
+            QVariantMap{ { "propfind", QVariantMap{ { "depth_infinity", true } } } } } });
+        fakeFolder.remoteModifier().mkdir("A");
+        fakeFolder.remoteModifier().mkdir("A/B");
+        fakeFolder.remoteModifier().insert("A/B/b1");
+
+        int refused = 0;
+        int listed = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &req, QIODevice *) -> QNetworkReply * {
+            if (req.attribute(QNetworkRequest::CustomVerbAttribute) != "PROPFIND")
+                return nullptr;
+            if (req.rawHeader("Depth") == "infinity") {
+                ++refused;
+                return new FakeErrorReply(op, req, this, 403);
+            }
+            ++listed;
+            return nullptr;
+        });
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(refused, 1);
+        QCOMPARE(listed, 3);
+    }
 };
 
 QTEST_GUILESS_MAIN(TestRemoteDiscovery)
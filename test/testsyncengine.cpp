@@ -56,6 +56,28 @@ private slots:
         QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
     }
 
+    void testAsyncJournalWrites() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        auto options = fakeFolder.syncEngine().syncOptions();
+        options._asyncJournalWrites = true;
+        fakeFolder.syncEngine().setSyncOptions(options);
+
+        fakeFolder.remoteModifier().insert("A/a0");
+        fakeFolder.remoteModifier().appendByte("A/a1");
+        fakeFolder.localModifier().insert("B/b0");
+        fakeFolder.localModifier().rename("C/c1", "C/c1-renamed");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // Everything is in the journal, so nothing is left to do
+        ItemCompletedSpy completeSpy(fakeFolder);
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(completeSpy.isEmpty());
+        SyncJournalFileRecord record;
+        QVERIFY(fakeFolder.syncJournal().getFileRecord(QByteArrayLiteral("B/b0"), &record));
+        QVERIFY(record.isValid());
+    }
+
     void testDirDownload() {
         FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
         ItemCompletedSpy completeSpy(fakeFolder);
@@ -696,6 +718,44 @@ private slots:
         QCOMPARE(nPUT, 3);
     }
 
+    // A single scheduling round fills the whole window, also across directories
+    void testPropagatorFillsWindow()
+    {
+        FakeFolder fakeFolder{FileInfo{}};
+        SyncOptions options;
+        options._minParallelTransfers = 3;
+        options._maxParallelTransfers = 3;
+        fakeFolder.syncEngine().setSyncOptions(options);
+
+        QObject parent;
+        int runningGets = 0;
+        int maxRunningGets = 0;
+        int runningGetsAtFirstReply = -1;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation) {
+                maxRunningGets = qMax(maxRunningGets, ++runningGets);
+                auto reply = new FakeGetReply(fakeFolder.remoteModifier(), op, request, &parent);
+                QObject::connect(reply, &QNetworkReply::finished, &parent, [&] {
+                    // The replies arrive before the next scheduling round
+                    if (runningGetsAtFirstReply == -1)
+                        runningGetsAtFirstReply = runningGets;
+                    --runningGets;
+                });
+                return reply;
+            }
+            return nullptr;
+        });
+
+        fakeFolder.remoteModifier().mkdir("A");
+        fakeFolder.remoteModifier().mkdir("B");
+        for (int i = 0; i < 10; ++i)
+            fakeFolder.remoteModifier().insert(QStringLiteral("%1/file%2").arg(i % 2 ? "A" : "B").arg(i), 200 * 1024);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(runningGetsAtFirstReply, 3);
+        QCOMPARE(maxRunningGets, 3);
+    }
+
 #ifndef Q_OS_WIN
     void testPropagatePermissions()
     {
@@ -745,6 +805,63 @@ private slots:
 
         QCOMPARE(QFileInfo(fakeFolder.localPath() + "foo").lastModified(), datetime);
     }
+
+    void testDiscoveryBudgets_data()
+    {
+        QTest::addColumn<int>("parallelNetworkJobs");
+        QTest::addColumn<int>("parallelLocalScans");
+
+        QTest::newRow("sequential") << 1 << 1;
+        QTest::newRow("more local scans") << 1 << 8;
+        QTest::newRow("more network jobs") << 6 << 1;
+        QTest::newRow("default") << 6 << 0;
+    }
+
+    // Local directories are listed with their own budget, possibly ahead of their job
+    void testDiscoveryBudgets()
+    {
+        QFETCH(int, parallelNetworkJobs);
+        QFETCH(int, parallelLocalScans);
+
+        FakeFolder fakeFolder{ FileInfo{} };
+        SyncOptions options;
+        options._parallelNetworkJobs = parallelNetworkJobs;
+        options._parallelLocalScans = parallelLocalScans;
+        fakeFolder.syncEngine().setSyncOptions(options);
+
+        for (int i = 0; i < 5; ++i) {
+            const QString dir = QStringLiteral("dir%1").arg(i);
+            fakeFolder.remoteModifier().mkdir(dir);
+            for (int j = 0; j < 5; ++j) {
+                const QString subdir = dir + QStringLiteral("/sub%1").arg(j);
+                fakeFolder.remoteModifier().mkdir(subdir);
+                fakeFolder.remoteModifier().insert(subdir + "/remote");
+            }
+        }
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // Only local changes: the remote side is not listed again
+        for (int i = 0; i < 5; ++i) {
+            for (int j = 0; j < 5; ++j) {
+                const QString subdir = QStringLiteral("dir%1/sub%2").arg(i).arg(j);
+                fakeFolder.localModifier().insert(subdir + "/local");
+                fakeFolder.localModifier().appendByte(subdir + "/remote");
+            }
+        }
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // Both sides changed
+        fakeFolder.remoteModifier().insert("dir0/sub0/remote2");
+        fakeFolder.localModifier().remove("dir4/sub4/local");
+        fakeFolder.localModifier().mkdir("dir2/sub2/new");
+        fakeFolder.localModifier().insert("dir2/sub2/new/file");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(fakeFolder.currentRemoteState().find("dir2/sub2/new/file"));
+        QVERIFY(!fakeFolder.currentRemoteState().find("dir4/sub4/local"));
+    }
 };
 
 QTEST_GUILESS_MAIN(TestSyncEngine)
@@ -466,6 +466,106 @@ private slots:
         QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
     }
 
+    // The statuses read while browsing a directory follow the later changes
+    void cachedStatusFollowsChanges() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        auto &tracker = fakeFolder.syncEngine().syncFileStatusTracker();
+        QCOMPARE(tracker.fileStatus("A/a1"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(tracker.fileStatus("A/a2"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(tracker.fileStatus("A/new"), SyncFileStatus(SyncFileStatus::StatusNone));
+
+        fakeFolder.localModifier().appendByte("A/a1");
+        fakeFolder.localModifier().insert("A/new");
+        fakeFolder.scheduleSync();
+        fakeFolder.execUntilBeforePropagation();
+        QCOMPARE(tracker.fileStatus("A/a1"), SyncFileStatus(SyncFileStatus::StatusSync));
+        QCOMPARE(tracker.fileStatus("A/a2"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(tracker.fileStatus("A/new"), SyncFileStatus(SyncFileStatus::StatusSync));
+
+        fakeFolder.execUntilFinished();
+        QCOMPARE(tracker.fileStatus("A/a1"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(tracker.fileStatus("A/new"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+
+        // A changed exclude list applies from the next sync on
+        fakeFolder.syncEngine().excludedFiles().addManualExclude("A/a2");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(tracker.fileStatus("A/a2"), SyncFileStatus(SyncFileStatus::StatusExcluded));
+    }
+
+    // The statuses pushed for parents don't come from the cache of statuses read by the shell
+    void parentStatusPushedWithCachedStatus() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        auto &tracker = fakeFolder.syncEngine().syncFileStatusTracker();
+        QCOMPARE(tracker.fileStatus("B"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(tracker.fileStatus("B/b1"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        fakeFolder.localModifier().appendByte("B/b1");
+        StatusPushSpy statusSpy(fakeFolder.syncEngine());
+
+        fakeFolder.scheduleSync();
+        fakeFolder.execUntilBeforePropagation();
+        QCOMPARE(statusSpy.statusOf("B"), SyncFileStatus(SyncFileStatus::StatusSync));
+        QCOMPARE(statusSpy.statusOf("B/b1"), SyncFileStatus(SyncFileStatus::StatusSync));
+        verifyThatPushMatchesPull(fakeFolder, statusSpy);
+        // Read while the child is syncing
+        QCOMPARE(tracker.fileStatus("B"), SyncFileStatus(SyncFileStatus::StatusSync));
+        statusSpy.clear();
+
+        fakeFolder.execUntilFinished();
+        QCOMPARE(statusSpy.statusOf("B"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(statusSpy.statusOf("B/b1"), SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        verifyThatPushMatchesPull(fakeFolder, statusSpy);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void directoryStatuses() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        auto &tracker = fakeFolder.syncEngine().syncFileStatusTracker();
+
+        auto statuses = tracker.directoryStatuses("A");
+        QCOMPARE(statuses.size(), 2);
+        QCOMPARE(statuses["a1"], SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(statuses["a2"], SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        // The other entries of the root are the excluded journal files
+        const auto rootStatuses = tracker.directoryStatuses("");
+        QCOMPARE(rootStatuses.size() - rootStatuses.keys(SyncFileStatus(SyncFileStatus::StatusExcluded)).size(), 4);
+
+        fakeFolder.localModifier().appendByte("A/a1");
+        fakeFolder.localModifier().insert("A/new");
+        fakeFolder.scheduleSync();
+        fakeFolder.execUntilBeforePropagation();
+        statuses = tracker.directoryStatuses("A");
+        QCOMPARE(statuses.size(), 3);
+        QCOMPARE(statuses["a1"], SyncFileStatus(SyncFileStatus::StatusSync));
+        QCOMPARE(statuses["a2"], SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(statuses["new"], SyncFileStatus(SyncFileStatus::StatusSync));
+        for (auto it = statuses.cbegin(); it != statuses.cend(); ++it)
+            QCOMPARE(it.value(), tracker.fileStatus("A/" + it.key()));
+
+        fakeFolder.execUntilFinished();
+        statuses = tracker.directoryStatuses("A");
+        QCOMPARE(statuses.size(), 3);
+        QCOMPARE(statuses["new"], SyncFileStatus(SyncFileStatus::StatusUpToDate));
+    }
+
+    void directoryStatusesWithProblems() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        auto &tracker = fakeFolder.syncEngine().syncFileStatusTracker();
+        fakeFolder.syncEngine().excludedFiles().addManualExclude("A/ignored");
+        fakeFolder.serverErrorPaths().append("A/errored");
+        fakeFolder.localModifier().insert("A/ignored");
+        fakeFolder.localModifier().insert("A/errored");
+        QVERIFY(!fakeFolder.syncOnce());
+
+        const auto statuses = tracker.directoryStatuses("A");
+        QCOMPARE(statuses.size(), 4);
+        QCOMPARE(statuses["a1"], SyncFileStatus(SyncFileStatus::StatusUpToDate));
+        QCOMPARE(statuses["ignored"], SyncFileStatus(SyncFileStatus::StatusExcluded));
+        QCOMPARE(statuses["errored"], SyncFileStatus(SyncFileStatus::StatusError));
+        for (auto it = statuses.cbegin(); it != statuses.cend(); ++it)
+            QCOMPARE(it.value(), tracker.fileStatus("A/" + it.key()));
+        QCOMPARE(tracker.directoryStatuses("")["A"], SyncFileStatus(SyncFileStatus::StatusWarning));
+    }
+
     void renameError() {
         FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
         fakeFolder.serverErrorPaths().append("A/a1");
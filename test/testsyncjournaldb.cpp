@@ -31,6 +31,16 @@ public:
         return Utility::qDateTimeToTime_t(time);
     }
 
+    static int userVersion(sqlite3 *db)
+    {
+        int version = -1;
+        sqlite3_exec(db, "PRAGMA user_version;", [](void *result, int, char **values, char **) {
+            *static_cast<int *>(result) = atoi(values[0]);
+            return 0;
+        }, &version, nullptr);
+        return version;
+    }
+
 private slots:
 
     void initTestCase()
@@ -453,6 +463,218 @@ private slots:
         QCOMPARE(list->size(), 0);
     }
 
+    void testAsyncWrites()
+    {
+        _db.setAsyncWrites(true);
+        _db.commitIfNeededAndStartNewTransaction("start");
+
+        // Reads see the writes queued before them
+        for (int i = 0; i < 100; ++i) {
+            SyncJournalFileRecord record;
+            record._path = "async/" + QByteArray::number(i);
+            record._type = ItemTypeFile;
+            record._etag = "etag" + QByteArray::number(i);
+            QVERIFY(_db.setFileRecord(record));
+            _db.commitIfNeededAndStartNewTransaction("file");
+        }
+        QVERIFY(_db.updateLocalMetadata("async/5", 123, 456, 789));
+        SyncJournalFileRecord stored;
+        QVERIFY(_db.getFileRecord(QByteArrayLiteral("async/5"), &stored));
+        QCOMPARE(stored._etag, QByteArray("etag5"));
+        QCOMPARE(stored._modtime, qint64(123));
+        QCOMPARE(stored._fileSize, qint64(456));
+        QCOMPARE(stored._inode, quint64(789));
+
+        SyncJournalDb::DownloadInfo info;
+        info._valid = true;
+        info._etag = "async";
+        info._tmpfile = "/tmp/async";
+        _db.setDownloadInfo("async/1", info);
+        QVERIFY(_db.getDownloadInfo("async/1") == info);
+
+        // Later writes for the same path replace the queued ones
+        info._etag = "async2";
+        _db.setDownloadInfo("async/1", info);
+        QCOMPARE(_db.getDownloadInfo("async/1")._etag, QByteArray("async2"));
+
+        // Deleted records are not brought back by the queued writes
+        _db.deleteFileRecord("async", true);
+        SyncJournalFileRecord record;
+        record._path = "async/1";
+        record._type = ItemTypeFile;
+        QVERIFY(_db.setFileRecord(record));
+        _db.commit("barrier");
+        int count = 0;
+        QVERIFY(_db.getFilesBelowPath("async", [&](const SyncJournalFileRecord &) { ++count; }));
+        QCOMPARE(count, 1);
+
+        // Disabling finishes the queued writes
+        _db.setDownloadInfo("async/1", SyncJournalDb::DownloadInfo());
+        _db.setAsyncWrites(false);
+        QVERIFY(!_db.getDownloadInfo("async/1")._valid);
+        _db.deleteFileRecord("async", true);
+    }
+
+    void testAsyncWriteErrors()
+    {
+        // The db can't be created in a folder that doesn't exist
+        SyncJournalDb db(_tempDir.path() + "/missing/sync.db");
+        QSignalSpy failedSpy(&db, &SyncJournalDb::queuedWriteFailed);
+        db.setAsyncWrites(true);
+
+        SyncJournalFileRecord record;
+        record._path = "async/failing";
+        record._type = ItemTypeFile;
+        QVERIFY(db.setFileRecord(record));
+
+        // The failure is reported for the path once the writer got to it
+        db.waitForQueuedWrites();
+        QCOMPARE(failedSpy.count(), 1);
+        QCOMPARE(failedSpy.first().first().toString(), QStringLiteral("async/failing"));
+
+        // The next commits report the failure of the queued write
+        auto result = db.commit("barrier");
+        QVERIFY(!result);
+        QVERIFY(result.error().contains("async/failing"));
+        QVERIFY(!db.commit("barrier"));
+
+        // Until the next sync enables async writes again
+        db.setAsyncWrites(false);
+        db.setAsyncWrites(true);
+        QVERIFY(db.commit("barrier"));
+        db.setAsyncWrites(false);
+    }
+
+    void testTreeQueries()
+    {
+        auto makeEntry = [&](const QByteArray &path, ItemType type) {
+            SyncJournalFileRecord record;
+            record._path = path;
+            record._type = type;
+            record._fileId = "id:" + path;
+            QVERIFY(_db.setFileRecord(record));
+        };
+        makeEntry("tree", ItemTypeDirectory);
+        makeEntry("tree/a", ItemTypeDirectory);
+        makeEntry("tree/a/file", ItemTypeFile);
+        makeEntry("tree/a/sub", ItemTypeDirectory);
+        makeEntry("tree/a/sub/file", ItemTypeFile);
+        makeEntry("tree/a-2", ItemTypeFile);
+        makeEntry("tree/b", ItemTypeFile);
+        makeEntry("treetop", ItemTypeFile); // prefix, but not below
+
+        // Directories are followed by their content
+        QByteArrayList below;
+        QVERIFY(_db.getFilesBelowPath("tree", [&](const SyncJournalFileRecord &rec) { below.append(rec._path); }));
+        QCOMPARE(below, QByteArrayList({ "tree/a-2", "tree/a", "tree/a/file", "tree/a/sub", "tree/a/sub/file", "tree/b" }));
+
+        QByteArrayList inPath;
+        QVERIFY(_db.listFilesInPath("tree/a", [&](const SyncJournalFileRecord &rec) { inPath.append(rec._path); }));
+        QCOMPARE(inPath, QByteArrayList({ "tree/a/file", "tree/a/sub" }));
+
+        // Records found by other keys get their full path as well
+        QByteArrayList byFileId;
+        QVERIFY(_db.getFileRecordsByFileId("id:tree/a/sub/file", [&](const SyncJournalFileRecord &rec) { byFileId.append(rec._path); }));
+        QCOMPARE(byFileId, QByteArrayList({ "tree/a/sub/file" }));
+
+        _db.deleteFileRecord("tree/a", true);
+        below.clear();
+        QVERIFY(_db.getFilesBelowPath("tree", [&](const SyncJournalFileRecord &rec) { below.append(rec._path); }));
+        QCOMPARE(below, QByteArrayList({ "tree/a-2", "tree/b" }));
+
+        _db.deleteFileRecord("tree", true);
+        _db.deleteFileRecord("treetop");
+    }
+
+    // Databases of older versions store the full path in the metadata table
+    void testMigrateFullPaths()
+    {
+        const QString dbPath = _tempDir.path() + "/old.db";
+        sqlite3 *oldDb = nullptr;
+        QCOMPARE(sqlite3_open(dbPath.toUtf8().constData(), &oldDb), SQLITE_OK);
+        QByteArray sql = "CREATE TABLE metadata(phash INTEGER(8), pathlen INTEGER, path VARCHAR(4096), inode INTEGER,"
+                         " uid INTEGER, gid INTEGER, mode INTEGER, modtime INTEGER(8), type INTEGER, md5 VARCHAR(32), PRIMARY KEY(phash));";
+        const QByteArrayList paths = { "dir", "dir/file", "dir/sub", "dir/sub/file", "top" };
+        for (const auto &path : paths) {
+            sql += QByteArray("INSERT INTO metadata VALUES(") + QByteArray::number(SyncJournalDb::getPHash(path))
+                + ", " + QByteArray::number(path.size()) + ", '" + path + "', 1, 0, 0, 0, 2, "
+                + (path.contains("file") ? "0" : "2") + ", 'etag');";
+        }
+        QCOMPARE(sqlite3_exec(oldDb, sql.constData(), nullptr, nullptr, nullptr), SQLITE_OK);
+        sqlite3_close(oldDb);
+
+        SyncJournalDb db(dbPath);
+        SyncJournalFileRecord record;
+        QVERIFY(db.getFileRecord(QByteArrayLiteral("dir/sub/file"), &record));
+        QVERIFY(record.isValid());
+        QCOMPARE(record._path, QByteArray("dir/sub/file"));
+        QCOMPARE(record._etag, QByteArray("etag"));
+        QCOMPARE(record._type, ItemTypeFile);
+
+        QByteArrayList below;
+        QVERIFY(db.getFilesBelowPath("", [&](const SyncJournalFileRecord &rec) { below.append(rec._path); }));
+        QCOMPARE(below, paths);
+
+        QByteArrayList inPath;
+        QVERIFY(db.listFilesInPath("dir", [&](const SyncJournalFileRecord &rec) { inPath.append(rec._path); }));
+        QCOMPARE(inPath, QByteArrayList({ "dir/file", "dir/sub" }));
+        db.close();
+
+        // The metadata table is gone and the schema version recorded
+        QCOMPARE(sqlite3_open(dbPath.toUtf8().constData(), &oldDb), SQLITE_OK);
+        QVERIFY(sqlite3_exec(oldDb, "SELECT path FROM metadata;", nullptr, nullptr, nullptr) != SQLITE_OK);
+        QCOMPARE(userVersion(oldDb), 1);
+
+        // An older client recreates the metadata table, it replaces the records
+        sql = "CREATE TABLE metadata(phash INTEGER(8), pathlen INTEGER, path VARCHAR(4096), inode INTEGER,"
+              " uid INTEGER, gid INTEGER, mode INTEGER, modtime INTEGER(8), type INTEGER, md5 VARCHAR(32), PRIMARY KEY(phash));"
+              "INSERT INTO metadata VALUES(" + QByteArray::number(SyncJournalDb::getPHash("other/file")) + ", 10, 'other/file', 1, 0, 0, 0, 2, 0, 'etag2');";
+        QCOMPARE(sqlite3_exec(oldDb, sql.constData(), nullptr, nullptr, nullptr), SQLITE_OK);
+        sqlite3_close(oldDb);
+
+        below.clear();
+        QVERIFY(db.getFilesBelowPath("", [&](const SyncJournalFileRecord &rec) { below.append(rec._path); }));
+        QCOMPARE(below, QByteArrayList({ "other/file" }));
+        db.close();
+
+        // Newer schema versions are refused
+        QCOMPARE(sqlite3_open(dbPath.toUtf8().constData(), &oldDb), SQLITE_OK);
+        QCOMPARE(sqlite3_exec(oldDb, "PRAGMA user_version = 99;", nullptr, nullptr, nullptr), SQLITE_OK);
+        sqlite3_close(oldDb);
+        QVERIFY(!db.open());
+    }
+
+    void testDirectoriesCleanup()
+    {
+        const QString dbPath = _tempDir.path() + "/directories.db";
+        SyncJournalDb db(dbPath);
+        for (const QByteArray path : { "dir", "dir/sub", "dir/sub/file", "dir2" }) {
+            SyncJournalFileRecord record;
+            record._path = path;
+            record._type = path.endsWith("file") ? ItemTypeFile : ItemTypeDirectory;
+            QVERIFY(db.setFileRecord(record));
+        }
+
+        // Renaming dir/sub to dir2/sub: the records are deleted one by one
+        QVERIFY(db.deleteFileRecord("dir/sub"));
+        QVERIFY(db.deleteFileRecord("dir/sub/file"));
+        SyncJournalFileRecord record;
+        record._path = "dir2/sub";
+        record._type = ItemTypeDirectory;
+        QVERIFY(db.setFileRecord(record));
+        db.close();
+
+        sqlite3 *rawDb = nullptr;
+        QCOMPARE(sqlite3_open(dbPath.toUtf8().constData(), &rawDb), SQLITE_OK);
+        QStringList directories;
+        QCOMPARE(sqlite3_exec(rawDb, "SELECT path FROM directories ORDER BY path;", [](void *result, int, char **values, char **) {
+            static_cast<QStringList *>(result)->append(QString::fromUtf8(values[0]));
+            return 0;
+        }, &directories, nullptr), SQLITE_OK);
+        sqlite3_close(rawDb);
+        QCOMPARE(directories, QStringList({ "", "dir2/" }));
+    }
+
 private:
     SyncJournalDb _db;
 };
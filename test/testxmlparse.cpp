@@ -613,6 +613,102 @@ private slots:
         QVERIFY(_subdirs.size() == 1);
     }
 
+    // The reply may arrive in arbitrary pieces, entries are reported as soon as they are complete
+    void testParserIncremental() {
+        const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\" xmlns:s=\"http://sabredav.org/ns\" xmlns:oc=\"http://owncloud.org/ns\">"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:id>00004213ocobzus5kn6s</oc:id>"
+              "<oc:permissions>RDNVCK</oc:permissions>"
+              "<oc:size>121780</oc:size>"
+              "<d:getetag>\"5527beb0400b0\"</d:getetag>"
+              "<d:resourcetype>"
+              "<d:collection/>"
+              "</d:resourcetype>"
+              "<d:getlastmodified>Fri, 06 Feb 2015 13:49:55 GMT</d:getlastmodified>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/qu%C3%A4tte.pdf</d:href>"
+              "<d:propstat>"
+              "<d:prop>"
+              "<oc:id>00004215ocobzus5kn6s</oc:id>"
+              "<oc:permissions>RDNVW</oc:permissions>"
+              "<d:getetag>\"2fa2f0d9ed49ea0c3e409d49e652dea0\"</d:getetag>"
+              "<d:resourcetype/>"
+              "<d:getlastmodified>Fri, 06 Feb 2015 13:49:55 GMT</d:getlastmodified>"
+              "<d:getcontentlength>121780</d:getcontentlength>"
+              "</d:prop>"
+              "<d:status>HTTP/1.1 200 OK</d:status>"
+              "</d:propstat>"
+              "</d:response>"
+              "</d:multistatus>";
+
+        QList<QMap<QString, QString>> expectedProperties;
+        {
+            LsColXMLParser parser;
+            connect(&parser, &LsColXMLParser::directoryListingIterated, this,
+                [&](const QString &, const QMap<QString, QString> &properties) { expectedProperties.append(properties); });
+            QHash<QString, ExtraFolderInfo> sizes;
+            QVERIFY(parser.parse(testXml, &sizes, "/oc/remote.php/webdav/sharefolder"));
+        }
+        QCOMPARE(expectedProperties.size(), 2);
+        QCOMPARE(expectedProperties[0]["resourcetype"], QStringLiteral("<collection></collection>"));
+        QCOMPARE(expectedProperties[1]["getcontentlength"], QStringLiteral("121780"));
+
+        LsColXMLParser parser;
+        connect( &parser, SIGNAL(directoryListingSubfolders(const QStringList&)),
+                 this, SLOT(slotDirectoryListingSubFolders(const QStringList&)) );
+        connect( &parser, SIGNAL(directoryListingIterated(const QString&, const QMap<QString,QString>&)),
+                 this, SLOT(slotDirectoryListingIterated(const QString&, const QMap<QString,QString>&)) );
+        connect( &parser, SIGNAL(finishedWithoutError()),
+                 this, SLOT(slotFinishedSuccessfully()) );
+        QList<QMap<QString, QString>> properties;
+        connect(&parser, &LsColXMLParser::directoryListingIterated, this,
+            [&](const QString &, const QMap<QString, QString> &props) { properties.append(props); });
+
+        QHash<QString, ExtraFolderInfo> sizes;
+        parser.startParsing(&sizes, "/oc/remote.php/webdav/sharefolder");
+        const int firstResponseEnd = testXml.indexOf("</d:response>") + int(strlen("</d:response>"));
+        for (int i = 0; i < testXml.size(); ++i) {
+            QVERIFY(parser.addData(testXml.mid(i, 1)));
+            if (i + 1 == firstResponseEnd)
+                QCOMPARE(_items, QStringList{ "/oc/remote.php/webdav/sharefolder" });
+        }
+        QVERIFY(!_success);
+        QVERIFY(parser.finishParsing());
+        QVERIFY(_success);
+
+        QCOMPARE(_items, QStringList({ "/oc/remote.php/webdav/sharefolder", QString::fromUtf8("/oc/remote.php/webdav/sharefolder/quätte.pdf") }));
+        QCOMPARE(_subdirs, QStringList{ "/oc/remote.php/webdav/sharefolder/" });
+        QCOMPARE(properties, expectedProperties);
+        QCOMPARE(sizes.value("/oc/remote.php/webdav/sharefolder/").size, qint64(121780));
+    }
+
+    // A broken reply is detected before it was received completely
+    void testParserIncrementalBrokenXml() {
+        const QByteArray testXml = "<?xml version='1.0' encoding='utf-8'?>"
+              "<d:multistatus xmlns:d=\"DAV:\" xmlns:s=\"http://sabredav.org/ns\" xmlns:oc=\"http://owncloud.org/ns\">"
+              "<d:response>"
+              "<d:href>/oc/remote.php/webdav/sharefolder/</d:href>"
+              "</d:multistatus>";
+
+        LsColXMLParser parser;
+        connect( &parser, SIGNAL(finishedWithoutError()),
+                 this, SLOT(slotFinishedSuccessfully()) );
+
+        QHash<QString, ExtraFolderInfo> sizes;
+        parser.startParsing(&sizes, "/oc/remote.php/webdav/sharefolder");
+        QVERIFY(!parser.addData(testXml));
+        QVERIFY(!parser.addData("</d:response>"));
+        QVERIFY(!parser.finishParsing());
+        QVERIFY(!_success);
+    }
 };
 
     QTEST_GUILESS_MAIN(TestXmlParse)